@@ -32,6 +32,15 @@
 #include "originator.h"
 #include "schedule.h"
 #include "hna.h"
+#include "fib.h"
+#include "hna_sync.h"
+#include "lpm.h"
+#include "peer_table.h"
+#include "snapshot.h"
+#include "events.h"
+#include "view.h"
+#include "vis.h"
+#include "route_pipe.h"
 #include "types.h"
 
 
@@ -76,12 +85,15 @@ uint8_t routing_class = 0;
 int16_t originator_interval = 1000;   /* originator message interval in miliseconds */
 
 struct gw_node *curr_gateway = NULL;
+struct gw_node *standby_gateway = NULL;
 pthread_t curr_gateway_thread_id = 0;
+pthread_t gw_probe_thread_id = 0;
 
 uint32_t pref_gateway = 0;
 
 char *policy_routing_script = NULL;
 int policy_routing_pipe = 0;
+uint8_t policy_routing_binary = 0;
 pid_t policy_routing_script_pid;
 
 uint8_t found_ifs = 0;
@@ -100,10 +112,9 @@ struct list_head_first if_list;
 
 struct vis_if vis_if;
 struct unix_if unix_if;
+struct lazy_if lazy_if;
 struct debug_clients debug_clients;
 
-unsigned char *vis_packet = NULL;
-uint16_t vis_packet_size = 0;
 
 uint64_t batman_clock_ticks = 0;
 
@@ -116,6 +127,29 @@ uint8_t local_win_size = TQ_LOCAL_WINDOW_SIZE;
 uint8_t num_words = (TQ_LOCAL_WINDOW_SIZE / WORD_BIT_SIZE);
 uint8_t aggregation_enabled = 1;
 
+uint8_t route_tq_margin = ROUTE_SWITCH_TQ_MARGIN;
+uint32_t route_dwell_time = ROUTE_SWITCH_DWELL_TIME;
+uint16_t route_flap_penalty = ROUTE_FLAP_PENALTY;
+uint32_t route_updates_suppressed = 0;
+
+uint8_t fib_compression = 0;
+uint32_t lazy_route_timeout = 0;
+
+uint8_t hna_sync = 0;
+int32_t hna_sync_sock = 0;
+
+uint32_t peer_file_interval = PEER_FILE_INTERVAL;
+
+uint8_t gw_workers = 1;
+uint8_t tunnel_offload = 0;
+uint8_t tunnel_aggregation = 1;
+uint8_t tunnel_compression = 0;
+uint8_t gw_queuing = 1;
+uint8_t gw_standby = 1;
+uint8_t gw_probing = 0;
+
+int32_t wakeup_pipe[2] = {0, 0};
+
 int nat_tool_avail = -1;
 int8_t disable_client_nat = 0;
 
@@ -139,7 +173,25 @@ void usage(void)
 	fprintf( stderr, "       -s visualization server\n" );
 	fprintf( stderr, "       -v print version\n" );
 	fprintf( stderr, "       --policy-routing-script\n" );
+	fprintf( stderr, "       --policy-routing-binary\n" );
 	fprintf( stderr, "       --disable-client-nat\n" );
+	fprintf( stderr, "       --route-tq-margin\n" );
+	fprintf( stderr, "       --route-dwell-time\n" );
+	fprintf( stderr, "       --route-flap-penalty\n" );
+	fprintf( stderr, "       --fib-compression\n" );
+	fprintf( stderr, "       --lazy-routes\n" );
+	fprintf( stderr, "       --hna-sync\n" );
+	fprintf( stderr, "       --lookup\n" );
+	fprintf( stderr, "       --peer-file-interval\n" );
+	fprintf( stderr, "       --gw-workers\n" );
+	fprintf( stderr, "       --tunnel-offload\n" );
+	fprintf( stderr, "       --disable-tunnel-aggregation\n" );
+	fprintf( stderr, "       --tunnel-compression\n" );
+	fprintf( stderr, "       --disable-gw-queuing\n" );
+	fprintf( stderr, "       --disable-gw-standby\n" );
+	fprintf( stderr, "       --gw-probe\n" );
+	fprintf( stderr, "       --snapshot\n" );
+	fprintf( stderr, "       --events\n" );
 }
 
 
@@ -191,7 +243,32 @@ void verbose_usage(void)
 	fprintf( stderr, "          default: none, allowed values: IP\n\n" );
 	fprintf( stderr, "       -v print version\n" );
 	fprintf( stderr, "       --policy-routing-script send all routing table changes to the script\n" );
+	fprintf(stderr, "       --policy-routing-binary send the changes as batched binary frames (see route_pipe.h) instead of text lines\n");
 	fprintf(stderr, "       --disable-client-nat deactivates the 'set tunnel NAT rules' feature (useful for half tunneling)\n");
+	fprintf(stderr, "       --route-tq-margin tq points a new next hop has to be better than the current one\n");
+	fprintf(stderr, "          default: %i (switch on any improvement), allowed values: 0 - %i\n\n", ROUTE_SWITCH_TQ_MARGIN, TQ_MAX_VALUE);
+	fprintf(stderr, "       --route-dwell-time minimum time in ms a next hop is kept before switching again\n");
+	fprintf(stderr, "          default: %i, allowed values: 0 - %i\n\n", ROUTE_SWITCH_DWELL_TIME, ROUTE_SWITCH_DWELL_TIME_MAX);
+	fprintf(stderr, "       --route-flap-penalty penalty points per next hop change - changes are suppressed above %i points\n", ROUTE_FLAP_SUPPRESS_LIMIT);
+	fprintf(stderr, "          until the penalty decayed (half life %ims) below %i points\n", ROUTE_FLAP_HALF_LIFE, ROUTE_FLAP_REUSE_LIMIT);
+	fprintf(stderr, "          default: %i (disabled), allowed values: 0 - %i\n\n", ROUTE_FLAP_PENALTY, ROUTE_FLAP_PENALTY_MAX);
+	fprintf(stderr, "       --fib-compression aggregate host and network routes sharing a next hop into fewer kernel routes\n");
+	fprintf(stderr, "       --lazy-routes install host routes on demand only and remove them after this many ms without traffic\n");
+	fprintf(stderr, "          default: 0 (disabled), suggested value: 60000\n\n");
+	fprintf(stderr, "       --hna-sync only announce the hash of the announced networks in OGMs and fetch the networks on change\n");
+	fprintf(stderr, "       --lookup originator, next hop and interface the running batmand uses for the given IP (needs -c)\n");
+	fprintf(stderr, "       --peer-file-interval minimum time in ms between two rewrites of the peer file after changes\n");
+	fprintf(stderr, "          default: %i, allowed values: 0 - %i (0 disables the peer file)\n\n", PEER_FILE_INTERVAL, PEER_FILE_INTERVAL_MAX);
+	fprintf(stderr, "       --gw-workers number of threads handling the tunnel traffic of the gateway (needs -g)\n");
+	fprintf(stderr, "          default: 1, allowed values: 1 - %i\n\n", GW_WORKERS_MAX);
+	fprintf(stderr, "       --tunnel-offload move TCP segments of up to 64KB through the gateway tunnel (TSO, UDP GSO / GRO)\n");
+	fprintf(stderr, "       --disable-tunnel-aggregation send every small packet in its own gateway tunnel datagram\n");
+	fprintf(stderr, "       --tunnel-compression compress the ip and tcp / udp headers of the gateway tunnel packets\n");
+	fprintf(stderr, "       --disable-gw-queuing forward the gateway tunnel packets without fair queuing and CoDel\n");
+	fprintf(stderr, "       --disable-gw-standby only keep a tunnel to the selected gateway (needs -r)\n");
+	fprintf(stderr, "       --gw-probe       choose the gateway by measured round trip time and throughput (needs -r)\n");
+	fprintf(stderr, "       --snapshot originators, gateways and announced networks of the running batmand as JSON (needs -c)\n");
+	fprintf(stderr, "       --events print the routing changes of the running batmand as JSON lines (needs -c)\n");
 }
 
 
@@ -213,13 +290,134 @@ int is_batman_if(char *dev, struct batman_if **batman_if)
 	return 0;
 }
 
+/* the rating choose_gw() compares the gateways by */
+static uint32_t get_gw_rating(struct gw_node *gw_node)
+{
+	int download_speed, upload_speed;
+
+	/* expected goodput in kbit/s - never more than the gateway advertises */
+	if (gw_probing) {
+		get_gw_speeds(gw_node->orig_node->gwflags, &download_speed, &upload_speed);
+		return gw_probe_goodput(&gw_node->probe, download_speed);
+	}
+
+	if (routing_class != 1)
+		return gw_node->orig_node->router->tq_avg;
+
+	get_gw_speeds(gw_node->orig_node->gwflags, &download_speed, &upload_speed);
+
+	return (((gw_node->orig_node->router->tq_avg * 100) / local_win_size) *
+	        ((gw_node->orig_node->router->tq_avg * 100) / local_win_size) *
+	        (download_speed / 64));
+}
+
+/* the best gateway besides the selected one - returns 1 if the standby changed */
+static uint8_t select_standby_gw(void)
+{
+	struct list_head *pos;
+	struct gw_node *gw_node, *tmp_standby_gw = NULL;
+	uint32_t current_time, rating, max_rating = 0;
+	char orig_str[ADDR_STR_LEN];
+
+	current_time = get_time_msec();
+
+	if ((gw_standby) && (routing_class != 0) && (curr_gateway != NULL)) {
+
+		list_for_each(pos, &gw_list) {
+
+			gw_node = list_entry(pos, struct gw_node, list);
+
+			if ((gw_node == curr_gateway) || (gw_node->deleted) || (gw_node->orig_node->router == NULL))
+				continue;
+
+			/* ignore this gateway if recent connection attempts were unsuccessful */
+			if ((int)(current_time - (gw_node->last_failure + 30000)) < 0)
+				continue;
+
+			/* older gateways would lose track of the client */
+			if (!tunnel_standby_possible(gw_node->orig_node->orig))
+				continue;
+
+			rating = get_gw_rating(gw_node);
+
+			/* the standby only changes for a clearly better one - each change costs a new lease */
+			if (gw_node == standby_gateway)
+				rating += rating * GW_STANDBY_MARGIN / 8;
+
+			if (rating > max_rating) {
+				max_rating = rating;
+				tmp_standby_gw = gw_node;
+			}
+
+		}
+
+	}
+
+	if (tmp_standby_gw == standby_gateway)
+		return 0;
+
+	standby_gateway = tmp_standby_gw;
+
+	if (standby_gateway != NULL) {
+		addr_to_string(standby_gateway->orig_node->orig, orig_str, ADDR_STR_LEN);
+		debug_output(3, "Standby gateway: %s (gw_flags: %i, tq: %i)\n", orig_str, standby_gateway->orig_node->gwflags, standby_gateway->orig_node->router->tq_avg);
+	}
+
+	return 1;
+}
+
+/* --gw-probe: switches as soon as another gateway is measured GW_PROBE_MARGIN / 8 faster than the selected one */
+static void check_probed_gw(void)
+{
+	struct list_head *pos;
+	struct gw_node *gw_node;
+	uint32_t current_time, rating, curr_rating;
+	char orig_str[ADDR_STR_LEN];
+
+	if ((pref_gateway != 0) || (curr_gateway->orig_node->router == NULL))
+		return;
+
+	current_time = get_time_msec();
+	curr_rating = get_gw_rating(curr_gateway);
+
+	list_for_each(pos, &gw_list) {
+
+		gw_node = list_entry(pos, struct gw_node, list);
+
+		if ((gw_node == curr_gateway) || (gw_node->deleted) || (gw_node->orig_node->router == NULL))
+			continue;
+
+		/* ignore this gateway if recent connection attempts were unsuccessful */
+		if ((int)(current_time - (gw_node->last_failure + 30000)) < 0)
+			continue;
+
+		rating = get_gw_rating(gw_node);
+
+		if ((uint64_t)rating * 8 <= (uint64_t)curr_rating * (8 + GW_PROBE_MARGIN))
+			continue;
+
+		addr_to_string(gw_node->orig_node->orig, orig_str, ADDR_STR_LEN);
+		debug_output(3, "Gateway %s measured faster: %u kbit/s (selected gateway: %u kbit/s)\n", orig_str, rating, curr_rating);
+
+		choose_gw();
+		return;
+
+	}
+}
+
+/* keeps a tunnel to the runner-up ready - switching over to it only takes a route change */
+void choose_standby_gw(void)
+{
+	if (((select_standby_gw()) || (tunnel_missing())) && (curr_gateway != NULL) && (!is_aborted()))
+		add_default_route();
+}
+
 void choose_gw(void)
 {
 	struct list_head *pos;
 	struct gw_node *gw_node, *tmp_curr_gw = NULL;
 	uint8_t max_gw_class = 0, max_tq = 0;
 	uint32_t current_time, max_gw_factor = 0, tmp_gw_factor = 0;
-	int download_speed, upload_speed;
 	char orig_str[ADDR_STR_LEN];
 	prof_start( PROF_choose_gw );
 
@@ -266,14 +464,11 @@ void choose_gw(void)
 		if ( gw_node->deleted )
 			continue;
 
-		switch ( routing_class ) {
+		/* measured goodput replaces the class */
+		switch ( ( gw_probing ? 1 : routing_class ) ) {
 
 			case 1: /* fast connection */
-				get_gw_speeds( gw_node->orig_node->gwflags, &download_speed, &upload_speed );
-
-				if (((tmp_gw_factor = (((gw_node->orig_node->router->tq_avg * 100 ) / local_win_size) *
-								  ((gw_node->orig_node->router->tq_avg * 100) / local_win_size) *
-								     (download_speed / 64))) > max_gw_factor) ||
+				if (((tmp_gw_factor = get_gw_rating(gw_node)) > max_gw_factor) ||
 								  ((tmp_gw_factor == max_gw_factor) && (gw_node->orig_node->router->tq_avg > max_tq)))
 					tmp_curr_gw = gw_node;
 				break;
@@ -324,6 +519,7 @@ void choose_gw(void)
 		}
 
 		curr_gateway = tmp_curr_gw;
+		event_gateway(curr_gateway);
 
 		/* may be the last gateway is now gone */
 		if ( ( curr_gateway != NULL ) && ( !is_aborted() ) ) {
@@ -331,6 +527,8 @@ void choose_gw(void)
 			addr_to_string( curr_gateway->orig_node->orig, orig_str, ADDR_STR_LEN );
 			debug_output( 3, "Adding default route to %s (gw_flags: %i, tq: %i, gw_product: %i)\n", orig_str, max_gw_class, max_tq, max_gw_factor );
 
+			/* if it was the standby its tunnel takes over right away */
+			select_standby_gw();
 			add_default_route();
 
 		}
@@ -340,7 +538,7 @@ void choose_gw(void)
 	prof_stop( PROF_choose_gw );
 }
 
-void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, unsigned char *hna_recv_buff, int16_t hna_buff_len)
+void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, unsigned char *hna_recv_buff, int32_t hna_buff_len)
 {
 	char orig_str[ADDR_STR_LEN], next_str[ADDR_STR_LEN];
 	struct neigh_node *old_router;
@@ -366,8 +564,8 @@ void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, u
 
 			debug_output(4, "Adding new route\n");
 
-			add_del_route(orig_node->orig, 32, neigh_node->addr, neigh_node->if_incoming->addr.sin_addr.s_addr,
-					neigh_node->if_incoming->if_index, neigh_node->if_incoming->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+			fib_add_del_route(orig_node->orig, 32, neigh_node->addr, neigh_node->if_incoming->addr.sin_addr.s_addr,
+					neigh_node->if_incoming->if_index, neigh_node->if_incoming->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_ADD);
 
 			orig_node->batman_if = neigh_node->if_incoming;
 			orig_node->router = neigh_node;
@@ -383,8 +581,8 @@ void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, u
 			/* remove old announced network(s) */
 			hna_global_del(orig_node);
 
-			add_del_route(orig_node->orig, 32, orig_node->router->addr, 0, orig_node->batman_if->if_index,
-					orig_node->batman_if->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+			fib_add_del_route(orig_node->orig, 32, orig_node->router->addr, 0, orig_node->batman_if->if_index,
+					orig_node->batman_if->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_DEL);
 
 		/* route changed */
 		} else {
@@ -392,18 +590,18 @@ void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, u
 			debug_output(4, "Route changed\n");
 
 			/* add new route */
-			add_del_route(orig_node->orig, 32, neigh_node->addr, neigh_node->if_incoming->addr.sin_addr.s_addr,
-					neigh_node->if_incoming->if_index, neigh_node->if_incoming->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+			fib_add_del_route(orig_node->orig, 32, neigh_node->addr, neigh_node->if_incoming->addr.sin_addr.s_addr,
+					neigh_node->if_incoming->if_index, neigh_node->if_incoming->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_ADD);
 
 			/* delete old route */
-			add_del_route(orig_node->orig, 32, orig_node->router->addr, 0, orig_node->batman_if->if_index,
-					orig_node->batman_if->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+			fib_add_del_route(orig_node->orig, 32, orig_node->router->addr, 0, orig_node->batman_if->if_index,
+					orig_node->batman_if->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_DEL);
 
 #ifdef NO_POLICY_ROUTING
 			/* add new route AGAIN, if not using policy based routing as the process of deleting the old route can actually delete the new route
 			   as well. */
-			add_del_route(orig_node->orig, 32, neigh_node->addr, neigh_node->if_incoming->addr.sin_addr.s_addr,
-					neigh_node->if_incoming->if_index, neigh_node->if_incoming->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+			fib_add_del_route(orig_node->orig, 32, neigh_node->addr, neigh_node->if_incoming->addr.sin_addr.s_addr,
+					neigh_node->if_incoming->if_index, neigh_node->if_incoming->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_ADD);
 
 
 #endif
@@ -422,6 +620,12 @@ void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, u
 		hna_global_update(orig_node, hna_recv_buff, hna_buff_len, old_router);
 	}
 
+	if (orig_node != NULL) {
+		lpm_update_orig(orig_node);
+		event_route(orig_node, old_router);
+		vis_update_orig(orig_node);
+	}
+
 	prof_stop(PROF_update_routes);
 }
 
@@ -452,6 +656,8 @@ void update_gw_list(struct orig_node *orig_node, uint8_t new_gwflags, uint16_t g
 
 				if (gw_node == curr_gateway)
 					choose_gw();
+				else if (gw_node == standby_gateway)
+					choose_standby_gw();
 
 			} else {
 
@@ -634,90 +840,14 @@ static int isBidirectionalNeigh(struct orig_node *orig_node, struct orig_node *o
 	return 0;
 }
 
-static void generate_vis_packet(void)
-{
-	struct hash_it_t *hashit = NULL;
-	struct orig_node *orig_node;
-	struct vis_data *vis_data;
-	struct list_head *list_pos;
-	struct batman_if *batman_if;
-
-	if (vis_packet != NULL) {
-		debugFree(vis_packet, 1102);
-		vis_packet = NULL;
-		vis_packet_size = 0;
-	}
-
-	vis_packet_size = sizeof(struct vis_packet);
-	vis_packet = debugMalloc(vis_packet_size, 104);
-
-	memcpy(&((struct vis_packet *)vis_packet)->sender_ip, (unsigned char *)&(((struct batman_if *)if_list.next)->addr.sin_addr.s_addr), 4);
-
-	((struct vis_packet *)vis_packet)->version = VIS_COMPAT_VERSION;
-	((struct vis_packet *)vis_packet)->gw_class = gateway_class;
-	((struct vis_packet *)vis_packet)->tq_max = TQ_MAX_VALUE;
-
-	/* neighbor list */
-	while (NULL != (hashit = hash_iterate(orig_hash, hashit))) {
-
-		orig_node = hashit->bucket->data;
-
-		/* we interested in 1 hop neighbours only */
-		if ((orig_node->router != NULL) && (orig_node->orig == orig_node->router->addr) &&
-		    (orig_node->router->tq_avg > 0)) {
-
-			vis_packet_size += sizeof(struct vis_data);
-
-			vis_packet = debugRealloc(vis_packet, vis_packet_size, 105);
-
-			vis_data = (struct vis_data *)(vis_packet + vis_packet_size - sizeof(struct vis_data));
-
-			memcpy(&vis_data->ip, (unsigned char *)&orig_node->orig, 4);
-
-			vis_data->data = orig_node->router->tq_avg;
-			vis_data->type = DATA_TYPE_NEIGH;
-
-		}
-
-	}
-
-	/* secondary interfaces */
-	if (found_ifs > 1) {
-		list_for_each(list_pos, &if_list) {
-			batman_if = list_entry(list_pos, struct batman_if, list);
-
-			if (((struct vis_packet *)vis_packet)->sender_ip == batman_if->addr.sin_addr.s_addr)
-				continue;
-
-			vis_packet_size += sizeof(struct vis_data);
-
-			vis_packet = debugRealloc(vis_packet, vis_packet_size, 106);
-
-			vis_data = (struct vis_data *)(vis_packet + vis_packet_size - sizeof(struct vis_data));
-
-			memcpy(&vis_data->ip, (unsigned char *)&batman_if->addr.sin_addr.s_addr, 4);
-
-			vis_data->data = 0;
-			vis_data->type = DATA_TYPE_SEC_IF;
-		}
-	}
-
-	/* hna announcements */
-	vis_packet = hna_local_update_vis_packet(vis_packet, &vis_packet_size);
-
-	if (vis_packet_size == sizeof(struct vis_packet)) {
-		debugFree(vis_packet, 1107);
-		vis_packet = NULL;
-		vis_packet_size = 0;
-	}
-}
-
 static void send_vis_packet(void)
 {
-	generate_vis_packet();
+	unsigned char *vis_packet;
+	uint16_t vis_packet_len;
 
-	if ( vis_packet != NULL )
-		send_udp_packet(vis_packet, vis_packet_size, &vis_if.addr, vis_if.sock, NULL);
+	/* the vis packet is kept up to date by vis.c */
+	if ((vis_packet = vis_get_packet(&vis_packet_len)) != NULL)
+		send_udp_packet(vis_packet, vis_packet_len, &vis_if.addr, vis_if.sock, NULL);
 }
 
 static uint8_t count_real_packets(struct bat_packet *in, uint32_t neigh, struct batman_if *if_incoming)
@@ -994,12 +1124,28 @@ int8_t batman(void)
 send_packets:
 		send_outstanding_packets(curr_time);
 
+		route_pipe_flush();
+
+		snapshot_serve();
+
+		/* view_publish() drops the gateway for the tunnel thread and the unix socket without choose_gw() */
+		event_gateway(curr_gateway);
+		event_flush();
+
+		view_publish(0);
+
 		if ((int)(curr_time - (debug_timeout + 1000)) > 0) {
 
 			debug_timeout = curr_time;
 
 			purge_orig( curr_time );
 
+			fib_lazy_purge(curr_time);
+
+			hna_sync_purge(curr_time);
+
+			peer_table_update(curr_time);
+
 			debug_orig();
 
 			check_inactive_interfaces();
@@ -1014,6 +1160,13 @@ send_packets:
 			if ( ( routing_class != 0 ) && ( curr_gateway == NULL ) )
 				choose_gw();
 
+			if ( ( routing_class != 0 ) && ( gw_probing ) && ( curr_gateway != NULL ) )
+				check_probed_gw();
+
+			/* replaces a failed standby tunnel and retries tunnels that could not be started */
+			if ( routing_class != 0 )
+				choose_standby_gw();
+
 			if ((vis_if.sock) && ((int)(curr_time - (vis_timeout + 10000)) > 0)) {
 
 				vis_timeout = curr_time;
@@ -1022,6 +1175,9 @@ send_packets:
 			}
 
 			hna_local_task_exec();
+
+			/* keep the TQ values of the other threads' view current */
+			view_publish(1);
 		}
 
 	}
@@ -1043,9 +1199,6 @@ send_packets:
 		debugFree(forw_node, 1106);
 	}
 
-	if (vis_packet != NULL)
-		debugFree(vis_packet, 1108);
-
 	set_forwarding( forward_old );
 
 	set_rp_filter( if_rp_filter_all_old, "all" );
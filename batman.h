@@ -49,6 +49,10 @@
 
 #define UNIX_PATH "/data/data/org.servalproject/var/batmand.socket"
 #define PEER_PATH "/data/data/org.servalproject/var/batmand.peers"
+#define PEER_TABLE_DIR "/dev/shm"            /* tmpfs - the table changes too often for flash */
+#define PEER_TABLE_PATH PEER_TABLE_DIR "/batmand.peers.map"
+#define UNIX_BULK_MAX_LEN 1048576  /* largest bulk HNA request accepted via the unix socket */
+#define UNIX_BULK_CHUNK 4096
 
 /***
  *
@@ -90,6 +94,46 @@
 #define TQ_HOP_PENALTY 10
 #define DEFAULT_ROUTING_CLASS 30
 
+/* the peer file (PEER_PATH) is rewritten at most every PEER_FILE_INTERVAL ms */
+#define PEER_FILE_INTERVAL 10000
+#define PEER_FILE_INTERVAL_MAX 3600000
+
+/* threads moving the tunnel traffic of the gateway (each with its own tun queue and udp socket) */
+#define GW_WORKERS_MAX 8
+
+/* packets each gateway worker queues per direction - the udp socket buffer is kept small so the queue builds up here */
+#define GW_QUEUE_LIMIT 256
+#define GW_QUEUE_SNDBUF 16384
+
+/* client tunnel threads: the selected gateway, the standby and one handing over */
+#define GW_TUNNELS_MAX 3
+
+/* a standby gateway is only replaced by one with a GW_STANDBY_MARGIN / 8 better rating */
+#define GW_STANDBY_MARGIN 1
+
+/* --gw-probe: every gateway is probed each GW_PROBE_INTERVAL ms, a measured GW_PROBE_MARGIN / 8 faster one takes over */
+#define GW_PROBE_INTERVAL 10000
+#define GW_PROBE_MARGIN 2
+
+/**
+ * next hop damping (all disabled by default)
+ * a new next hop has to be ROUTE_SWITCH_TQ_MARGIN better than the current one,
+ * the current one has to be in use for at least ROUTE_SWITCH_DWELL_TIME ms and
+ * every next hop change adds ROUTE_FLAP_PENALTY points to the originator which
+ * suppress further changes once they exceed the suppress limit until they
+ * decayed below the reuse limit again
+ */
+#define ROUTE_SWITCH_TQ_MARGIN 0
+#define ROUTE_SWITCH_DWELL_TIME 0
+#define ROUTE_SWITCH_DWELL_TIME_MAX 3600000
+#define ROUTE_FLAP_PENALTY 0
+#define ROUTE_FLAP_PENALTY_MAX 65535
+#define ROUTE_FLAP_SUPPRESS_LIMIT 3000
+#define ROUTE_FLAP_REUSE_LIMIT 750
+#define ROUTE_FLAP_HALF_LIFE 15000
+
+#define LAZY_ROUTE_TIMEOUT_MAX 86400000 /* --lazy-routes: one day, the purge compares it as signed ms */
+
 
 #define MAX_AGGREGATION_BYTES 512 /* should not be bigger than 512 bytes or change the size of forw_node->direct_link_flags */
 #define MAX_AGGREGATION_MS 100
@@ -159,6 +203,7 @@ extern int16_t originator_interval;
 extern uint32_t pref_gateway;
 extern char *policy_routing_script;
 extern int policy_routing_pipe;
+extern uint8_t policy_routing_binary;
 extern pid_t policy_routing_script_pid;
 
 extern int8_t stop;
@@ -166,7 +211,9 @@ extern int nat_tool_avail;
 extern int8_t disable_client_nat;
 
 extern struct gw_node *curr_gateway;
+extern struct gw_node *standby_gateway;
 extern pthread_t curr_gateway_thread_id;
+extern pthread_t gw_probe_thread_id;
 
 extern uint8_t found_ifs;
 extern uint8_t active_ifs;
@@ -183,9 +230,10 @@ extern struct list_head_first gw_list;
 extern struct list_head_first forw_list;
 extern struct vis_if vis_if;
 extern struct unix_if unix_if;
+extern struct lazy_if lazy_if;
 extern struct debug_clients debug_clients;
 
-extern uint8_t tunnel_running;
+extern uint32_t tunnel_gw_addrs[GW_TUNNELS_MAX];
 extern uint64_t batman_clock_ticks;
 
 extern uint8_t hop_penalty;
@@ -197,15 +245,39 @@ extern uint8_t local_win_size;
 extern uint8_t num_words;
 extern uint8_t aggregation_enabled;
 
+extern uint8_t route_tq_margin;
+extern uint32_t route_dwell_time;
+extern uint16_t route_flap_penalty;
+extern uint32_t route_updates_suppressed;
+
+extern uint8_t fib_compression;
+extern uint32_t lazy_route_timeout;
+
+extern uint8_t hna_sync;
+extern int32_t hna_sync_sock;
+
+extern uint32_t peer_file_interval;
+extern uint8_t gw_workers;
+extern uint8_t tunnel_offload;
+extern uint8_t tunnel_aggregation;
+extern uint8_t tunnel_compression;
+extern uint8_t gw_queuing;
+extern uint8_t gw_standby;
+extern uint8_t gw_probing;
+
+/* lets other threads interrupt the select() of the main loop */
+extern int32_t wakeup_pipe[2];
+
 #include "types.h" // can be removed as soon as these function have been cleaned up
 int8_t batman(void);
 void usage(void);
 void verbose_usage(void);
 int is_batman_if(char *dev, struct batman_if **batman_if);
-void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, unsigned char *hna_recv_buff, int16_t hna_buff_len);
+void update_routes(struct orig_node *orig_node, struct neigh_node *neigh_node, unsigned char *hna_recv_buff, int32_t hna_buff_len);
 void update_gw_list(struct orig_node *orig_node, uint8_t new_gwflags, uint16_t gw_port);
 void get_gw_speeds(unsigned char gw_class, int *down, int *up);
 unsigned char get_gw_class(int down, int up);
 void choose_gw(void);
+void choose_standby_gw(void);
 
 #endif
@@ -103,8 +103,12 @@ void del_nat_rule(char *BATMANUNUSED(dev)) {
 	fprintf(stderr, "del_nat_rule: not implemented\n");
 }
 
-void own_hna_rules(uint32_t hna_ip, uint8_t netmask, int8_t route_action) {
-	fprintf(stderr, "own_hna_rules: not implemented\n");
+void hna_local_update_nat(uint32_t BATMANUNUSED(hna_ip), uint8_t BATMANUNUSED(netmask), int8_t BATMANUNUSED(route_action)) {
+	fprintf(stderr, "hna_local_update_nat: not implemented\n");
+}
+
+void nat_rules_flush(void) {
+	return;
 }
 
 /* Probe for tun interface availability */
@@ -123,6 +127,19 @@ int8_t del_dev_tun(int32_t fd)
 	return close(fd);
 }
 
+int8_t add_dev_lazy_tun(char *BATMANUNUSED(tun_dev), size_t BATMANUNUSED(tun_dev_size), int32_t *BATMANUNUSED(fd), int32_t *BATMANUNUSED(ifi))
+{
+	fprintf(stderr, "add_dev_lazy_tun: not implemented\n");
+	return -1;
+}
+
+int8_t add_dev_tun_queue(char *BATMANUNUSED(tun_dev), int32_t *fd, uint8_t BATMANUNUSED(tun_flags))
+{
+	fprintf(stderr, "add_dev_tun_queue: not implemented\n");
+	*fd = -1;
+	return -1;
+}
+
 int8_t set_tun_addr(int32_t BATMANUNUSED(fd), uint32_t tun_addr, char *tun_ifname)
 {
 	int so;
@@ -154,7 +171,7 @@ int8_t set_tun_addr(int32_t BATMANUNUSED(fd), uint32_t tun_addr, char *tun_ifnam
 }
 
 int8_t add_dev_tun(struct batman_if *batman_if, uint32_t tun_addr,
-		char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *BATMANUNUSED(ifi))
+		char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *BATMANUNUSED(ifi), uint8_t BATMANUNUSED(tun_flags))
 {
 	int so;
 	struct ifreq ifr_tun, ifr_if;
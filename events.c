@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * routing event stream for unix socket subscribers
+ *
+ * The main thread reports the routing changes where they happen. Each
+ * event gets the next sequence number and - as long as somebody is
+ * subscribed - is formatted into a ring of the last EVENT_RING_SIZE
+ * events. event_flush() (once per main loop run) sends every subscriber
+ * what it has not seen yet without ever blocking; a subscriber which
+ * falls behind by more than the ring gets an overflow event and has to
+ * resync from a snapshot.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "os.h"
+#include "batman.h"
+#include "events.h"
+
+
+struct event_subscriber {
+	struct list_head list;
+	int32_t sock;
+	uint32_t next_seq;                    /* first event not sent yet */
+	char pending[EVENT_LEN];              /* rest of a partly sent event */
+	uint16_t pending_len;
+	uint16_t pending_offset;
+};
+
+struct event {
+	uint32_t seq;
+	uint16_t len;
+	char line[EVENT_LEN];
+};
+
+
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* allocated with the first subscription */
+static struct event *event_ring = NULL;
+static struct list_head_first event_subscribers;
+static uint32_t event_subscribers_num = 0;
+
+static uint32_t event_seq = 0, event_overflows = 0;
+static uint8_t event_backlog = 0;
+static uint32_t event_gw_addr = 0;
+
+
+
+static void event_lock(void)
+{
+	if (pthread_mutex_lock(&event_mutex) != 0)
+		debug_output(0, "Error - could not lock event mutex: %s \n", strerror(errno));
+}
+
+static void event_unlock(void)
+{
+	if (pthread_mutex_unlock(&event_mutex) != 0)
+		debug_output(0, "Error - could not unlock event mutex: %s \n", strerror(errno));
+}
+
+/* formats an address as JSON string - or null */
+static char *event_addr(uint32_t addr, char *buff, size_t size)
+{
+	if (addr == 0) {
+		snprintf(buff, size, "null");
+	} else {
+		buff[0] = '"';
+		addr_to_string(addr, buff + 1, size - 2);
+		strcat(buff, "\"");
+	}
+
+	return buff;
+}
+
+/* format is the event specific part, seq and time are added */
+static void event_add(char *format, ...)
+{
+	struct event *event;
+	va_list args;
+	int len;
+
+	event_lock();
+
+	event_seq++;
+
+	if (event_subscribers_num == 0)
+		goto out;
+
+	event = &event_ring[event_seq % EVENT_RING_SIZE];
+	event->seq = event_seq;
+
+	len = snprintf(event->line, sizeof(event->line), "{\"seq\":%u,\"time\":%u,", event_seq, get_time_msec());
+
+	va_start(args, format);
+	len += vsnprintf(event->line + len, sizeof(event->line) - len, format, args);
+	va_end(args);
+
+	/* can't happen with the formats below */
+	if (len > (int)sizeof(event->line) - 3)
+		len = sizeof(event->line) - 3;
+
+	len += sprintf(event->line + len, "}\n");
+	event->len = len;
+	event_backlog = 1;
+
+out:
+	event_unlock();
+}
+
+void event_orig_add(struct orig_node *orig_node)
+{
+	char orig_str[ADDR_STR_LEN + 2];
+
+	event_add("\"event\":\"originator_added\",\"originator\":%s", event_addr(orig_node->orig, orig_str, sizeof(orig_str)));
+}
+
+void event_orig_del(struct orig_node *orig_node)
+{
+	char orig_str[ADDR_STR_LEN + 2];
+
+	event_add("\"event\":\"originator_removed\",\"originator\":%s", event_addr(orig_node->orig, orig_str, sizeof(orig_str)));
+}
+
+/* called after every route update - reports next hop changes and TQ changes crossing a threshold */
+void event_route(struct orig_node *orig_node, struct neigh_node *old_router)
+{
+	char orig_str[ADDR_STR_LEN + 2], router_str[ADDR_STR_LEN + 2], old_router_str[ADDR_STR_LEN + 2];
+	uint8_t tq = (orig_node->router != NULL ? orig_node->router->tq_avg : 0);
+	uint8_t old_tq = orig_node->event_tq;
+
+	if (orig_node->router != old_router) {
+
+		orig_node->event_tq = tq;
+
+		event_add("\"event\":\"next_hop\",\"originator\":%s,\"next_hop\":%s,\"old_next_hop\":%s,\"tq\":%i",
+		          event_addr(orig_node->orig, orig_str, sizeof(orig_str)),
+		          event_addr((orig_node->router != NULL ? orig_node->router->addr : 0), router_str, sizeof(router_str)),
+		          event_addr((old_router != NULL ? old_router->addr : 0), old_router_str, sizeof(old_router_str)), tq);
+		return;
+
+	}
+
+	if ((orig_node->router == NULL) || (tq / EVENT_TQ_STEP == old_tq / EVENT_TQ_STEP))
+		return;
+
+	if ((tq > old_tq ? tq - old_tq : old_tq - tq) < EVENT_TQ_HYSTERESIS)
+		return;
+
+	orig_node->event_tq = tq;
+
+	event_add("\"event\":\"tq\",\"originator\":%s,\"tq\":%i,\"old_tq\":%i",
+	          event_addr(orig_node->orig, orig_str, sizeof(orig_str)), tq, old_tq);
+}
+
+/* the gateway may also be dropped by other threads - the main loop calls this regularly */
+void event_gateway(struct gw_node *gw_node)
+{
+	char gw_str[ADDR_STR_LEN + 2], old_gw_str[ADDR_STR_LEN + 2];
+	uint32_t gw_addr = (gw_node != NULL ? gw_node->orig_node->orig : 0);
+
+	if (gw_addr == event_gw_addr)
+		return;
+
+	event_add("\"event\":\"gateway\",\"gateway\":%s,\"old_gateway\":%s",
+	          event_addr(gw_addr, gw_str, sizeof(gw_str)), event_addr(event_gw_addr, old_gw_str, sizeof(old_gw_str)));
+
+	event_gw_addr = gw_addr;
+}
+
+void event_hna(uint32_t addr, uint8_t netmask, struct orig_node *orig_node, struct orig_node *old_orig_node)
+{
+	char addr_str[ADDR_STR_LEN], orig_str[ADDR_STR_LEN + 2], old_orig_str[ADDR_STR_LEN + 2];
+
+	addr_to_string(addr, addr_str, sizeof(addr_str));
+
+	event_add("\"event\":\"hna\",\"network\":\"%s/%i\",\"originator\":%s,\"old_originator\":%s", addr_str, netmask,
+	          event_addr((orig_node != NULL ? orig_node->orig : 0), orig_str, sizeof(orig_str)),
+	          event_addr((old_orig_node != NULL ? old_orig_node->orig : 0), old_orig_str, sizeof(old_orig_str)));
+}
+
+/* returns 0 if the rest of a partly sent event is still pending */
+static int event_send_pending(struct event_subscriber *subscriber)
+{
+	ssize_t sent;
+
+	while (subscriber->pending_offset < subscriber->pending_len) {
+
+		sent = send(subscriber->sock, subscriber->pending + subscriber->pending_offset,
+		            subscriber->pending_len - subscriber->pending_offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (sent < 0) {
+
+			if (errno == EINTR)
+				continue;
+
+			/* other errors: the unix socket thread notices the closed client */
+			return 0;
+
+		}
+
+		subscriber->pending_offset += sent;
+
+	}
+
+	subscriber->pending_len = subscriber->pending_offset = 0;
+	return 1;
+}
+
+/* returns 0 if nothing could be sent - a partly sent event is completed by event_send_pending() */
+static int event_send(struct event_subscriber *subscriber, char *line, uint16_t len)
+{
+	ssize_t sent;
+
+	do {
+		sent = send(subscriber->sock, line, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while ((sent < 0) && (errno == EINTR));
+
+	if (sent < 0)
+		return 0;
+
+	if (sent < len) {
+		memcpy(subscriber->pending, line + sent, len - sent);
+		subscriber->pending_len = len - sent;
+		subscriber->pending_offset = 0;
+	}
+
+	return 1;
+}
+
+void event_flush(void)
+{
+	struct list_head *list_pos;
+	struct event_subscriber *subscriber;
+	struct event *event;
+	char overflow[64];
+	uint32_t next_seq;
+
+	if (!event_backlog)
+		return;
+
+	event_lock();
+
+	event_backlog = 0;
+
+	list_for_each(list_pos, &event_subscribers) {
+
+		subscriber = list_entry(list_pos, struct event_subscriber, list);
+
+		while ((event_send_pending(subscriber)) && ((int)(event_seq - subscriber->next_seq) >= 0)) {
+
+			/* the ring does not reach back that far anymore */
+			if ((int)(event_seq - subscriber->next_seq) >= EVENT_RING_SIZE) {
+
+				next_seq = event_seq - EVENT_RING_SIZE + 1;
+				snprintf(overflow, sizeof(overflow), "{\"seq\":%u,\"time\":%u,\"event\":\"overflow\"}\n", next_seq, get_time_msec());
+
+				if (!event_send(subscriber, overflow, strlen(overflow)))
+					break;
+
+				subscriber->next_seq = next_seq;
+				event_overflows++;
+				continue;
+
+			}
+
+			event = &event_ring[subscriber->next_seq % EVENT_RING_SIZE];
+
+			if (!event_send(subscriber, event->line, event->len))
+				break;
+
+			subscriber->next_seq++;
+
+		}
+
+		if ((subscriber->pending_len > 0) || ((int)(event_seq - subscriber->next_seq) >= 0))
+			event_backlog = 1;
+
+	}
+
+	event_unlock();
+}
+
+uint32_t event_get_seq(void)
+{
+	return event_seq;
+}
+
+void event_subscribe(int32_t sock)
+{
+	struct event_subscriber *subscriber;
+	char line[64];
+
+	event_lock();
+
+	if (event_ring == NULL) {
+		event_ring = debugMalloc(EVENT_RING_SIZE * sizeof(struct event), 951);
+		memset(event_ring, 0, EVENT_RING_SIZE * sizeof(struct event));
+		INIT_LIST_HEAD_FIRST(event_subscribers);
+	}
+
+	subscriber = debugMalloc(sizeof(struct event_subscriber), 952);
+	memset(subscriber, 0, sizeof(struct event_subscriber));
+	INIT_LIST_HEAD(&subscriber->list);
+
+	subscriber->sock = sock;
+	subscriber->next_seq = event_seq + 1;
+
+	list_add_tail(&subscriber->list, &event_subscribers);
+	event_subscribers_num++;
+
+	snprintf(line, sizeof(line), "{\"seq\":%u,\"time\":%u,\"event\":\"subscribed\"}\n", event_seq, get_time_msec());
+
+	/* the client did not read anything yet - this fits into the socket */
+	event_send(subscriber, line, strlen(line));
+
+	event_unlock();
+}
+
+void event_unsubscribe(int32_t sock)
+{
+	struct list_head *list_pos, *list_pos_tmp, *prev_list_head;
+	struct event_subscriber *subscriber;
+
+	event_lock();
+
+	if (event_ring == NULL)
+		goto out;
+
+	prev_list_head = (struct list_head *)&event_subscribers;
+
+	list_for_each_safe(list_pos, list_pos_tmp, &event_subscribers) {
+
+		subscriber = list_entry(list_pos, struct event_subscriber, list);
+
+		if (subscriber->sock == sock) {
+			list_del(prev_list_head, list_pos, &event_subscribers);
+			debugFree(subscriber, 1952);
+			event_subscribers_num--;
+			break;
+		}
+
+		prev_list_head = &subscriber->list;
+
+	}
+
+out:
+	event_unlock();
+}
+
+void event_get_stats(uint32_t *seq, uint32_t *subscribers, uint32_t *overflows)
+{
+	event_lock();
+	*seq = event_seq;
+	*subscribers = event_subscribers_num;
+	*overflows = event_overflows;
+	event_unlock();
+}
+
+void event_free(void)
+{
+	struct list_head *list_pos, *list_pos_tmp;
+
+	event_lock();
+
+	if (event_ring != NULL) {
+
+		list_for_each_safe(list_pos, list_pos_tmp, &event_subscribers) {
+
+			list_del((struct list_head *)&event_subscribers, list_pos, &event_subscribers);
+			debugFree(list_pos, 1953);
+
+		}
+
+		debugFree(event_ring, 1951);
+		event_ring = NULL;
+		event_subscribers_num = 0;
+
+	}
+
+	event_unlock();
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_EVENTS_H
+#define _BATMAN_EVENTS_H
+
+#include "batman.h"
+
+
+/***
+ *
+ * routing event stream (unix socket command "e")
+ *
+ * A subscribed client receives one JSON object per line:
+ *
+ * {"seq":<n>,"time":<ms>,"event":"subscribed"}                  first line - following events have seq > n
+ * {"seq":<n>,"time":<ms>,"event":"originator_added","originator":"a.b.c.d"}
+ * {"seq":<n>,"time":<ms>,"event":"originator_removed","originator":"a.b.c.d"}
+ * {"seq":<n>,"time":<ms>,"event":"next_hop","originator":"a.b.c.d","next_hop":"a.b.c.d"|null,"old_next_hop":"a.b.c.d"|null,"tq":<tq>}
+ * {"seq":<n>,"time":<ms>,"event":"tq","originator":"a.b.c.d","tq":<tq>,"old_tq":<tq>}
+ * {"seq":<n>,"time":<ms>,"event":"gateway","gateway":"a.b.c.d"|null,"old_gateway":"a.b.c.d"|null}
+ * {"seq":<n>,"time":<ms>,"event":"hna","network":"a.b.c.d/n","originator":"a.b.c.d"|null,"old_originator":"a.b.c.d"|null}
+ * {"seq":<n>,"time":<ms>,"event":"overflow"}                    events before seq n were lost
+ *
+ * Sequence numbers are counted for every event, even without subscribers.
+ * The snapshot (see snapshot.h) carries the seq of the last event it
+ * contains - a client (re)syncs by subscribing, fetching a snapshot and
+ * applying the events with a higher seq. A "tq" event is sent if the
+ * TQ value of the next hop crossed a multiple of EVENT_TQ_STEP and moved
+ * at least EVENT_TQ_HYSTERESIS points since the last next_hop / tq event.
+ * Clients which do not read fast enough lose events older than the last
+ * EVENT_RING_SIZE and get an "overflow" event.
+ *
+ ***/
+
+#define EVENT_RING_SIZE 512
+#define EVENT_LEN 256
+#define EVENT_TQ_STEP 32
+#define EVENT_TQ_HYSTERESIS 8
+
+
+void event_orig_add(struct orig_node *orig_node);
+void event_orig_del(struct orig_node *orig_node);
+void event_route(struct orig_node *orig_node, struct neigh_node *old_router);
+void event_gateway(struct gw_node *gw_node);
+void event_hna(uint32_t addr, uint8_t netmask, struct orig_node *orig_node, struct orig_node *old_orig_node);
+void event_flush(void);
+uint32_t event_get_seq(void);
+void event_subscribe(int32_t sock);
+void event_unsubscribe(int32_t sock);
+void event_get_stats(uint32_t *seq, uint32_t *subscribers, uint32_t *overflows);
+void event_free(void);
+
+#endif
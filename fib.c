@@ -0,0 +1,849 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * FIB compression for the host and network routing tables
+ *
+ * All unicast routes towards originators and announced networks are kept in
+ * a binary trie per routing table. Every trie node knows how many kernel
+ * entries its subtree needs depending on the next hop it inherits from the
+ * entries above (a small set of candidate next hops plus "anything else").
+ * Based on these costs a node either installs nothing, restates the route
+ * or installs an aggregate which covers siblings with the same next hop.
+ * Address ranges below an aggregate that must not use it get a throw route
+ * (or a more specific route) as exception.
+ *
+ * A route change only recomputes the costs along its path towards the root
+ * and only the subtrees whose costs or inherited next hop changed are
+ * compared against the installed entries.
+ *
+ * With lazy routes the host routes are only handed to the trie once a
+ * packet towards the originator hit the catch-all route of the unreachable
+ * table and are taken back again after being idle for a while.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "originator.h"
+#include "fib.h"
+
+
+#define FIB_INFINITY 0x3fffffff
+
+/* the ioctl based routing code can't install throw routes */
+#ifdef NO_POLICY_ROUTING
+#define FIB_THROW_COST FIB_INFINITY
+#else
+#define FIB_THROW_COST 1
+#endif
+
+
+struct fib_nexthop {
+	struct list_head list;
+	uint32_t router;
+	uint32_t src_ip;
+	int32_t ifi;
+	char *dev;
+	uint32_t refcount;
+};
+
+struct fib_node {
+	struct fib_node *parent;
+	struct fib_node *child[2];
+	uint32_t prefix;                      /* host byte order */
+	uint8_t len;
+	uint8_t dirty;                        /* costs changed since the last reconcile */
+	uint8_t reconciled;
+	uint8_t installed[3];                 /* entry at this prefix, entries filling the missing child 0 / 1 */
+	struct fib_nexthop *inst[3];          /* next hop of the installed entry - NULL is a throw entry */
+	struct fib_nexthop *route;            /* next hop of the route ending at this prefix */
+	struct fib_nexthop *last_in;          /* next hop inherited during the last reconcile */
+	uint8_t cand_num;
+	struct fib_nexthop *cand[FIB_CANDIDATES];
+	uint32_t cost[FIB_CANDIDATES];        /* entries needed by this subtree if cand[i] is inherited */
+	uint32_t cost_other;                  /* entries needed by this subtree if anything else is inherited */
+};
+
+struct fib_table {
+	uint8_t rt_table;
+	struct fib_node *root;
+	uint32_t routes;
+	uint32_t entries;
+};
+
+/* route towards an originator which is only installed on demand */
+struct fib_lazy {
+	uint32_t dest;                        /* needs to be the first field - see compare_orig() */
+	uint32_t router;
+	uint32_t src_ip;
+	int32_t ifi;
+	char *dev;
+	uint32_t last_used;
+	uint8_t active;
+};
+
+struct fib_del_entry {
+	struct fib_table *fib_table;
+	uint32_t prefix;
+	uint8_t len;
+	struct fib_nexthop *nexthop;
+};
+
+
+static struct fib_table fib_tables[] = {
+	{BATMAN_RT_TABLE_HOSTS, NULL, 0, 0},
+	{BATMAN_RT_TABLE_NETWORKS, NULL, 0, 0},
+};
+
+static struct list_head_first fib_nexthop_list = {(struct list_head *)&fib_nexthop_list, (struct list_head *)&fib_nexthop_list};
+
+/* inherited next hop which matches none of the candidates */
+static struct fib_nexthop fib_other;
+
+/* entries are deleted after all new entries have been added */
+static struct fib_del_entry *fib_del_list = NULL;
+static uint32_t fib_del_num = 0, fib_del_size = 0;
+
+static struct hashtable_t *fib_lazy_hash = NULL;
+static uint32_t fib_lazy_active = 0, fib_lazy_misses = 0;
+
+
+
+static struct fib_table *fib_get_table(uint8_t rt_table)
+{
+	uint8_t i;
+
+	for (i = 0; i < sizeof(fib_tables) / sizeof(fib_tables[0]); i++) {
+		if (fib_tables[i].rt_table == rt_table)
+			return &fib_tables[i];
+	}
+
+	return NULL;
+}
+
+static uint32_t fib_netmask(uint8_t len)
+{
+	return (len == 0 ? 0 : 0xFFFFFFFF << (32 - len));
+}
+
+static void fib_nexthop_hold(struct fib_nexthop *fib_nexthop)
+{
+	if ((fib_nexthop != NULL) && (fib_nexthop != &fib_other))
+		fib_nexthop->refcount++;
+}
+
+static void fib_nexthop_put(struct fib_nexthop *fib_nexthop)
+{
+	struct list_head *list_pos, *prev_list_head;
+
+	if ((fib_nexthop == NULL) || (fib_nexthop == &fib_other))
+		return;
+
+	if (--fib_nexthop->refcount > 0)
+		return;
+
+	prev_list_head = (struct list_head *)&fib_nexthop_list;
+
+	list_for_each(list_pos, &fib_nexthop_list) {
+		if (list_pos == &fib_nexthop->list) {
+			list_del(prev_list_head, list_pos, &fib_nexthop_list);
+			break;
+		}
+
+		prev_list_head = list_pos;
+	}
+
+	debugFree(fib_nexthop, 1802);
+}
+
+/* returns the next hop with an additional reference */
+static struct fib_nexthop *fib_nexthop_get(uint32_t router, uint32_t src_ip, int32_t ifi, char *dev)
+{
+	struct fib_nexthop *fib_nexthop;
+
+	list_for_each_entry(fib_nexthop, &fib_nexthop_list, list) {
+		if ((fib_nexthop->router == router) && (fib_nexthop->ifi == ifi)) {
+			fib_nexthop->refcount++;
+			return fib_nexthop;
+		}
+	}
+
+	fib_nexthop = debugMalloc(sizeof(struct fib_nexthop), 802);
+	memset(fib_nexthop, 0, sizeof(struct fib_nexthop));
+	INIT_LIST_HEAD(&fib_nexthop->list);
+
+	fib_nexthop->router = router;
+	fib_nexthop->src_ip = src_ip;
+	fib_nexthop->ifi = ifi;
+	fib_nexthop->dev = dev;
+	fib_nexthop->refcount = 1;
+
+	list_add_tail(&fib_nexthop->list, &fib_nexthop_list);
+
+	return fib_nexthop;
+}
+
+static struct fib_node *fib_node_new(struct fib_node *parent, uint32_t prefix, uint8_t len)
+{
+	struct fib_node *fib_node;
+
+	fib_node = debugMalloc(sizeof(struct fib_node), 801);
+	memset(fib_node, 0, sizeof(struct fib_node));
+
+	fib_node->parent = parent;
+	fib_node->prefix = prefix & fib_netmask(len);
+	fib_node->len = len;
+	fib_node->dirty = 1;
+
+	return fib_node;
+}
+
+static void fib_node_free(struct fib_node *fib_node)
+{
+	uint8_t i;
+
+	for (i = 0; i < fib_node->cand_num; i++)
+		fib_nexthop_put(fib_node->cand[i]);
+
+	fib_nexthop_put(fib_node->last_in);
+	debugFree(fib_node, 1801);
+}
+
+static struct fib_node *fib_node_find(struct fib_table *fib_table, uint32_t prefix, uint8_t len, uint8_t create)
+{
+	struct fib_node *fib_node, *child;
+	uint8_t bit;
+
+	if (fib_table->root == NULL) {
+		if (!create)
+			return NULL;
+
+		fib_table->root = fib_node_new(NULL, 0, 0);
+	}
+
+	fib_node = fib_table->root;
+
+	while (fib_node->len < len) {
+		bit = (prefix >> (31 - fib_node->len)) & 1;
+
+		if (fib_node->child[bit] == NULL) {
+			if (!create)
+				return NULL;
+
+			child = fib_node_new(fib_node, prefix, fib_node->len + 1);
+
+			/* the entry filling this half covers the very same prefix */
+			if (fib_node->installed[bit + 1]) {
+				child->installed[0] = 1;
+				child->inst[0] = fib_node->inst[bit + 1];
+				fib_node->installed[bit + 1] = 0;
+				fib_node->inst[bit + 1] = NULL;
+			}
+
+			fib_node->child[bit] = child;
+		}
+
+		fib_node = fib_node->child[bit];
+	}
+
+	return fib_node;
+}
+
+/* next hop the routes want for the addresses of this node which are not covered by longer routes */
+static struct fib_nexthop *fib_node_want(struct fib_node *fib_node)
+{
+	while (fib_node != NULL) {
+		if (fib_node->route != NULL)
+			return fib_node->route;
+
+		fib_node = fib_node->parent;
+	}
+
+	return NULL;
+}
+
+static uint32_t fib_cost_add(uint32_t cost1, uint32_t cost2)
+{
+	return (cost1 + cost2 > FIB_INFINITY ? FIB_INFINITY : cost1 + cost2);
+}
+
+static uint32_t fib_entry_cost(struct fib_nexthop *fib_nexthop)
+{
+	return (fib_nexthop == NULL ? FIB_THROW_COST : 1);
+}
+
+static int fib_entry_allowed(struct fib_node *fib_node, struct fib_nexthop *want, struct fib_nexthop *fib_nexthop)
+{
+	/* restating the route or throwing is always fine */
+	if (fib_nexthop == want)
+		return 1;
+
+	if (fib_nexthop == NULL)
+		return (FIB_THROW_COST < FIB_INFINITY);
+
+	if (fib_node->len < FIB_MIN_AGGREGATE_LEN)
+		return 0;
+
+	/* add_del_route() would take this for a single hop route */
+	if ((fib_node->len < 32) && (htonl(fib_node->prefix) == fib_nexthop->router))
+		return 0;
+
+	return 1;
+}
+
+static uint32_t fib_node_cost(struct fib_node *fib_node, struct fib_nexthop *in)
+{
+	uint8_t i;
+
+	for (i = 0; i < fib_node->cand_num; i++) {
+		if (fib_node->cand[i] == in)
+			return fib_node->cost[i];
+	}
+
+	return fib_node->cost_other;
+}
+
+static uint32_t fib_half_cost(struct fib_node *fib_node, uint8_t bit, struct fib_nexthop *want, struct fib_nexthop *in)
+{
+	if (fib_node->child[bit] != NULL)
+		return fib_node_cost(fib_node->child[bit], in);
+
+	if (in == want)
+		return 0;
+
+	return fib_entry_cost(want);
+}
+
+/* cheapest way to serve this subtree if in is inherited - prefers the current state on equal costs */
+static uint32_t fib_node_eval(struct fib_node *fib_node, struct fib_nexthop *want, struct fib_nexthop *in,
+			      uint8_t *install, struct fib_nexthop **fib_nexthop)
+{
+	uint32_t best_cost, cost;
+	uint8_t i, best_install = 0;
+	struct fib_nexthop *best_nexthop = NULL, *cand;
+
+	best_cost = fib_cost_add(fib_half_cost(fib_node, 0, want, in), fib_half_cost(fib_node, 1, want, in));
+
+	for (i = 0; i < fib_node->cand_num; i++) {
+		cand = fib_node->cand[i];
+
+		if (!fib_entry_allowed(fib_node, want, cand))
+			continue;
+
+		cost = fib_cost_add(fib_entry_cost(cand),
+				    fib_cost_add(fib_half_cost(fib_node, 0, want, cand), fib_half_cost(fib_node, 1, want, cand)));
+
+		if ((cost < best_cost) ||
+		    ((cost == best_cost) && (fib_node->installed[0]) && (fib_node->inst[0] == cand))) {
+			best_cost = cost;
+			best_install = 1;
+			best_nexthop = cand;
+		}
+	}
+
+	if (install != NULL) {
+		*install = best_install;
+		*fib_nexthop = best_nexthop;
+	}
+
+	return best_cost;
+}
+
+/* recalculates the candidate next hops of a node and their costs */
+static void fib_node_update(struct fib_node *fib_node)
+{
+	struct fib_nexthop *want, *cand[2 * FIB_CANDIDATES + 2], *tmp_cand;
+	struct fib_node *child;
+	int32_t benefit[2 * FIB_CANDIDATES + 2], tmp_benefit;
+	uint8_t cand_num = 0, bit, i, j;
+
+	want = fib_node_want(fib_node);
+
+	cand[cand_num] = want;
+	benefit[cand_num++] = FIB_INFINITY;
+
+	if (want != NULL) {
+		cand[cand_num] = NULL;
+		benefit[cand_num++] = FIB_INFINITY;
+	}
+
+	/* next hops which save entries in the subtrees */
+	for (bit = 0; bit < 2; bit++) {
+		child = fib_node->child[bit];
+
+		if (child == NULL)
+			continue;
+
+		for (i = 0; i < child->cand_num; i++) {
+			for (j = 0; j < cand_num; j++) {
+				if (cand[j] == child->cand[i])
+					break;
+			}
+
+			if (j == cand_num) {
+				cand[cand_num] = child->cand[i];
+				benefit[cand_num++] = 0;
+			}
+
+			if (benefit[j] < FIB_INFINITY)
+				benefit[j] += child->cost_other - child->cost[i];
+		}
+	}
+
+	for (i = 1; i < cand_num; i++) {
+		for (j = i; (j > 0) && (benefit[j] > benefit[j - 1]); j--) {
+			tmp_cand = cand[j];
+			cand[j] = cand[j - 1];
+			cand[j - 1] = tmp_cand;
+
+			tmp_benefit = benefit[j];
+			benefit[j] = benefit[j - 1];
+			benefit[j - 1] = tmp_benefit;
+		}
+	}
+
+	if (cand_num > FIB_CANDIDATES)
+		cand_num = FIB_CANDIDATES;
+
+	for (i = 0; i < cand_num; i++)
+		fib_nexthop_hold(cand[i]);
+
+	for (i = 0; i < fib_node->cand_num; i++)
+		fib_nexthop_put(fib_node->cand[i]);
+
+	memcpy(fib_node->cand, cand, cand_num * sizeof(struct fib_nexthop *));
+	fib_node->cand_num = cand_num;
+
+	for (i = 0; i < cand_num; i++)
+		fib_node->cost[i] = fib_node_eval(fib_node, want, cand[i], NULL, NULL);
+
+	fib_node->cost_other = fib_node_eval(fib_node, want, &fib_other, NULL, NULL);
+	fib_node->dirty = 1;
+}
+
+static void fib_subtree_update(struct fib_node *fib_node)
+{
+	if (fib_node->child[0] != NULL)
+		fib_subtree_update(fib_node->child[0]);
+
+	if (fib_node->child[1] != NULL)
+		fib_subtree_update(fib_node->child[1]);
+
+	fib_node_update(fib_node);
+}
+
+static void fib_kernel_route(struct fib_table *fib_table, uint32_t prefix, uint8_t len, struct fib_nexthop *fib_nexthop, int8_t route_action)
+{
+	if (fib_nexthop == NULL)
+		add_del_route(htonl(prefix), len, 0, 0, 0, "unknown", fib_table->rt_table, ROUTE_TYPE_THROW, route_action);
+	else
+		add_del_route(htonl(prefix), len, fib_nexthop->router, (route_action == ROUTE_ADD ? fib_nexthop->src_ip : 0),
+			      fib_nexthop->ifi, fib_nexthop->dev, fib_table->rt_table, ROUTE_TYPE_UNICAST, route_action);
+}
+
+/* takes over the reference of fib_nexthop */
+static void fib_defer_del(struct fib_table *fib_table, uint32_t prefix, uint8_t len, struct fib_nexthop *fib_nexthop)
+{
+	if (fib_del_num == fib_del_size) {
+		fib_del_size = (fib_del_size == 0 ? 16 : fib_del_size * 2);
+		fib_del_list = debugRealloc(fib_del_list, fib_del_size * sizeof(struct fib_del_entry), 803);
+	}
+
+	fib_del_list[fib_del_num].fib_table = fib_table;
+	fib_del_list[fib_del_num].prefix = prefix;
+	fib_del_list[fib_del_num].len = len;
+	fib_del_list[fib_del_num].nexthop = fib_nexthop;
+	fib_del_num++;
+}
+
+static void fib_flush_del(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < fib_del_num; i++) {
+		fib_kernel_route(fib_del_list[i].fib_table, fib_del_list[i].prefix, fib_del_list[i].len, fib_del_list[i].nexthop, ROUTE_DEL);
+		fib_nexthop_put(fib_del_list[i].nexthop);
+	}
+
+	fib_del_num = 0;
+}
+
+/* slot 0 is the entry of the node itself, slot 1 and 2 fill the missing child 0 / 1 */
+static void fib_entry_set(struct fib_table *fib_table, struct fib_node *fib_node, uint8_t slot, uint8_t install, struct fib_nexthop *fib_nexthop)
+{
+	uint32_t prefix = fib_node->prefix;
+	uint8_t len = fib_node->len;
+
+	if ((fib_node->installed[slot] == install) && ((!install) || (fib_node->inst[slot] == fib_nexthop)))
+		return;
+
+	if (slot > 0) {
+		prefix |= (uint32_t)(slot - 1) << (31 - len);
+		len++;
+	}
+
+	if (!install) {
+		fib_defer_del(fib_table, prefix, len, fib_node->inst[slot]);
+		fib_node->installed[slot] = 0;
+		fib_node->inst[slot] = NULL;
+		fib_table->entries--;
+		return;
+	}
+
+	fib_nexthop_hold(fib_nexthop);
+
+	if (fib_node->installed[slot]) {
+#ifdef NO_POLICY_ROUTING
+		/* deleting the old route could delete the new one as well */
+		fib_kernel_route(fib_table, prefix, len, fib_node->inst[slot], ROUTE_DEL);
+		fib_nexthop_put(fib_node->inst[slot]);
+		fib_kernel_route(fib_table, prefix, len, fib_nexthop, ROUTE_ADD);
+#else
+		fib_kernel_route(fib_table, prefix, len, fib_nexthop, ROUTE_ADD);
+		fib_defer_del(fib_table, prefix, len, fib_node->inst[slot]);
+#endif
+	} else {
+		fib_kernel_route(fib_table, prefix, len, fib_nexthop, ROUTE_ADD);
+		fib_table->entries++;
+	}
+
+	fib_node->installed[slot] = 1;
+	fib_node->inst[slot] = fib_nexthop;
+}
+
+/* frees a child without route and children - its entry becomes the entry filling the missing child */
+static void fib_node_prune(struct fib_node *fib_node, uint8_t bit)
+{
+	struct fib_node *child = fib_node->child[bit];
+
+	if ((child->route != NULL) || (child->child[0] != NULL) || (child->child[1] != NULL) ||
+	    (child->installed[1]) || (child->installed[2]))
+		return;
+
+	fib_node->installed[bit + 1] = child->installed[0];
+	fib_node->inst[bit + 1] = child->inst[0];
+	fib_node->child[bit] = NULL;
+
+	fib_node_free(child);
+}
+
+static void fib_reconcile(struct fib_table *fib_table, struct fib_node *fib_node, struct fib_nexthop *in)
+{
+	struct fib_nexthop *want, *out, *fib_nexthop;
+	uint8_t install, bit;
+
+	if ((!fib_node->dirty) && (fib_node->reconciled) && (fib_node->last_in == in))
+		return;
+
+	want = fib_node_want(fib_node);
+
+	fib_node_eval(fib_node, want, in, &install, &fib_nexthop);
+	fib_entry_set(fib_table, fib_node, 0, install, fib_nexthop);
+
+	out = (install ? fib_nexthop : in);
+
+	for (bit = 0; bit < 2; bit++) {
+		if (fib_node->child[bit] != NULL) {
+			fib_reconcile(fib_table, fib_node->child[bit], out);
+			fib_node_prune(fib_node, bit);
+		} else {
+			fib_entry_set(fib_table, fib_node, bit + 1, (out != want), want);
+		}
+	}
+
+	fib_nexthop_hold(in);
+	fib_nexthop_put(fib_node->last_in);
+	fib_node->last_in = in;
+
+	fib_node->dirty = 0;
+	fib_node->reconciled = 1;
+}
+
+static void fib_route_changed(struct fib_table *fib_table, struct fib_node *fib_node)
+{
+	/* the wanted next hop of the whole subtree may have changed */
+	fib_subtree_update(fib_node);
+
+	for (fib_node = fib_node->parent; fib_node != NULL; fib_node = fib_node->parent)
+		fib_node_update(fib_node);
+
+	fib_reconcile(fib_table, fib_table->root, NULL);
+	fib_flush_del();
+}
+
+static void fib_install_route(uint32_t dest, uint8_t netmask, uint32_t router, uint32_t src_ip, int32_t ifi, char *dev, uint8_t rt_table, int8_t route_action)
+{
+	struct fib_table *fib_table;
+	struct fib_node *fib_node;
+	struct fib_nexthop *fib_nexthop;
+
+	fib_table = fib_get_table(rt_table);
+
+	if ((!fib_compression) || (fib_table == NULL) || (netmask > 32)) {
+		add_del_route(dest, netmask, router, src_ip, ifi, dev, rt_table, ROUTE_TYPE_UNICAST, route_action);
+		return;
+	}
+
+	dest = ntohl(dest) & fib_netmask(netmask);
+
+	if (route_action == ROUTE_DEL) {
+		fib_node = fib_node_find(fib_table, dest, netmask, 0);
+
+		/* ignore deletions of routes which have been replaced already */
+		if ((fib_node == NULL) || (fib_node->route == NULL) ||
+		    (fib_node->route->router != router) || (fib_node->route->ifi != ifi))
+			return;
+
+		fib_nexthop_put(fib_node->route);
+		fib_node->route = NULL;
+		fib_table->routes--;
+
+	} else {
+		fib_node = fib_node_find(fib_table, dest, netmask, 1);
+		fib_nexthop = fib_nexthop_get(router, src_ip, ifi, dev);
+
+		if (fib_node->route == fib_nexthop) {
+			fib_nexthop_put(fib_nexthop);
+			return;
+		}
+
+		if (fib_node->route != NULL)
+			fib_nexthop_put(fib_node->route);
+		else
+			fib_table->routes++;
+
+		fib_node->route = fib_nexthop;
+	}
+
+	fib_route_changed(fib_table, fib_node);
+}
+
+static void fib_lazy_install(struct fib_lazy *fib_lazy, int8_t route_action)
+{
+	fib_install_route(fib_lazy->dest, 32, fib_lazy->router, fib_lazy->src_ip, fib_lazy->ifi, fib_lazy->dev, BATMAN_RT_TABLE_HOSTS, route_action);
+}
+
+/* remembers the route towards an originator but only installs it while the originator is in use */
+static void fib_lazy_update(uint32_t dest, uint32_t router, uint32_t src_ip, int32_t ifi, char *dev, int8_t route_action)
+{
+	struct fib_lazy *fib_lazy;
+	struct hashtable_t *swaphash;
+
+	if (fib_lazy_hash == NULL) {
+		if (route_action == ROUTE_DEL)
+			return;
+
+		if (NULL == (fib_lazy_hash = hash_new(128, compare_orig, choose_orig)))
+			restore_and_exit(0);
+	}
+
+	fib_lazy = hash_find(fib_lazy_hash, &dest);
+
+	if (route_action == ROUTE_DEL) {
+
+		/* ignore deletions of routes which have been replaced already */
+		if ((fib_lazy == NULL) || (fib_lazy->router != router) || (fib_lazy->ifi != ifi))
+			return;
+
+		if (fib_lazy->active) {
+			fib_lazy_install(fib_lazy, ROUTE_DEL);
+			fib_lazy_active--;
+		}
+
+		hash_remove(fib_lazy_hash, fib_lazy);
+		debugFree(fib_lazy, 1804);
+		return;
+	}
+
+	if (fib_lazy == NULL) {
+		fib_lazy = debugMalloc(sizeof(struct fib_lazy), 804);
+		memset(fib_lazy, 0, sizeof(struct fib_lazy));
+
+		fib_lazy->dest = dest;
+		hash_add(fib_lazy_hash, fib_lazy);
+
+		if (fib_lazy_hash->elements * 4 > fib_lazy_hash->size) {
+
+			swaphash = hash_resize(fib_lazy_hash, fib_lazy_hash->size * 2);
+
+			if (swaphash == NULL) {
+				debug_output(0, "Couldn't resize lazy route hash table \n");
+				restore_and_exit(0);
+			}
+
+			fib_lazy_hash = swaphash;
+		}
+
+	} else if (fib_lazy->active) {
+
+		if ((fib_lazy->router != router) || (fib_lazy->ifi != ifi)) {
+			fib_install_route(dest, 32, router, src_ip, ifi, dev, BATMAN_RT_TABLE_HOSTS, ROUTE_ADD);
+			fib_lazy_install(fib_lazy, ROUTE_DEL);
+		}
+
+	}
+
+	fib_lazy->router = router;
+	fib_lazy->src_ip = src_ip;
+	fib_lazy->ifi = ifi;
+	fib_lazy->dev = dev;
+}
+
+void fib_add_del_route(uint32_t dest, uint8_t netmask, uint32_t router, uint32_t src_ip, int32_t ifi, char *dev, uint8_t rt_table, int8_t route_action)
+{
+	if ((lazy_route_timeout > 0) && (rt_table == BATMAN_RT_TABLE_HOSTS) && (netmask == 32))
+		fib_lazy_update(dest, router, src_ip, ifi, dev, route_action);
+	else
+		fib_install_route(dest, netmask, router, src_ip, ifi, dev, rt_table, route_action);
+}
+
+/* a packet towards dest hit the catch-all route - returns 1 if a route has been installed */
+int8_t fib_lazy_miss(uint32_t dest, uint32_t curr_time)
+{
+	struct fib_lazy *fib_lazy = NULL;
+	char dest_str[ADDR_STR_LEN];
+
+	fib_lazy_misses++;
+
+	if (fib_lazy_hash != NULL)
+		fib_lazy = hash_find(fib_lazy_hash, &dest);
+
+	if (fib_lazy == NULL) {
+		addr_to_string(dest, dest_str, sizeof(dest_str));
+		debug_output(4, "Lazy routes: no route towards %s - dropping packet\n", dest_str);
+		return 0;
+	}
+
+	fib_lazy->last_used = curr_time;
+
+	if (!fib_lazy->active) {
+		addr_to_string(dest, dest_str, sizeof(dest_str));
+		debug_output(4, "Lazy routes: installing route towards %s\n", dest_str);
+
+		fib_lazy_install(fib_lazy, ROUTE_ADD);
+		fib_lazy->active = 1;
+		fib_lazy_active++;
+	}
+
+	return 1;
+}
+
+/* takes back the routes which did not see a miss for lazy_route_timeout ms - the kernel does not
+ * tell us whether a route is still in use so busy destinations simply miss once more */
+void fib_lazy_purge(uint32_t curr_time)
+{
+	struct hash_it_t *hashit = NULL;
+	struct fib_lazy *fib_lazy;
+
+	if (fib_lazy_hash == NULL)
+		return;
+
+	while (NULL != (hashit = hash_iterate(fib_lazy_hash, hashit))) {
+
+		fib_lazy = hashit->bucket->data;
+
+		if ((!fib_lazy->active) || ((int)(curr_time - (fib_lazy->last_used + lazy_route_timeout)) <= 0))
+			continue;
+
+		fib_lazy_install(fib_lazy, ROUTE_DEL);
+		fib_lazy->active = 0;
+		fib_lazy_active--;
+	}
+}
+
+void fib_get_lazy_stats(uint32_t *routes, uint32_t *active, uint32_t *misses)
+{
+	*routes = (fib_lazy_hash != NULL ? fib_lazy_hash->elements : 0);
+	*active = fib_lazy_active;
+	*misses = fib_lazy_misses;
+}
+
+void fib_get_stats(uint8_t rt_table, uint32_t *routes, uint32_t *entries)
+{
+	struct fib_table *fib_table = fib_get_table(rt_table);
+
+	*routes = (fib_table != NULL ? fib_table->routes : 0);
+	*entries = (fib_table != NULL ? fib_table->entries : 0);
+}
+
+static void fib_subtree_free(struct fib_table *fib_table, struct fib_node *fib_node)
+{
+	uint8_t slot;
+
+	if (fib_node->child[0] != NULL)
+		fib_subtree_free(fib_table, fib_node->child[0]);
+
+	if (fib_node->child[1] != NULL)
+		fib_subtree_free(fib_table, fib_node->child[1]);
+
+	for (slot = 0; slot < 3; slot++)
+		fib_entry_set(fib_table, fib_node, slot, 0, NULL);
+
+	fib_nexthop_put(fib_node->route);
+	fib_node_free(fib_node);
+}
+
+static void fib_lazy_free(void *data)
+{
+	struct fib_lazy *fib_lazy = data;
+
+	if (fib_lazy->active)
+		fib_lazy_install(fib_lazy, ROUTE_DEL);
+
+	debugFree(fib_lazy, 1804);
+}
+
+void fib_free(void)
+{
+	uint8_t i;
+
+	if (fib_lazy_hash != NULL)
+		hash_delete(fib_lazy_hash, fib_lazy_free);
+
+	fib_lazy_hash = NULL;
+	fib_lazy_active = 0;
+
+	for (i = 0; i < sizeof(fib_tables) / sizeof(fib_tables[0]); i++) {
+		if (fib_tables[i].root == NULL)
+			continue;
+
+		fib_subtree_free(&fib_tables[i], fib_tables[i].root);
+
+		fib_tables[i].root = NULL;
+		fib_tables[i].routes = 0;
+	}
+
+	fib_flush_del();
+
+	if (fib_del_list != NULL)
+		debugFree(fib_del_list, 1803);
+
+	fib_del_list = NULL;
+	fib_del_size = 0;
+}
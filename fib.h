@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_FIB_H
+#define _BATMAN_FIB_H
+
+#include "batman.h"
+
+
+/* number of next hops a trie node remembers the costs for */
+#define FIB_CANDIDATES 4
+
+/* never aggregate routes into prefixes shorter than this */
+#define FIB_MIN_AGGREGATE_LEN 16
+
+
+void fib_add_del_route(uint32_t dest, uint8_t netmask, uint32_t router, uint32_t src_ip, int32_t ifi, char *dev, uint8_t rt_table, int8_t route_action);
+int8_t fib_lazy_miss(uint32_t dest, uint32_t curr_time);
+void fib_lazy_purge(uint32_t curr_time);
+void fib_get_lazy_stats(uint32_t *routes, uint32_t *active, uint32_t *misses);
+void fib_get_stats(uint8_t rt_table, uint32_t *routes, uint32_t *entries);
+void fib_free(void);
+
+#endif
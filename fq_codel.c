@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "fq_codel.h"
+
+
+
+static void fq_lock(struct fq_codel *fq)
+{
+	if (pthread_mutex_lock(&fq->mutex) != 0)
+		debug_output(0, "Error - could not lock fair queue mutex: %s \n", strerror(errno));
+}
+
+static void fq_unlock(struct fq_codel *fq)
+{
+	if (pthread_mutex_unlock(&fq->mutex) != 0)
+		debug_output(0, "Error - could not unlock fair queue mutex: %s \n", strerror(errno));
+}
+
+static uint32_t fq_isqrt(uint32_t x)
+{
+	uint32_t res = 0, bit = 1 << 30;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit != 0) {
+
+		if (x >= res + bit) {
+			x -= res + bit;
+			res = (res >> 1) + bit;
+		} else {
+			res >>= 1;
+		}
+
+		bit >>= 2;
+
+	}
+
+	return res;
+}
+
+/* next drop: interval / sqrt(count) later */
+static uint32_t fq_control_law(uint32_t time, uint32_t count)
+{
+	if (count > 0xffff)
+		count = 0xffff;
+
+	return time + (FQ_CODEL_INTERVAL * 256) / fq_isqrt(count << 16);
+}
+
+static struct fq_flow *fq_flow_get(struct fq_codel *fq, uint32_t key)
+{
+	struct fq_flow *flow, *idle = NULL;
+	uint32_t first = ntohl(key), i;
+
+	for (i = 0; i < FQ_CODEL_PROBE; i++) {
+
+		flow = &fq->flows[(first + i) % FQ_CODEL_FLOWS];
+
+		if (flow->key == key)
+			return flow;
+
+		if ((idle == NULL) && (!flow->active))
+			idle = flow;
+
+	}
+
+	return (idle != NULL ? idle : &fq->flows[first % FQ_CODEL_FLOWS]);
+}
+
+static struct fq_packet *fq_flow_pop(struct fq_codel *fq, struct fq_flow *flow)
+{
+	struct fq_packet *packet;
+
+	if (list_empty(&flow->packets))
+		return NULL;
+
+	packet = list_entry(flow->packets.next, struct fq_packet, list);
+	list_del((struct list_head *)&flow->packets, &packet->list, &flow->packets);
+
+	flow->backlog -= packet->len;
+	fq->num--;
+
+	return packet;
+}
+
+static void fq_drop(struct fq_codel *fq, struct fq_flow *flow, struct fq_packet *packet)
+{
+	flow->stat_drops++;
+	list_add(&packet->list, &fq->free_packets);
+}
+
+static void fq_list_pop(struct fq_flow *flow, struct list_head_first *head)
+{
+	list_del((struct list_head *)head, &flow->list, head);
+}
+
+/* the packet's delay decides - but a queue holding at most one packet is never shortened */
+static uint8_t fq_ok_to_drop(struct fq_flow *flow, struct fq_packet *packet, uint32_t now)
+{
+	if (((int)(now - packet->time) < FQ_CODEL_TARGET) || (flow->backlog <= FQ_CODEL_QUANTUM)) {
+		flow->first_above_time = 0;
+		return 0;
+	}
+
+	if (flow->first_above_time == 0) {
+		flow->first_above_time = now + FQ_CODEL_INTERVAL;
+		return 0;
+	}
+
+	return ((int)(now - flow->first_above_time) >= 0);
+}
+
+static struct fq_packet *fq_codel_flow_dequeue(struct fq_codel *fq, struct fq_flow *flow, uint32_t now)
+{
+	struct fq_packet *packet;
+	uint32_t delta;
+	uint8_t ok_to_drop;
+
+	if ((packet = fq_flow_pop(fq, flow)) == NULL) {
+		flow->dropping = 0;
+		return NULL;
+	}
+
+	ok_to_drop = fq_ok_to_drop(flow, packet, now);
+
+	if (flow->dropping) {
+
+		if (!ok_to_drop)
+			flow->dropping = 0;
+
+		while ((flow->dropping) && ((int)(now - flow->drop_next) >= 0)) {
+
+			fq_drop(fq, flow, packet);
+			flow->drop_count++;
+
+			if ((packet = fq_flow_pop(fq, flow)) == NULL) {
+				flow->dropping = 0;
+				return NULL;
+			}
+
+			if (!fq_ok_to_drop(flow, packet, now))
+				flow->dropping = 0;
+			else
+				flow->drop_next = fq_control_law(flow->drop_next, flow->drop_count);
+
+		}
+
+	} else if (ok_to_drop) {
+
+		fq_drop(fq, flow, packet);
+		packet = fq_flow_pop(fq, flow);
+
+		/* a queue that needed dropping just before starts with the drop rate it had */
+		delta = flow->drop_count - flow->drop_count_last;
+		flow->drop_count = (((delta > 1) && ((int)(now - flow->drop_next) < 16 * FQ_CODEL_INTERVAL)) ? delta : 1);
+		flow->drop_count_last = flow->drop_count;
+		flow->drop_next = fq_control_law(now, flow->drop_count);
+		flow->dropping = 1;
+
+		if (packet == NULL)
+			return NULL;
+
+	}
+
+	flow->stat_packets++;
+	flow->stat_delay_sum += now - packet->time;
+
+	if (now - packet->time > flow->stat_delay_max)
+		flow->stat_delay_max = now - packet->time;
+
+	return packet;
+}
+
+struct fq_codel *fq_codel_new(int32_t limit, int32_t packet_size)
+{
+	struct fq_codel *fq;
+	int32_t i;
+
+	fq = debugMalloc(sizeof(struct fq_codel), 991);
+	memset(fq, 0, sizeof(struct fq_codel));
+
+	pthread_mutex_init(&fq->mutex, NULL);
+
+	INIT_LIST_HEAD_FIRST(fq->new_flows);
+	INIT_LIST_HEAD_FIRST(fq->old_flows);
+	INIT_LIST_HEAD_FIRST(fq->free_packets);
+
+	for (i = 0; i < FQ_CODEL_FLOWS; i++) {
+		INIT_LIST_HEAD(&fq->flows[i].list);
+		INIT_LIST_HEAD_FIRST(fq->flows[i].packets);
+	}
+
+	fq->limit = limit;
+	fq->packet_size = packet_size;
+	fq->packets = debugMalloc(limit * sizeof(struct fq_packet), 992);
+	fq->buff = debugMalloc(limit * packet_size, 993);
+
+	for (i = 0; i < limit; i++) {
+		fq->packets[i].data = fq->buff + i * packet_size;
+		list_add_tail(&fq->packets[i].list, &fq->free_packets);
+	}
+
+	return fq;
+}
+
+void fq_codel_free(struct fq_codel *fq)
+{
+	pthread_mutex_destroy(&fq->mutex);
+
+	debugFree(fq->buff, 1993);
+	debugFree(fq->packets, 1992);
+	debugFree(fq, 1991);
+}
+
+/* a packet buffer to fill - if all are queued the head of the longest queue makes room */
+struct fq_packet *fq_codel_packet(struct fq_codel *fq)
+{
+	struct fq_packet *packet;
+	struct fq_flow *flow = NULL;
+	struct list_head *list_pos;
+
+	fq_lock(fq);
+
+	if (list_empty(&fq->free_packets)) {
+
+		/* only the active queues hold packets */
+		list_for_each(list_pos, &fq->new_flows) {
+			if ((flow == NULL) || (list_entry(list_pos, struct fq_flow, list)->backlog > flow->backlog))
+				flow = list_entry(list_pos, struct fq_flow, list);
+		}
+
+		list_for_each(list_pos, &fq->old_flows) {
+			if ((flow == NULL) || (list_entry(list_pos, struct fq_flow, list)->backlog > flow->backlog))
+				flow = list_entry(list_pos, struct fq_flow, list);
+		}
+
+		packet = fq_flow_pop(fq, flow);
+		fq_drop(fq, flow, packet);
+		fq->overlimit_drops++;
+
+	}
+
+	packet = list_entry(fq->free_packets.next, struct fq_packet, list);
+	list_del((struct list_head *)&fq->free_packets, &packet->list, &fq->free_packets);
+
+	fq_unlock(fq);
+	return packet;
+}
+
+/* gives back a packet returned by fq_codel_packet() or fq_codel_dequeue() */
+void fq_codel_release(struct fq_codel *fq, struct fq_packet *packet)
+{
+	fq_lock(fq);
+	list_add(&packet->list, &fq->free_packets);
+	fq_unlock(fq);
+}
+
+/* the packet (len set) goes to the queue of key */
+void fq_codel_enqueue(struct fq_codel *fq, struct fq_packet *packet, uint32_t key, uint32_t now)
+{
+	struct fq_flow *flow;
+
+	fq_lock(fq);
+
+	flow = fq_flow_get(fq, key);
+
+	/* an idle queue taken over by another client starts over */
+	if ((flow->key != key) && (!flow->active)) {
+		memset(&flow->first_above_time, 0, sizeof(struct fq_flow) - offsetof(struct fq_flow, first_above_time));
+		flow->key = key;
+	}
+
+	packet->time = now;
+	list_add_tail(&packet->list, &flow->packets);
+
+	flow->backlog += packet->len;
+	fq->num++;
+
+	if (!flow->active) {
+		flow->deficit = FQ_CODEL_QUANTUM;
+		flow->active = 1;
+		list_add_tail(&flow->list, &fq->new_flows);
+	}
+
+	fq_unlock(fq);
+}
+
+/* the next packet to send - NULL if all queues are empty */
+struct fq_packet *fq_codel_dequeue(struct fq_codel *fq, uint32_t now)
+{
+	struct list_head_first *head;
+	struct fq_packet *packet = NULL;
+	struct fq_flow *flow;
+
+	fq_lock(fq);
+
+	while (packet == NULL) {
+
+		if (!list_empty(&fq->new_flows))
+			head = &fq->new_flows;
+		else if (!list_empty(&fq->old_flows))
+			head = &fq->old_flows;
+		else
+			break;
+
+		flow = list_entry(head->next, struct fq_flow, list);
+
+		if (flow->deficit <= 0) {
+			flow->deficit += FQ_CODEL_QUANTUM;
+			fq_list_pop(flow, head);
+			list_add_tail(&flow->list, &fq->old_flows);
+			continue;
+		}
+
+		if ((packet = fq_codel_flow_dequeue(fq, flow, now)) != NULL) {
+			flow->deficit -= packet->len;
+			break;
+		}
+
+		/* an emptied new flow goes through the old flows once - it can't skip the others by coming back */
+		fq_list_pop(flow, head);
+
+		if ((head == &fq->new_flows) && (!list_empty(&fq->old_flows)))
+			list_add_tail(&flow->list, &fq->old_flows);
+		else
+			flow->active = 0;
+
+	}
+
+	fq_unlock(fq);
+	return packet;
+}
+
+int32_t fq_codel_backlog(struct fq_codel *fq)
+{
+	int32_t num;
+
+	fq_lock(fq);
+	num = fq->num;
+	fq_unlock(fq);
+
+	return num;
+}
+
+/* copies the statistics of up to max queues that were used */
+int32_t fq_codel_get_stats(struct fq_codel *fq, struct fq_stats *stats, int32_t max)
+{
+	struct fq_flow *flow;
+	int32_t i, num = 0;
+
+	fq_lock(fq);
+
+	for (i = 0; (i < FQ_CODEL_FLOWS) && (num < max); i++) {
+
+		flow = &fq->flows[i];
+
+		if (flow->stat_packets + flow->stat_drops == 0)
+			continue;
+
+		stats[num].key = flow->key;
+		stats[num].packets = flow->stat_packets;
+		stats[num].drops = flow->stat_drops;
+		stats[num].delay_avg = (flow->stat_packets > 0 ? flow->stat_delay_sum / flow->stat_packets : 0);
+		stats[num].delay_max = flow->stat_delay_max;
+		stats[num].backlog = flow->backlog;
+		num++;
+
+	}
+
+	fq_unlock(fq);
+	return num;
+}
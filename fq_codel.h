@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+#ifndef _BATMAN_FQ_CODEL_H
+#define _BATMAN_FQ_CODEL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "list-batman.h"
+
+
+#define FQ_CODEL_FLOWS 1024
+#define FQ_CODEL_PROBE 8                      /* queues looked at for the one of a client */
+#define FQ_CODEL_QUANTUM 1514                 /* bytes a flow may send per round */
+#define FQ_CODEL_TARGET 5                     /* ms - acceptable standing queue delay */
+#define FQ_CODEL_INTERVAL 100                 /* ms - how long the delay may stay above target */
+
+
+struct fq_packet {
+	struct list_head list;
+	uint32_t time;                        /* enqueued at */
+	int32_t len;
+	unsigned char *data;                  /* packet_size bytes */
+};
+
+struct fq_flow {
+	struct list_head list;                /* in the new or old flows list while active */
+	struct list_head_first packets;
+	uint32_t key;                         /* client of the queue */
+	int32_t deficit;
+	uint32_t backlog;                     /* bytes */
+	uint32_t first_above_time;
+	uint32_t drop_next;
+	uint32_t drop_count;
+	uint32_t drop_count_last;
+	uint8_t dropping;
+	uint8_t active;
+	uint32_t stat_packets;
+	uint32_t stat_drops;
+	uint32_t stat_delay_sum;              /* ms */
+	uint32_t stat_delay_max;
+};
+
+struct fq_stats {
+	uint32_t key;
+	uint32_t packets;
+	uint32_t drops;
+	uint32_t delay_avg;                   /* ms */
+	uint32_t delay_max;
+	uint32_t backlog;
+};
+
+/**
+ * fair queue with CoDel per flow (like the fq_codel qdisc)
+ *
+ * Every key (client address) gets a queue of its own: the low bits of the
+ * key pick the first queue to look at, a queue busy with another client
+ * is skipped for the next idle one within FQ_CODEL_PROBE. The addresses
+ * the gateway hands out one after the other therefore never share a
+ * queue - only if all FQ_CODEL_PROBE queues are busy a client joins the
+ * first one (and counts in its statistics). The queues take turns
+ * (deficit round robin), flows that just became active go first. On
+ * dequeue CoDel drops packets of a queue whose packets stayed longer than
+ * FQ_CODEL_TARGET for at least FQ_CODEL_INTERVAL - the more often the
+ * shorter the delay stays above target. The packet buffers are allocated
+ * once, if they run out the head of the longest queue is dropped.
+ * The mutex only keeps fq_codel_get_stats() from reading halfway updated
+ * queues - a queue has a single user otherwise.
+ */
+struct fq_codel {
+	pthread_mutex_t mutex;
+	struct fq_flow flows[FQ_CODEL_FLOWS];
+	struct list_head_first new_flows;
+	struct list_head_first old_flows;
+	struct list_head_first free_packets;
+	struct fq_packet *packets;
+	unsigned char *buff;
+	int32_t limit;
+	int32_t num;
+	int32_t packet_size;
+	uint32_t overlimit_drops;
+};
+
+
+struct fq_codel *fq_codel_new(int32_t limit, int32_t packet_size);
+void fq_codel_free(struct fq_codel *fq);
+struct fq_packet *fq_codel_packet(struct fq_codel *fq);
+void fq_codel_release(struct fq_codel *fq, struct fq_packet *packet);
+void fq_codel_enqueue(struct fq_codel *fq, struct fq_packet *packet, uint32_t key, uint32_t now);
+struct fq_packet *fq_codel_dequeue(struct fq_codel *fq, uint32_t now);
+int32_t fq_codel_backlog(struct fq_codel *fq);
+int32_t fq_codel_get_stats(struct fq_codel *fq, struct fq_stats *stats, int32_t max);
+
+#endif
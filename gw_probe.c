@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+/**
+ * active probes of the gateways (see gw_probe.h)
+ *
+ * A round is one small probe followed by a train of large ones, sent back
+ * to back. The reply to the small probe gives the round trip time, the
+ * spacing of the train replies the throughput of the narrowest link on
+ * the way to the gateway and back. Both are smoothed per gateway and
+ * turned into the goodput a tcp connection could expect.
+ *
+ * Nothing in here depends on the daemon - tools/gw_probe uses the same
+ * code to probe a gateway or to stand in for one.
+ */
+
+
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "gw_probe.h"
+
+
+
+static uint64_t gw_probe_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static int32_t gw_probe_send(int32_t sock, struct sockaddr_in *gw_addr, uint16_t round, uint8_t index, int32_t len)
+{
+	unsigned char buff[GW_PROBE_LARGE];
+	uint32_t magic = htonl(GW_PROBE_MAGIC);
+
+	round = htons(round);
+
+	memset(buff, 0, len);
+	buff[0] = GW_PROBE_REQUEST;
+	buff[1] = index;
+	memcpy(buff + 2, &round, sizeof(round));
+	memcpy(buff + 4, &magic, sizeof(magic));
+
+	return sendto(sock, buff, len, 0, (struct sockaddr *)gw_addr, sizeof(struct sockaddr_in));
+}
+
+/* sends a round and waits for its replies - returns -1 if the probes could not be sent */
+int8_t gw_probe_round(int32_t sock, struct sockaddr_in *gw_addr, uint16_t round, struct gw_probe_sample *sample)
+{
+	unsigned char buff[GW_PROBE_LARGE + 1];
+	uint8_t replied[GW_PROBE_TRAIN + 1];
+	struct pollfd pfd;
+	uint64_t start, now, deadline, train_first = 0, train_last = 0, train_bytes = 0, bw;
+	uint32_t magic;
+	uint16_t reply_round;
+	int32_t len, i, train_num = 0;
+
+	memset(sample, 0, sizeof(struct gw_probe_sample));
+	memset(replied, 0, sizeof(replied));
+
+	/* replies of earlier rounds which came too late */
+	while (recv(sock, buff, sizeof(buff), MSG_DONTWAIT) >= 0)
+		;
+
+	start = gw_probe_now();
+
+	for (i = 0; i <= GW_PROBE_TRAIN; i++) {
+
+		if (gw_probe_send(sock, gw_addr, round, i, (i == 0 ? GW_PROBE_SMALL : GW_PROBE_LARGE)) < 0)
+			return -1;
+
+		sample->sent++;
+
+	}
+
+	deadline = start + GW_PROBE_TIMEOUT * 1000;
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+
+	while (sample->received < sample->sent) {
+
+		if ((now = gw_probe_now()) >= deadline)
+			break;
+
+		if ((i = poll(&pfd, 1, (deadline - now + 999) / 1000)) < 0) {
+
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+
+		}
+
+		if (i == 0)
+			break;
+
+		if ((len = recv(sock, buff, sizeof(buff), MSG_DONTWAIT)) < GW_PROBE_HDR_LEN)
+			continue;
+
+		now = gw_probe_now();
+
+		memcpy(&reply_round, buff + 2, sizeof(reply_round));
+		memcpy(&magic, buff + 4, sizeof(magic));
+
+		if ((buff[0] != GW_PROBE_REPLY) || (ntohl(magic) != GW_PROBE_MAGIC) || (ntohs(reply_round) != round))
+			continue;
+
+		if ((buff[1] > GW_PROBE_TRAIN) || (replied[buff[1]]))
+			continue;
+
+		replied[buff[1]] = 1;
+		sample->received++;
+
+		if (buff[1] == 0) {
+			sample->rtt = (now > start ? now - start : 1);
+			continue;
+		}
+
+		/* the first reply of the train only starts the clock */
+		if (train_num == 0)
+			train_first = now;
+		else
+			train_bytes += len;
+
+		train_last = now;
+		train_num++;
+
+	}
+
+	if (train_num > 1) {
+
+		bw = (train_bytes * 8 * 1000) / (train_last > train_first ? train_last - train_first : 1);
+		sample->bw = (bw > UINT32_MAX ? UINT32_MAX : bw);
+
+	}
+
+	return 1;
+}
+
+/* gateway: echoes a probe request - returns the bytes sent, 0 if the datagram is no probe */
+int32_t gw_probe_reply(int32_t sock, unsigned char *buff, int32_t len, struct sockaddr_in *addr)
+{
+	uint32_t magic;
+
+	if ((len < GW_PROBE_HDR_LEN) || (len > GW_PROBE_LARGE) || (buff[0] != GW_PROBE_REQUEST))
+		return 0;
+
+	memcpy(&magic, buff + 4, sizeof(magic));
+
+	if (ntohl(magic) != GW_PROBE_MAGIC)
+		return 0;
+
+	buff[0] = GW_PROBE_REPLY;
+
+	return sendto(sock, buff, len, 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
+}
+
+/* moves the estimates a quarter of the way towards the sample - lost probes leave rtt and throughput alone */
+void gw_probe_update(struct gw_probe_estimate *estimate, struct gw_probe_sample *sample)
+{
+	uint8_t loss = 100;
+
+	if (sample->sent > 0)
+		loss = ((sample->sent - sample->received) * 100) / sample->sent;
+
+	if (sample->rtt > 0)
+		estimate->rtt = (estimate->rtt == 0 ? sample->rtt : (uint32_t)(((uint64_t)estimate->rtt * 3 + sample->rtt) / 4));
+
+	if (sample->bw > 0)
+		estimate->bw = (estimate->bw == 0 ? sample->bw : (uint32_t)(((uint64_t)estimate->bw * 3 + sample->bw) / 4));
+
+	estimate->loss = (estimate->rounds == 0 ? loss : (estimate->loss * 3 + loss) / 4);
+
+	if (estimate->rounds < 255)
+		estimate->rounds++;
+}
+
+/* expected tcp goodput in kbit/s: the narrower of the measured path and one window per rtt, less the lost share (limit 0: none) */
+uint32_t gw_probe_goodput(struct gw_probe_estimate *estimate, uint32_t limit)
+{
+	uint64_t goodput, window;
+
+	if ((estimate->rtt == 0) || (estimate->bw == 0))
+		return 0;
+
+	goodput = estimate->bw;
+	window = ((uint64_t)GW_PROBE_WINDOW * 8 * 1000) / estimate->rtt;
+
+	if (window < goodput)
+		goodput = window;
+
+	if ((limit > 0) && (limit < goodput))
+		goodput = limit;
+
+	return (goodput * (100 - estimate->loss)) / 100;
+}
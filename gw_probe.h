@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+#ifndef _BATMAN_GW_PROBE_H
+#define _BATMAN_GW_PROBE_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+
+/*
+ * Probe datagrams are sent to the tunnel port of the gateway and share
+ * the type byte with the tunnel messages (see posix/tunnel.c):
+ *
+ *   byte 0      GW_PROBE_REQUEST / GW_PROBE_REPLY
+ *   byte 1      index within the round - 0 is the rtt probe, the train follows
+ *   bytes 2-3   round (network byte order)
+ *   bytes 4-7   GW_PROBE_MAGIC (network byte order)
+ *   ...         zero padding
+ *
+ * The gateway echoes every request with the type changed - never more
+ * bytes than it received and without a lease. Gateways which do not know
+ * the probes ignore them, their rounds count as lost.
+ */
+#define GW_PROBE_REQUEST 0x07
+#define GW_PROBE_REPLY 0x08
+#define GW_PROBE_MAGIC 0x62617470             /* "batp" */
+#define GW_PROBE_HDR_LEN 8
+
+#define GW_PROBE_SMALL 32                     /* rtt probe */
+#define GW_PROBE_LARGE 1200                   /* train probes - fit the tunnel mtu of the mesh */
+#define GW_PROBE_TRAIN 8                      /* back to back probes of a round measuring the throughput */
+#define GW_PROBE_TIMEOUT 1000                 /* ms to wait for the replies of a round */
+#define GW_PROBE_WINDOW 65536                 /* bytes a tcp connection moves per rtt at most (no window scaling) */
+
+
+/* raw result of one probe round */
+struct gw_probe_sample {
+	uint32_t rtt;                         /* usec - 0 if the rtt probe got lost */
+	uint32_t bw;                          /* kbit/s - 0 if less than 2 train probes came back */
+	uint8_t sent;
+	uint8_t received;
+};
+
+/* smoothed estimates of one gateway */
+struct gw_probe_estimate {
+	uint32_t rtt;                         /* usec */
+	uint32_t bw;                          /* kbit/s */
+	uint8_t loss;                         /* percent */
+	uint8_t rounds;                       /* saturates at 255 */
+};
+
+
+int8_t gw_probe_round(int32_t sock, struct sockaddr_in *gw_addr, uint16_t round, struct gw_probe_sample *sample);
+int32_t gw_probe_reply(int32_t sock, unsigned char *buff, int32_t len, struct sockaddr_in *addr);
+void gw_probe_update(struct gw_probe_estimate *estimate, struct gw_probe_sample *sample);
+uint32_t gw_probe_goodput(struct gw_probe_estimate *estimate, uint32_t limit);
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "gw_table.h"
+
+
+#define GW_TABLE_WIP_SIZE 128                 /* initial number of hash buckets - always a power of two */
+
+
+static uint64_t addrs_used[GW_TABLE_WORDS];
+static uint64_t words_full[GW_TABLE_WORDS / 64];
+static struct gw_client *blocks[GW_TABLE_ADDRS / GW_TABLE_BLOCK];
+
+static struct gw_client **wip_buckets = NULL;
+static uint32_t wip_size = 0;
+
+static struct gw_client *wheel[GW_TABLE_WHEEL_SLOTS];
+static uint32_t wheel_pos, wheel_time, wheel_tick, lease_timeout;
+
+static uint32_t table_net, clients_num = 0;
+
+
+
+/* hash algorithm from http://en.wikipedia.org/wiki/Hash_table */
+static uint32_t gw_table_hash(uint32_t wip_addr)
+{
+	unsigned char *key = (unsigned char *)&wip_addr;
+	uint32_t hash = 0;
+	size_t i;
+
+	for (i = 0; i < 4; i++) {
+		hash += key[i];
+		hash += (hash << 10);
+		hash ^= (hash >> 6);
+	}
+
+	hash += (hash << 3);
+	hash ^= (hash >> 11);
+	hash += (hash << 15);
+
+	return hash & (wip_size - 1);
+}
+
+static void gw_table_wip_link(struct gw_client *gw_client)
+{
+	uint32_t i = gw_table_hash(gw_client->wip_addr);
+
+	gw_client->wip_next = wip_buckets[i];
+	wip_buckets[i] = gw_client;
+}
+
+static void gw_table_wip_unlink(struct gw_client *gw_client)
+{
+	struct gw_client **pos = &wip_buckets[gw_table_hash(gw_client->wip_addr)];
+
+	while ((*pos != NULL) && (*pos != gw_client))
+		pos = &(*pos)->wip_next;
+
+	if (*pos != NULL)
+		*pos = gw_client->wip_next;
+}
+
+static void gw_table_wip_free(struct gw_client **buckets)
+{
+	if (buckets != NULL)
+		debugFree(buckets, 2002);
+}
+
+static void gw_table_wip_resize(uint32_t size)
+{
+	struct gw_client **old_buckets = wip_buckets, *gw_client, *next;
+	uint32_t old_size = wip_size, i;
+
+	wip_buckets = debugMalloc(size * sizeof(struct gw_client *), 1002);
+	memset(wip_buckets, 0, size * sizeof(struct gw_client *));
+	wip_size = size;
+
+	for (i = 0; i < old_size; i++) {
+
+		for (gw_client = old_buckets[i]; gw_client != NULL; gw_client = next) {
+			next = gw_client->wip_next;
+			gw_table_wip_link(gw_client);
+		}
+
+	}
+
+	gw_table_wip_free(old_buckets);
+}
+
+/* files the client under the tick its lease expires at - beyond the wheel it is checked earlier and filed again */
+static void gw_table_wheel_add(struct gw_client *gw_client)
+{
+	int32_t ticks = (int32_t)(gw_client->last_keep_alive + lease_timeout - wheel_time) / (int32_t)wheel_tick;
+	uint32_t slot;
+
+	if (ticks < 0)
+		ticks = 0;
+
+	if (ticks >= GW_TABLE_WHEEL_SLOTS)
+		ticks = GW_TABLE_WHEEL_SLOTS - 1;
+
+	slot = (wheel_pos + ticks) % GW_TABLE_WHEEL_SLOTS;
+
+	gw_client->wheel_next = wheel[slot];
+	wheel[slot] = gw_client;
+}
+
+static uint8_t gw_table_used(uint32_t index)
+{
+	return ((addrs_used[index / 64] >> (index % 64)) & 1);
+}
+
+static void gw_table_mark(uint32_t index)
+{
+	addrs_used[index / 64] |= 1ULL << (index % 64);
+
+	if (addrs_used[index / 64] == ~0ULL)
+		words_full[index / 4096] |= 1ULL << ((index / 64) % 64);
+}
+
+static void gw_table_unmark(uint32_t index)
+{
+	addrs_used[index / 64] &= ~(1ULL << (index % 64));
+	words_full[index / 4096] &= ~(1ULL << ((index / 64) % 64));
+}
+
+/* the lowest free address - -1 if the pool is exhausted */
+static int32_t gw_table_alloc(void)
+{
+	uint32_t i, word;
+
+	for (i = 0; i < GW_TABLE_WORDS / 64; i++) {
+
+		if (words_full[i] == ~0ULL)
+			continue;
+
+		word = i * 64 + __builtin_ctzll(~words_full[i]);
+		return word * 64 + __builtin_ctzll(~addrs_used[word]);
+
+	}
+
+	return -1;
+}
+
+static struct gw_client *gw_table_record(uint32_t index)
+{
+	if (blocks[index / GW_TABLE_BLOCK] == NULL)
+		return NULL;
+
+	return &blocks[index / GW_TABLE_BLOCK][index % GW_TABLE_BLOCK];
+}
+
+/* net is the /16 of the virtual addresses - its first and last address are never handed out */
+void gw_table_init(uint32_t net, uint32_t lease, uint32_t tick, uint32_t now)
+{
+	memset(addrs_used, 0, sizeof(addrs_used));
+	memset(words_full, 0, sizeof(words_full));
+	memset(blocks, 0, sizeof(blocks));
+	memset(wheel, 0, sizeof(wheel));
+
+	table_net = net;
+	lease_timeout = lease;
+	wheel_tick = tick;
+	wheel_time = now;
+	wheel_pos = 0;
+	clients_num = 0;
+
+	wip_size = 0;
+	wip_buckets = NULL;
+	gw_table_wip_resize(GW_TABLE_WIP_SIZE);
+
+	gw_table_mark(0);
+	gw_table_mark(GW_TABLE_ADDRS - 1);
+}
+
+/* free_cb is called for every client left */
+void gw_table_free(void (*free_cb)(struct gw_client *))
+{
+	struct gw_client *gw_client;
+	uint32_t i;
+
+	for (i = 1; i < GW_TABLE_ADDRS - 1; i++) {
+
+		if ((gw_table_used(i)) && ((gw_client = gw_table_record(i)) != NULL))
+			free_cb(gw_client);
+
+	}
+
+	for (i = 0; i < GW_TABLE_ADDRS / GW_TABLE_BLOCK; i++) {
+
+		if (blocks[i] != NULL)
+			debugFree(blocks[i], 2001);
+
+		blocks[i] = NULL;
+
+	}
+
+	gw_table_wip_free(wip_buckets);
+	wip_buckets = NULL;
+	wip_size = 0;
+	clients_num = 0;
+}
+
+struct gw_client *gw_table_find_wip(uint32_t wip_addr)
+{
+	struct gw_client *gw_client;
+
+	for (gw_client = wip_buckets[gw_table_hash(wip_addr)]; gw_client != NULL; gw_client = gw_client->wip_next) {
+
+		if (gw_client->wip_addr == wip_addr)
+			return gw_client;
+
+	}
+
+	return NULL;
+}
+
+struct gw_client *gw_table_find_vip(uint32_t vip_addr)
+{
+	struct gw_client *gw_client;
+	uint32_t index;
+
+	if ((vip_addr & htonl(0xffff0000)) != table_net)
+		return NULL;
+
+	index = ntohl(vip_addr) & (GW_TABLE_ADDRS - 1);
+
+	/* the reserved addresses are marked as used but have no record */
+	if ((!gw_table_used(index)) || ((gw_client = gw_table_record(index)) == NULL) || (gw_client->vip_addr != vip_addr))
+		return NULL;
+
+	return gw_client;
+}
+
+/* returns NULL if no virtual address is left */
+struct gw_client *gw_table_add(uint32_t wip_addr, uint16_t client_port, uint32_t now)
+{
+	struct gw_client *gw_client;
+	int32_t index;
+
+	if ((index = gw_table_alloc()) < 0)
+		return NULL;
+
+	if (blocks[index / GW_TABLE_BLOCK] == NULL)
+		blocks[index / GW_TABLE_BLOCK] = debugMalloc(GW_TABLE_BLOCK * sizeof(struct gw_client), 1001);
+
+	gw_table_mark(index);
+
+	gw_client = &blocks[index / GW_TABLE_BLOCK][index % GW_TABLE_BLOCK];
+	memset(gw_client, 0, sizeof(struct gw_client));
+
+	gw_client->wip_addr = wip_addr;
+	gw_client->vip_addr = table_net | htonl(index);
+	gw_client->client_port = client_port;
+	gw_client->last_keep_alive = now;
+
+	gw_table_wip_link(gw_client);
+	gw_table_wheel_add(gw_client);
+	clients_num++;
+
+	if (clients_num * 2 > wip_size)
+		gw_table_wip_resize(wip_size * 2);
+
+	return gw_client;
+}
+
+/* drops the clients whose lease expired (expire_cb is called before) - returns their number */
+uint32_t gw_table_expire(uint32_t now, void (*expire_cb)(struct gw_client *))
+{
+	struct gw_client *gw_client, *next;
+	uint32_t expired = 0, i;
+
+	for (i = 0; (i < GW_TABLE_WHEEL_SLOTS) && ((int)(now - (wheel_time + wheel_tick)) >= 0); i++) {
+
+		gw_client = wheel[wheel_pos];
+		wheel[wheel_pos] = NULL;
+
+		wheel_pos = (wheel_pos + 1) % GW_TABLE_WHEEL_SLOTS;
+		wheel_time += wheel_tick;
+
+		for (; gw_client != NULL; gw_client = next) {
+
+			next = gw_client->wheel_next;
+
+			/* keep alives arrived since it was filed */
+			if ((int)(now - (gw_client->last_keep_alive + lease_timeout)) <= 0) {
+				gw_table_wheel_add(gw_client);
+				continue;
+			}
+
+			expire_cb(gw_client);
+
+			gw_table_wip_unlink(gw_client);
+			gw_table_unmark(ntohl(gw_client->vip_addr) & (GW_TABLE_ADDRS - 1));
+			clients_num--;
+			expired++;
+
+		}
+
+	}
+
+	/* not called for more than a turn - every client was filed again, the wheel starts over from now */
+	if ((int)(now - (wheel_time + wheel_tick)) >= 0)
+		wheel_time = now - (now - wheel_time) % wheel_tick;
+
+	return expired;
+}
+
+uint32_t gw_table_clients(void)
+{
+	return clients_num;
+}
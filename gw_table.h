@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+#ifndef _BATMAN_GW_TABLE_H
+#define _BATMAN_GW_TABLE_H
+
+#include <stdint.h>
+
+#include "batman.h"
+
+
+#define GW_TABLE_ADDRS 65536                  /* the virtual client addresses form a /16 */
+#define GW_TABLE_BLOCK 256                    /* client records are allocated per /24 */
+#define GW_TABLE_WORDS (GW_TABLE_ADDRS / 64)
+#define GW_TABLE_WHEEL_SLOTS 32               /* times the tick has to cover the lease timeout */
+
+
+/**
+ * client table of the gateway
+ *
+ * The virtual addresses are handed out from a bitmap over the /16 - a
+ * second bitmap marks the full words, so a free address is found with
+ * two bit scans. The address is the index of the client record: records
+ * live in blocks of GW_TABLE_BLOCK (allocated with the first client of a
+ * /24 and kept until the table is freed), a lookup by virtual address
+ * is a plain array access. The records are chained into a hash of the
+ * client (wan) addresses and into a lease wheel - no allocation per
+ * client. The wheel is lazy: a client is filed under the tick its lease
+ * would have expired at and only checked again then, keep alives just
+ * update last_keep_alive.
+ *
+ * The caller does the locking.
+ */
+
+void gw_table_init(uint32_t net, uint32_t lease, uint32_t tick, uint32_t now);
+void gw_table_free(void (*free_cb)(struct gw_client *));
+struct gw_client *gw_table_find_wip(uint32_t wip_addr);
+struct gw_client *gw_table_find_vip(uint32_t vip_addr);
+struct gw_client *gw_table_add(uint32_t wip_addr, uint16_t client_port, uint32_t now);
+uint32_t gw_table_expire(uint32_t now, void (*expire_cb)(struct gw_client *));
+uint32_t gw_table_clients(void);
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+/**
+ * header compression for the gateway tunnel (see hdr_comp.h)
+ *
+ * Only plain IPv4 packets (no options or fragments) carrying tcp or udp
+ * are compressed, everything else is passed as is. A compressed tcp
+ * packet carries the tos, ip id, sequence and ack numbers, data offset,
+ * flags, window and checksum (20 instead of 40 bytes, options follow
+ * unchanged), a compressed udp packet the tos, ip id and checksum (8
+ * instead of 28 bytes). The transport checksum is never touched - should
+ * a packet ever be rebuilt from the wrong context the receiving host
+ * drops it.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "os.h"
+#include "batman.h"
+#include "hdr_comp.h"
+
+
+#define HDR_COMP_TCP_LEN 20                   /* type, context, generation, tos, id, seq, ack, offset / flags, window, checksum */
+#define HDR_COMP_UDP_LEN 8                    /* type, context, generation, tos, id, checksum */
+#define HDR_COMP_TH_URG 0x20
+
+
+
+static void hdr_comp_ip_csum(unsigned char *ip_hdr)
+{
+	uint32_t sum = 0;
+	int32_t i;
+
+	ip_hdr[10] = ip_hdr[11] = 0;
+
+	for (i = 0; i < 20; i += 2)
+		sum += (ip_hdr[i] << 8) | ip_hdr[i + 1];
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	ip_hdr[10] = (~sum >> 8) & 0xff;
+	ip_hdr[11] = ~sum & 0xff;
+}
+
+/* copies the fields which stay the same for the whole flow - returns the protocol or 0 if the packet can't be compressed */
+static uint8_t hdr_comp_key(unsigned char *packet, int32_t len, unsigned char *key)
+{
+	/* everything but the DF bit */
+	if ((len < 28) || (packet[0] != 0x45) || ((packet[2] << 8 | packet[3]) != len) || (((packet[6] & 0xbf) | packet[7]) != 0))
+		return 0;
+
+	memcpy(key, packet, 24);
+	key[1] = key[2] = key[3] = key[4] = key[5] = key[10] = key[11] = 0;
+
+	return packet[9];
+}
+
+static uint32_t hdr_comp_hash(unsigned char *key)
+{
+	uint32_t hash = 0;
+	int32_t i;
+
+	for (i = 0; i < 24; i++) {
+		hash += key[i];
+		hash += (hash << 10);
+		hash ^= (hash >> 6);
+	}
+
+	hash += (hash << 3);
+	hash ^= (hash >> 11);
+	hash += (hash << 15);
+
+	return hash;
+}
+
+struct hdr_comp *hdr_comp_new(void)
+{
+	struct hdr_comp *comp = debugMalloc(sizeof(struct hdr_comp), 981);
+
+	hdr_comp_reset(comp);
+	return comp;
+}
+
+void hdr_comp_reset(struct hdr_comp *comp)
+{
+	memset(comp, 0, sizeof(struct hdr_comp));
+}
+
+void hdr_comp_free(struct hdr_comp *comp)
+{
+	debugFree(comp, 1981);
+}
+
+/**
+ * compresses the ip packet in place and returns its new length
+ *
+ * The flow gets one of the contexts ctx_first, ctx_first + ctx_step, ...
+ * so that several senders can share the receiver's table without ever
+ * touching the same context.
+ */
+int32_t hdr_comp_packet(struct hdr_comp *comp, unsigned char *packet, int32_t len, uint8_t ctx_first, uint8_t ctx_step)
+{
+	struct hdr_comp_ctx *ctx;
+	unsigned char key[24], comp_hdr[HDR_COMP_TCP_LEN], *th = packet + 20;
+	uint8_t proto, ctx_id, full;
+
+	proto = hdr_comp_key(packet, len, key);
+
+	if (proto == IPPROTO_TCP) {
+
+		if ((len < 40) || ((th[12] >> 4) < 5) || (20 + (th[12] >> 4) * 4 > len))
+			return len;
+
+	} else if (proto == IPPROTO_UDP) {
+
+		/* without checksum nobody would notice a packet rebuilt from the wrong context */
+		if (((th[6] | th[7]) == 0) || ((th[4] << 8 | th[5]) != len - 20))
+			return len;
+
+	} else {
+
+		return len;
+
+	}
+
+	ctx_id = ctx_first + ctx_step * (hdr_comp_hash(key) % (HDR_COMP_CTX_NUM / ctx_step));
+	ctx = &comp->ctx[ctx_id];
+
+	if ((!ctx->valid) || (memcmp(ctx->key, key, sizeof(key)) != 0)) {
+		memcpy(ctx->key, key, sizeof(key));
+		ctx->packets = 0;
+		ctx->gen++;
+		ctx->valid = 1;
+	}
+
+	/* the receiver lost the full header - the flow starts over (another thread may set the flag) */
+	if ((ctx->resync) && (__sync_bool_compare_and_swap(&ctx->resync, 1, 0)))
+		ctx->packets = 0;
+
+	full = (ctx->packets++ % HDR_COMP_REFRESH < HDR_COMP_FULL_NUM);
+
+	/* the urgent pointer is not transmitted */
+	if ((proto == IPPROTO_TCP) && ((th[13] & HDR_COMP_TH_URG) || ((th[18] | th[19]) != 0)))
+		full = 1;
+
+	/* the receiver recomputes the ip checksum anyway */
+	if (full) {
+		packet[0] = HDR_COMP_FULL;
+		packet[10] = ctx_id;
+		packet[11] = ctx->gen;
+		return len;
+	}
+
+	comp_hdr[1] = ctx_id;
+	comp_hdr[2] = ctx->gen;
+	comp_hdr[3] = packet[1];
+	comp_hdr[4] = packet[4];
+	comp_hdr[5] = packet[5];
+
+	if (proto == IPPROTO_UDP) {
+
+		comp_hdr[0] = HDR_COMP_UDP;
+		comp_hdr[6] = th[6];
+		comp_hdr[7] = th[7];
+
+		memmove(packet + HDR_COMP_UDP_LEN, packet + 28, len - 28);
+		memcpy(packet, comp_hdr, HDR_COMP_UDP_LEN);
+
+		return len - (28 - HDR_COMP_UDP_LEN);
+
+	}
+
+	comp_hdr[0] = HDR_COMP_TCP;
+	memcpy(comp_hdr + 6, th + 4, 8);
+	memcpy(comp_hdr + 14, th + 12, 6);
+
+	/* the tcp options stay in front of the payload */
+	memmove(packet + HDR_COMP_TCP_LEN, packet + 40, len - 40);
+	memcpy(packet, comp_hdr, HDR_COMP_TCP_LEN);
+
+	return len - (40 - HDR_COMP_TCP_LEN);
+}
+
+/**
+ * rebuilds a packet sent by hdr_comp_packet() - plain ip packets and full
+ * headers are restored in place (returns 0), compressed headers are
+ * written into hdr (returns the header length) and *payload points to the
+ * rest of the packet. Returns -1 if the packet has to be dropped.
+ */
+int32_t hdr_decomp_packet(struct hdr_comp *comp, unsigned char *packet, int32_t len, unsigned char *hdr, unsigned char **payload, int32_t *payload_len)
+{
+	struct hdr_comp_ctx *ctx;
+	int32_t comp_len, hdr_len, opt_len = 0, tot_len;
+
+	*payload = packet;
+	*payload_len = len;
+
+	if (HDR_COMP_PLAIN(packet))
+		return 0;
+
+	if (comp == NULL)
+		return -1;
+
+	if (packet[0] == HDR_COMP_FULL) {
+
+		if ((len < 28) || (packet[10] >= HDR_COMP_CTX_NUM))
+			return -1;
+
+		ctx = &comp->ctx[packet[10]];
+		packet[0] = 0x45;
+
+		if (hdr_comp_key(packet, len, ctx->key) == 0) {
+			ctx->valid = 0;
+			return -1;
+		}
+
+		ctx->gen = packet[11];
+		ctx->valid = 1;
+		ctx->missed = 0;
+
+		hdr_comp_ip_csum(packet);
+		return 0;
+
+	}
+
+	if ((packet[0] != HDR_COMP_TCP) && (packet[0] != HDR_COMP_UDP))
+		return -1;
+
+	comp_len = (packet[0] == HDR_COMP_TCP ? HDR_COMP_TCP_LEN : HDR_COMP_UDP_LEN);
+
+	if ((len < comp_len) || (packet[1] >= HDR_COMP_CTX_NUM))
+		return -1;
+
+	ctx = &comp->ctx[packet[1]];
+
+	/* the full header of this flow got lost */
+	if ((!ctx->valid) || (ctx->gen != packet[2]) || (ctx->key[9] != (packet[0] == HDR_COMP_TCP ? IPPROTO_TCP : IPPROTO_UDP)))
+		return -1;
+
+	memcpy(hdr, ctx->key, sizeof(ctx->key));
+	hdr[1] = packet[3];
+	hdr[4] = packet[4];
+	hdr[5] = packet[5];
+
+	if (packet[0] == HDR_COMP_TCP) {
+
+		hdr_len = 20 + (packet[14] >> 4) * 4;
+		opt_len = hdr_len - 40;
+
+		if ((opt_len < 0) || (comp_len + opt_len > len))
+			return -1;
+
+		memcpy(hdr + 24, packet + 6, 8);
+		memcpy(hdr + 32, packet + 14, 6);
+		hdr[38] = hdr[39] = 0;
+		memcpy(hdr + 40, packet + comp_len, opt_len);
+
+	} else {
+
+		hdr_len = 28;
+		hdr[24] = ((len - comp_len + 8) >> 8) & 0xff;
+		hdr[25] = (len - comp_len + 8) & 0xff;
+		hdr[26] = packet[6];
+		hdr[27] = packet[7];
+
+	}
+
+	*payload = packet + comp_len + opt_len;
+	*payload_len = len - comp_len - opt_len;
+
+	tot_len = hdr_len + *payload_len;
+	hdr[2] = (tot_len >> 8) & 0xff;
+	hdr[3] = tot_len & 0xff;
+
+	hdr_comp_ip_csum(hdr);
+	return hdr_len;
+}
+
+/**
+ * called for a packet hdr_decomp_packet() dropped - returns the context
+ * the sender has to send a full header for or -1 if there is nothing to
+ * ask for (yet): the first dropped packet of a context asks, then every
+ * HDR_COMP_RESYNC_MISSED-th in case the request got lost
+ */
+int32_t hdr_decomp_resync(struct hdr_comp *comp, unsigned char *packet, int32_t len)
+{
+	struct hdr_comp_ctx *ctx;
+
+	if ((comp == NULL) || (len < 3) || ((packet[0] != HDR_COMP_TCP) && (packet[0] != HDR_COMP_UDP)) || (packet[1] >= HDR_COMP_CTX_NUM))
+		return -1;
+
+	ctx = &comp->ctx[packet[1]];
+
+	if ((ctx->valid) && (ctx->gen == packet[2]))
+		return -1;
+
+	return (ctx->missed++ % HDR_COMP_RESYNC_MISSED == 0 ? packet[1] : -1);
+}
+
+/* the receiver asked for a full header - the next packet of the flow carries it */
+void hdr_comp_resync(struct hdr_comp *comp, uint8_t ctx_id)
+{
+	if (ctx_id < HDR_COMP_CTX_NUM)
+		__sync_lock_test_and_set(&comp->ctx[ctx_id].resync, 1);
+}
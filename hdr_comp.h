@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+
+#ifndef _BATMAN_HDR_COMP_H
+#define _BATMAN_HDR_COMP_H
+
+#include <stdint.h>
+
+
+#define HDR_COMP_CTX_NUM 64
+#define HDR_COMP_REFRESH 32                   /* every n-th packet of a flow carries the full header again */
+#define HDR_COMP_FULL_NUM 2                   /* so do the first ones - one of them may get lost */
+#define HDR_COMP_HDR_MAX 80                   /* ip header and tcp header with options */
+#define HDR_COMP_RESYNC_MISSED 16             /* a lost resync request is repeated after this many dropped packets */
+
+/* the first byte of a tunnelled packet - ip packets (IPv4 and IPv6) never start with a version of 0 */
+#define HDR_COMP_FULL 0x01                    /* ip packet with context id and generation in the ip checksum */
+#define HDR_COMP_TCP 0x02
+#define HDR_COMP_UDP 0x03
+
+#define HDR_COMP_PLAIN(packet) (((packet)[0] >> 4) != 0)
+
+
+struct hdr_comp_ctx {
+	unsigned char key[24];                /* ip header (without tos, length, id, checksum) and ports */
+	uint16_t packets;
+	uint8_t gen;                          /* changes whenever the context is given to another flow */
+	uint8_t valid;
+	uint8_t missed;                       /* receiver: packets dropped since the last full header */
+	volatile uint8_t resync;              /* sender: the receiver asked for a full header */
+};
+
+/**
+ * header compression contexts of one tunnel direction
+ *
+ * Both ends keep a table of flows (addresses, protocol, ttl and ports).
+ * The sender announces a flow with a full packet and afterwards only sends
+ * the changing fields of the ip and tcp / udp header - absolute values, no
+ * deltas, so a lost packet never corrupts the following ones. The receiver
+ * rebuilds the headers from its copy of the context. If it lost the full
+ * header of a flow it asks the sender for a new one right away
+ * (hdr_decomp_resync() / hdr_comp_resync()) instead of dropping packets
+ * until the next refresh.
+ */
+struct hdr_comp {
+	struct hdr_comp_ctx ctx[HDR_COMP_CTX_NUM];
+};
+
+
+struct hdr_comp *hdr_comp_new(void);
+void hdr_comp_reset(struct hdr_comp *comp);
+void hdr_comp_free(struct hdr_comp *comp);
+int32_t hdr_comp_packet(struct hdr_comp *comp, unsigned char *packet, int32_t len, uint8_t ctx_first, uint8_t ctx_step);
+int32_t hdr_decomp_packet(struct hdr_comp *comp, unsigned char *packet, int32_t len, unsigned char *hdr, unsigned char **payload, int32_t *payload_len);
+int32_t hdr_decomp_resync(struct hdr_comp *comp, unsigned char *packet, int32_t len);
+void hdr_comp_resync(struct hdr_comp *comp, uint8_t ctx_id);
+
+#endif
@@ -24,6 +24,11 @@
 #include "hna.h"
 #include "os.h"
 #include "hash.h"
+#include "fib.h"
+#include "hna_sync.h"
+#include "lpm.h"
+#include "events.h"
+#include "vis.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -31,13 +36,16 @@
 
 
 unsigned char *hna_buff_local = NULL;
-uint8_t num_hna_local = 0;
+uint16_t num_hna_local = 0;
 
 struct list_head_first hna_list;
 struct list_head_first hna_chg_list;
 
 static pthread_mutex_t hna_chg_list_mutex;
+static struct hashtable_t *hna_local_hash = NULL;
 static struct hashtable_t *hna_global_hash = NULL;
+static unsigned char *hna_cmp_buff = NULL;
+static int32_t hna_cmp_buff_len = 0;
 
 int compare_hna(void *data1, void *data2)
 {
@@ -63,6 +71,17 @@ int choose_hna(void *data, int32_t size)
 	return (hash % size);
 }
 
+/* hna_local_entry starts with its list head - the key is addr + netmask */
+static int compare_hna_local(void *data1, void *data2)
+{
+	return compare_hna(&((struct hna_local_entry *)data1)->addr, &((struct hna_local_entry *)data2)->addr);
+}
+
+static int choose_hna_local(void *data, int32_t size)
+{
+	return choose_hna(&((struct hna_local_entry *)data)->addr, size);
+}
+
 void hna_init(void)
 {
 	/* hna local */
@@ -71,6 +90,13 @@ void hna_init(void)
 
 	pthread_mutex_init(&hna_chg_list_mutex, NULL);
 
+	hna_local_hash = hash_new(128, compare_hna_local, choose_hna_local);
+
+	if (hna_local_hash == NULL) {
+		printf("Error - Could not create hna_local_hash (out of memory?)\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/* hna global */
 	hna_global_hash = hash_new(128, compare_hna, choose_hna);
 
@@ -102,18 +128,17 @@ void hna_local_task_add_ip(uint32_t ip_addr, uint16_t netmask, uint8_t route_act
 		debug_output(0, "Error - could not unlock hna_chg_list mutex in %s(): %s \n", __func__, strerror(errno));
 }
 
-/* this function can be called when the daemon starts or at runtime */
-void hna_local_task_add_str(char *hna_string, uint8_t route_action, uint8_t runtime)
+/* parses "ip/netmask" - invalid networks are fatal unless we are already running */
+static int hna_local_parse_str(char *hna_string, uint32_t *ip_addr, uint16_t *netmask, uint8_t runtime)
 {
 	struct in_addr tmp_ip_holder;
-	uint16_t netmask;
 	char *slash_ptr;
 
 	if ((slash_ptr = strchr(hna_string, '/')) == NULL) {
 
 		if (runtime) {
 			debug_output(3, "Invalid announced network (netmask is missing): %s\n", hna_string);
-			return;
+			return 0;
 		}
 
 		printf("Invalid announced network (netmask is missing): %s\n", hna_string);
@@ -128,7 +153,7 @@ void hna_local_task_add_str(char *hna_string, uint8_t route_action, uint8_t runt
 
 		if (runtime) {
 			debug_output(3, "Invalid announced network (IP is invalid): %s\n", hna_string);
-			return;
+			return 0;
 		}
 
 		printf("Invalid announced network (IP is invalid): %s\n", hna_string);
@@ -136,26 +161,26 @@ void hna_local_task_add_str(char *hna_string, uint8_t route_action, uint8_t runt
 	}
 
 	errno = 0;
-	netmask = strtol(slash_ptr + 1, NULL, 10);
+	*netmask = strtol(slash_ptr + 1, NULL, 10);
 
-	if ((errno == ERANGE) || (errno != 0 && netmask == 0)) {
+	if ((errno == ERANGE) || (errno != 0 && *netmask == 0)) {
 
 		*slash_ptr = '/';
 
 		if (runtime)
-			return;
+			return 0;
 
 		perror("strtol");
 		exit(EXIT_FAILURE);
 	}
 
-	if (netmask < 1 || netmask > 32) {
+	if (*netmask < 1 || *netmask > 32) {
 
 		*slash_ptr = '/';
 
 		if (runtime) {
 			debug_output(3, "Invalid announced network (netmask is invalid): %s\n", hna_string);
-			return;
+			return 0;
 		}
 
 		printf("Invalid announced network (netmask is invalid): %s\n", hna_string);
@@ -164,39 +189,155 @@ void hna_local_task_add_str(char *hna_string, uint8_t route_action, uint8_t runt
 
 	*slash_ptr = '/';
 
-	tmp_ip_holder.s_addr = (tmp_ip_holder.s_addr & htonl(0xFFFFFFFF << (32 - netmask)));
-	hna_local_task_add_ip(tmp_ip_holder.s_addr, netmask, route_action);
+	*ip_addr = (tmp_ip_holder.s_addr & htonl(0xFFFFFFFF << (32 - *netmask)));
+	return 1;
+}
+
+/* this function can be called when the daemon starts or at runtime */
+void hna_local_task_add_str(char *hna_string, uint8_t route_action, uint8_t runtime)
+{
+	uint32_t ip_addr;
+	uint16_t netmask;
+
+	if (hna_local_parse_str(hna_string, &ip_addr, &netmask, runtime))
+		hna_local_task_add_ip(ip_addr, netmask, route_action);
+}
+
+/**
+ * hna_local_task_add_bulk() queues a list of "a:ip/netmask" (add) and
+ * "A:ip/netmask" (delete) lines as one transaction: the tasks are only
+ * handed to hna_local_task_exec() if every line could be parsed.
+ * Returns the number of queued tasks or -1 if the request was rejected.
+ */
+int hna_local_task_add_bulk(char *bulk_string)
+{
+	struct list_head_first task_list;
+	struct list_head *list_pos, *list_pos_tmp;
+	struct hna_task *hna_task;
+	char *line, *line_end;
+	uint32_t ip_addr;
+	uint16_t netmask;
+	int num_tasks = 0;
+
+	INIT_LIST_HEAD_FIRST(task_list);
+
+	for (line = bulk_string; *line != '\0'; line = line_end + 1) {
+
+		line_end = strchr(line, '\n');
+
+		if (line_end == NULL)
+			line_end = line + strlen(line) - 1;
+		else
+			*line_end = '\0';
+
+		/* ignore empty lines */
+		if (*line == '\0')
+			continue;
+
+		if (((line[0] != 'a') && (line[0] != 'A')) || (line[1] != ':') ||
+		    (!hna_local_parse_str(line + 2, &ip_addr, &netmask, 1))) {
+			debug_output(3, "Rejecting bulk HNA request - invalid line: %s\n", line);
+			goto free_tasks;
+		}
+
+		hna_task = debugMalloc(sizeof(struct hna_task), 707);
+		memset(hna_task, 0, sizeof(struct hna_task));
+		INIT_LIST_HEAD(&hna_task->list);
+
+		hna_task->addr = ip_addr;
+		hna_task->netmask = netmask;
+		hna_task->route_action = (line[0] == 'a' ? ROUTE_ADD : ROUTE_DEL);
+
+		list_add_tail(&hna_task->list, &task_list);
+		num_tasks++;
+	}
+
+	if (num_tasks == 0)
+		return 0;
+
+	if (pthread_mutex_lock(&hna_chg_list_mutex) != 0)
+		debug_output(0, "Error - could not lock hna_chg_list mutex in %s(): %s \n", __func__, strerror(errno));
+
+	/* append the whole task list at once */
+	hna_chg_list.prev->next = task_list.next;
+	task_list.prev->next = (struct list_head *)&hna_chg_list;
+	hna_chg_list.prev = task_list.prev;
+
+	if (pthread_mutex_unlock(&hna_chg_list_mutex) != 0)
+		debug_output(0, "Error - could not unlock hna_chg_list mutex in %s(): %s \n", __func__, strerror(errno));
+
+	debug_output(3, "Queued bulk HNA request with %i network changes\n", num_tasks);
+	return num_tasks;
+
+free_tasks:
+	list_for_each_safe(list_pos, list_pos_tmp, &task_list) {
+		list_del((struct list_head *)&task_list, list_pos, &task_list);
+		debugFree(list_entry(list_pos, struct hna_task, list), 1712);
+	}
+
+	return -1;
+}
+
+static void hna_local_hash_resize(void)
+{
+	struct hashtable_t *swaphash;
+
+	swaphash = hash_resize(hna_local_hash, hna_local_hash->size * 2);
+
+	if (swaphash == NULL)
+		debug_output(0, "Couldn't resize local hna hash table \n");
+	else
+		hna_local_hash = swaphash;
 }
 
 static void hna_local_buffer_fill(void)
 {
 	struct hna_local_entry *hna_local_entry;
+	int num_elements;
 
 	if (hna_buff_local != NULL)
 		debugFree(hna_buff_local, 1701);
 
 	num_hna_local = 0;
 	hna_buff_local = NULL;
+	num_elements = hna_local_hash->elements;
 
-	if (list_empty(&hna_list))
-		return;
+	if (num_elements > UINT16_MAX) {
+		debug_output(0, "Warning - only %i of %i announced networks are used \n", UINT16_MAX, num_elements);
+		num_elements = UINT16_MAX;
+	}
+
+	/* without hna sync the announced networks have to fit into the own OGM */
+	if ((!hna_sync) && (num_elements > (int)MAX_HNA_OGM))
+		debug_output(0, "Warning - only %i of %i announced networks fit into the OGM (see --hna-sync) \n",
+			     (int)MAX_HNA_OGM, num_elements);
 
-	list_for_each_entry(hna_local_entry, &hna_list, list) {
-		hna_buff_local = debugRealloc(hna_buff_local, (num_hna_local + 1) * 5 * sizeof(unsigned char), 15);
+	if (num_elements > 0) {
+		hna_buff_local = debugMalloc(num_elements * 5 * sizeof(unsigned char), 15);
+
+		list_for_each_entry(hna_local_entry, &hna_list, list) {
+			if (num_hna_local == num_elements)
+				break;
 
-		memmove(&hna_buff_local[num_hna_local * 5], (unsigned char *)&hna_local_entry->addr, 4);
-		hna_buff_local[(num_hna_local * 5) + 4] = (unsigned char)hna_local_entry->netmask;
-		num_hna_local++;
+			memmove(&hna_buff_local[num_hna_local * 5], (unsigned char *)&hna_local_entry->addr, 4);
+			hna_buff_local[(num_hna_local * 5) + 4] = (unsigned char)hna_local_entry->netmask;
+			num_hna_local++;
+		}
 	}
+
+	if (hna_sync)
+		hna_sync_local_update(hna_buff_local, num_hna_local);
+
+	vis_update_local();
 }
 
 void hna_local_task_exec(void)
 {
 	struct list_head *list_pos, *list_pos_tmp, *prev_list_head;
-	struct list_head *hna_pos, *hna_pos_tmp;
 	struct hna_task *hna_task;
-	struct hna_local_entry *hna_local_entry;
+	struct hna_local_entry *hna_local_entry, hna_local_key;
 	char hna_addr_str[ADDR_STR_LEN];
+	int num_deleted = 0;
 
 	if (pthread_mutex_trylock(&hna_chg_list_mutex) != 0)
 		return;
@@ -209,35 +350,27 @@ void hna_local_task_exec(void)
 		hna_task = list_entry(list_pos, struct hna_task, list);
 		addr_to_string(hna_task->addr, hna_addr_str, sizeof(hna_addr_str));
 
-		hna_local_entry = NULL;
-		prev_list_head = (struct list_head *)&hna_list;
-
-		list_for_each_safe(hna_pos, hna_pos_tmp, &hna_list) {
+		hna_local_key.addr = hna_task->addr;
+		hna_local_key.netmask = hna_task->netmask;
 
-			hna_local_entry = list_entry(hna_pos, struct hna_local_entry, list);
+		hna_local_entry = ((struct hna_local_entry *)hash_find(hna_local_hash, &hna_local_key));
 
-			if ((hna_task->addr == hna_local_entry->addr) && (hna_task->netmask == hna_local_entry->netmask)) {
+		if (hna_local_entry != NULL) {
 
-				if (hna_task->route_action == ROUTE_DEL) {
-					debug_output(3, "Deleting HNA from announce network list: %s/%i\n", hna_addr_str, hna_task->netmask);
+			if (hna_task->route_action == ROUTE_DEL) {
+				debug_output(3, "Deleting HNA from announce network list: %s/%i\n", hna_addr_str, hna_task->netmask);
 
-					hna_local_update_routes(hna_local_entry, ROUTE_DEL);
-					list_del(prev_list_head, hna_pos, &hna_list);
-					debugFree(hna_local_entry, 1702);
-				} else {
-					debug_output(3, "Can't add HNA - already announcing network: %s/%i\n", hna_addr_str, hna_task->netmask);
-				}
-
-				break;
+				hna_local_update_routes(hna_local_entry, ROUTE_DEL);
+				hash_remove(hna_local_hash, hna_local_entry);
 
+				/* unlinked from hna_list once all tasks are done */
+				hna_local_entry->netmask = 0;
+				num_deleted++;
+			} else {
+				debug_output(3, "Can't add HNA - already announcing network: %s/%i\n", hna_addr_str, hna_task->netmask);
 			}
 
-			prev_list_head = &hna_local_entry->list;
-			hna_local_entry = NULL;
-
-		}
-
-		if (hna_local_entry == NULL) {
+		} else {
 
 			if (hna_task->route_action == ROUTE_ADD) {
 				debug_output(3, "Adding HNA to announce network list: %s/%i\n", hna_addr_str, hna_task->netmask);
@@ -252,6 +385,10 @@ void hna_local_task_exec(void)
 
 				hna_local_update_routes(hna_local_entry, ROUTE_ADD);
 				list_add_tail(&hna_local_entry->list, &hna_list);
+				hash_add(hna_local_hash, hna_local_entry);
+
+				if (hna_local_hash->elements * 4 > hna_local_hash->size)
+					hna_local_hash_resize();
 			} else {
 				debug_output(3, "Can't delete HNA - network is not announced: %s/%i\n", hna_addr_str, hna_task->netmask);
 			}
@@ -263,6 +400,26 @@ void hna_local_task_exec(void)
 
 	}
 
+	/* remove the deleted networks in one pass */
+	if (num_deleted > 0) {
+		prev_list_head = (struct list_head *)&hna_list;
+
+		list_for_each_safe(list_pos, list_pos_tmp, &hna_list) {
+			hna_local_entry = list_entry(list_pos, struct hna_local_entry, list);
+
+			if (hna_local_entry->netmask != 0) {
+				prev_list_head = list_pos;
+				continue;
+			}
+
+			list_del(prev_list_head, list_pos, &hna_list);
+			debugFree(hna_local_entry, 1702);
+		}
+	}
+
+	/* apply the nat rules of all tasks at once */
+	nat_rules_flush();
+
 	/* rewrite local buffer */
 	hna_local_buffer_fill();
 
@@ -271,46 +428,107 @@ unlock_chg_list:
 		debug_output(0, "Error - could not unlock hna_chg_list mutex in %s(): %s \n", __func__, strerror(errno));
 }
 
-unsigned char *hna_local_update_vis_packet(unsigned char *vis_packet, uint16_t *vis_packet_size)
+void hna_local_update_routes(struct hna_local_entry *hna_local_entry, int8_t route_action)
 {
-	struct hna_local_entry *hna_local_entry;
-	struct vis_data *vis_data;
+	/* add / delete throw routing entries for own hna */
+	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_THROW, route_action);
+	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_THROW, route_action);
+	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_THROW, route_action);
+	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_THROW, route_action);
+
+	/* do not NAT HNA networks automatically */
+	hna_local_update_nat(hna_local_entry->addr, hna_local_entry->netmask, route_action);
+}
 
-	if (num_hna_local < 1)
-		return vis_packet;
+/* insert the orig pointer behind all candidates with an equal or better TQ */
+static void hna_orig_ptr_insert(struct hna_global_entry *hna_global_entry, struct hna_orig_ptr *hna_orig_ptr)
+{
+	struct list_head *list_pos, *prev_list_head;
+	struct hna_orig_ptr *hna_orig_ptr_tmp;
 
-	list_for_each_entry(hna_local_entry, &hna_list, list) {
-		*vis_packet_size += sizeof(struct vis_data);
+	prev_list_head = (struct list_head *)&hna_global_entry->orig_list;
 
-		vis_packet = debugRealloc(vis_packet, *vis_packet_size, 107);
-		vis_data = (struct vis_data *)(vis_packet + *vis_packet_size - sizeof(struct vis_data));
+	list_for_each(list_pos, &hna_global_entry->orig_list) {
+		hna_orig_ptr_tmp = list_entry(list_pos, struct hna_orig_ptr, list);
 
-		memcpy(&vis_data->ip, (unsigned char *)&hna_local_entry->addr, 4);
+		if (hna_orig_ptr_tmp->orig_node->hna_tq < hna_orig_ptr->orig_node->hna_tq) {
+			list_add_before(prev_list_head, list_pos, &hna_orig_ptr->list);
+			return;
+		}
 
-		vis_data->data = hna_local_entry->netmask;
-		vis_data->type = DATA_TYPE_HNA;
+		prev_list_head = list_pos;
 	}
 
-	return vis_packet;
+	list_add_tail(&hna_orig_ptr->list, &hna_global_entry->orig_list);
 }
 
-void hna_local_update_routes(struct hna_local_entry *hna_local_entry, int8_t route_action)
+static struct hna_orig_ptr *hna_orig_ptr_unlink(struct hna_global_entry *hna_global_entry, struct orig_node *orig_node)
 {
-	/* add / delete throw routing entries for own hna */
-	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_THROW, route_action);
-	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_THROW, route_action);
-	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_THROW, route_action);
-	add_del_route(hna_local_entry->addr, hna_local_entry->netmask, 0, 0, 0, "unknown", BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_THROW, route_action);
+	struct list_head *list_pos, *prev_list_head;
+	struct hna_orig_ptr *hna_orig_ptr;
 
-	/* do not NAT HNA networks automatically */
-	hna_local_update_nat(hna_local_entry->addr, hna_local_entry->netmask, route_action);
+	prev_list_head = (struct list_head *)&hna_global_entry->orig_list;
+
+	list_for_each(list_pos, &hna_global_entry->orig_list) {
+		hna_orig_ptr = list_entry(list_pos, struct hna_orig_ptr, list);
+
+		if (hna_orig_ptr->orig_node == orig_node) {
+			list_del(prev_list_head, list_pos, &hna_global_entry->orig_list);
+			return hna_orig_ptr;
+		}
+
+		prev_list_head = list_pos;
+	}
+
+	return NULL;
+}
+
+/**
+ * the head of the orig list is the best candidate - if it differs from the
+ * orig node in use the route is moved from old_orig_node to the new one
+ */
+static void hna_global_select(struct hna_global_entry *hna_global_entry, struct orig_node *old_orig_node)
+{
+	struct orig_node *new_orig_node = NULL;
+
+	if (!list_empty(&hna_global_entry->orig_list))
+		new_orig_node = list_entry(hna_global_entry->orig_list.next, struct hna_orig_ptr, list)->orig_node;
+
+	hna_global_entry->curr_orig_node = new_orig_node;
+
+	if (new_orig_node == old_orig_node)
+		return;
+
+	lpm_update_hna(hna_global_entry->addr, hna_global_entry->netmask, new_orig_node);
+	event_hna(hna_global_entry->addr, hna_global_entry->netmask, new_orig_node, old_orig_node);
+
+	/**
+	 * if we change the orig node towards the HNA we may still route via the same next hop
+	 * which does not require any routing table changes
+	 */
+	if ((new_orig_node) && (old_orig_node) && (new_orig_node->router->addr == old_orig_node->router->addr))
+		return;
+
+	if (new_orig_node)
+		fib_add_del_route(hna_global_entry->addr, hna_global_entry->netmask, new_orig_node->router->addr,
+					new_orig_node->router->if_incoming->addr.sin_addr.s_addr,
+					new_orig_node->router->if_incoming->if_index,
+					new_orig_node->router->if_incoming->dev,
+					BATMAN_RT_TABLE_NETWORKS, ROUTE_ADD);
+
+	/* delete previous route */
+	if (old_orig_node)
+		fib_add_del_route(hna_global_entry->addr, hna_global_entry->netmask, old_orig_node->router->addr,
+					old_orig_node->router->if_incoming->addr.sin_addr.s_addr,
+					old_orig_node->router->if_incoming->if_index,
+					old_orig_node->router->if_incoming->dev,
+					BATMAN_RT_TABLE_NETWORKS, ROUTE_DEL);
 }
 
 static void _hna_global_add(struct orig_node *orig_node, struct hna_element *hna_element)
 {
 	struct hna_global_entry *hna_global_entry;
 	struct hna_orig_ptr *hna_orig_ptr = NULL;
-	struct orig_node *old_orig_node = NULL;
 	struct hashtable_t *swaphash;
 
 	hna_global_entry = ((struct hna_global_entry *)hash_find(hna_global_hash, hna_element));
@@ -339,154 +557,146 @@ static void _hna_global_add(struct orig_node *orig_node, struct hna_element *hna
 		}
 	}
 
-	/* the given orig_node already is the current orig node for this HNA */
-	if (hna_global_entry->curr_orig_node == orig_node)
-		return;
-
+	/* the given orig_node already is a candidate for this HNA */
 	list_for_each_entry(hna_orig_ptr, &hna_global_entry->orig_list, list) {
 		if (hna_orig_ptr->orig_node == orig_node)
-			break;
-
-		hna_orig_ptr = NULL;
-	}
-
-	/* append the given orig node to the list */
-	if (!hna_orig_ptr) {
-		hna_orig_ptr = debugMalloc(sizeof(struct hna_orig_ptr), 704);
-
-		if (!hna_orig_ptr)
 			return;
-
-		hna_orig_ptr->orig_node = orig_node;
-		INIT_LIST_HEAD(&hna_orig_ptr->list);
-
-		list_add_tail(&hna_orig_ptr->list, &hna_global_entry->orig_list);
 	}
 
-	/* our TQ value towards the HNA is better */
-	if ((!hna_global_entry->curr_orig_node) ||
-		(orig_node->router->tq_avg > hna_global_entry->curr_orig_node->router->tq_avg)) {
+	hna_orig_ptr = debugMalloc(sizeof(struct hna_orig_ptr), 704);
 
-		old_orig_node = hna_global_entry->curr_orig_node;
-		hna_global_entry->curr_orig_node = orig_node;
-
-		/**
-		 * if we change the orig node towards the HNA we may still route via the same next hop
-		 * which does not require any routing table changes
-		 */
-		if ((old_orig_node) &&
-			(hna_global_entry->curr_orig_node->router->addr == old_orig_node->router->addr))
-			return;
+	if (!hna_orig_ptr)
+		return;
 
-		add_del_route(hna_element->addr, hna_element->netmask, orig_node->router->addr,
-					orig_node->router->if_incoming->addr.sin_addr.s_addr,
-					orig_node->router->if_incoming->if_index,
-					orig_node->router->if_incoming->dev,
-					BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_ADD);
-	}
+	hna_orig_ptr->orig_node = orig_node;
+	INIT_LIST_HEAD(&hna_orig_ptr->list);
 
-	/* delete previous route */
-	if (old_orig_node) {
-		add_del_route(hna_element->addr, hna_element->netmask, old_orig_node->router->addr,
-					old_orig_node->router->if_incoming->addr.sin_addr.s_addr,
-					old_orig_node->router->if_incoming->if_index,
-					old_orig_node->router->if_incoming->dev,
-					BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_DEL);
-	}
+	/* the orig node only becomes the head if its TQ is better than the current one */
+	hna_orig_ptr_insert(hna_global_entry, hna_orig_ptr);
+	hna_global_select(hna_global_entry, hna_global_entry->curr_orig_node);
 }
 
 static void _hna_global_del(struct orig_node *orig_node, struct hna_element *hna_element)
 {
-	struct list_head *list_pos, *list_pos_tmp, *prev_list_head;
 	struct hna_global_entry *hna_global_entry;
-	struct hna_orig_ptr *hna_orig_ptr = NULL;
+	struct hna_orig_ptr *hna_orig_ptr;
 
 	hna_global_entry = ((struct hna_global_entry *)hash_find(hna_global_hash, hna_element));
 
 	if (!hna_global_entry)
 		return;
 
-	hna_global_entry->curr_orig_node = NULL;
+	hna_orig_ptr = hna_orig_ptr_unlink(hna_global_entry, orig_node);
 
-	prev_list_head = (struct list_head *)&hna_global_entry->orig_list;
-	list_for_each_safe(list_pos, list_pos_tmp, &hna_global_entry->orig_list) {
-		hna_orig_ptr = list_entry(list_pos, struct hna_orig_ptr, list);
+	if (!hna_orig_ptr)
+		return;
 
-		/* delete old entry in orig list */
-		if (hna_orig_ptr->orig_node == orig_node) {
-			list_del(prev_list_head, list_pos, &hna_global_entry->orig_list);
-			debugFree(hna_orig_ptr, 1707);
-			continue;
-		}
+	debugFree(hna_orig_ptr, 1707);
 
-		/* find best alternative route */
-		if ((!hna_global_entry->curr_orig_node) ||
-			(hna_orig_ptr->orig_node->router->tq_avg > hna_global_entry->curr_orig_node->router->tq_avg))
-			hna_global_entry->curr_orig_node = hna_orig_ptr->orig_node;
+	/* switch to the best alternative route if the orig node was in use */
+	hna_global_select(hna_global_entry, hna_global_entry->curr_orig_node);
 
-		prev_list_head = &hna_orig_ptr->list;
+	/* if no alternative route is available remove the HNA entry completely */
+	if (!hna_global_entry->curr_orig_node) {
+		hash_remove(hna_global_hash, hna_element);
+		debugFree(hna_global_entry, 1708);
 	}
+}
 
-	/* set new route if available */
-	if (hna_global_entry->curr_orig_node) {
-		/**
-		 * if we delete one orig node towards the HNA but we switch to an alternative
-		 * which is reachable via the same next hop no routing table changes are necessary
-		 */
-		if (hna_global_entry->curr_orig_node->router->addr == orig_node->router->addr)
-			return;
+static int hna_element_cmp(const void *data1, const void *data2)
+{
+	return memcmp(data1, data2, sizeof(struct hna_element));
+}
+
+/* order (and byte order) independent content hash of an announced HNA set */
+uint32_t hna_buff_hash(unsigned char *hna_buff, int32_t hna_buff_len)
+{
+	struct hna_element *buff = (struct hna_element *)hna_buff;
+	uint32_t hash = 0, key;
+	int i, num_elements;
+
+	num_elements = hna_buff_len / sizeof(struct hna_element);
+
+	for (i = 0; i < num_elements; i++) {
+		key = ntohl(buff[i].addr) ^ (buff[i].netmask * 0x9e3779b1);
 
-		add_del_route(hna_element->addr, hna_element->netmask, hna_global_entry->curr_orig_node->router->addr,
-					hna_global_entry->curr_orig_node->router->if_incoming->addr.sin_addr.s_addr,
-					hna_global_entry->curr_orig_node->router->if_incoming->if_index,
-					hna_global_entry->curr_orig_node->router->if_incoming->dev,
-					BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+		key ^= key >> 16;
+		key *= 0x85ebca6b;
+		key ^= key >> 13;
+		key *= 0xc2b2ae35;
+		key ^= key >> 16;
+
+		hash += key;
 	}
 
-	add_del_route(hna_element->addr, hna_element->netmask, orig_node->router->addr,
-				orig_node->router->if_incoming->addr.sin_addr.s_addr,
-				orig_node->router->if_incoming->if_index,
-				orig_node->router->if_incoming->dev,
-				BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+	return hash + num_elements;
+}
 
-	/* if no alternative route is available remove the HNA entry completely */
-	if (!hna_global_entry->curr_orig_node) {
-		hash_remove(hna_global_hash, hna_element);
-		debugFree(hna_global_entry, 1708);
+/* equal hashes are only a hint - compare a sorted copy of the new set with the stored one */
+static int hna_buff_equal(struct orig_node *orig_node, unsigned char *new_hna, int32_t new_hna_len)
+{
+	if (hna_cmp_buff_len < new_hna_len) {
+		hna_cmp_buff = (hna_cmp_buff ? debugRealloc(hna_cmp_buff, new_hna_len, 713) : debugMalloc(new_hna_len, 713));
+		hna_cmp_buff_len = new_hna_len;
 	}
+
+	memcpy(hna_cmp_buff, new_hna, new_hna_len);
+	qsort(hna_cmp_buff, new_hna_len / sizeof(struct hna_element), sizeof(struct hna_element), hna_element_cmp);
+
+	return (memcmp(hna_cmp_buff, orig_node->hna_buff, new_hna_len) == 0);
 }
 
-/* hna_buff_delete searches in buf if element e is found.
- *
- * if found, delete it from the buf and return 1.
- * if not found, return 0.
+/* copy the announced networks into the orig node - kept sorted for hna_buff_merge() */
+static void hna_buff_store(struct orig_node *orig_node, unsigned char *new_hna, int32_t new_hna_len, uint32_t new_hna_hash, int tag)
+{
+	orig_node->hna_buff = debugMalloc(new_hna_len, tag);
+	orig_node->hna_buff_len = new_hna_len;
+	orig_node->hna_hash = new_hna_hash;
+	memcpy(orig_node->hna_buff, new_hna, new_hna_len);
+
+	qsort(orig_node->hna_buff, new_hna_len / sizeof(struct hna_element), sizeof(struct hna_element), hna_element_cmp);
+}
+
+/**
+ * hna_buff_merge walks both sorted buffers at once and adds (ROUTE_ADD) the
+ * networks only found in new_buff or deletes (ROUTE_DEL) the networks only
+ * found in old_buff. duplicated announcements are skipped.
  */
-static int hna_buff_delete(struct hna_element *buf, int *buf_len, struct hna_element *e)
+static void hna_buff_merge(struct orig_node *orig_node, struct hna_element *old_buff, int old_num,
+			   struct hna_element *new_buff, int new_num, int8_t route_action)
 {
-	int i;
-	int num_elements;
+	struct hna_element *e;
+	int i = 0, j = 0, cmp;
 
-	if (buf == NULL)
-		return 0;
+	while ((i < old_num) || (j < new_num)) {
 
-	/* align to multiple of sizeof(struct hna_element) */
-	num_elements = *buf_len / sizeof(struct hna_element);
+		if (i >= old_num)
+			cmp = 1;
+		else if (j >= new_num)
+			cmp = -1;
+		else
+			cmp = hna_element_cmp(&old_buff[i], &new_buff[j]);
 
-	for (i = 0; i < num_elements; i++) {
+		e = (cmp < 0 ? &old_buff[i] : &new_buff[j]);
 
-		if (memcmp(&buf[i], e, sizeof(struct hna_element)) == 0) {
+		if ((e->netmask > 0) && (e->netmask <= 32)) {
+			if ((cmp < 0) && (route_action == ROUTE_DEL))
+				_hna_global_del(orig_node, e);
+			else if ((cmp > 0) && (route_action == ROUTE_ADD))
+				_hna_global_add(orig_node, e);
+		}
 
-			/* move last element forward */
-			memmove(&buf[i], &buf[num_elements - 1], sizeof(struct hna_element));
-			*buf_len -= sizeof(struct hna_element);
+		if (cmp <= 0) {
+			for (i++; (i < old_num) && (hna_element_cmp(&old_buff[i - 1], &old_buff[i]) == 0); i++);
+		}
 
-			return 1;
+		if (cmp >= 0) {
+			for (j++; (j < new_num) && (hna_element_cmp(&new_buff[j - 1], &new_buff[j]) == 0); j++);
 		}
 	}
-	return 0;
 }
 
-void hna_global_add(struct orig_node *orig_node, unsigned char *new_hna, int16_t new_hna_len)
+void hna_global_add(struct orig_node *orig_node, unsigned char *new_hna, int32_t new_hna_len)
 {
 	struct hna_element *e, *buff;
 	int i, num_elements;
@@ -495,12 +705,14 @@ void hna_global_add(struct orig_node *orig_node, unsigned char *new_hna, int16_t
 	if ((new_hna == NULL) || (new_hna_len == 0)) {
 		orig_node->hna_buff = NULL;
 		orig_node->hna_buff_len = 0;
+		orig_node->hna_hash = 0;
 		return;
 	}
 
-	orig_node->hna_buff = debugMalloc(new_hna_len, 705);
-	orig_node->hna_buff_len = new_hna_len;
-	memcpy(orig_node->hna_buff, new_hna, new_hna_len);
+	hna_buff_store(orig_node, new_hna, new_hna_len, hna_buff_hash(new_hna, new_hna_len), 705);
+
+	/* the orig lists of the global hna entries are sorted by this TQ */
+	orig_node->hna_tq = (orig_node->router ? orig_node->router->tq_avg : 0);
 
 	/* add new routes */
 	num_elements = orig_node->hna_buff_len / sizeof(struct hna_element);
@@ -532,12 +744,14 @@ void hna_global_add(struct orig_node *orig_node, unsigned char *new_hna, int16_t
  * a situation where no route is present.
  */
 void hna_global_update(struct orig_node *orig_node, unsigned char *new_hna,
-				int16_t new_hna_len, struct neigh_node *old_router)
+				int32_t new_hna_len, struct neigh_node *old_router)
 {
 	struct hna_element *e, *buff;
 	struct hna_global_entry *hna_global_entry;
-	int i, num_elements, old_hna_len;
+	int i, num_elements;
 	unsigned char *old_hna;
+	int32_t old_hna_len;
+	uint32_t new_hna_hash;
 
 	/* orig node stopped announcing any networks */
 	if ((orig_node->hna_buff) && ((new_hna == NULL) || (new_hna_len == 0))) {
@@ -575,81 +789,71 @@ void hna_global_update(struct orig_node *orig_node, unsigned char *new_hna,
 			if (hna_global_entry->curr_orig_node != orig_node)
 				continue;
 
-			add_del_route(e->addr, e->netmask, orig_node->router->addr,
+			fib_add_del_route(e->addr, e->netmask, orig_node->router->addr,
 					orig_node->router->if_incoming->addr.sin_addr.s_addr,
 					orig_node->router->if_incoming->if_index,
 					orig_node->router->if_incoming->dev,
-					BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+					BATMAN_RT_TABLE_NETWORKS, ROUTE_ADD);
 
-			add_del_route(e->addr, e->netmask, old_router->addr,
+			fib_add_del_route(e->addr, e->netmask, old_router->addr,
 				old_router->if_incoming->addr.sin_addr.s_addr,
 				old_router->if_incoming->if_index,
 				old_router->if_incoming->dev,
-				BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+				BATMAN_RT_TABLE_NETWORKS, ROUTE_DEL);
 		}
 
 		return;
 	}
 
 	/**
-	 * check if the buffers even changed. if its still the same, there is no need to
-	 * update the routes. if the router changed, then we have to update all the routes
-	 * NOTE: no NULL pointer checking here because memcmp() just returns if n == 0
+	 * check if the announced set even changed. if its still the same, there is
+	 * no need to update the routes - the order independent hash of the sets
+	 * rejects most changes quickly, equal hashes are confirmed byte by byte
 	 */
-	if ((orig_node->hna_buff_len == new_hna_len) && (memcmp(orig_node->hna_buff, new_hna, new_hna_len) == 0))
+	new_hna_hash = hna_buff_hash(new_hna, new_hna_len);
+
+	if ((orig_node->hna_buff_len == new_hna_len) && (orig_node->hna_hash == new_hna_hash) &&
+	    (hna_buff_equal(orig_node, new_hna, new_hna_len)))
 		return;	/* nothing to do */
 
 	/* changed HNA */
 	old_hna = orig_node->hna_buff;
 	old_hna_len = orig_node->hna_buff_len;
 
-	orig_node->hna_buff = debugMalloc(new_hna_len, 706);
-	orig_node->hna_buff_len = new_hna_len;
-	memcpy(orig_node->hna_buff, new_hna, new_hna_len);
-
-	/* add new routes and keep old routes */
-	num_elements = orig_node->hna_buff_len / sizeof(struct hna_element);
-	buff = (struct hna_element *)orig_node->hna_buff;
+	hna_buff_store(orig_node, new_hna, new_hna_len, new_hna_hash, 706);
 
-	for (i = 0; i < num_elements; i++) {
-		e = &buff[i];
-
-		/**
-		 * if the router is the same, and the announcement was already in the old
-		 * buffer, we can keep the route.
-		 */
-		if (hna_buff_delete((struct hna_element *)old_hna, &old_hna_len, e) == 0) {
-			/* not found / deleted, need to add this new route */
-			if ((e->netmask > 0) && (e->netmask <= 32))
-				_hna_global_add(orig_node, e);
-		}
-	}
-
-	/* old routes which are not to be kept are deleted now. */
-	num_elements = old_hna_len / sizeof(struct hna_element);
-	buff = (struct hna_element *)old_hna;
-
-	for (i = 0; i < num_elements; i++) {
-		e = &buff[i];
-
-		if ((e->netmask > 0) && (e->netmask <= 32))
-			_hna_global_del(orig_node, e);
-	}
+	/* add new routes and keep old routes - old routes which are not to be kept are deleted afterwards */
+	hna_buff_merge(orig_node, (struct hna_element *)old_hna, old_hna_len / sizeof(struct hna_element),
+		       (struct hna_element *)orig_node->hna_buff, orig_node->hna_buff_len / sizeof(struct hna_element), ROUTE_ADD);
+	hna_buff_merge(orig_node, (struct hna_element *)old_hna, old_hna_len / sizeof(struct hna_element),
+		       (struct hna_element *)orig_node->hna_buff, orig_node->hna_buff_len / sizeof(struct hna_element), ROUTE_DEL);
 
 	/* dispose old hna buffer now. */
-	if (old_hna != NULL)
-		debugFree(old_hna, 1704);
+	debugFree(old_hna, 1704);
 }
 
+/**
+ * hna_global_check_tq() moves the orig node to its new position in the
+ * orig lists of the announced networks once its TQ changed - lists in
+ * which the new TQ still fits between its neighbours are left alone and
+ * routes only change where the orig node takes over or loses the head
+ */
 void hna_global_check_tq(struct orig_node *orig_node)
 {
 	struct hna_element *e, *buff;
 	struct hna_global_entry *hna_global_entry;
+	struct hna_orig_ptr *hna_orig_ptr, *prev_ptr;
+	struct list_head *list_pos, *list_head;
 	int i, num_elements;
 
-	if ((orig_node->hna_buff == NULL) || (orig_node->hna_buff_len == 0))
+	if ((orig_node->hna_buff == NULL) || (orig_node->hna_buff_len == 0) || (orig_node->router == NULL))
+		return;
+
+	if (orig_node->hna_tq == orig_node->router->tq_avg)
 		return;
 
+	orig_node->hna_tq = orig_node->router->tq_avg;
+
 	num_elements = orig_node->hna_buff_len / sizeof(struct hna_element);
 	buff = (struct hna_element *)orig_node->hna_buff;
 
@@ -664,35 +868,31 @@ void hna_global_check_tq(struct orig_node *orig_node)
 		if (!hna_global_entry)
 			continue;
 
-		/* if the given orig node is not in use no routes need to change */
-		if (hna_global_entry->curr_orig_node == orig_node)
+		list_head = (struct list_head *)&hna_global_entry->orig_list;
+		hna_orig_ptr = prev_ptr = NULL;
+
+		list_for_each(list_pos, &hna_global_entry->orig_list) {
+			if (list_entry(list_pos, struct hna_orig_ptr, list)->orig_node == orig_node) {
+				hna_orig_ptr = list_entry(list_pos, struct hna_orig_ptr, list);
+				break;
+			}
+
+			prev_ptr = list_entry(list_pos, struct hna_orig_ptr, list);
+		}
+
+		if (!hna_orig_ptr)
 			continue;
 
-		/* the TQ value has to better than the currently selected orig node */
-		if (hna_global_entry->curr_orig_node->router->tq_avg > orig_node->router->tq_avg)
+		/* the order does not change - neither does the best candidate */
+		if (((prev_ptr == NULL) || (prev_ptr->orig_node->hna_tq >= orig_node->hna_tq)) &&
+		    ((list_pos->next == list_head) ||
+		     (list_entry(list_pos->next, struct hna_orig_ptr, list)->orig_node->hna_tq <= orig_node->hna_tq)))
 			continue;
 
-		/**
-		 * if we change the orig node towards the HNA we may still route via the same next hop
-		 * which does not require any routing table changes
-		 */
-		if (hna_global_entry->curr_orig_node->router->addr == orig_node->router->addr)
-			goto set_orig_node;
-
-		add_del_route(e->addr, e->netmask, orig_node->router->addr,
-				orig_node->router->if_incoming->addr.sin_addr.s_addr,
-				orig_node->router->if_incoming->if_index,
-				orig_node->router->if_incoming->dev,
-				BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_ADD);
-
-		add_del_route(e->addr, e->netmask, hna_global_entry->curr_orig_node->router->addr,
-			hna_global_entry->curr_orig_node->router->if_incoming->addr.sin_addr.s_addr,
-			hna_global_entry->curr_orig_node->router->if_incoming->if_index,
-			hna_global_entry->curr_orig_node->router->if_incoming->dev,
-			BATMAN_RT_TABLE_NETWORKS, ROUTE_TYPE_UNICAST, ROUTE_DEL);
-
-set_orig_node:
-		hna_global_entry->curr_orig_node = orig_node;
+		list_del((prev_ptr == NULL ? list_head : &prev_ptr->list), list_pos, &hna_global_entry->orig_list);
+
+		hna_orig_ptr_insert(hna_global_entry, hna_orig_ptr);
+		hna_global_select(hna_global_entry, hna_global_entry->curr_orig_node);
 	}
 }
 
@@ -719,6 +919,13 @@ void hna_global_del(struct orig_node *orig_node)
 	debugFree(orig_node->hna_buff, 1709);
 	orig_node->hna_buff = NULL;
 	orig_node->hna_buff_len = 0;
+	orig_node->hna_hash = 0;
+}
+
+/* walks the announced networks of other nodes - same semantics as hash_iterate() */
+struct hash_it_t *hna_global_iterate(struct hash_it_t *iter)
+{
+	return hash_iterate(hna_global_hash, iter);
 }
 
 static void _hna_global_hash_del(void *data)
@@ -751,9 +958,21 @@ void hna_free(void)
 		debugFree(hna_local_entry, 1705);
 	}
 
+	nat_rules_flush();
+
+	/* the entries were freed above */
+	if (hna_local_hash != NULL)
+		hash_delete(hna_local_hash, NULL);
+
 	if (hna_buff_local != NULL)
 		debugFree(hna_buff_local, 1706);
 
+	if (hna_cmp_buff != NULL)
+		debugFree(hna_cmp_buff, 1713);
+
+	hna_cmp_buff = NULL;
+	hna_cmp_buff_len = 0;
+
 	num_hna_local = 0;
 	hna_buff_local = NULL;
 
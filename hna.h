@@ -25,7 +25,7 @@
 
 
 extern unsigned char *hna_buff_local;
-extern uint8_t num_hna_local;
+extern uint16_t num_hna_local;
 
 /* we print the announced hna over the unix socket */
 extern struct list_head_first hna_list;
@@ -39,6 +39,9 @@ struct hna_element
 	uint8_t  netmask;
 } __attribute__((packed));
 
+/* announced networks which fit into the own OGM */
+#define MAX_HNA_OGM ((MAX_AGGREGATION_BYTES - sizeof(struct bat_packet)) / sizeof(struct hna_element))
+
 struct hna_task
 {
 	struct list_head list;
@@ -72,13 +75,15 @@ void hna_init(void);
 void hna_free(void);
 void hna_local_task_add_ip(uint32_t ip_addr, uint16_t netmask, uint8_t route_action);
 void hna_local_task_add_str(char *hna_string, uint8_t route_action, uint8_t runtime);
+int hna_local_task_add_bulk(char *bulk_string);
 void hna_local_task_exec(void);
 
-unsigned char *hna_local_update_vis_packet(unsigned char *vis_packet, uint16_t *vis_packet_size);
 void hna_local_update_routes(struct hna_local_entry *hna_local_entry, int8_t route_action);
 
-void hna_global_add(struct orig_node *orig_node, unsigned char *new_hna, int16_t new_hna_len);
+uint32_t hna_buff_hash(unsigned char *hna_buff, int32_t hna_buff_len);
+void hna_global_add(struct orig_node *orig_node, unsigned char *new_hna, int32_t new_hna_len);
 void hna_global_update(struct orig_node *orig_node, unsigned char *new_hna,
-				int16_t new_hna_len, struct neigh_node *old_router);
+				int32_t new_hna_len, struct neigh_node *old_router);
 void hna_global_check_tq(struct orig_node *orig_node);
 void hna_global_del(struct orig_node *orig_node);
+struct hash_it_t *hna_global_iterate(struct hash_it_t *iter);
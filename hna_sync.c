@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * versioned distribution of the announced networks (--hna-sync)
+ *
+ * Instead of the announced networks the own OGMs only carry a reference
+ * element: the hash of the announced set and HNA_SYNC_REF_NETMASK as
+ * netmask (which is ignored by nodes not knowing this mode). A node
+ * seeing a hash which differs from the set it knows asks the originator
+ * via unicast for the set. The originator answers with the changes since
+ * the set the requester knows (if it still remembers that set) or with
+ * the full set, split into chunks of HNA_SYNC_CHUNK_ELEMENTS networks.
+ * The assembled set has to match the announced hash before it is used.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "originator.h"
+#include "hna.h"
+#include "hna_sync.h"
+
+
+struct hna_sync_set {
+	uint32_t hash;
+	int32_t num_elements;
+	struct hna_element *buff;          /* sorted */
+};
+
+struct hna_sync_transfer {
+	uint32_t orig;                     /* key - has to be the first member */
+	uint32_t wanted;                   /* hash announced by the originator */
+	uint32_t requested;                /* when the set was requested the last time */
+	uint32_t last_used;
+	uint8_t pending;
+	uint8_t need_full;                 /* the last delta did not apply - request the full set */
+	uint8_t type;                      /* update being assembled */
+	uint32_t hash;
+	uint32_t base_hash;
+	uint16_t num_chunks;
+	uint16_t chunks_received;
+	uint16_t total_elements;
+	uint8_t *chunk_bits;
+	struct hna_element *buff;
+};
+
+/* hna_sync_sets[0] is the set we announce, the others are its predecessors */
+static struct hna_sync_set hna_sync_sets[HNA_SYNC_HISTORY + 1];
+static struct hashtable_t *hna_sync_hash = NULL;
+static uint32_t hna_sync_full_received = 0, hna_sync_delta_received = 0, hna_sync_packets_sent = 0;
+
+
+
+static int hna_sync_element_cmp(const void *data1, const void *data2)
+{
+	return memcmp(data1, data2, sizeof(struct hna_element));
+}
+
+void hna_sync_local_update(unsigned char *hna_buff, int32_t num_elements)
+{
+	uint32_t hash = hna_buff_hash(hna_buff, num_elements * sizeof(struct hna_element));
+
+	if ((hash == hna_sync_sets[0].hash) && (num_elements == hna_sync_sets[0].num_elements))
+		return;
+
+	if (hna_sync_sets[HNA_SYNC_HISTORY].buff != NULL)
+		debugFree(hna_sync_sets[HNA_SYNC_HISTORY].buff, 1911);
+
+	memmove(&hna_sync_sets[1], &hna_sync_sets[0], HNA_SYNC_HISTORY * sizeof(struct hna_sync_set));
+
+	hna_sync_sets[0].hash = hash;
+	hna_sync_sets[0].num_elements = num_elements;
+	hna_sync_sets[0].buff = NULL;
+
+	if (num_elements > 0) {
+		hna_sync_sets[0].buff = debugMalloc(num_elements * sizeof(struct hna_element), 911);
+		memcpy(hna_sync_sets[0].buff, hna_buff, num_elements * sizeof(struct hna_element));
+		qsort(hna_sync_sets[0].buff, num_elements, sizeof(struct hna_element), hna_sync_element_cmp);
+	}
+
+	debug_output(4, "HNA sync: announced set changed (%i networks, hash %08x)\n", num_elements, hash);
+}
+
+/* writes the reference element of the own OGM */
+int8_t hna_sync_fill_ref(unsigned char *buff)
+{
+	struct hna_element hna_element;
+
+	if (hna_sync_sets[0].num_elements == 0)
+		return 0;
+
+	hna_element.addr = htonl(hna_sync_sets[0].hash);
+	hna_element.netmask = HNA_SYNC_REF_NETMASK;
+	memcpy(buff, &hna_element, sizeof(struct hna_element));
+
+	return 1;
+}
+
+/**
+ * hna_sync_recv_ref() remembers the announced hash and replaces the reference
+ * element of a received OGM with the set we already know of the originator
+ */
+void hna_sync_recv_ref(struct orig_node *orig_node, unsigned char **hna_recv_buff, int32_t *hna_buff_len)
+{
+	struct hna_element *hna_element = (struct hna_element *)*hna_recv_buff;
+
+	if (!hna_sync)
+		return;
+
+	if ((*hna_recv_buff == NULL) || (*hna_buff_len != sizeof(struct hna_element)) ||
+	    (hna_element->netmask != HNA_SYNC_REF_NETMASK)) {
+		orig_node->hna_sync_hash = 0;
+		return;
+	}
+
+	orig_node->hna_sync_hash = ntohl(hna_element->addr);
+
+	*hna_recv_buff = orig_node->hna_buff;
+	*hna_buff_len = orig_node->hna_buff_len;
+}
+
+static void hna_sync_transfer_reset(struct hna_sync_transfer *hna_sync_transfer)
+{
+	if (hna_sync_transfer->chunk_bits != NULL)
+		debugFree(hna_sync_transfer->chunk_bits, 1912);
+
+	if (hna_sync_transfer->buff != NULL)
+		debugFree(hna_sync_transfer->buff, 1913);
+
+	hna_sync_transfer->chunk_bits = NULL;
+	hna_sync_transfer->buff = NULL;
+	hna_sync_transfer->num_chunks = hna_sync_transfer->chunks_received = 0;
+}
+
+static void hna_sync_transfer_free(void *data)
+{
+	hna_sync_transfer_reset(data);
+	debugFree(data, 1914);
+}
+
+static void hna_sync_send(struct hna_sync_packet *hna_sync_packet, int32_t num_elements, uint32_t addr, uint16_t port)
+{
+	struct sockaddr_in sin;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = addr;
+	sin.sin_port = port;
+
+	if (send_udp_packet((unsigned char *)hna_sync_packet, sizeof(struct hna_sync_packet) + num_elements * sizeof(struct hna_element),
+			    &sin, hna_sync_sock, NULL) == 0)
+		hna_sync_packets_sent++;
+}
+
+/* asks the originator for its announced networks if we don't know the announced set */
+void hna_sync_check(struct orig_node *orig_node, uint32_t curr_time)
+{
+	struct hna_sync_transfer *hna_sync_transfer;
+	struct hna_sync_packet hna_sync_packet;
+	struct hashtable_t *swaphash;
+
+	if ((!hna_sync) || (orig_node->hna_sync_hash == 0) || (orig_node->router == NULL))
+		return;
+
+	if ((orig_node->hna_buff != NULL) && (orig_node->hna_hash == orig_node->hna_sync_hash))
+		return;
+
+	if (hna_sync_hash == NULL) {
+		if (NULL == (hna_sync_hash = hash_new(32, compare_orig, choose_orig)))
+			return;
+	}
+
+	hna_sync_transfer = hash_find(hna_sync_hash, &orig_node->orig);
+
+	if (hna_sync_transfer == NULL) {
+		hna_sync_transfer = debugMalloc(sizeof(struct hna_sync_transfer), 912);
+		memset(hna_sync_transfer, 0, sizeof(struct hna_sync_transfer));
+		hna_sync_transfer->orig = orig_node->orig;
+
+		hash_add(hna_sync_hash, hna_sync_transfer);
+
+		if (hna_sync_hash->elements * 4 > hna_sync_hash->size) {
+			swaphash = hash_resize(hna_sync_hash, hna_sync_hash->size * 2);
+
+			if (swaphash == NULL)
+				debug_output(0, "Couldn't resize hna sync hash table \n");
+			else
+				hna_sync_hash = swaphash;
+		}
+	}
+
+	hna_sync_transfer->last_used = curr_time;
+
+	/* the request is still on its way */
+	if ((hna_sync_transfer->pending) && (hna_sync_transfer->wanted == orig_node->hna_sync_hash) &&
+	    ((int)(curr_time - (hna_sync_transfer->requested + HNA_SYNC_TIMEOUT)) < 0))
+		return;
+
+	hna_sync_transfer_reset(hna_sync_transfer);
+	hna_sync_transfer->wanted = orig_node->hna_sync_hash;
+	hna_sync_transfer->requested = curr_time;
+	hna_sync_transfer->pending = 1;
+
+	memset(&hna_sync_packet, 0, sizeof(hna_sync_packet));
+	hna_sync_packet.version = HNA_SYNC_VERSION;
+	hna_sync_packet.type = HNA_SYNC_REQUEST;
+	hna_sync_packet.orig = orig_node->orig;
+	hna_sync_packet.hash = htonl(orig_node->hna_sync_hash);
+
+	if ((orig_node->hna_buff != NULL) && (!hna_sync_transfer->need_full))
+		hna_sync_packet.base_hash = htonl(orig_node->hna_hash);
+
+	debug_output(4, "HNA sync: requesting announced networks (hash %08x, known %08x)\n",
+		     orig_node->hna_sync_hash, ntohl(hna_sync_packet.base_hash));
+
+	hna_sync_send(&hna_sync_packet, 0, orig_node->orig, htons(HNA_SYNC_PORT));
+}
+
+/* answers a request with the changes since the known set or with the full set */
+static void hna_sync_respond(struct hna_sync_packet *request, struct sockaddr_in *addr)
+{
+	unsigned char packet_buff[sizeof(struct hna_sync_packet) + HNA_SYNC_CHUNK_ELEMENTS * sizeof(struct hna_element)];
+	struct hna_sync_packet *hna_sync_packet = (struct hna_sync_packet *)packet_buff;
+	struct hna_sync_set *curr_set = &hna_sync_sets[0], *base_set = NULL;
+	struct hna_element *buff = curr_set->buff, *delta = NULL;
+	int32_t i = 0, j = 0, num_elements = curr_set->num_elements, num_delta = 0, chunk, num_chunks, chunk_elements;
+	uint32_t base_hash = ntohl(request->base_hash);
+	int cmp;
+
+	if (base_hash != 0) {
+		for (i = 0; i <= HNA_SYNC_HISTORY; i++) {
+			if ((hna_sync_sets[i].hash == base_hash) && ((i == 0) || (hna_sync_sets[i].num_elements > 0))) {
+				base_set = &hna_sync_sets[i];
+				break;
+			}
+		}
+	}
+
+	/* sorted merge of the known and the current set */
+	if (base_set != NULL) {
+		delta = debugMalloc((base_set->num_elements + curr_set->num_elements + 1) * sizeof(struct hna_element), 913);
+		i = j = 0;
+
+		while ((i < base_set->num_elements) || (j < curr_set->num_elements)) {
+
+			if (i >= base_set->num_elements)
+				cmp = 1;
+			else if (j >= curr_set->num_elements)
+				cmp = -1;
+			else
+				cmp = hna_sync_element_cmp(&base_set->buff[i], &curr_set->buff[j]);
+
+			if (cmp < 0) {
+				delta[num_delta] = base_set->buff[i];
+				delta[num_delta++].netmask |= HNA_SYNC_DEL_FLAG;
+			} else if (cmp > 0) {
+				delta[num_delta++] = curr_set->buff[j];
+			}
+
+			if (cmp <= 0)
+				i++;
+
+			if (cmp >= 0)
+				j++;
+		}
+
+		if (num_delta < curr_set->num_elements) {
+			buff = delta;
+			num_elements = num_delta;
+		} else {
+			base_set = NULL;
+		}
+	}
+
+	num_chunks = (num_elements > 0 ? (num_elements + HNA_SYNC_CHUNK_ELEMENTS - 1) / HNA_SYNC_CHUNK_ELEMENTS : 1);
+
+	for (chunk = 0; chunk < num_chunks; chunk++) {
+
+		chunk_elements = num_elements - chunk * HNA_SYNC_CHUNK_ELEMENTS;
+
+		if (chunk_elements > HNA_SYNC_CHUNK_ELEMENTS)
+			chunk_elements = HNA_SYNC_CHUNK_ELEMENTS;
+
+		memset(hna_sync_packet, 0, sizeof(struct hna_sync_packet));
+		hna_sync_packet->version = HNA_SYNC_VERSION;
+		hna_sync_packet->type = (base_set != NULL ? HNA_SYNC_DELTA : HNA_SYNC_FULL);
+		hna_sync_packet->chunk = htons(chunk);
+		hna_sync_packet->num_chunks = htons(num_chunks);
+		hna_sync_packet->num_elements = htons(chunk_elements);
+		hna_sync_packet->total_elements = htons(num_elements);
+		hna_sync_packet->orig = ((struct batman_if *)if_list.next)->addr.sin_addr.s_addr;
+		hna_sync_packet->hash = htonl(curr_set->hash);
+		hna_sync_packet->base_hash = (base_set != NULL ? htonl(base_set->hash) : 0);
+
+		if (chunk_elements > 0)
+			memcpy(packet_buff + sizeof(struct hna_sync_packet), &buff[chunk * HNA_SYNC_CHUNK_ELEMENTS],
+			       chunk_elements * sizeof(struct hna_element));
+
+		hna_sync_send(hna_sync_packet, chunk_elements, addr->sin_addr.s_addr, addr->sin_port);
+	}
+
+	if (delta != NULL)
+		debugFree(delta, 1915);
+}
+
+/* hands the assembled set to the global hna code if it matches the announced hash */
+static void hna_sync_apply(struct hna_sync_transfer *hna_sync_transfer)
+{
+	struct orig_node *orig_node;
+	struct hna_element *new_buff = NULL, *old_buff, *added, removed;
+	int32_t i, j, num_elements = 0, num_added = 0, num_old;
+	char orig_str[ADDR_STR_LEN];
+
+	orig_node = hash_find(orig_hash, &hna_sync_transfer->orig);
+
+	if ((orig_node == NULL) || (orig_node->router == NULL))
+		goto reset;
+
+	addr_to_string(orig_node->orig, orig_str, sizeof(orig_str));
+
+	if (hna_sync_transfer->type == HNA_SYNC_DELTA) {
+
+		/* the delta is based on a set we don't have (anymore) */
+		if ((orig_node->hna_buff == NULL) || (orig_node->hna_hash != hna_sync_transfer->base_hash)) {
+			hna_sync_transfer->need_full = 1;
+			goto reset;
+		}
+
+		old_buff = (struct hna_element *)orig_node->hna_buff;
+		num_old = orig_node->hna_buff_len / sizeof(struct hna_element);
+		new_buff = debugMalloc((num_old + hna_sync_transfer->total_elements + 1) * sizeof(struct hna_element), 914);
+
+		/* the added networks are collected behind the space of the old set */
+		added = &new_buff[num_old];
+
+		for (i = 0; i < hna_sync_transfer->total_elements; i++) {
+			if (hna_sync_transfer->buff[i].netmask & HNA_SYNC_DEL_FLAG)
+				continue;
+
+			added[num_added++] = hna_sync_transfer->buff[i];
+		}
+
+		/* both the old set and the delta are sorted - a wrong delta is caught by the hash check */
+		for (i = 0, j = 0; i < num_old; i++) {
+
+			while (j < hna_sync_transfer->total_elements) {
+				removed = hna_sync_transfer->buff[j];
+				removed.netmask &= ~HNA_SYNC_DEL_FLAG;
+
+				if (hna_sync_element_cmp(&removed, &old_buff[i]) >= 0)
+					break;
+
+				j++;
+			}
+
+			if ((j < hna_sync_transfer->total_elements) && (hna_sync_transfer->buff[j].netmask & HNA_SYNC_DEL_FLAG) &&
+			    (hna_sync_element_cmp(&removed, &old_buff[i]) == 0))
+				continue;
+
+			new_buff[num_elements++] = old_buff[i];
+		}
+
+		memmove(&new_buff[num_elements], added, num_added * sizeof(struct hna_element));
+		num_elements += num_added;
+
+	} else {
+
+		num_elements = hna_sync_transfer->total_elements;
+		new_buff = hna_sync_transfer->buff;
+		hna_sync_transfer->buff = NULL;
+
+	}
+
+	if (hna_buff_hash((unsigned char *)new_buff, num_elements * sizeof(struct hna_element)) != hna_sync_transfer->hash) {
+		debug_output(3, "HNA sync: received set of %s does not match its hash - requesting the full set\n", orig_str);
+		hna_sync_transfer->need_full = 1;
+		goto reset;
+	}
+
+	debug_output(4, "HNA sync: %s update of %s applied (%i networks)\n",
+		     (hna_sync_transfer->type == HNA_SYNC_DELTA ? "delta" : "full"), orig_str, num_elements);
+
+	if (hna_sync_transfer->type == HNA_SYNC_DELTA)
+		hna_sync_delta_received++;
+	else
+		hna_sync_full_received++;
+
+	hna_sync_transfer->need_full = 0;
+	hna_global_update(orig_node, (num_elements > 0 ? (unsigned char *)new_buff : NULL),
+			  num_elements * sizeof(struct hna_element), orig_node->router);
+
+reset:
+	if (new_buff != NULL)
+		debugFree(new_buff, 1916);
+
+	hna_sync_transfer_reset(hna_sync_transfer);
+	hna_sync_transfer->pending = 0;
+}
+
+/* an update has to come from the originator itself or from one of the neighbours we receive its OGMs from */
+static int8_t hna_sync_sender_valid(uint32_t orig, uint32_t sender)
+{
+	struct list_head *list_pos;
+	struct orig_node *orig_node;
+	struct neigh_node *neigh_node;
+
+	if (sender == orig)
+		return 1;
+
+	orig_node = hash_find(orig_hash, &orig);
+
+	if (orig_node == NULL)
+		return 0;
+
+	list_for_each(list_pos, &orig_node->neigh_list) {
+
+		neigh_node = list_entry(list_pos, struct neigh_node, list);
+
+		if (neigh_node->addr == sender)
+			return 1;
+
+	}
+
+	return 0;
+}
+
+static void hna_sync_recv_update(struct hna_sync_packet *hna_sync_packet, int32_t packet_len, struct sockaddr_in *addr)
+{
+	struct hna_sync_transfer *hna_sync_transfer;
+	uint16_t chunk, num_chunks, num_elements, total_elements, expected;
+	uint32_t hash, base_hash;
+	char orig_str[ADDR_STR_LEN], sender_str[ADDR_STR_LEN];
+
+	if (hna_sync_hash == NULL)
+		return;
+
+	if (!hna_sync_sender_valid(hna_sync_packet->orig, addr->sin_addr.s_addr)) {
+
+		addr_to_string(hna_sync_packet->orig, orig_str, sizeof(orig_str));
+		addr_to_string(addr->sin_addr.s_addr, sender_str, sizeof(sender_str));
+		debug_output(4, "HNA sync: dropping update for %s sent by %s - neither the originator nor one of its neighbours\n", orig_str, sender_str);
+		return;
+
+	}
+
+	hna_sync_transfer = hash_find(hna_sync_hash, &hna_sync_packet->orig);
+
+	if ((hna_sync_transfer == NULL) || (!hna_sync_transfer->pending))
+		return;
+
+	chunk = ntohs(hna_sync_packet->chunk);
+	num_chunks = ntohs(hna_sync_packet->num_chunks);
+	num_elements = ntohs(hna_sync_packet->num_elements);
+	total_elements = ntohs(hna_sync_packet->total_elements);
+	hash = ntohl(hna_sync_packet->hash);
+	base_hash = ntohl(hna_sync_packet->base_hash);
+
+	expected = (total_elements > 0 ? (total_elements + HNA_SYNC_CHUNK_ELEMENTS - 1) / HNA_SYNC_CHUNK_ELEMENTS : 1);
+
+	if ((num_chunks != expected) || (chunk >= num_chunks))
+		return;
+
+	expected = (chunk == num_chunks - 1 ? total_elements - chunk * HNA_SYNC_CHUNK_ELEMENTS : HNA_SYNC_CHUNK_ELEMENTS);
+
+	if ((num_elements != expected) || (packet_len != (int32_t)(sizeof(struct hna_sync_packet) + num_elements * sizeof(struct hna_element))))
+		return;
+
+	/* first chunk of an update or the originator changed its set meanwhile */
+	if ((hna_sync_transfer->chunk_bits == NULL) || (hna_sync_transfer->type != hna_sync_packet->type) ||
+	    (hna_sync_transfer->hash != hash) || (hna_sync_transfer->base_hash != base_hash) ||
+	    (hna_sync_transfer->total_elements != total_elements)) {
+
+		hna_sync_transfer_reset(hna_sync_transfer);
+
+		hna_sync_transfer->type = hna_sync_packet->type;
+		hna_sync_transfer->hash = hash;
+		hna_sync_transfer->base_hash = base_hash;
+		hna_sync_transfer->total_elements = total_elements;
+		hna_sync_transfer->num_chunks = num_chunks;
+		hna_sync_transfer->chunk_bits = debugMalloc(num_chunks, 915);
+		memset(hna_sync_transfer->chunk_bits, 0, num_chunks);
+		hna_sync_transfer->buff = debugMalloc((total_elements + 1) * sizeof(struct hna_element), 916);
+		memset(hna_sync_transfer->buff, 0, (total_elements + 1) * sizeof(struct hna_element));
+	}
+
+	if (hna_sync_transfer->chunk_bits[chunk])
+		return;
+
+	memcpy(&hna_sync_transfer->buff[chunk * HNA_SYNC_CHUNK_ELEMENTS], hna_sync_packet + 1, num_elements * sizeof(struct hna_element));
+	hna_sync_transfer->chunk_bits[chunk] = 1;
+	hna_sync_transfer->chunks_received++;
+
+	if (hna_sync_transfer->chunks_received == hna_sync_transfer->num_chunks)
+		hna_sync_apply(hna_sync_transfer);
+}
+
+void hna_sync_recv_packet(unsigned char *packet_buff, int32_t packet_len, struct sockaddr_in *addr, uint32_t BATMANUNUSED(curr_time))
+{
+	struct hna_sync_packet *hna_sync_packet = (struct hna_sync_packet *)packet_buff;
+
+	if ((!hna_sync) || (packet_len < (int32_t)sizeof(struct hna_sync_packet)) || (hna_sync_packet->version != HNA_SYNC_VERSION))
+		return;
+
+	switch (hna_sync_packet->type) {
+	case HNA_SYNC_REQUEST:
+		hna_sync_respond(hna_sync_packet, addr);
+		break;
+	case HNA_SYNC_FULL:
+	case HNA_SYNC_DELTA:
+		hna_sync_recv_update(hna_sync_packet, packet_len, addr);
+		break;
+	}
+}
+
+void hna_sync_purge(uint32_t curr_time)
+{
+	struct hash_it_t *hashit = NULL;
+	struct hna_sync_transfer *hna_sync_transfer;
+
+	if (hna_sync_hash == NULL)
+		return;
+
+	while (NULL != (hashit = hash_iterate(hna_sync_hash, hashit))) {
+
+		hna_sync_transfer = hashit->bucket->data;
+
+		if ((int)(curr_time - (hna_sync_transfer->last_used + HNA_SYNC_PURGE_TIMEOUT)) <= 0)
+			continue;
+
+		hash_remove_bucket(hna_sync_hash, hashit);
+		hna_sync_transfer_free(hna_sync_transfer);
+	}
+}
+
+void hna_sync_get_stats(uint32_t *transfers, uint32_t *full, uint32_t *delta, uint32_t *sent)
+{
+	*transfers = (hna_sync_hash != NULL ? hna_sync_hash->elements : 0);
+	*full = hna_sync_full_received;
+	*delta = hna_sync_delta_received;
+	*sent = hna_sync_packets_sent;
+}
+
+void hna_sync_free(void)
+{
+	int i;
+
+	if (hna_sync_hash != NULL)
+		hash_delete(hna_sync_hash, hna_sync_transfer_free);
+
+	hna_sync_hash = NULL;
+
+	for (i = 0; i <= HNA_SYNC_HISTORY; i++) {
+		if (hna_sync_sets[i].buff != NULL)
+			debugFree(hna_sync_sets[i].buff, 1917);
+	}
+
+	memset(hna_sync_sets, 0, sizeof(hna_sync_sets));
+}
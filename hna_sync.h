@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_HNA_SYNC_H
+#define _BATMAN_HNA_SYNC_H
+
+#include "batman.h"
+
+
+/* announced networks per update packet */
+#define HNA_SYNC_CHUNK_ELEMENTS 250
+
+/* number of previous own sets we can send deltas against */
+#define HNA_SYNC_HISTORY 4
+
+/* a transfer is requested again if it did not complete within this time */
+#define HNA_SYNC_TIMEOUT 2000
+
+/* unused transfers are dropped after this time */
+#define HNA_SYNC_PURGE_TIMEOUT 10000
+
+
+void hna_sync_local_update(unsigned char *hna_buff, int32_t num_elements);
+int8_t hna_sync_fill_ref(unsigned char *buff);
+void hna_sync_recv_ref(struct orig_node *orig_node, unsigned char **hna_recv_buff, int32_t *hna_buff_len);
+void hna_sync_check(struct orig_node *orig_node, uint32_t curr_time);
+void hna_sync_recv_packet(unsigned char *packet_buff, int32_t packet_len, struct sockaddr_in *addr, uint32_t curr_time);
+void hna_sync_purge(uint32_t curr_time);
+void hna_sync_get_stats(uint32_t *transfers, uint32_t *full, uint32_t *delta, uint32_t *sent);
+void hna_sync_free(void);
+
+#endif
@@ -33,6 +33,7 @@
 
 #include "../os.h"
 #include "../batman.h"
+#include "../route_pipe.h"
 
 
 static const char *route_type_to_string[] = {
@@ -104,7 +105,10 @@ void add_del_route(uint32_t dest, uint8_t netmask, uint32_t router, uint32_t src
 	inet_ntop(AF_INET, &src_ip, str3, sizeof(str3));
 
 	if (policy_routing_script != NULL) {
-		dprintf(policy_routing_pipe, "ROUTE %s %s %s %i %s %s %i %s %i\n", (route_action == ROUTE_DEL ? "del" : "add"), route_type_to_string_script[route_type], str1, netmask, str2, str3, ifi, dev, rt_table);
+		if (policy_routing_binary)
+			route_pipe_route(dest, netmask, router, src_ip, ifi, dev, rt_table, route_type, route_action);
+		else
+			dprintf(policy_routing_pipe, "ROUTE %s %s %s %i %s %s %i %s %i\n", (route_action == ROUTE_DEL ? "del" : "add"), route_type_to_string_script[route_type], str1, netmask, str2, str3, ifi, dev, rt_table);
 		return;
 	}
 
@@ -224,7 +228,10 @@ void add_del_route(uint32_t dest, uint8_t netmask, uint32_t router, uint32_t src
 	inet_ntop(AF_INET, &src_ip, str3, sizeof(str3));
 
 	if (policy_routing_script != NULL) {
-		dprintf(policy_routing_pipe, "ROUTE %s %s %s %i %s %s %i %s %i\n", (route_action == ROUTE_DEL ? "del" : "add"), route_type_to_string_script[route_type], str1, netmask, str2, str3, ifi, dev, rt_table);
+		if (policy_routing_binary)
+			route_pipe_route(dest, netmask, router, src_ip, ifi, dev, rt_table, route_type, route_action);
+		else
+			dprintf(policy_routing_pipe, "ROUTE %s %s %s %i %s %s %i %s %i\n", (route_action == ROUTE_DEL ? "del" : "add"), route_type_to_string_script[route_type], str1, netmask, str2, str3, ifi, dev, rt_table);
 		return;
 	}
 
@@ -407,6 +414,11 @@ void add_del_rule(uint32_t network, uint8_t netmask, int8_t rt_table, uint32_t p
 	inet_ntop(AF_INET, &network, str1, sizeof (str1));
 
 	if (policy_routing_script != NULL) {
+		if (policy_routing_binary) {
+			route_pipe_rule(network, netmask, rt_table, prio, iif, rule_type, rule_action);
+			return;
+		}
+
 		dprintf(policy_routing_pipe, "RULE %s %s %s %i %s %s %u %s %i\n", (rule_action == RULE_DEL ? "del" : "add"), rule_type_to_string[rule_type], str1, netmask, "unused", "unused", prio, iif, rt_table);
 		return;
 	}
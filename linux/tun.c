@@ -31,110 +31,305 @@
 #include <linux/if.h>     /* ifr_if, ifr_tun */
 #include <sys/socket.h>
 #include <stdio.h>
-#include <stdlib.h>       /* system() */
-#include <sys/wait.h>     /* WEXITSTATUS */
+#include <stdlib.h>       /* getenv() */
+#include <string.h>
+#include <sys/wait.h>     /* waitpid() */
 
 #include "../os.h"
 #include "../batman.h"
 
-#define IPTABLES_ADD_MASQ "iptables -t nat -A POSTROUTING -o %s -j MASQUERADE"
-#define IPTABLES_DEL_MASQ "iptables -t nat -D POSTROUTING -o %s -j MASQUERADE"
+#define IPTABLES_ADD_MASQ "-A POSTROUTING -o %s -j MASQUERADE"
+#define IPTABLES_DEL_MASQ "-D POSTROUTING -o %s -j MASQUERADE"
 
-#define IPTABLES_ADD_MSS "iptables -t mangle -I POSTROUTING -p tcp --tcp-flags SYN,RST SYN -o %s -j TCPMSS --clamp-mss-to-pmtu"
-#define IPTABLES_DEL_MSS "iptables -t mangle -D POSTROUTING -p tcp --tcp-flags SYN,RST SYN -o %s -j TCPMSS --clamp-mss-to-pmtu"
+#define IPTABLES_ADD_MSS "-I POSTROUTING -p tcp --tcp-flags SYN,RST SYN -o %s -j TCPMSS --clamp-mss-to-pmtu"
+#define IPTABLES_DEL_MSS "-D POSTROUTING -p tcp --tcp-flags SYN,RST SYN -o %s -j TCPMSS --clamp-mss-to-pmtu"
 
-#define IPTABLES_ADD_ACC "iptables -t nat -I POSTROUTING -s %s/%i -j ACCEPT"
-#define IPTABLES_DEL_ACC "iptables -t nat -D POSTROUTING -s %s/%i -j ACCEPT"
+#define IPTABLES_ADD_ACC "-I POSTROUTING -s %s/%i -j ACCEPT"
+#define IPTABLES_DEL_ACC "-D POSTROUTING -s %s/%i -j ACCEPT"
 
-int run_cmd(char *cmd) {
-	int error; int pipes[2]; int stderrfd = -1; int ret = 0;
-	char error_log[256];
+#define NAT_TABLE_NAT 0
+#define NAT_TABLE_MANGLE 1
+#define NAT_TABLE_NUM 2
 
-	if (pipe(pipes) < 0) {
+#define NAT_TOOL_DEFAULT_PATH "/usr/local/sbin:/usr/sbin:/sbin"
+#define NAT_CMD_MAX_ARGS 32
+
+static const char *nat_table_names[NAT_TABLE_NUM] = {"nat", "mangle"};
+
+static char iptables_path[256] = "", iptables_restore_path[256] = "";
+
+/* rules waiting for nat_rules_flush() - one rule per line */
+static pthread_mutex_t nat_rules_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *nat_rules[NAT_TABLE_NUM] = {NULL, NULL};
+static size_t nat_rules_len[NAT_TABLE_NUM] = {0, 0};
+
+/* runs the command without shell and feeds it input - returns 0 on success */
+static int exec_cmd(char *const argv[], char *input)
+{
+	int in_pipe[2], err_pipe[2], status, i;
+	char error_log[256], cmd[256];
+	ssize_t ret;
+	size_t len, written;
+	pid_t pid;
+
+	cmd[0] = '\0';
+
+	for (i = 0; argv[i] != NULL; i++) {
+		len = strlen(cmd);
+		snprintf(cmd + len, sizeof(cmd) - len, "%s%s", (i > 0 ? " " : ""), argv[i]);
+	}
+
+	if (pipe(in_pipe) < 0) {
+		debug_output(3, "Warning - could not create a pipe to '%s': %s\n", cmd, strerror(errno));
+		return -1;
+	}
+
+	if (pipe(err_pipe) < 0) {
 		debug_output(3, "Warning - could not create a pipe to '%s': %s\n", cmd, strerror(errno));
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		return -1;
+	}
+
+	if ((pid = fork()) < 0) {
+		debug_output(3, "Warning - could not fork to execute '%s': %s\n", cmd, strerror(errno));
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		close(err_pipe[0]);
+		close(err_pipe[1]);
 		return -1;
 	}
 
-	memset(error_log, 0, 256);
+	/* child */
+	if (pid == 0) {
+		dup2(in_pipe[0], STDIN_FILENO);
+		dup2(err_pipe[1], STDOUT_FILENO);
+		dup2(err_pipe[1], STDERR_FILENO);
 
-	/* save stderr */
-	stderrfd = dup(STDERR_FILENO);
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		close(err_pipe[0]);
+		close(err_pipe[1]);
 
-	/* connect the commands output with the pipe for later logging */
-	dup2(pipes[1], STDERR_FILENO);
-	close(pipes[1]);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	close(in_pipe[0]);
+	close(err_pipe[1]);
+
+	if (input != NULL) {
+		len = strlen(input);
+		written = 0;
 
-	error = system(cmd);
+		while (written < len) {
+			if ((ret = write(in_pipe[1], input + written, len - written)) < 0) {
+				if (errno == EINTR)
+					continue;
 
-	/* copy stderr back */
-	dup2(stderrfd, STDERR_FILENO);
-	close(stderrfd);
+				break;
+			}
 
-	if ((error < 0) || (WEXITSTATUS(error) != 0)) {
-		ret = read(pipes[0], error_log, sizeof(error_log));
+			written += ret;
+		}
+	}
+
+	close(in_pipe[1]);
+
+	memset(error_log, 0, sizeof(error_log));
+	len = 0;
+
+	/* the output is only kept for logging but has to be read to not block the command */
+	while ((ret = read(err_pipe[0], error_log + len, sizeof(error_log) - 1 - len)) != 0) {
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (len + ret < sizeof(error_log) - 1)
+			len += ret;
+	}
+
+	close(err_pipe[0]);
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			status = -1;
+			break;
+		}
+	}
+
+	if ((status < 0) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != 0)) {
 		debug_output(3, "Warning - command '%s' returned an error\n", cmd);
 
-		if (ret > 0)
+		if (len > 0)
 			debug_output(3, "          %s\n", error_log);
 
-		ret = -1;
+		return -1;
 	}
 
-	close(pipes[0]);
-	return ret;
+	return 0;
+}
+
+/* looks for an executable in PATH and the usual sbin directories */
+static int find_in_path(char *name, char *path, size_t path_size)
+{
+	char dirs[1024], *dir, *saveptr = NULL;
+	char *env_path = getenv("PATH");
+
+	snprintf(dirs, sizeof(dirs), "%s:%s", (env_path != NULL ? env_path : ""), NAT_TOOL_DEFAULT_PATH);
+
+	for (dir = strtok_r(dirs, ":", &saveptr); dir != NULL; dir = strtok_r(NULL, ":", &saveptr)) {
+		snprintf(path, path_size, "%s/%s", dir, name);
+
+		if (access(path, X_OK) == 0)
+			return 0;
+	}
+
+	path[0] = '\0';
+	return -1;
 }
 
 /* Probe for iptables binary availability */
 int probe_nat_tool(void) {
-	return run_cmd("which iptables > /dev/null");
+	if (find_in_path("iptables", iptables_path, sizeof(iptables_path)) < 0)
+		return -1;
+
+	/* without iptables-restore every rule is applied on its own */
+	find_in_path("iptables-restore", iptables_restore_path, sizeof(iptables_restore_path));
+
+	return 0;
 }
 
-void exec_iptables_rule(char *cmd, int8_t route_action) {
+static void nat_rule_queue(uint8_t table, char *rule, int8_t route_action) {
+	size_t len = strlen(rule);
+
 	if (disable_client_nat)
 		return;
 
 	if (nat_tool_avail == -1) {
 		debug_output(3, "Warning - could not %sactivate NAT: iptables binary not found!\n", (route_action == ROUTE_ADD ? "" : "de"));
-		debug_output(3, "          You may need to run this command: %s\n", cmd);
+		debug_output(3, "          You may need to run this command: iptables -t %s %s\n", nat_table_names[table], rule);
 		return;
 	}
 
-	run_cmd(cmd);
+	pthread_mutex_lock(&nat_rules_mutex);
+
+	nat_rules[table] = debugRealloc(nat_rules[table], nat_rules_len[table] + len + 2, 906);
+	memcpy(nat_rules[table] + nat_rules_len[table], rule, len);
+	nat_rules_len[table] += len;
+	nat_rules[table][nat_rules_len[table]++] = '\n';
+	nat_rules[table][nat_rules_len[table]] = '\0';
+
+	pthread_mutex_unlock(&nat_rules_mutex);
+}
+
+/* fallback if the transaction failed - e.g. because one of the rules to delete did not exist */
+static void nat_rules_exec_single(uint8_t table) {
+	char *argv[NAT_CMD_MAX_ARGS + 1], *line, *token, *saveptr_line = NULL, *saveptr_token = NULL;
+	int argc;
+
+	for (line = strtok_r(nat_rules[table], "\n", &saveptr_line); line != NULL; line = strtok_r(NULL, "\n", &saveptr_line)) {
+
+		argv[0] = iptables_path;
+		argv[1] = "-t";
+		argv[2] = (char *)nat_table_names[table];
+		argc = 3;
+
+		for (token = strtok_r(line, " ", &saveptr_token); (token != NULL) && (argc < NAT_CMD_MAX_ARGS); token = strtok_r(NULL, " ", &saveptr_token))
+			argv[argc++] = token;
+
+		argv[argc] = NULL;
+		exec_cmd(argv, NULL);
+
+	}
+}
+
+/**
+ * applies the queued rules with one iptables-restore call per table - a
+ * table is committed as a whole or not at all, so only the rules of a
+ * failed table are retried one by one
+ */
+void nat_rules_flush(void) {
+	char *argv[] = {iptables_restore_path, "--noflush", NULL};
+	char *input;
+	uint8_t table;
+
+	pthread_mutex_lock(&nat_rules_mutex);
+
+	for (table = 0; table < NAT_TABLE_NUM; table++) {
+
+		if (nat_rules[table] == NULL)
+			continue;
+
+		if (iptables_restore_path[0] != '\0') {
+
+			input = debugMalloc(nat_rules_len[table] + 20 + 1, 907);
+			sprintf(input, "*%s\n%sCOMMIT\n", nat_table_names[table], nat_rules[table]);
+
+			if (exec_cmd(argv, input) < 0) {
+				debug_output(3, "Warning - iptables-restore failed for the %s table - applying its rules one by one\n", nat_table_names[table]);
+				nat_rules_exec_single(table);
+			}
+
+			debugFree(input, 1907);
+
+		} else {
+
+			nat_rules_exec_single(table);
+
+		}
+
+		debugFree(nat_rules[table], 1906);
+		nat_rules[table] = NULL;
+		nat_rules_len[table] = 0;
+
+	}
+
+	pthread_mutex_unlock(&nat_rules_mutex);
 }
 
 void add_nat_rule(char *dev) {
-	char cmd[150];
+	char rule[150];
+
+	sprintf(rule, IPTABLES_ADD_MASQ, dev);
+	nat_rule_queue(NAT_TABLE_NAT, rule, ROUTE_ADD);
 
-	sprintf(cmd, IPTABLES_ADD_MASQ, dev);
-	exec_iptables_rule(cmd, ROUTE_ADD);
+	sprintf(rule, IPTABLES_ADD_MSS, dev);
+	nat_rule_queue(NAT_TABLE_MANGLE, rule, ROUTE_ADD);
 
-	sprintf(cmd, IPTABLES_ADD_MSS, dev);
-	exec_iptables_rule(cmd, ROUTE_ADD);
+	nat_rules_flush();
 }
 
 void del_nat_rule(char *dev) {
-	char cmd[150];
+	char rule[150];
 
-	sprintf(cmd, IPTABLES_DEL_MASQ, dev);
-	exec_iptables_rule(cmd, ROUTE_DEL);
+	sprintf(rule, IPTABLES_DEL_MASQ, dev);
+	nat_rule_queue(NAT_TABLE_NAT, rule, ROUTE_DEL);
 
-	sprintf(cmd, IPTABLES_ADD_MSS, dev);
-	exec_iptables_rule(cmd, ROUTE_DEL);
+	sprintf(rule, IPTABLES_DEL_MSS, dev);
+	nat_rule_queue(NAT_TABLE_MANGLE, rule, ROUTE_DEL);
+
+	nat_rules_flush();
 }
 
+/* queued only - the caller applies all changes with nat_rules_flush() */
 void hna_local_update_nat(uint32_t hna_ip, uint8_t netmask, int8_t route_action) {
-	char cmd[100], ip_addr[16];
+	char rule[100], ip_addr[16];
 
 	inet_ntop(AF_INET, &hna_ip, ip_addr, sizeof(ip_addr));
 
 	if (route_action == ROUTE_DEL)
-		sprintf(cmd, IPTABLES_DEL_ACC, ip_addr, netmask);
+		sprintf(rule, IPTABLES_DEL_ACC, ip_addr, netmask);
 	else
-		sprintf(cmd, IPTABLES_ADD_ACC, ip_addr, netmask);
+		sprintf(rule, IPTABLES_ADD_ACC, ip_addr, netmask);
 
-	exec_iptables_rule(cmd, route_action);
+	nat_rule_queue(NAT_TABLE_NAT, rule, route_action);
 }
 
+
 /* Probe for tun interface availability */
 int8_t probe_tun(uint8_t print_to_stderr) {
 
@@ -159,6 +354,20 @@ int8_t probe_tun(uint8_t print_to_stderr) {
 
 
 
+/**
+ * lets the kernel hand out TCP packets of up to 64KB (TSO - unless
+ * TUN_NO_TSO is set) and packets without checksum - the tunnel thread
+ * segments them and fills in the checksums (see tunnel_send_packet())
+ */
+static void set_dev_tun_offload( int32_t fd, uint8_t tun_flags ) {
+
+	if ( ioctl( fd, TUNSETOFFLOAD, TUN_F_CSUM | ( tun_flags & TUN_NO_TSO ? 0 : TUN_F_TSO4 ) ) < 0 )
+		debug_output( 0, "Warning - can't enable tun offloads (TUNSETOFFLOAD): %s\n", strerror(errno) );
+
+}
+
+
+
 int8_t del_dev_tun( int32_t fd ) {
 
 	if ( ioctl( fd, TUNSETPERSIST, 0 ) < 0 ) {
@@ -176,7 +385,7 @@ int8_t del_dev_tun( int32_t fd ) {
 
 
 
-int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi ) {
+int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi, uint8_t tun_flags ) {
 
 	int32_t tmp_fd, sock_opts;
 	struct ifreq ifr_tun, ifr_if;
@@ -189,6 +398,16 @@ int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_de
 	ifr_tun.ifr_flags = IFF_TUN | IFF_NO_PI;
 	strncpy( ifr_tun.ifr_name, "gate%d", IFNAMSIZ );
 
+#ifdef IFF_MULTI_QUEUE
+	/* further queues are attached via add_dev_tun_queue() */
+	if ( tun_flags & TUN_MULTI_QUEUE )
+		ifr_tun.ifr_flags |= IFF_MULTI_QUEUE;
+#endif
+
+	/* every packet starts with a struct virtio_net_hdr */
+	if ( tun_flags & TUN_OFFLOAD )
+		ifr_tun.ifr_flags |= IFF_VNET_HDR;
+
 	if ( ( *fd = open( "/dev/net/tun", O_RDWR ) ) < 0 ) {
 
 		debug_output( 0, "Error - can't create tun device (/dev/net/tun): %s\n", strerror(errno) );
@@ -204,6 +423,9 @@ int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_de
 
 	}
 
+	if ( tun_flags & TUN_OFFLOAD )
+		set_dev_tun_offload( *fd, tun_flags );
+
 	if ( ioctl( *fd, TUNSETPERSIST, 1 ) < 0 ) {
 
 		debug_output( 0, "Error - can't create tun device (TUNSETPERSIST): %s\n", strerror(errno) );
@@ -317,6 +539,121 @@ int8_t add_dev_tun( struct batman_if *batman_if, uint32_t tun_addr, char *tun_de
 }
 
 
+
+/* opens another queue of a tun device created by add_dev_tun() with TUN_MULTI_QUEUE set */
+int8_t add_dev_tun_queue( char *tun_dev, int32_t *fd, uint8_t tun_flags ) {
+
+#ifdef IFF_MULTI_QUEUE
+	int32_t sock_opts;
+	struct ifreq ifr_tun;
+
+	memset( &ifr_tun, 0, sizeof(ifr_tun) );
+
+	ifr_tun.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+	strncpy( ifr_tun.ifr_name, tun_dev, IFNAMSIZ - 1 );
+
+	/* the queues have to agree on the flags of the device */
+	if ( tun_flags & TUN_OFFLOAD )
+		ifr_tun.ifr_flags |= IFF_VNET_HDR;
+
+	if ( ( *fd = open( "/dev/net/tun", O_RDWR ) ) < 0 ) {
+
+		debug_output( 0, "Error - can't open tun queue (/dev/net/tun): %s\n", strerror(errno) );
+		return -1;
+
+	}
+
+	if ( ( ioctl( *fd, TUNSETIFF, (void *)&ifr_tun ) ) < 0 ) {
+
+		debug_output( 0, "Error - can't open tun queue (TUNSETIFF): %s\n", strerror(errno) );
+		close(*fd);
+		return -1;
+
+	}
+
+	if ( tun_flags & TUN_OFFLOAD )
+		set_dev_tun_offload( *fd, tun_flags );
+
+	sock_opts = fcntl( *fd, F_GETFL, 0 );
+	fcntl( *fd, F_SETFL, sock_opts | O_NONBLOCK );
+
+	return 1;
+#else
+	tun_flags = 0;
+	debug_output( 0, "Error - can't open tun queue of %s: multi queue tun devices not supported\n", tun_dev );
+	*fd = -1;
+	return -1;
+#endif
+
+}
+
+
+/* tun device catching the packets towards originators without installed route */
+int8_t add_dev_lazy_tun(char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi)
+{
+	int32_t tmp_fd, sock_opts;
+	struct ifreq ifr_tun;
+
+	memset(&ifr_tun, 0, sizeof(ifr_tun));
+
+	ifr_tun.ifr_flags = IFF_TUN | IFF_NO_PI;
+	strncpy(ifr_tun.ifr_name, "lazy%d", IFNAMSIZ);
+
+	if ((*fd = open("/dev/net/tun", O_RDWR)) < 0) {
+		debug_output(0, "Error - can't create lazy tun device (/dev/net/tun): %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(*fd, TUNSETIFF, (void *)&ifr_tun) < 0) {
+		debug_output(0, "Error - can't create lazy tun device (TUNSETIFF): %s\n", strerror(errno));
+		close(*fd);
+		return -1;
+	}
+
+	tmp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (tmp_fd < 0) {
+		debug_output(0, "Error - can't create lazy tun device (udp socket): %s\n", strerror(errno));
+		close(*fd);
+		return -1;
+	}
+
+	if (ioctl(tmp_fd, SIOCGIFINDEX, &ifr_tun) < 0) {
+		debug_output(0, "Error - can't create lazy tun device (SIOCGIFINDEX): %s\n", strerror(errno));
+		goto error;
+	}
+
+	*ifi = ifr_tun.ifr_ifindex;
+
+	if (ioctl(tmp_fd, SIOCGIFFLAGS, &ifr_tun) < 0) {
+		debug_output(0, "Error - can't create lazy tun device (SIOCGIFFLAGS): %s\n", strerror(errno));
+		goto error;
+	}
+
+	ifr_tun.ifr_flags |= IFF_UP;
+	ifr_tun.ifr_flags |= IFF_RUNNING;
+
+	if (ioctl(tmp_fd, SIOCSIFFLAGS, &ifr_tun) < 0) {
+		debug_output(0, "Error - can't create lazy tun device (SIOCSIFFLAGS): %s\n", strerror(errno));
+		goto error;
+	}
+
+	/* make tun socket non blocking */
+	sock_opts = fcntl(*fd, F_GETFL, 0);
+	fcntl(*fd, F_SETFL, sock_opts | O_NONBLOCK);
+
+	strncpy(tun_dev, ifr_tun.ifr_name, tun_dev_size - 1);
+	close(tmp_fd);
+
+	return 1;
+
+error:
+	close(tmp_fd);
+	close(*fd);
+	return -1;
+}
+
+
 int8_t set_tun_addr( int32_t fd, uint32_t tun_addr, char *tun_dev ) {
 
 	struct sockaddr_in addr;
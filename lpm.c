@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * destination lookup index
+ *
+ * Every originator we have a route to and every announced network in use
+ * is kept in a path compressed binary trie, so the unix socket can tell
+ * which originator, next hop and interface a destination would use
+ * without walking the originator and HNA tables. Like the routing rules
+ * an originator wins over announced networks, otherwise the longest
+ * prefix wins.
+ *
+ * The index is maintained by the main thread (routing changes and new
+ * TQ values) and read by the unix socket thread - therefore it only holds
+ * copies of the routing data and is protected by its own mutex.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "originator.h"
+#include "lpm.h"
+
+
+struct lpm_orig {
+	uint32_t orig;                        /* key - has to be the first member */
+	uint32_t router;
+	uint8_t tq;
+	uint8_t routed;                       /* the host entry points to this originator */
+	char dev[IFNAMSIZ];
+	uint32_t refcount;                    /* trie nodes pointing to this originator */
+};
+
+struct lpm_node {
+	struct lpm_node *child[2];
+	uint32_t prefix;                      /* host byte order */
+	uint8_t len;
+	struct lpm_orig *host;                /* the originator itself - only at /32 */
+	struct lpm_orig *hna;                 /* originator in use for this announced network */
+};
+
+
+static pthread_mutex_t lpm_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct lpm_node *lpm_root = NULL;
+static struct hashtable_t *lpm_orig_hash = NULL;
+static uint32_t lpm_prefixes = 0, lpm_nodes = 0;
+
+
+
+static void lpm_lock(void)
+{
+	if (pthread_mutex_lock(&lpm_mutex) != 0)
+		debug_output(0, "Error - could not lock lpm mutex: %s \n", strerror(errno));
+}
+
+static void lpm_unlock(void)
+{
+	if (pthread_mutex_unlock(&lpm_mutex) != 0)
+		debug_output(0, "Error - could not unlock lpm mutex: %s \n", strerror(errno));
+}
+
+static uint32_t lpm_netmask(uint8_t len)
+{
+	return (len == 0 ? 0 : 0xFFFFFFFF << (32 - len));
+}
+
+static uint8_t lpm_bit(uint32_t prefix, uint8_t pos)
+{
+	return (prefix >> (31 - pos)) & 1;
+}
+
+/* number of leading bits both prefixes share - at most max_len */
+static uint8_t lpm_common_len(uint32_t prefix1, uint32_t prefix2, uint8_t max_len)
+{
+	uint32_t diff = prefix1 ^ prefix2;
+	uint8_t len = (diff == 0 ? 32 : __builtin_clz(diff));
+
+	return (len < max_len ? len : max_len);
+}
+
+/* copy the current routing data of the originator */
+static void lpm_orig_refresh(struct lpm_orig *lpm_orig, struct orig_node *orig_node)
+{
+	if (orig_node->router == NULL)
+		return;
+
+	lpm_orig->router = orig_node->router->addr;
+	lpm_orig->tq = orig_node->router->tq_avg;
+
+	if (strncmp(lpm_orig->dev, orig_node->router->if_incoming->dev, IFNAMSIZ - 1) != 0) {
+		strncpy(lpm_orig->dev, orig_node->router->if_incoming->dev, IFNAMSIZ - 1);
+		lpm_orig->dev[IFNAMSIZ - 1] = '\0';
+	}
+}
+
+static struct lpm_orig *lpm_orig_get(struct orig_node *orig_node)
+{
+	struct lpm_orig *lpm_orig;
+	struct hashtable_t *swaphash;
+
+	if (lpm_orig_hash == NULL) {
+		if (NULL == (lpm_orig_hash = hash_new(128, compare_orig, choose_orig)))
+			return NULL;
+	}
+
+	lpm_orig = hash_find(lpm_orig_hash, &orig_node->orig);
+
+	if (lpm_orig == NULL) {
+		lpm_orig = debugMalloc(sizeof(struct lpm_orig), 921);
+		memset(lpm_orig, 0, sizeof(struct lpm_orig));
+		lpm_orig->orig = orig_node->orig;
+
+		hash_add(lpm_orig_hash, lpm_orig);
+
+		if (lpm_orig_hash->elements * 4 > lpm_orig_hash->size) {
+			swaphash = hash_resize(lpm_orig_hash, lpm_orig_hash->size * 2);
+
+			if (swaphash == NULL)
+				debug_output(0, "Couldn't resize lpm hash table \n");
+			else
+				lpm_orig_hash = swaphash;
+		}
+	}
+
+	lpm_orig_refresh(lpm_orig, orig_node);
+	return lpm_orig;
+}
+
+static void lpm_orig_put(struct lpm_orig *lpm_orig)
+{
+	if (--lpm_orig->refcount > 0)
+		return;
+
+	hash_remove(lpm_orig_hash, lpm_orig);
+	debugFree(lpm_orig, 1921);
+}
+
+static struct lpm_node *lpm_node_new(uint32_t prefix, uint8_t len)
+{
+	struct lpm_node *lpm_node;
+
+	lpm_node = debugMalloc(sizeof(struct lpm_node), 922);
+	memset(lpm_node, 0, sizeof(struct lpm_node));
+
+	lpm_node->prefix = prefix & lpm_netmask(len);
+	lpm_node->len = len;
+
+	lpm_nodes++;
+	return lpm_node;
+}
+
+static void lpm_node_free(struct lpm_node *lpm_node)
+{
+	lpm_nodes--;
+	debugFree(lpm_node, 1922);
+}
+
+/* finds the node of the given prefix or inserts it */
+static struct lpm_node *lpm_node_get(uint32_t prefix, uint8_t len)
+{
+	struct lpm_node **slot = &lpm_root, *lpm_node, *new_node, *branch;
+	uint8_t common = 0;
+
+	while ((lpm_node = *slot) != NULL) {
+		common = lpm_common_len(lpm_node->prefix, prefix, (lpm_node->len < len ? lpm_node->len : len));
+
+		if (common < lpm_node->len)
+			break;
+
+		if (lpm_node->len == len)
+			return lpm_node;
+
+		slot = &lpm_node->child[lpm_bit(prefix, lpm_node->len)];
+	}
+
+	new_node = lpm_node_new(prefix, len);
+
+	if (lpm_node == NULL) {
+		*slot = new_node;
+		return new_node;
+	}
+
+	/* the new prefix covers the node in the way */
+	if (common == len) {
+		new_node->child[lpm_bit(lpm_node->prefix, len)] = lpm_node;
+		*slot = new_node;
+		return new_node;
+	}
+
+	/* both only share a shorter prefix - branch there */
+	branch = lpm_node_new(prefix, common);
+	branch->child[lpm_bit(prefix, common)] = new_node;
+	branch->child[lpm_bit(lpm_node->prefix, common)] = lpm_node;
+	*slot = branch;
+
+	return new_node;
+}
+
+static struct lpm_node *lpm_node_find(uint32_t prefix, uint8_t len)
+{
+	struct lpm_node *lpm_node = lpm_root;
+
+	while ((lpm_node != NULL) && (lpm_node->len < len)) {
+		if ((prefix ^ lpm_node->prefix) & lpm_netmask(lpm_node->len))
+			return NULL;
+
+		lpm_node = lpm_node->child[lpm_bit(prefix, lpm_node->len)];
+	}
+
+	if ((lpm_node != NULL) && (lpm_node->len == len) && (lpm_node->prefix == prefix))
+		return lpm_node;
+
+	return NULL;
+}
+
+static int lpm_node_unused(struct lpm_node *lpm_node)
+{
+	return ((lpm_node->host == NULL) && (lpm_node->hna == NULL) &&
+		((lpm_node->child[0] == NULL) || (lpm_node->child[1] == NULL)));
+}
+
+/* removes the node of the given prefix if nothing needs it anymore */
+static void lpm_node_cleanup(uint32_t prefix, uint8_t len)
+{
+	struct lpm_node **slot = &lpm_root, **parent_slot = NULL, *lpm_node, *parent;
+
+	while (((lpm_node = *slot) != NULL) && (lpm_node->len < len)) {
+		parent_slot = slot;
+		slot = &lpm_node->child[lpm_bit(prefix, lpm_node->len)];
+	}
+
+	if ((lpm_node == NULL) || (lpm_node->len != len) || (lpm_node->prefix != prefix))
+		return;
+
+	if (!lpm_node_unused(lpm_node))
+		return;
+
+	*slot = (lpm_node->child[0] != NULL ? lpm_node->child[0] : lpm_node->child[1]);
+	lpm_node_free(lpm_node);
+
+	/* a branch left with a single child is not needed either */
+	if ((parent_slot != NULL) && (lpm_node_unused(*parent_slot))) {
+		parent = *parent_slot;
+		*parent_slot = (parent->child[0] != NULL ? parent->child[0] : parent->child[1]);
+		lpm_node_free(parent);
+	}
+}
+
+/* called whenever the route towards the originator may have changed */
+void lpm_update_orig(struct orig_node *orig_node)
+{
+	struct lpm_orig *lpm_orig;
+	struct lpm_node *lpm_node;
+	uint32_t prefix = ntohl(orig_node->orig);
+
+	lpm_lock();
+
+	if (orig_node->router == NULL) {
+
+		lpm_node = lpm_node_find(prefix, 32);
+
+		if ((lpm_node != NULL) && (lpm_node->host != NULL)) {
+			lpm_node->host->routed = 0;
+			lpm_orig_put(lpm_node->host);
+			lpm_node->host = NULL;
+			lpm_prefixes--;
+
+			lpm_node_cleanup(prefix, 32);
+		}
+
+	} else {
+
+		lpm_orig = lpm_orig_get(orig_node);
+
+		/* the common case: just a new TQ value */
+		if ((lpm_orig == NULL) || (lpm_orig->routed))
+			goto unlock;
+
+		lpm_node = lpm_node_get(prefix, 32);
+		lpm_node->host = lpm_orig;
+		lpm_orig->routed = 1;
+		lpm_orig->refcount++;
+		lpm_prefixes++;
+
+	}
+
+unlock:
+	lpm_unlock();
+}
+
+/* called whenever an announced network switches to another originator (NULL if it is gone) */
+void lpm_update_hna(uint32_t addr, uint8_t netmask, struct orig_node *orig_node)
+{
+	struct lpm_orig *lpm_orig;
+	struct lpm_node *lpm_node;
+	uint32_t prefix = ntohl(addr) & lpm_netmask(netmask);
+
+	lpm_lock();
+
+	if (orig_node == NULL) {
+
+		lpm_node = lpm_node_find(prefix, netmask);
+
+		if ((lpm_node != NULL) && (lpm_node->hna != NULL)) {
+			lpm_orig_put(lpm_node->hna);
+			lpm_node->hna = NULL;
+			lpm_prefixes--;
+
+			lpm_node_cleanup(prefix, netmask);
+		}
+
+	} else {
+
+		lpm_orig = lpm_orig_get(orig_node);
+
+		if (lpm_orig == NULL)
+			goto unlock;
+
+		lpm_node = lpm_node_get(prefix, netmask);
+
+		if (lpm_node->hna == lpm_orig)
+			goto unlock;
+
+		lpm_orig->refcount++;
+
+		if (lpm_node->hna != NULL)
+			lpm_orig_put(lpm_node->hna);
+		else
+			lpm_prefixes++;
+
+		lpm_node->hna = lpm_orig;
+
+	}
+
+unlock:
+	lpm_unlock();
+}
+
+/* returns 1 and fills lpm_result if a route towards the given address (network byte order) exists */
+int8_t lpm_lookup(uint32_t addr, struct lpm_result *lpm_result)
+{
+	struct lpm_node *lpm_node, *match = NULL;
+	struct lpm_orig *lpm_orig = NULL;
+	uint32_t dest = ntohl(addr);
+
+	lpm_lock();
+
+	lpm_node = lpm_root;
+
+	while ((lpm_node != NULL) && (((dest ^ lpm_node->prefix) & lpm_netmask(lpm_node->len)) == 0)) {
+
+		/* the originator itself wins over any announced network */
+		if (lpm_node->host != NULL) {
+			match = lpm_node;
+			lpm_orig = lpm_node->host;
+			break;
+		}
+
+		if (lpm_node->hna != NULL) {
+			match = lpm_node;
+			lpm_orig = lpm_node->hna;
+		}
+
+		if (lpm_node->len == 32)
+			break;
+
+		lpm_node = lpm_node->child[lpm_bit(dest, lpm_node->len)];
+	}
+
+	if (match != NULL) {
+		lpm_result->prefix = htonl(match->prefix);
+		lpm_result->netmask = match->len;
+		lpm_result->is_host = (lpm_orig == match->host);
+		lpm_result->orig = lpm_orig->orig;
+		lpm_result->router = lpm_orig->router;
+		lpm_result->tq = lpm_orig->tq;
+		memcpy(lpm_result->dev, lpm_orig->dev, IFNAMSIZ);
+	}
+
+	lpm_unlock();
+
+	return (match != NULL ? 1 : 0);
+}
+
+void lpm_get_stats(uint32_t *prefixes, uint32_t *nodes)
+{
+	lpm_lock();
+
+	*prefixes = lpm_prefixes;
+	*nodes = lpm_nodes;
+
+	lpm_unlock();
+}
+
+static void lpm_subtree_free(struct lpm_node *lpm_node)
+{
+	if (lpm_node->child[0] != NULL)
+		lpm_subtree_free(lpm_node->child[0]);
+
+	if (lpm_node->child[1] != NULL)
+		lpm_subtree_free(lpm_node->child[1]);
+
+	lpm_node_free(lpm_node);
+}
+
+static void lpm_orig_free(void *data)
+{
+	debugFree(data, 1923);
+}
+
+void lpm_free(void)
+{
+	lpm_lock();
+
+	if (lpm_root != NULL)
+		lpm_subtree_free(lpm_root);
+
+	if (lpm_orig_hash != NULL)
+		hash_delete(lpm_orig_hash, lpm_orig_free);
+
+	lpm_root = NULL;
+	lpm_orig_hash = NULL;
+	lpm_prefixes = 0;
+
+	lpm_unlock();
+}
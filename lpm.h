@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_LPM_H
+#define _BATMAN_LPM_H
+
+#include <net/if.h>
+
+#include "batman.h"
+
+
+/* answer of a destination lookup */
+struct lpm_result {
+	uint32_t prefix;
+	uint8_t netmask;
+	uint8_t is_host;                      /* matched the originator itself - not an announced network */
+	uint32_t orig;
+	uint32_t router;
+	uint8_t tq;
+	char dev[IFNAMSIZ];
+};
+
+
+void lpm_update_orig(struct orig_node *orig_node);
+void lpm_update_hna(uint32_t addr, uint8_t netmask, struct orig_node *orig_node);
+int8_t lpm_lookup(uint32_t addr, struct lpm_result *lpm_result);
+void lpm_get_stats(uint32_t *prefixes, uint32_t *nodes);
+void lpm_free(void);
+
+#endif
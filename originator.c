@@ -19,12 +19,6 @@
  *
  */
 
-struct reachable_peer {
-  unsigned char addr_len;
-  unsigned char addr[32];
-  unsigned char tq_avg;
-};
-
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,6 +27,10 @@ struct reachable_peer {
 #include "batman.h"
 #include "originator.h"
 #include "hna.h"
+#include "fib.h"
+#include "hna_sync.h"
+#include "events.h"
+#include "vis.h"
 #include "types.h"
 
 struct neigh_node * create_neighbor(struct orig_node *orig_node, struct orig_node *orig_neigh_node, uint32_t neigh, struct batman_if *if_incoming) {
@@ -131,6 +129,7 @@ struct orig_node *get_orig_node( uint32_t addr ) {
 	memset( orig_node->bcast_own_sum, 0, found_ifs * sizeof(uint8_t) );
 
 	hash_add( orig_hash, orig_node );
+	event_orig_add(orig_node);
 
 	if ( orig_hash->elements * 4 > orig_hash->size ) {
 
@@ -154,11 +153,87 @@ struct orig_node *get_orig_node( uint32_t addr ) {
 
 
 
+static void route_flap_decay(struct orig_node *orig_node, uint32_t curr_time)
+{
+	uint32_t elapsed = curr_time - orig_node->flap_decayed;
+
+	orig_node->flap_decayed = curr_time;
+
+	if (orig_node->flap_penalty == 0)
+		return;
+
+	/* halve the penalty for each half life that passed and decay the remainder linearly */
+	if (elapsed / ROUTE_FLAP_HALF_LIFE > 31)
+		orig_node->flap_penalty = 0;
+	else
+		orig_node->flap_penalty >>= elapsed / ROUTE_FLAP_HALF_LIFE;
+
+	orig_node->flap_penalty -= (uint32_t)(((uint64_t)orig_node->flap_penalty * (elapsed % ROUTE_FLAP_HALF_LIFE)) / (2 * ROUTE_FLAP_HALF_LIFE));
+
+	if ((orig_node->flap_suppressed) && (orig_node->flap_penalty < ROUTE_FLAP_REUSE_LIMIT))
+		orig_node->flap_suppressed = 0;
+}
+
+
+
+/* checks whether the next hop towards orig_node may be changed to neigh_node or whether damping holds it back */
+static int route_switch_allowed(struct orig_node *orig_node, struct neigh_node *neigh_node, uint32_t curr_time)
+{
+	char orig_str[ADDR_STR_LEN];
+	char *reason = NULL;
+
+	/* never hold on to a next hop which does not forward anything */
+	if ((orig_node->router == NULL) || (orig_node->router->tq_avg == 0))
+		return 1;
+
+	route_flap_decay(orig_node, curr_time);
+
+	if ((route_tq_margin > 0) && (neigh_node->tq_avg < orig_node->router->tq_avg + route_tq_margin))
+		reason = "tq margin";
+	else if ((route_dwell_time > 0) && ((int)(curr_time - (orig_node->router_changed + route_dwell_time)) < 0))
+		reason = "dwell time";
+	else if (orig_node->flap_suppressed)
+		reason = "flap penalty";
+
+	if (reason == NULL)
+		return 1;
+
+	route_updates_suppressed++;
+
+	addr_to_string(orig_node->orig, orig_str, ADDR_STR_LEN);
+	debug_output(4, "Suppressing next hop change towards %s (%s): tq curr: %i, tq new: %i, penalty: %u \n", orig_str, reason, orig_node->router->tq_avg, neigh_node->tq_avg, orig_node->flap_penalty);
+
+	return 0;
+}
+
+
+
+/* has to be called before the next hop of orig_node is changed to neigh_node */
+static void route_switch_account(struct orig_node *orig_node, struct neigh_node *neigh_node, uint32_t curr_time)
+{
+	if (neigh_node == NULL)
+		return;
+
+	orig_node->router_changed = curr_time;
+
+	if ((orig_node->router == NULL) || (route_flap_penalty == 0))
+		return;
+
+	route_flap_decay(orig_node, curr_time);
+	orig_node->flap_penalty += route_flap_penalty;
+
+	if (orig_node->flap_penalty > ROUTE_FLAP_SUPPRESS_LIMIT)
+		orig_node->flap_suppressed = 1;
+}
+
+
+
 void update_orig(struct orig_node *orig_node, struct bat_packet *in, uint32_t neigh, struct batman_if *if_incoming, unsigned char *hna_recv_buff, int16_t hna_buff_len, uint8_t is_duplicate, uint32_t curr_time)
 {
 	struct list_head *list_pos;
 	struct gw_node *gw_node;
 	struct neigh_node *neigh_node = NULL, *tmp_neigh_node = NULL;
+	int32_t hna_len = hna_buff_len;
 	prof_start(PROF_update_originator);
 
 	debug_output(4, "update_originator(): Searching and updating originator entry of received packet,  \n");
@@ -193,6 +268,9 @@ void update_orig(struct orig_node *orig_node, struct bat_packet *in, uint32_t ne
 		neigh_node->last_ttl = in->ttl;
 	}
 
+	/* hna sync: the OGM only references the announced set */
+	hna_sync_recv_ref(orig_node, &hna_recv_buff, &hna_len);
+
 	/**
 	 * if we got have a better tq value via this neighbour or
 	 * same tq value but the link is more symetric change the next hop
@@ -201,19 +279,22 @@ void update_orig(struct orig_node *orig_node, struct bat_packet *in, uint32_t ne
 	if ((orig_node->router != neigh_node) && ((!orig_node->router) ||
 	    (neigh_node->tq_avg > orig_node->router->tq_avg) ||
 	    ((neigh_node->tq_avg == orig_node->router->tq_avg) &&
-	     (neigh_node->orig_node->bcast_own_sum[if_incoming->if_num] > orig_node->router->orig_node->bcast_own_sum[if_incoming->if_num]))))
-		update_routes(orig_node, neigh_node, hna_recv_buff, hna_buff_len);
-	else
-		update_routes(orig_node, orig_node->router, hna_recv_buff, hna_buff_len);
+	     (neigh_node->orig_node->bcast_own_sum[if_incoming->if_num] > orig_node->router->orig_node->bcast_own_sum[if_incoming->if_num]))) &&
+	    (route_switch_allowed(orig_node, neigh_node, curr_time))) {
+		route_switch_account(orig_node, neigh_node, curr_time);
+		update_routes(orig_node, neigh_node, hna_recv_buff, hna_len);
+	} else
+		update_routes(orig_node, orig_node->router, hna_recv_buff, hna_len);
 
 	if (orig_node->gwflags != in->gwflags)
 		update_gw_list(orig_node, in->gwflags, in->gwport);
 
 	orig_node->gwflags = in->gwflags;
 	hna_global_check_tq(orig_node);
+	hna_sync_check(orig_node, curr_time);
 
-	/* restart gateway selection if we have more packets and fast or late switching enabled */
-	if ((routing_class > 2) && (orig_node->gwflags != 0) && (curr_gateway != NULL)) {
+	/* restart gateway selection if we have more packets and fast or late switching enabled - measured gateways are switched by their probes */
+	if ((routing_class > 2) && (!gw_probing) && (orig_node->gwflags != 0) && (curr_gateway != NULL)) {
 
 		/* if the node is not our current gateway and
 		   we have preferred gateray disabled and a better tq value or we found our preferred gateway */
@@ -239,7 +320,8 @@ void update_orig(struct orig_node *orig_node, struct bat_packet *in, uint32_t ne
 
 					debug_output(3, "Gateway client - restart gateway selection: better gateway found (tq curr: %i, tq new: %i) \n", curr_gateway->orig_node->router->tq_avg, orig_node->router->tq_avg);
 
-					del_default_route();
+					/* switches right away - a standby tunnel to the new gateway takes over without a gap */
+					choose_gw();
 
 				}
 
@@ -313,6 +395,7 @@ void purge_orig(uint32_t curr_time)
 			}
 
 			update_routes( orig_node, NULL, NULL, 0 );
+			event_orig_del(orig_node);
 
 			debugFree( orig_node->bcast_own, 1403 );
 			debugFree( orig_node->bcast_own_sum, 1404 );
@@ -343,13 +426,15 @@ void purge_orig(uint32_t curr_time)
 						/* remove old announced network(s) */
 						hna_global_del(orig_node);
 
-						add_del_route(orig_node->orig, 32, orig_node->router->addr, 0, orig_node->batman_if->if_index, orig_node->batman_if->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+						fib_add_del_route(orig_node->orig, 32, orig_node->router->addr, 0, orig_node->batman_if->if_index, orig_node->batman_if->dev, BATMAN_RT_TABLE_HOSTS, ROUTE_DEL);
 
 						/* if the neighbour is the route towards our gateway */
 						if ((curr_gateway != NULL) && (curr_gateway->orig_node == orig_node))
 							del_default_route();
 
 						orig_node->router = NULL;
+						event_route(orig_node, neigh_node);
+						vis_update_orig(orig_node);
 
 					}
 
@@ -372,9 +457,15 @@ void purge_orig(uint32_t curr_time)
 
 			}
 
-			if ((neigh_purged) && ((best_neigh_node == NULL) || (orig_node->router == NULL) || (max_tq > orig_node->router->tq_avg)))
+			if ((neigh_purged) && ((best_neigh_node == NULL) || (orig_node->router == NULL) ||
+			    ((max_tq > orig_node->router->tq_avg) && (route_switch_allowed(orig_node, best_neigh_node, curr_time))))) {
+				route_switch_account(orig_node, best_neigh_node, curr_time);
 				update_routes( orig_node, best_neigh_node, orig_node->hna_buff, orig_node->hna_buff_len );
 
+				/* the HNA candidate lists are sorted by the TQ of the router */
+				hna_global_check_tq(orig_node);
+			}
+
 		}
 
 	}
@@ -388,6 +479,9 @@ void purge_orig(uint32_t curr_time)
 
 		if ((gw_node->deleted) && ((int)(curr_time - (gw_node->deleted + (2 * purge_timeout))) > 0)) {
 
+			if (gw_node == standby_gateway)
+				standby_gateway = NULL;
+
 			list_del( prev_list_head, gw_pos, &gw_list );
 			debugFree( gw_pos, 1406 );
 
@@ -419,7 +513,7 @@ void debug_orig(void) {
 	uint16_t batman_count = 0;
 	uint64_t uptime_sec;
 	int download_speed, upload_speed, debug_out_size;
-	char str[ADDR_STR_LEN], str2[ADDR_STR_LEN], orig_str[ADDR_STR_LEN], debug_out_str[1001];
+	char str[ADDR_STR_LEN], str2[ADDR_STR_LEN], orig_str[ADDR_STR_LEN], debug_out_str[1001], probe_str[80];
 
 
 	if ( debug_clients.clients_num[1] > 0 ) {
@@ -451,7 +545,12 @@ void debug_orig(void) {
 
 				get_gw_speeds( gw_node->orig_node->gwflags, &download_speed, &upload_speed );
 
-				debug_output(2, "%s %-15s (%3i) %''15s [%10s], gw_class %3i - %i%s/%i%s, gateway failures: %i \n", ( curr_gateway == gw_node ? "=>" : "  " ), str, gw_node->orig_node->router->tq_avg, str2, gw_node->orig_node->router->if_incoming->dev, gw_node->orig_node->gwflags, (download_speed > 2048 ? download_speed / 1024 : download_speed), (download_speed > 2048 ? "MBit" : "KBit"), (upload_speed > 2048 ? upload_speed / 1024 : upload_speed), (upload_speed > 2048 ? "MBit" : "KBit"), gw_node->gw_failure);
+				probe_str[0] = '\0';
+
+				if (gw_probing)
+					snprintf(probe_str, sizeof(probe_str), ", measured: rtt %u.%03u ms, %u kbit/s, loss %u%%", gw_node->probe.rtt / 1000, gw_node->probe.rtt % 1000, gw_node->probe.bw, gw_node->probe.loss);
+
+				debug_output(2, "%s %-15s (%3i) %''15s [%10s], gw_class %3i - %i%s/%i%s, gateway failures: %i%s \n", ( curr_gateway == gw_node ? "=>" : "  " ), str, gw_node->orig_node->router->tq_avg, str2, gw_node->orig_node->router->if_incoming->dev, gw_node->orig_node->gwflags, (download_speed > 2048 ? download_speed / 1024 : download_speed), (download_speed > 2048 ? "MBit" : "KBit"), (upload_speed > 2048 ? upload_speed / 1024 : upload_speed), (upload_speed > 2048 ? "MBit" : "KBit"), gw_node->gw_failure, probe_str);
 
 				batman_count++;
 
@@ -466,119 +565,6 @@ void debug_orig(void) {
 
 	}
 
-	/* PGS 20110314 - Write list of peers out to a file.  
-	   Toggle where we write in the file so that there is always a consistent copy on disk.
-	   XXX - Does not make sure the early-half version doesn't get too big and overwrite the late-half version.
-
-	 */
-	if (1)
-	{
-	  FILE *f=fopen(PEER_PATH,"r+");
-	  struct reachable_peer p;
-	  unsigned int peers=0;
-
-	  if (!f) f=fopen(PEER_PATH,"w+");
-
-	  if (!f) 
-	    {
-	      perror("Couldn't fopen PEER_PATH");
-	    }
-	  else
-	    {
-	    unsigned int offset;
-	    if (fread(&offset,sizeof(int),1,f)==1)
-	      {
-		offset=ntohl(offset);
-		offset^=0x20000;
-		if (fseek(f,offset,SEEK_SET))
-		  perror("fseek() failed writing to peer list file");
-	      }
-	    else
-	      /* Initial writing offset */
-	      offset=0x100;
-	    
-	    unsigned int t=htonl(time(0));
-	    if (fwrite(&t,sizeof(int),1,f)!=1) {
-	      /* Dang it, couldn't write the timestamp */
-	    }
-
-	    while ( NULL != ( hashit = hash_iterate( orig_hash, hashit ) ) ) {
-
-	      orig_node = hashit->bucket->data;
-	      
-	      if ( orig_node->router == NULL )
-		{
-		  continue;
-		}
-
-	      /* Build record to write to file:
-	         Address length (0 for last record in file)
-	         Address
-	         TQ_AVG (i.e. link score)
-	      */
-	      p.addr_len=4;
-	      bzero(&p.addr[0],32);
-	      bcopy((unsigned char *)&orig_node->orig,&p.addr[0],4);
-	      p.tq_avg=orig_node->router->tq_avg;
-	      peers++;
-
-	      /* Write to file */
-	      if (fwrite(&p,sizeof(p),1,f)!=1)
-		{
-		  /* Dang it, the record didn't get written */
-		}
-	    }
-
-#ifdef _POSIX_SYNCHRONIZED_IO
-#if _POSIX_SYNCHRONIZED_IO > 0
-	    fdatasync(fileno(f));
-#else
-	    fsync(fileno(f));
-#endif
-#else
-	    fsync(fileno(f));
-#endif
-	    /* Mark end of data with an empty record */
-	    p.addr_len=0;
-	    bzero(&p.addr[0],32);
-	    p.tq_avg=0;
-	    /* Write to file */
-	    if (fwrite(&p,sizeof(p),1,f)!=1)
-	      {
-		/* Dang it, the record didn't get written */
-	      }
-
-	    /* Update offset toggle */
-	    if (fseek(f,0,SEEK_SET)==0) {
-	      offset=htonl(offset);
-	      if (fwrite(&offset,sizeof(int),1,f)!=1)
-		{
-		  /* Dang it, couldn't write the offset */
-		}
-	    }
-	    else 
-	      {
-		/* Dang it, couldn't seek back to start of file */
-	      }
-
-	    /* Update peer count */
-	    if (fseek(f,4,SEEK_SET)==0) {
-	      peers=htonl(peers);
-	      if (fwrite(&peers,sizeof(int),1,f)!=1)
-		{
-		  /* Dang it, couldn't write the peer count */
-		}
-	    }
-	    else 
-	      {
-		/* Dang it, couldn't seek back to start of file */
-	      }
-
-
-	    fclose(f);
-	  }
-	}
-
 	if ( ( debug_clients.clients_num[0] > 0 ) || ( debug_clients.clients_num[3] > 0 ) ) {
 
 		addr_to_string( ((struct batman_if *)if_list.next)->addr.sin_addr.s_addr, orig_str, sizeof(orig_str) );
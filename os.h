@@ -50,14 +50,21 @@ int add_del_interface_rules( int8_t del );
 int flush_routes_rules( int8_t rt_table );
 
 /* tun.c */
+#define TUN_MULTI_QUEUE 0x01              /* further queues via add_dev_tun_queue() */
+#define TUN_OFFLOAD 0x02                  /* packets with virtio_net_hdr, TSO and checksum offload */
+#define TUN_NO_TSO 0x04                   /* with TUN_OFFLOAD: checksum offload only, packets fit the MTU */
+
 int probe_nat_tool(void);
 void add_nat_rule(char *dev);
 void del_nat_rule(char *dev);
 void hna_local_update_nat(uint32_t hna_ip, uint8_t netmask, int8_t route_action);
+void nat_rules_flush(void);
 int8_t probe_tun(uint8_t print_to_stderr);
 int8_t del_dev_tun( int32_t fd );
-int8_t add_dev_tun( struct batman_if *batman_if, uint32_t dest_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi );
+int8_t add_dev_tun( struct batman_if *batman_if, uint32_t dest_addr, char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi, uint8_t tun_flags );
+int8_t add_dev_tun_queue( char *tun_dev, int32_t *fd, uint8_t tun_flags );
 int8_t set_tun_addr( int32_t fd, uint32_t tun_addr, char *tun_dev );
+int8_t add_dev_lazy_tun(char *tun_dev, size_t tun_dev_size, int32_t *fd, int32_t *ifi);
 
 /* init.c */
 void apply_init_args(int argc, char *argv[]);
@@ -83,9 +90,18 @@ int is_wifi_interface(char *dev, int fd);
 void print_animation( void );
 void del_default_route(void);
 void add_default_route(void);
+uint8_t tunnel_missing(void);
+uint8_t tunnel_standby_possible(uint32_t gw_addr);
 int8_t receive_packet(unsigned char *packet_buff, int32_t packet_buff_len, int16_t *packet_len, uint32_t *neigh, uint32_t timeout, struct batman_if **if_incoming);
 int8_t send_udp_packet(unsigned char *packet_buff, int packet_buff_len, struct sockaddr_in *broad, int send_sock, struct batman_if *batman_if);
 void del_gw_interface(void);
+int8_t add_lazy_interface(void);
+void del_lazy_interface(void);
+int8_t add_hna_sync_socket(void);
+void del_hna_sync_socket(void);
+int8_t add_wakeup_pipe(void);
+void del_wakeup_pipe(void);
+void wakeup_main_loop(void);
 void restore_defaults(void);
 void cleanup(void);
 
@@ -93,6 +109,9 @@ void cleanup(void);
 void init_bh_ports(void);
 void *gw_listen(void *arg);
 void *client_to_gw_tun( void *arg );
+void *client_probe_gws(void *arg);
+void tunnel_wakeup(void);
+void gw_queue_output(int32_t sock);
 
 /* unix_sokcet.c */
 void *unix_listen( void *arg );
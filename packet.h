@@ -28,6 +28,7 @@
 
 #define PORT 4305
 #define GW_PORT 4306
+#define HNA_SYNC_PORT (PORT + 3)
 
 #define DIRECTLINK 0x40
 
@@ -57,3 +58,24 @@ struct vis_data {
 	uint8_t data;
 	uint32_t ip;
 } __attribute__((packed));
+
+/* hna sync: the OGM only carries this netmask and the hash of the announced set as addr */
+#define HNA_SYNC_REF_NETMASK 0xff
+#define HNA_SYNC_DEL_FLAG 0x80    /* delta updates: netmask of removed networks */
+
+#define HNA_SYNC_VERSION 1
+#define HNA_SYNC_REQUEST 1
+#define HNA_SYNC_FULL 2
+#define HNA_SYNC_DELTA 3
+
+struct hna_sync_packet {
+	uint8_t version;
+	uint8_t type;
+	uint16_t chunk;
+	uint16_t num_chunks;
+	uint16_t num_elements;    /* elements following in this packet */
+	uint16_t total_elements;  /* elements of all chunks */
+	uint32_t orig;            /* originator announcing the networks */
+	uint32_t hash;            /* hash of the announced set (request: wanted set) */
+	uint32_t base_hash;       /* delta: set the changes apply to (request: known set) */
+} __attribute__((packed));
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * list of reachable peers for local consumers
+ *
+ * Once per second the reachable originators are compared against the
+ * published list. Only if something relevant changed the memory mapped
+ * table (see peer_table.h) is rewritten and the waiting readers are woken.
+ *
+ * The table lives on tmpfs (PEER_TABLE_DIR) - the old peer file (PEER_PATH)
+ * is the only one written to flash. It is still written for existing
+ * readers but only after a change and at most every peer_file_interval ms.
+ * Its two halves are toggled so there is always a consistent copy on disk.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "os.h"
+#include "batman.h"
+#include "peer_table.h"
+
+
+/* layout of the old peer file */
+struct reachable_peer {
+	unsigned char addr_len;
+	unsigned char addr[32];
+	unsigned char tq_avg;
+};
+
+#define PEER_FILE_FIRST_HALF 0x100
+#define PEER_FILE_HALF_SIZE 0x20000
+#define PEER_FILE_MAX_PEERS ((PEER_FILE_HALF_SIZE - sizeof(uint32_t)) / sizeof(struct reachable_peer) - 1)
+
+
+static struct peer_table_header *peer_table = NULL;
+static size_t peer_table_size = 0;
+static uint8_t peer_table_failed = 0;
+
+/* the list as published last time and the list being collected */
+static struct peer_table_record *peer_published = NULL, *peer_collected = NULL;
+static uint32_t peer_published_num = 0, peer_list_size = 0;
+static uint32_t peer_generation = 0;
+
+/* the file of a previous run is outdated */
+static uint8_t peer_file_pending = 1;
+static uint32_t peer_file_last = 0, peer_file_writes = 0;
+
+
+
+static int peer_record_cmp(const void *data1, const void *data2)
+{
+	uint32_t addr1 = ntohl(((struct peer_table_record *)data1)->addr);
+	uint32_t addr2 = ntohl(((struct peer_table_record *)data2)->addr);
+
+	return (addr1 < addr2 ? -1 : (addr1 > addr2 ? 1 : 0));
+}
+
+static void peer_table_wake(void)
+{
+#ifdef __linux__
+	syscall(SYS_futex, &peer_table->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * the directory is world writable - the table of a previous run is only
+ * reused if it is a plain file of our own (no symlink, no hard link),
+ * anything else is replaced by a newly created file
+ */
+static int32_t peer_table_create(void)
+{
+	struct stat st;
+	int32_t fd;
+
+	if ((fd = open(PEER_TABLE_PATH, O_RDWR | O_NOFOLLOW | O_CLOEXEC)) >= 0) {
+
+		if ((fstat(fd, &st) == 0) && (S_ISREG(st.st_mode)) && (st.st_uid == geteuid()) && (st.st_nlink == 1))
+			return fd;
+
+		close(fd);
+		debug_output(0, "Warning - replacing peer table '%s': not a regular file of this user\n", PEER_TABLE_PATH);
+
+	}
+
+	if ((unlink(PEER_TABLE_PATH) < 0) && (errno != ENOENT))
+		return -1;
+
+	return open(PEER_TABLE_PATH, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+}
+
+static void peer_table_open(void)
+{
+	struct peer_table_header *old_table;
+	uint32_t seq = 1;
+	int32_t fd;
+
+	peer_table_size = sizeof(struct peer_table_header) + PEER_TABLE_MAX_PEERS * sizeof(struct peer_table_record);
+
+	/* android has no /dev/shm but /dev is a tmpfs as well */
+	if ((mkdir(PEER_TABLE_DIR, 01777) < 0) && (errno != EEXIST))
+		debug_output(0, "Warning - can't create peer table directory '%s': %s\n", PEER_TABLE_DIR, strerror(errno));
+
+	if ((fd = peer_table_create()) < 0) {
+		debug_output(0, "Error - can't open peer table '%s': %s\n", PEER_TABLE_PATH, strerror(errno));
+		goto err;
+	}
+
+	if (ftruncate(fd, peer_table_size) < 0) {
+		debug_output(0, "Error - can't resize peer table '%s': %s\n", PEER_TABLE_PATH, strerror(errno));
+		close(fd);
+		goto err;
+	}
+
+	old_table = mmap(NULL, peer_table_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (old_table == MAP_FAILED) {
+		debug_output(0, "Error - can't map peer table '%s': %s\n", PEER_TABLE_PATH, strerror(errno));
+		goto err;
+	}
+
+	peer_table = old_table;
+
+	/**
+	 * readers may still use the table of a previous run - the reset is a
+	 * seqlock write like any other (odd even if that run died mid-write)
+	 * and the new generation wakes those waiting on the old one
+	 */
+	if ((peer_table->magic == PEER_TABLE_MAGIC) && (peer_table->version == PEER_TABLE_VERSION)) {
+		peer_generation = peer_table->generation + 1;
+		seq = peer_table->seq | 1;
+	}
+
+	peer_table->seq = seq;
+	__sync_synchronize();
+
+	memset(peer_table + 1, 0, peer_table_size - sizeof(struct peer_table_header));
+
+	peer_table->magic = PEER_TABLE_MAGIC;
+	peer_table->version = PEER_TABLE_VERSION;
+	peer_table->record_size = sizeof(struct peer_table_record);
+	peer_table->max_peers = PEER_TABLE_MAX_PEERS;
+	peer_table->num_peers = 0;
+	peer_table->changed = 0;
+	peer_table->reserved = 0;
+
+	__sync_synchronize();
+	peer_table->seq = seq + 1;
+	peer_table->generation = peer_generation;
+
+	peer_table_wake();
+	return;
+
+err:
+	peer_table_failed = 1;
+}
+
+static void peer_table_publish(void)
+{
+	if (peer_table == NULL)
+		return;
+
+	/* seqlock: the counter is odd while the records are changed */
+	peer_table->seq++;
+	__sync_synchronize();
+
+	memcpy(peer_table + 1, peer_published, peer_published_num * sizeof(struct peer_table_record));
+	peer_table->num_peers = peer_published_num;
+	peer_table->changed = time(NULL);
+
+	__sync_synchronize();
+	peer_table->seq++;
+
+	peer_table->generation = ++peer_generation;
+	peer_table_wake();
+}
+
+static int peer_list_changed(uint32_t num)
+{
+	uint32_t i;
+
+	if (num != peer_published_num)
+		return 1;
+
+	for (i = 0; i < num; i++) {
+		if ((peer_collected[i].addr != peer_published[i].addr) ||
+		    (peer_collected[i].router != peer_published[i].router) ||
+		    (peer_collected[i].tq / PEER_TABLE_TQ_BUCKET != peer_published[i].tq / PEER_TABLE_TQ_BUCKET))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void peer_file_write(void)
+{
+	struct reachable_peer *peers;
+	uint32_t offset, num, i, *timestamp;
+	int32_t fd, len;
+
+	if ((fd = open(PEER_PATH, O_RDWR | O_CREAT, 0644)) < 0) {
+		debug_output(0, "Error - can't open peer file '%s': %s\n", PEER_PATH, strerror(errno));
+		return;
+	}
+
+	/* write into the half which is not in use */
+	if (pread(fd, &offset, sizeof(offset), 0) == sizeof(offset))
+		offset = ntohl(offset) ^ PEER_FILE_HALF_SIZE;
+	else
+		offset = PEER_FILE_FIRST_HALF;
+
+	if ((offset != PEER_FILE_FIRST_HALF) && (offset != (PEER_FILE_FIRST_HALF ^ PEER_FILE_HALF_SIZE)))
+		offset = PEER_FILE_FIRST_HALF;
+
+	num = (peer_published_num > PEER_FILE_MAX_PEERS ? PEER_FILE_MAX_PEERS : peer_published_num);
+
+	/* timestamp, one record per peer and an empty record marking the end */
+	len = sizeof(uint32_t) + (num + 1) * sizeof(struct reachable_peer);
+	timestamp = debugMalloc(len, 931);
+	memset(timestamp, 0, len);
+
+	*timestamp = htonl(time(NULL));
+	peers = (struct reachable_peer *)(timestamp + 1);
+
+	for (i = 0; i < num; i++) {
+		peers[i].addr_len = 4;
+		memcpy(peers[i].addr, &peer_published[i].addr, 4);
+		peers[i].tq_avg = peer_published[i].tq;
+	}
+
+	if (pwrite(fd, timestamp, len, offset) != len)
+		debug_output(0, "Error - can't write peer file '%s': %s\n", PEER_PATH, strerror(errno));
+
+	debugFree(timestamp, 1931);
+
+#ifdef _POSIX_SYNCHRONIZED_IO
+#if _POSIX_SYNCHRONIZED_IO > 0
+	fdatasync(fd);
+#else
+	fsync(fd);
+#endif
+#else
+	fsync(fd);
+#endif
+
+	/* switch the readers to the new half */
+	offset = htonl(offset);
+	num = htonl(num);
+
+	if ((pwrite(fd, &offset, sizeof(offset), 0) != sizeof(offset)) ||
+	    (pwrite(fd, &num, sizeof(num), sizeof(offset)) != sizeof(num)))
+		debug_output(0, "Error - can't write peer file '%s': %s\n", PEER_PATH, strerror(errno));
+
+	close(fd);
+	peer_file_writes++;
+}
+
+void peer_table_update(uint32_t curr_time)
+{
+	struct hash_it_t *hashit = NULL;
+	struct orig_node *orig_node;
+	struct peer_table_record *swap;
+	uint32_t num = 0;
+
+	if ((peer_table == NULL) && (!peer_table_failed))
+		peer_table_open();
+
+	if ((peer_list_size < (uint32_t)orig_hash->elements) && (peer_list_size < PEER_TABLE_MAX_PEERS)) {
+		peer_list_size = (orig_hash->elements > PEER_TABLE_MAX_PEERS ? PEER_TABLE_MAX_PEERS : (uint32_t)orig_hash->elements);
+
+		peer_published = debugRealloc(peer_published, peer_list_size * sizeof(struct peer_table_record), 932);
+		peer_collected = debugRealloc(peer_collected, peer_list_size * sizeof(struct peer_table_record), 933);
+	}
+
+	while (NULL != (hashit = hash_iterate(orig_hash, hashit))) {
+
+		orig_node = hashit->bucket->data;
+
+		if ((orig_node->router == NULL) || (num >= peer_list_size))
+			continue;
+
+		memset(&peer_collected[num], 0, sizeof(struct peer_table_record));
+		peer_collected[num].addr = orig_node->orig;
+		peer_collected[num].router = orig_node->router->addr;
+		peer_collected[num].tq = orig_node->router->tq_avg;
+		num++;
+
+	}
+
+	qsort(peer_collected, num, sizeof(struct peer_table_record), peer_record_cmp);
+
+	if (peer_list_changed(num)) {
+
+		swap = peer_published;
+		peer_published = peer_collected;
+		peer_collected = swap;
+		peer_published_num = num;
+
+		peer_table_publish();
+		peer_file_pending = 1;
+
+	}
+
+	if ((!peer_file_pending) || (peer_file_interval == 0))
+		return;
+
+	if ((peer_file_writes > 0) && ((int)(curr_time - (peer_file_last + peer_file_interval)) < 0))
+		return;
+
+	peer_file_write();
+	peer_file_last = curr_time;
+	peer_file_pending = 0;
+}
+
+void peer_table_get_stats(uint32_t *peers, uint32_t *generation, uint32_t *file_writes)
+{
+	*peers = peer_published_num;
+	*generation = peer_generation;
+	*file_writes = peer_file_writes;
+}
+
+void peer_table_free(void)
+{
+	/* tell the readers nobody is reachable anymore */
+	peer_published_num = 0;
+	peer_table_publish();
+
+	if (peer_table != NULL)
+		munmap(peer_table, peer_table_size);
+
+	if (peer_published != NULL)
+		debugFree(peer_published, 1932);
+
+	if (peer_collected != NULL)
+		debugFree(peer_collected, 1933);
+
+	peer_table = NULL;
+	peer_published = peer_collected = NULL;
+	peer_list_size = 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_PEER_TABLE_H
+#define _BATMAN_PEER_TABLE_H
+
+#include <stdint.h>
+
+
+/***
+ *
+ * memory mapped table of the reachable originators (PEER_TABLE_PATH)
+ *
+ * The file has a fixed size: the header followed by PEER_TABLE_MAX_PEERS
+ * records of which the first num_peers are valid (sorted by address).
+ * batmand only rewrites it if an originator became reachable or
+ * unreachable, changed its next hop or its TQ value moved into another
+ * PEER_TABLE_TQ_BUCKET.
+ *
+ * Readers use the seqlock: read seq, retry while it is odd, copy the
+ * records and retry if seq changed meanwhile. generation is incremented
+ * after every change - readers may sleep on it with
+ * futex(&generation, FUTEX_WAIT, last_generation) (not FUTEX_PRIVATE).
+ * num_peers drops to 0 when batmand stops. All fields are in host byte
+ * order unless noted otherwise.
+ *
+ ***/
+
+#define PEER_TABLE_MAGIC 0x42505442         /* "BPTB" */
+#define PEER_TABLE_VERSION 1
+#define PEER_TABLE_MAX_PEERS 4096
+#define PEER_TABLE_TQ_BUCKET 16
+
+
+struct peer_table_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t max_peers;
+	volatile uint32_t seq;
+	volatile uint32_t generation;
+	uint32_t num_peers;
+	uint32_t changed;                   /* time() of the last change */
+	uint32_t reserved;
+} __attribute__((packed));
+
+struct peer_table_record {
+	uint32_t addr;                      /* network byte order */
+	uint32_t router;                    /* next hop - network byte order */
+	uint8_t tq;
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+
+void peer_table_update(uint32_t curr_time);
+void peer_table_get_stats(uint32_t *peers, uint32_t *generation, uint32_t *file_writes);
+void peer_table_free(void);
+
+#endif
@@ -40,6 +40,7 @@
 #include "../os.h"
 #include "../batman.h"
 #include "../hna.h"
+#include "../vis.h"
 
 #define IOCSETDEV 1
 
@@ -88,6 +89,63 @@ static int my_daemon(void) {
 
 }
 
+/**
+ * asks the running batmand whether it takes bulk HNA requests ("b:") - a
+ * batmand knowing them answers "y:b" with a "BULK" line, older ones take it
+ * for "y" and send their command line. Returns -1 if the socket failed.
+ */
+static int8_t unix_bulk_supported(int sock)
+{
+	char buff[1501], *line_ptr, *cr_ptr;
+	int32_t buff_len = 0, recv_len;
+	int8_t supported = 0;
+	uint8_t skip_line = 0;
+
+	memset(buff, 0, 30);
+	snprintf(buff, 30, "y:b");
+
+	if (write(sock, buff, 30) != 30)
+		return -1;
+
+	while ((recv_len = read(sock, buff + buff_len, 1500 - buff_len)) > 0) {
+
+		buff_len += recv_len;
+		buff[buff_len] = '\0';
+		line_ptr = buff;
+
+		while ((cr_ptr = strchr(line_ptr, '\n')) != NULL) {
+
+			*cr_ptr = '\0';
+
+			if (skip_line)
+				skip_line = 0;
+			else if (strcmp(line_ptr, "EOD") == 0)
+				return supported;
+			else if (strcmp(line_ptr, "BULK") == 0)
+				supported = 1;
+
+			line_ptr = cr_ptr + 1;
+
+		}
+
+		buff_len -= line_ptr - buff;
+
+		/* the command line of an old batmand may not fit - it is skipped */
+		if (buff_len == 1500) {
+			buff_len = 0;
+			skip_line = 1;
+		} else {
+			memmove(buff, line_ptr, buff_len);
+		}
+
+	}
+
+	if (recv_len == 0)
+		errno = ECONNRESET;
+
+	return -1;
+}
+
 static void create_routing_pipe(void)
 {
 	int fd[2], pipe_opts;
@@ -144,21 +202,43 @@ void apply_init_args( int argc, char *argv[] ) {
 	struct batman_if *batman_if;
 	struct hna_task *hna_task;
 	struct debug_level_info *debug_level_info;
+	struct list_head *list_pos, *list_pos_tmp;
 	uint8_t found_args = 1, batch_mode = 0, info_output = 0, was_hna = 0;
-	int8_t res;
+	int8_t res, bulk_ok = 0;
 
 	int32_t optchar, option_index, recv_buff_len, bytes_written, download_speed = 0, upload_speed = 0;
-	char str1[16], str2[16], *slash_ptr, *unix_buff, *buff_ptr, *cr_ptr;
+	int32_t bulk_len = 0, bulk_size = 0, write_len, kept_len = 0;
+	char str1[16], str2[16], *slash_ptr, *unix_buff, *buff_ptr, *cr_ptr, *bulk_buff = NULL;
 	char routing_class_opt = 0, gateway_class_opt = 0, pref_gw_opt = 0;
-	char hop_penalty_opt = 0, purge_timeout_opt = 0;
-	uint32_t vis_server = 0;
+	char hop_penalty_opt = 0, purge_timeout_opt = 0, lookup_opt = 0, snapshot_opt = 0, events_opt = 0;
+	uint32_t vis_server = 0, lookup_addr = 0;
+	long tmp_workers, tmp_value;
+	char *endptr;
 	struct option long_options[] =
 	{
 		{"policy-routing-script",     required_argument,       0, 'n'},
+		{"policy-routing-binary",     no_argument,       0, 'j'},
 		{"hop-penalty",     required_argument,       0, 'm'},
 		{"purge-timeout",     required_argument,       0, 'q'},
 		{"disable-aggregation",     no_argument,       0, 'x'},
 		{"disable-client-nat",     no_argument,       0, 'z'},
+		{"route-tq-margin",     required_argument,       0, 'e'},
+		{"route-dwell-time",     required_argument,       0, 'w'},
+		{"route-flap-penalty",     required_argument,       0, 'f'},
+		{"fib-compression",     no_argument,       0, 'k'},
+		{"lazy-routes",     required_argument,       0, 'l'},
+		{"hna-sync",     no_argument,       0, 'u'},
+		{"lookup",     required_argument,       0, 't'},
+		{"peer-file-interval",     required_argument,       0, 'P'},
+		{"gw-workers",     required_argument,       0, 'W'},
+		{"tunnel-offload",     no_argument,       0, 'O'},
+		{"disable-tunnel-aggregation",     no_argument,       0, 'G'},
+		{"tunnel-compression",     no_argument,       0, 'C'},
+		{"disable-gw-queuing",     no_argument,       0, 'Q'},
+		{"disable-gw-standby",     no_argument,       0, 'Y'},
+		{"gw-probe",     no_argument,       0, 'M'},
+		{"snapshot",     no_argument,       0, 'S'},
+		{"events",     no_argument,       0, 'E'},
 		{0, 0, 0, 0}
 	};
 
@@ -277,6 +357,11 @@ void apply_init_args( int argc, char *argv[] ) {
 				found_args += ((*((char*)( optarg - 1)) == optchar) ? 1 : 2);
 				break;
 
+			case 'j':
+				policy_routing_binary = 1;
+				found_args++;
+				break;
+
 			case 'm':
 
 				errno = 0;
@@ -297,6 +382,66 @@ void apply_init_args( int argc, char *argv[] ) {
 				found_args += ((*((char*)( optarg - 1)) == optchar ) ? 1 : 2);
 				break;
 
+			case 'e':
+
+				errno = 0;
+
+				tmp_value = strtol(optarg, &endptr, 10);
+
+				if ((errno != 0) || (endptr == optarg) || (*endptr != '\0') ||
+				    (tmp_value < 0) || (tmp_value > TQ_MAX_VALUE)) {
+
+					printf("Invalid route TQ margin specified: %s.\nThe margin has to be between 0 and %i.\n", optarg, TQ_MAX_VALUE);
+					usage();
+					exit(EXIT_FAILURE);
+
+				}
+
+				route_tq_margin = tmp_value;
+
+				found_args += ((*((char*)( optarg - 1)) == optchar ) ? 1 : 2);
+				break;
+
+			case 'w':
+
+				errno = 0;
+
+				tmp_value = strtol(optarg, &endptr, 10);
+
+				if ((errno != 0) || (endptr == optarg) || (*endptr != '\0') ||
+				    (tmp_value < 0) || (tmp_value > ROUTE_SWITCH_DWELL_TIME_MAX)) {
+
+					printf("Invalid route dwell time specified: %s.\nThe dwell time has to be between 0 and %i ms.\n", optarg, ROUTE_SWITCH_DWELL_TIME_MAX);
+					usage();
+					exit(EXIT_FAILURE);
+
+				}
+
+				route_dwell_time = tmp_value;
+
+				found_args += ((*((char*)( optarg - 1)) == optchar ) ? 1 : 2);
+				break;
+
+			case 'f':
+
+				errno = 0;
+
+				tmp_value = strtol(optarg, &endptr, 10);
+
+				if ((errno != 0) || (endptr == optarg) || (*endptr != '\0') ||
+				    (tmp_value < 0) || (tmp_value > ROUTE_FLAP_PENALTY_MAX)) {
+
+					printf("Invalid route flap penalty specified: %s.\nThe penalty has to be between 0 and %i.\n", optarg, ROUTE_FLAP_PENALTY_MAX);
+					usage();
+					exit(EXIT_FAILURE);
+
+				}
+
+				route_flap_penalty = tmp_value;
+
+				found_args += ((*((char*)( optarg - 1)) == optchar ) ? 1 : 2);
+				break;
+
 			case 'o':
 
 				errno = 0;
@@ -376,11 +521,134 @@ void apply_init_args( int argc, char *argv[] ) {
 				found_args++;
 				break;
 
+			case 'k':
+				fib_compression = 1;
+				found_args++;
+				break;
+
+			case 'l':
+
+				errno = 0;
+
+				tmp_value = strtol(optarg, &endptr, 10);
+
+				if ((errno != 0) || (endptr == optarg) || (*endptr != '\0') ||
+				    (tmp_value < 0) || (tmp_value > LAZY_ROUTE_TIMEOUT_MAX)) {
+
+					printf("Invalid lazy route timeout specified: %s.\nThe timeout has to be between 0 and %i ms.\n", optarg, LAZY_ROUTE_TIMEOUT_MAX);
+					usage();
+					exit(EXIT_FAILURE);
+
+				}
+
+				lazy_route_timeout = tmp_value;
+
+				found_args += ((*((char*)( optarg - 1)) == optchar ) ? 1 : 2);
+				break;
+
 			case 'z':
 				disable_client_nat = 1;
 				found_args++;
 				break;
 
+			case 'u':
+				hna_sync = 1;
+				found_args++;
+				break;
+
+			case 'O':
+				tunnel_offload = 1;
+				found_args++;
+				break;
+
+			case 'G':
+				tunnel_aggregation = 0;
+				found_args++;
+				break;
+
+			case 'C':
+				tunnel_compression = 1;
+				found_args++;
+				break;
+
+			case 'Q':
+				gw_queuing = 0;
+				found_args++;
+				break;
+
+			case 'Y':
+				gw_standby = 0;
+				found_args++;
+				break;
+
+			case 'M':
+				gw_probing = 1;
+				found_args++;
+				break;
+
+			case 'P':
+
+				errno = 0;
+
+				tmp_value = strtol(optarg, &endptr, 10);
+
+				if ((errno != 0) || (endptr == optarg) || (*endptr != '\0') ||
+				    (tmp_value < 0) || (tmp_value > PEER_FILE_INTERVAL_MAX)) {
+
+					printf("Invalid peer file interval specified: %s.\nThe interval has to be between 0 and %i ms.\n", optarg, PEER_FILE_INTERVAL_MAX);
+					usage();
+					exit(EXIT_FAILURE);
+
+				}
+
+				peer_file_interval = tmp_value;
+
+				found_args += ((*((char*)( optarg - 1)) == optchar ) ? 1 : 2);
+				break;
+
+			case 'W':
+
+				errno = 0;
+
+				tmp_workers = strtol(optarg, NULL, 10);
+
+				if ((tmp_workers < 1) || (tmp_workers > GW_WORKERS_MAX)) {
+
+					printf("Invalid number of gateway workers specified: %li.\nThe number has to be between 1 and %i.\n", tmp_workers, GW_WORKERS_MAX);
+					exit(EXIT_FAILURE);
+
+				}
+
+				gw_workers = tmp_workers;
+
+				found_args += ((*((char*)( optarg - 1)) == optchar ) ? 1 : 2);
+				break;
+
+			case 't':
+
+				if (inet_pton(AF_INET, optarg, &tmp_ip_holder) < 1) {
+
+					printf("Invalid lookup IP specified: %s\n", optarg);
+					exit(EXIT_FAILURE);
+
+				}
+
+				lookup_addr = tmp_ip_holder.s_addr;
+				lookup_opt = 1;
+
+				found_args += ((*((char*)( optarg - 1)) == optchar) ? 1 : 2);
+				break;
+
+			case 'S':
+				snapshot_opt = 1;
+				found_args++;
+				break;
+
+			case 'E':
+				events_opt = 1;
+				found_args++;
+				break;
+
 			case 'h':
 			default:
 				usage();
@@ -397,6 +665,24 @@ void apply_init_args( int argc, char *argv[] ) {
 
 	}
 
+	if (!unix_client && lookup_opt) {
+		fprintf(stderr, "Error - '--lookup' asks the running batmand and needs the '-c' option !\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (!unix_client && snapshot_opt) {
+		fprintf(stderr, "Error - '--snapshot' asks the running batmand and needs the '-c' option !\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (!unix_client && events_opt) {
+		fprintf(stderr, "Error - '--events' subscribes to the running batmand and needs the '-c' option !\n");
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
 	if ( ( download_speed > 0 ) && ( upload_speed == 0 ) )
 		upload_speed = download_speed / 5;
 
@@ -426,6 +712,17 @@ void apply_init_args( int argc, char *argv[] ) {
 	if ( ( ( routing_class != 0 ) || ( gateway_class != 0 ) ) && ( !probe_tun(1) ) )
 		exit(EXIT_FAILURE);
 
+	if (lazy_route_timeout > 0) {
+#ifdef NO_POLICY_ROUTING
+		/* the catch-all route would end up in the main routing table */
+		fprintf(stderr, "Error - lazy routes need policy routing !\n");
+		exit(EXIT_FAILURE);
+#endif
+
+		if (!probe_tun(1))
+			exit(EXIT_FAILURE);
+	}
+
 	if (!unix_client) {
 
 		if (argc <= found_args) {
@@ -439,6 +736,9 @@ void apply_init_args( int argc, char *argv[] ) {
 
 		nat_tool_avail = probe_nat_tool();
 
+		if ((policy_routing_binary) && (policy_routing_script == NULL))
+			fprintf(stderr, "Warning - the activated option '--policy-routing-binary' has no effect without a policy routing script.\n");
+
 		if (policy_routing_script != NULL)
 			create_routing_pipe();
 
@@ -563,13 +863,29 @@ void apply_init_args( int argc, char *argv[] ) {
 
 		log_facility_active = 1;
 
+		if (add_wakeup_pipe() < 0) {
+			restore_defaults();
+			exit(EXIT_FAILURE);
+		}
+
 		pthread_create( &unix_if.listen_thread_id, NULL, &unix_listen, NULL );
 
+		/* idles while no routing class is set */
+		if (gw_probing)
+			pthread_create(&gw_probe_thread_id, NULL, &client_probe_gws, NULL);
+
 		/* add rule for hna networks */
 		add_del_rule(0, 0, BATMAN_RT_TABLE_NETWORKS, BATMAN_RT_PRIO_UNREACH - 1, 0, RULE_TYPE_DST, RULE_ADD);
 
-		/* add unreachable routing table entry */
-		add_del_route(0, 0, 0, 0, 0, "unknown", BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_UNREACHABLE, ROUTE_ADD);
+		/* add unreachable routing table entry - or catch the packets for the lazy routes */
+		if (lazy_route_timeout > 0) {
+			if (add_lazy_interface() < 0) {
+				restore_defaults();
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			add_del_route(0, 0, 0, 0, 0, "unknown", BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_UNREACHABLE, ROUTE_ADD);
+		}
 
 		if (routing_class > 0) {
 			if (add_del_interface_rules(RULE_ADD) < 0) {
@@ -578,6 +894,13 @@ void apply_init_args( int argc, char *argv[] ) {
 			}
 		}
 
+		if (hna_sync) {
+			if (add_hna_sync_socket() < 0) {
+				restore_defaults();
+				exit(EXIT_FAILURE);
+			}
+		}
+
 		memset(&vis_if, 0, sizeof(vis_if));
 
 		if (vis_server) {
@@ -585,6 +908,7 @@ void apply_init_args( int argc, char *argv[] ) {
 			vis_if.addr.sin_port = htons(PORT + 2);
 			vis_if.addr.sin_addr.s_addr = vis_server;
 			vis_if.sock = socket( PF_INET, SOCK_DGRAM, 0 );
+			vis_init();
 		}
 
 		if (gateway_class != 0)
@@ -619,6 +943,7 @@ void apply_init_args( int argc, char *argv[] ) {
 	} else {
 
 more_hna:
+		kept_len = 0;
 		unix_if.unix_sock = socket( AF_LOCAL, SOCK_STREAM, 0 );
 
 		memset( &unix_if.addr, 0, sizeof(struct sockaddr_un) );
@@ -672,13 +997,38 @@ more_hna:
 			batch_mode = 1;
 			snprintf(unix_buff, 20, "q:%u", purge_timeout);
 
+		} else if (lookup_opt) {
+
+			batch_mode = 1;
+			addr_to_string(lookup_addr, str1, sizeof(str1));
+			snprintf(unix_buff, 20, "l:%s", str1);
+
+		} else if (snapshot_opt) {
+
+			batch_mode = 1;
+			snprintf(unix_buff, 10, "j");
+
+		} else if (events_opt) {
+
+			/* not in batch mode - the events are printed until batmand stops */
+			snprintf(unix_buff, 10, "e");
+
 		} else if (info_output) {
 
 			batch_mode = 1;
 			snprintf( unix_buff, 10, "i" );
 
-		} else if (!list_empty(&hna_chg_list)) {
+		} else if ((!list_empty(&hna_chg_list)) && (!was_hna) &&
+			   ((bulk_ok = unix_bulk_supported(unix_if.unix_sock)) < 0)) {
+
+			printf("Error - can't talk to batmand via unix socket: %s\n", strerror(errno));
+			close(unix_if.unix_sock);
+			debugFree(unix_buff, 5101);
+			exit(EXIT_FAILURE);
+
+		} else if ((!list_empty(&hna_chg_list)) && (!bulk_ok)) {
 
+			/* older batmand versions take one announced network change per connection */
 			batch_mode = was_hna = 1;
 			hna_task = (struct hna_task *)hna_chg_list.next;
 			addr_to_string(hna_task->addr, str1, sizeof(str1));
@@ -689,6 +1039,36 @@ more_hna:
 			list_del((struct list_head *)&hna_chg_list, &hna_task->list, &hna_chg_list);
 			debugFree(hna_task, 1298);
 
+		} else if (!list_empty(&hna_chg_list)) {
+
+			/* all announced network changes are sent as one bulk request */
+			batch_mode = 1;
+			bulk_size = UNIX_BULK_CHUNK;
+			bulk_buff = debugMalloc(bulk_size, 5002);
+			bulk_len = sprintf(bulk_buff, "b:");
+
+			list_for_each_safe(list_pos, list_pos_tmp, &hna_chg_list) {
+
+				hna_task = list_entry(list_pos, struct hna_task, list);
+
+				if (bulk_size - bulk_len < 30) {
+					bulk_size += UNIX_BULK_CHUNK;
+					bulk_buff = debugRealloc(bulk_buff, bulk_size, 5003);
+				}
+
+				addr_to_string(hna_task->addr, str1, sizeof(str1));
+				bulk_len += snprintf(bulk_buff + bulk_len, bulk_size - bulk_len, "%c:%s/%i\n",
+				                     (hna_task->route_action == ROUTE_ADD ? 'a' : 'A'),
+				                     str1, hna_task->netmask);
+
+				list_del((struct list_head *)&hna_chg_list, list_pos, &hna_chg_list);
+				debugFree(hna_task, 1298);
+
+			}
+
+			/* empty line terminates the request */
+			bulk_buff[bulk_len++] = '\n';
+
 		} else {
 
 			batch_mode = 1;
@@ -696,17 +1076,36 @@ more_hna:
 
 		}
 
-		if ( write( unix_if.unix_sock, unix_buff, 30 ) < 0 ) {
+		buff_ptr = (bulk_buff != NULL ? bulk_buff : unix_buff);
+		write_len = (bulk_buff != NULL ? bulk_len : 30);
 
-			printf( "Error - can't write to unix socket: %s\n", strerror(errno) );
-			close( unix_if.unix_sock );
-			debugFree( unix_buff, 5101 );
-			exit(EXIT_FAILURE);
+		while (write_len > 0) {
+
+			if ((bytes_written = write(unix_if.unix_sock, buff_ptr, write_len)) < 0) {
+
+				if (errno == EINTR)
+					continue;
+
+				printf( "Error - can't write to unix socket: %s\n", strerror(errno) );
+				close( unix_if.unix_sock );
+				debugFree( unix_buff, 5101 );
+				exit(EXIT_FAILURE);
+
+			}
 
+			buff_ptr += bytes_written;
+			write_len -= bytes_written;
+
+		}
+
+		if (bulk_buff != NULL) {
+			debugFree(bulk_buff, 5103);
+			bulk_buff = NULL;
 		}
 
-		while ( ( recv_buff_len = read( unix_if.unix_sock, unix_buff, 1500 ) ) > 0 ) {
+		while ( ( recv_buff_len = read( unix_if.unix_sock, unix_buff + kept_len, 1500 - kept_len ) ) > 0 ) {
 
+			recv_buff_len += kept_len;
 			unix_buff[recv_buff_len] = '\0';
 
 			buff_ptr = unix_buff;
@@ -737,11 +1136,26 @@ more_hna:
 
 			}
 
-			if ( bytes_written != recv_buff_len )
-				printf( "%s", buff_ptr );
+			/* keep an incomplete line for the next read unless it fills the whole buffer */
+			kept_len = recv_buff_len - bytes_written;
+
+			if (kept_len == 1500) {
+				printf("%s", buff_ptr);
+				kept_len = 0;
+			} else {
+				memmove(unix_buff, buff_ptr, kept_len);
+			}
+
+			/* streamed output (debug levels, events) may be piped into another program */
+			fflush(stdout);
 
 		}
 
+		if ((recv_buff_len == 0) && (kept_len > 0)) {
+			unix_buff[kept_len] = '\0';
+			printf("%s", unix_buff);
+		}
+
 close_con:
 		close( unix_if.unix_sock );
 		debugFree( unix_buff, 5102 );
@@ -785,6 +1199,27 @@ void interface_listen_sockets(void)
 			FD_SET(batman_if->udp_recv_sock, &receive_wait_set);
 		}
 	}
+
+	if (lazy_if.tun_fd) {
+		if (lazy_if.tun_fd > receive_max_sock)
+			receive_max_sock = lazy_if.tun_fd;
+
+		FD_SET(lazy_if.tun_fd, &receive_wait_set);
+	}
+
+	if (hna_sync_sock) {
+		if (hna_sync_sock > receive_max_sock)
+			receive_max_sock = hna_sync_sock;
+
+		FD_SET(hna_sync_sock, &receive_wait_set);
+	}
+
+	if (wakeup_pipe[0]) {
+		if (wakeup_pipe[0] > receive_max_sock)
+			receive_max_sock = wakeup_pipe[0];
+
+		FD_SET(wakeup_pipe[0], &receive_wait_set);
+	}
 }
 
 static int is_interface_up(char *dev)
@@ -987,6 +1422,7 @@ static void activate_interface(struct batman_if *batman_if)
 	active_ifs++;
 
 	interface_listen_sockets();
+	vis_update_local();
 	debug_output(3, "Interface activated: %s\n", batman_if->dev);
 
 	batman_if->if_rp_filter_old = get_rp_filter(batman_if->dev);
@@ -1073,6 +1509,14 @@ void init_interface_gw (void) {
 
 		}
 
+#ifdef SO_REUSEPORT
+		/* the further gateway workers bind their sockets to the same port */
+		sock_opts = 1;
+
+		if ((gw_workers > 1) && (setsockopt(batman_if->udp_tunnel_sock, SOL_SOCKET, SO_REUSEPORT, &sock_opts, sizeof(sock_opts)) < 0))
+			debug_output(0, "Warning - can't set SO_REUSEPORT on tunnel socket: %s\n", strerror(errno));
+#endif
+
 		if ( bind( batman_if->udp_tunnel_sock, (struct sockaddr *)&batman_if->addr, sizeof(struct sockaddr_in) ) < 0 ) {
 
 			debug_output( 0, "Error - can't bind tunnel socket: %s\n", strerror(errno) );
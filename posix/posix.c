@@ -33,11 +33,22 @@
 #include <sys/times.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <fcntl.h>
 #include <net/if.h>
+#include <netinet/ip.h>
 
 #include "../os.h"
 #include "../batman.h"
 #include "../hna.h"
+#include "../fib.h"
+#include "../hna_sync.h"
+#include "../lpm.h"
+#include "../peer_table.h"
+#include "../snapshot.h"
+#include "../events.h"
+#include "../view.h"
+#include "../vis.h"
+#include "../route_pipe.h"
 
 
 #define BAT_LOGO_PRINT(x,y,z) printf( "\x1B[%i;%iH%c", y + 1, x, z )                      /* write char 'z' into column 'x', row 'y' */
@@ -47,7 +58,8 @@
 static clock_t last_clock_tick;
 static float system_tick;
 
-uint8_t tunnel_running = 0;
+/* gateway of every running client tunnel thread - the main thread takes a free slot, the thread clears it on exit */
+uint32_t tunnel_gw_addrs[GW_TUNNELS_MAX];
 
 static pthread_mutex_t batman_clock_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct tms dummy_tms_struct;
@@ -288,39 +300,289 @@ void handler( int32_t BATMANUNUSED(sig) ) {
 void del_default_route(void)
 {
 	curr_gateway = NULL;
+	tunnel_wakeup();
 }
 
 
 
-void add_default_route(void)
+static int32_t tunnel_slot(uint32_t gw_addr)
+{
+	int32_t i;
+
+	for (i = 0; i < GW_TUNNELS_MAX; i++) {
+
+		if (tunnel_gw_addrs[i] == gw_addr)
+			return i;
+
+	}
+
+	return -1;
+}
+
+static void add_tunnel(struct gw_node *gw_node)
 {
 	struct curr_gw_data *curr_gw_data;
+	int32_t slot;
 
-	if (tunnel_running) {
-		debug_output(3, "Error - couldn't create tunnel: old tunnel is still active\n");
+	if ((gw_node == NULL) || (tunnel_slot(gw_node->orig_node->orig) >= 0))
+		return;
+
+	if ((slot = tunnel_slot(0)) < 0) {
+		debug_output(3, "Error - couldn't create tunnel: old tunnels are still active\n");
 		return;
 	}
 
 	curr_gw_data = debugMalloc( sizeof(struct curr_gw_data), 207 );
-	curr_gw_data->orig = curr_gateway->orig_node->orig;
-	curr_gw_data->gw_node = curr_gateway;
-	curr_gw_data->batman_if = curr_gateway->orig_node->batman_if;
+	curr_gw_data->orig = gw_node->orig_node->orig;
+	curr_gw_data->gw_port = gw_node->gw_port;
+	curr_gw_data->batman_if = gw_node->orig_node->batman_if;
+	curr_gw_data->slot = slot;
 
-	tunnel_running = 1;
+	tunnel_gw_addrs[slot] = curr_gw_data->orig;
 
 	if (pthread_create(&curr_gateway_thread_id, NULL, &client_to_gw_tun, curr_gw_data) != 0) {
 
 		debug_output(0, "Error - couldn't spawn thread: %s\n", strerror(errno));
 		debugFree(curr_gw_data, 1213);
-		curr_gateway = NULL;
-		tunnel_running = 0;
+		tunnel_gw_addrs[slot] = 0;
+
+		if (gw_node == curr_gateway)
+			curr_gateway = NULL;
 
 	} else {
 
 		pthread_detach(curr_gateway_thread_id);
 
 	}
+}
+
+static uint8_t tunnels_running(void)
+{
+	int32_t i;
+
+	for (i = 0; i < GW_TUNNELS_MAX; i++) {
+
+		if (tunnel_gw_addrs[i] != 0)
+			return 1;
+
+	}
+
+	return 0;
+}
+
+/* starts the tunnels to the selected and the standby gateway unless they are running already */
+void add_default_route(void)
+{
+	/* the tunnel threads follow the gateway selection via the published view */
+	view_publish(1);
+
+	add_tunnel(curr_gateway);
+	add_tunnel(standby_gateway);
+}
+
+/* the selected or the standby gateway has no tunnel thread (yet) */
+uint8_t tunnel_missing(void)
+{
+	if ((curr_gateway != NULL) && (tunnel_slot(curr_gateway->orig_node->orig) < 0))
+		return 1;
+
+	return ((standby_gateway != NULL) && (tunnel_slot(standby_gateway->orig_node->orig) < 0));
+}
+
+
+
+/* replaces the unreachable entry with a route into the lazy tun device */
+int8_t add_lazy_interface(void)
+{
+	struct batman_if *batman_if = (struct batman_if *)if_list.next;
+
+	if (add_dev_lazy_tun(lazy_if.tun_dev, sizeof(lazy_if.tun_dev), &lazy_if.tun_fd, &lazy_if.tun_ifi) < 0) {
+		lazy_if.tun_fd = 0;
+		return -1;
+	}
+
+	if ((lazy_if.raw_sock = socket(PF_INET, SOCK_RAW, IPPROTO_RAW)) < 0) {
+		debug_output(0, "Error - can't create raw socket for lazy routes: %s\n", strerror(errno));
+		lazy_if.raw_sock = 0;
+		return -1;
+	}
+
+	/* locally generated packets shall leave with the address of the primary interface */
+	add_del_route(0, 0, 0, batman_if->addr.sin_addr.s_addr, lazy_if.tun_ifi, lazy_if.tun_dev, BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+
+	if (lazy_if.tun_fd > receive_max_sock)
+		receive_max_sock = lazy_if.tun_fd;
+
+	FD_SET(lazy_if.tun_fd, &receive_wait_set);
+	return 1;
+}
+
+void del_lazy_interface(void)
+{
+	if (lazy_if.tun_fd) {
+		add_del_route(0, 0, 0, 0, lazy_if.tun_ifi, lazy_if.tun_dev, BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+		close(lazy_if.tun_fd);
+		lazy_if.tun_fd = 0;
+	}
+
+	if (lazy_if.raw_sock) {
+		close(lazy_if.raw_sock);
+		lazy_if.raw_sock = 0;
+	}
+}
+
+/* receives the hna sync requests and updates on all interfaces */
+int8_t add_hna_sync_socket(void)
+{
+	struct sockaddr_in addr;
+	int32_t sock_opts;
+
+	if ((hna_sync_sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+		debug_output(0, "Error - can't create hna sync socket: %s\n", strerror(errno));
+		hna_sync_sock = 0;
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(HNA_SYNC_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (bind(hna_sync_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		debug_output(0, "Error - can't bind hna sync socket: %s\n", strerror(errno));
+		del_hna_sync_socket();
+		return -1;
+	}
 
+	sock_opts = fcntl(hna_sync_sock, F_GETFL, 0);
+	fcntl(hna_sync_sock, F_SETFL, sock_opts | O_NONBLOCK);
+
+	if (hna_sync_sock > receive_max_sock)
+		receive_max_sock = hna_sync_sock;
+
+	FD_SET(hna_sync_sock, &receive_wait_set);
+	return 1;
+}
+
+void del_hna_sync_socket(void)
+{
+	if (hna_sync_sock) {
+		close(hna_sync_sock);
+		hna_sync_sock = 0;
+	}
+}
+
+/* other threads write a byte into the pipe to make the main loop run */
+int8_t add_wakeup_pipe(void)
+{
+	int32_t sock_opts, i;
+
+	if (pipe(wakeup_pipe) < 0) {
+		debug_output(0, "Error - can't create wakeup pipe: %s\n", strerror(errno));
+		wakeup_pipe[0] = wakeup_pipe[1] = 0;
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		sock_opts = fcntl(wakeup_pipe[i], F_GETFL, 0);
+		fcntl(wakeup_pipe[i], F_SETFL, sock_opts | O_NONBLOCK);
+	}
+
+	if (wakeup_pipe[0] > receive_max_sock)
+		receive_max_sock = wakeup_pipe[0];
+
+	FD_SET(wakeup_pipe[0], &receive_wait_set);
+	return 1;
+}
+
+void del_wakeup_pipe(void)
+{
+	if (wakeup_pipe[0]) {
+		close(wakeup_pipe[0]);
+		close(wakeup_pipe[1]);
+		wakeup_pipe[0] = wakeup_pipe[1] = 0;
+	}
+}
+
+void wakeup_main_loop(void)
+{
+	char c = 0;
+
+	/* a full pipe wakes the main loop as well */
+	if ((wakeup_pipe[1]) && (write(wakeup_pipe[1], &c, 1) < 0) && (errno != EAGAIN))
+		debug_output(0, "Error - can't wake up the main loop: %s\n", strerror(errno));
+}
+
+static void wakeup_pipe_drain(void)
+{
+	char buff[64];
+
+	while (read(wakeup_pipe[0], buff, sizeof(buff)) > 0);
+}
+
+static void hna_sync_receive_packets(void)
+{
+	unsigned char packet_buff[2000];
+	struct sockaddr_in addr;
+	socklen_t addr_len;
+	ssize_t packet_len;
+	uint32_t curr_time = get_time_msec();
+	int i;
+
+	/* don't starve the originator processing */
+	for (i = 0; i < 64; i++) {
+
+		addr_len = sizeof(addr);
+
+		if ((packet_len = recvfrom(hna_sync_sock, packet_buff, sizeof(packet_buff), 0, (struct sockaddr *)&addr, &addr_len)) < 0) {
+
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				debug_output(0, "Error - can't receive hna sync packet: %s\n", strerror(errno));
+
+			break;
+		}
+
+		hna_sync_recv_packet(packet_buff, packet_len, &addr, curr_time);
+	}
+}
+
+/* installs the routes towards the destinations of the caught packets and sends the packets again */
+static void lazy_receive_packets(void)
+{
+	unsigned char packet_buff[2000];
+	struct sockaddr_in addr;
+	struct iphdr *iph;
+	ssize_t packet_len;
+	uint32_t curr_time = get_time_msec();
+	int i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+
+	/* don't starve the originator processing */
+	for (i = 0; i < 64; i++) {
+
+		if ((packet_len = read(lazy_if.tun_fd, packet_buff, sizeof(packet_buff))) < 0) {
+
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				debug_output(0, "Error - can't read from lazy tun device: %s\n", strerror(errno));
+
+			break;
+		}
+
+		iph = (struct iphdr *)packet_buff;
+
+		if ((packet_len < (ssize_t)sizeof(struct iphdr)) || (iph->version != 4))
+			continue;
+
+		if (!fib_lazy_miss(iph->daddr, curr_time))
+			continue;
+
+		addr.sin_addr.s_addr = iph->daddr;
+
+		if (sendto(lazy_if.raw_sock, packet_buff, packet_len, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			debug_output(4, "Lazy routes: can't send packet again: %s\n", strerror(errno));
+	}
 }
 
 
@@ -366,6 +628,33 @@ int8_t receive_packet(unsigned char *packet_buff, int32_t packet_buff_len, int16
 	if ( res == 0 )
 		return 0;
 
+	if ((lazy_if.tun_fd) && (FD_ISSET(lazy_if.tun_fd, &tmp_wait_set))) {
+
+		lazy_receive_packets();
+
+		if (--res == 0)
+			return 0;
+
+	}
+
+	if ((hna_sync_sock) && (FD_ISSET(hna_sync_sock, &tmp_wait_set))) {
+
+		hna_sync_receive_packets();
+
+		if (--res == 0)
+			return 0;
+
+	}
+
+	if ((wakeup_pipe[0]) && (FD_ISSET(wakeup_pipe[0], &tmp_wait_set))) {
+
+		wakeup_pipe_drain();
+
+		if (--res == 0)
+			return 0;
+
+	}
+
 	list_for_each(if_pos, &if_list) {
 
 		batman_if = list_entry(if_pos, struct batman_if, list);
@@ -433,6 +722,8 @@ void del_gw_interface(void)
 	if (batman_if->udp_tunnel_sock > 0) {
 
 		if (batman_if->listen_thread_id != 0) {
+			/* gw_listen() sleeps until it is told to check gateway_class / stop */
+			tunnel_wakeup();
 			pthread_join(batman_if->listen_thread_id, NULL);
 		} else {
 
@@ -460,8 +751,10 @@ void restore_defaults(void) {
 
 	struct list_head *if_pos, *if_pos_tmp;
 	struct batman_if *batman_if;
+	int32_t i;
 
 	stop = 1;
+	tunnel_wakeup();
 
 	if ( routing_class > 0 )
 		add_del_interface_rules(RULE_DEL);
@@ -483,14 +776,23 @@ void restore_defaults(void) {
 	add_del_rule(0, 0, BATMAN_RT_TABLE_NETWORKS, BATMAN_RT_PRIO_UNREACH - 1, 0, RULE_TYPE_DST, RULE_DEL);
 
 	/* delete unreachable routing table entry */
-	add_del_route(0, 0, 0, 0, 0, "unknown", BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_UNREACHABLE, ROUTE_DEL);
+	if (lazy_route_timeout > 0)
+		del_lazy_interface();
+	else
+		add_del_route(0, 0, 0, 0, 0, "unknown", BATMAN_RT_TABLE_UNREACH, ROUTE_TYPE_UNREACHABLE, ROUTE_DEL);
 
 	if ( ( routing_class != 0 ) && ( curr_gateway != NULL ) )
 		del_default_route();
 
+	/* the (detached) tunnel threads remove their tun devices and free their buffers */
+	for (i = 0; (tunnels_running()) && (i < 100); i++)
+		usleep(10000);
+
 	if ( vis_if.sock )
 		close( vis_if.sock );
 
+	del_hna_sync_socket();
+
 	if ( unix_if.unix_sock )
 		close( unix_if.unix_sock );
 
@@ -499,10 +801,19 @@ void restore_defaults(void) {
 		unix_if.listen_thread_id = 0;
 	}
 
+	if (gw_probe_thread_id != 0) {
+		pthread_join(gw_probe_thread_id, NULL);
+		gw_probe_thread_id = 0;
+	}
+
+	/* the unix socket thread is gone - nobody wakes us anymore */
+	del_wakeup_pipe();
+
 	if ( debug_level == 0 )
 		closelog();
 
 	if (policy_routing_script != NULL) {
+		route_pipe_close();
 		close(policy_routing_pipe);
 		waitpid(policy_routing_script_pid, NULL, 0);
 	}
@@ -631,6 +942,14 @@ int main(int argc, char *argv[])
 
 	/* cleaning up */
 	hna_free();
+	hna_sync_free();
+	fib_free();
+	lpm_free();
+	peer_table_free();
+	snapshot_free();
+	event_free();
+	view_free();
+	vis_free();
 
 	restore_defaults();
 	cleanup();
@@ -21,6 +21,8 @@
 
 
 
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -28,6 +30,7 @@
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
@@ -37,66 +40,1547 @@
 #endif
 #include <net/if.h>
 #include <fcntl.h>        /* open(), O_RDWR */
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <linux/virtio_net.h>
+#endif
+
+
+#include "../os.h"
+#include "../batman.h"
+#include "../view.h"
+#include "../hdr_comp.h"
+#include "../fq_codel.h"
+#include "../gw_table.h"
+#include "../gw_probe.h"
+
+
+
+#define TUNNEL_DATA 0x01
+#define TUNNEL_IP_REQUEST 0x02
+#define TUNNEL_IP_INVALID 0x03
+#define TUNNEL_KEEPALIVE_REQUEST 0x04
+#define TUNNEL_KEEPALIVE_REPLY 0x05
+#define TUNNEL_DATA_AGGR 0x06                 /* several packets, each behind its length (2 bytes, network order) */
+#define TUNNEL_COMP_RESYNC 0x09               /* the context id follows - its full header got lost (0x07 / 0x08 are the probes) */
+
+/* capabilities exchanged with the ip request - older gateways echo the request and leave the gateway byte 0 */
+#define TUNNEL_CAPS_CLIENT 5
+#define TUNNEL_CAPS_GW 6
+#define TUNNEL_CAP_AGGR 0x01
+#define TUNNEL_CAP_COMP 0x02                  /* header compression (see hdr_comp.c) */
+#define TUNNEL_CAP_PORT 0x04                  /* the lease follows the port of a new ip request - older gateways stick to the first one */
+
+#define TUNNEL_AGGR_PACKET_MAX 512            /* larger packets are sent on their own */
+
+#define GW_STATE_UNKNOWN  0x01
+#define GW_STATE_VERIFIED 0x02
+
+#define GW_STATE_UNKNOWN_TIMEOUT 60000
+#define GW_STATE_VERIFIED_TIMEOUT 5 * GW_STATE_UNKNOWN_TIMEOUT
+
+#define IP_LEASE_TIMEOUT 4 * GW_STATE_VERIFIED_TIMEOUT
+
+#define GW_CLIENT_SWEEP_INTERVAL 60000
+
+/* what the view wants a client tunnel to do */
+#define CLIENT_ROLE_NONE 0
+#define CLIENT_ROLE_ACTIVE 1                  /* routes the traffic */
+#define CLIENT_ROLE_STANDBY 2                 /* only holds its lease - ready to take over */
+
+#define CLIENT_HANDOVER_WAIT 1000             /* ms the old tunnel waits for a standby to take over */
+#define CLIENT_PORT_WAIT 2000                 /* ms a new tunnel waits for the old one to free the tunnel port */
+#define CLIENT_NO_STANDBY_MAX 8
+#define CLIENT_NO_STANDBY_TIMEOUT 300000      /* ms before a gateway without TUNNEL_CAP_PORT is asked again */
+
+/* what woke up a tunnel thread */
+#define TUNNEL_EV_SOCK 0x01
+#define TUNNEL_EV_TUN 0x02
+#define TUNNEL_EV_TIMER 0x04
+#define TUNNEL_EV_WAKEUP 0x08
+#define TUNNEL_EV_SOCK_OUT 0x10               /* the socket takes data again (see tunnel_poll_sock_out()) */
+
+#define TUNNEL_BUFF_LEN 1501
+#ifdef __linux__
+#define TUNNEL_BATCH_LEN 32
+#else
+#define TUNNEL_BATCH_LEN 1
+#endif
+
+/* with offloads (--tunnel-offload) a buffer holds a whole TSO packet or GSO / GRO datagram train */
+#define TUNNEL_GSO_BUFF_LEN 65535
+#define TUNNEL_GSO_TRAIN_LEN (65535 - 28)     /* largest UDP payload */
+#define TUNNEL_GSO_SEGS_MAX 64
+#define TUNNEL_GSO_BATCH_LEN 8
+
+#define TUNNEL_BATCH_VNET 0x01                /* tun device passes a virtio_net_hdr with every packet */
+#define TUNNEL_BATCH_GSO 0x02                 /* datagrams of the same size are sent with one UDP_SEGMENT buffer */
+#define TUNNEL_BATCH_GRO 0x04                 /* received buffers may hold several datagrams (UDP_GRO) */
+#define TUNNEL_BATCH_KEEP 0x08                /* datagrams the full socket did not take stay in the batch */
+
+#ifdef __linux__
+#define TUNNEL_CTRL_LEN CMSG_SPACE(sizeof(int))
+#define TUNNEL_TH_CWR 0x80
+#define TUNNEL_VNET_LEN sizeof(struct virtio_net_hdr)
+#else
+#define TUNNEL_VNET_LEN 0
+#endif
+
+/* queued packets keep room for the virtio_net_hdr in front and for headers rebuilt by hdr_decomp_packet() */
+#define TUNNEL_QUEUE_PACKET_LEN (TUNNEL_VNET_LEN + TUNNEL_BUFF_LEN + HDR_COMP_HDR_MAX)
+
+#define TUNNEL_POLL_CLIENT 0                  /* one slot per client tunnel thread */
+#define TUNNEL_POLL_GW GW_TUNNELS_MAX         /* one slot per gateway worker */
+#define TUNNEL_POLL_MAX (TUNNEL_POLL_GW + GW_WORKERS_MAX)
+
+
+/**
+ * the tunnel threads sleep until a packet arrives, their next deadline
+ * (lease refresh, blackhole detection, client sweep) expired or the main
+ * thread wakes them via tunnel_wakeup() - on Linux with epoll, a timerfd
+ * and an eventfd, elsewhere with select() and a pipe
+ */
+struct tunnel_poll {
+#ifdef __linux__
+	int32_t epoll_fd;
+	int32_t timer_fd;
+#else
+	fd_set wait_sockets;
+	fd_set write_sockets;
+	int32_t max_sock;
+#endif
+	int32_t sock;
+	int32_t tun_fd;
+	int32_t wakeup_fd[2];                 /* read / write end - the same eventfd on Linux */
+	uint32_t deadline;
+	uint8_t timer_armed;
+	uint8_t sock_out;                     /* waiting for TUNNEL_EV_SOCK_OUT */
+};
+
+/**
+ * packets moved between the udp socket and the tun device - on Linux up
+ * to TUNNEL_BATCH_LEN packets are received with one recvmmsg() and sent
+ * with one sendmmsg(), otherwise (or if the kernel lacks these calls)
+ * one packet per recvfrom() / sendto()
+ *
+ * With offloads the tun device hands out TCP packets of up to 64KB which
+ * are cut into wire sized TUNNEL_DATA datagrams here. Consecutive
+ * datagrams of the same size to the same address share one buffer and
+ * leave with one UDP_SEGMENT send, the kernel splits them on the wire.
+ * Received UDP_GRO buffers are handed out datagram by datagram. The
+ * datagrams themselves are unchanged - peers without offloads don't
+ * notice the difference.
+ */
+struct tunnel_batch {
+	unsigned char *buff;                  /* num_max buffers of buff_len bytes */
+	struct iovec *iovs;
+	struct sockaddr_in *addrs;
+	uint16_t *seg_sizes;                  /* datagram size of a GSO / GRO buffer - 0 for a single datagram */
+#ifdef __linux__
+	struct mmsghdr *msgs;
+	char *ctrl;                           /* UDP_SEGMENT / UDP_GRO control messages */
+	unsigned char *tun_buff;              /* virtio_net_hdr + packet read from the tun device */
+#endif
+	int32_t buff_len;
+	int32_t num_max;
+	int32_t num;
+	int32_t next;                         /* next received buffer to hand out */
+	int32_t seg_off;                      /* next datagram within a GRO buffer */
+	int32_t aggr_len;                     /* largest TUNNEL_DATA_AGGR datagram - 0 disables aggregation */
+	uint8_t comp_first;                   /* header compression contexts used by this sender */
+	uint8_t comp_step;
+	uint8_t flags;
+};
+
+/**
+ * the gateway runs gw_workers threads - each one owns a queue of the
+ * multi queue tun device and a udp socket bound with SO_REUSEPORT to the
+ * gateway port. The kernel hashes every client (address and port) onto
+ * the same socket, the tun queues are picked per flow. The client table
+ * is shared by all workers and guarded by gw_clients_rwlock: packets only
+ * take the read lock, lease handling and the client sweep (done by the
+ * first worker) the write lock.
+ *
+ * Unless --disable-gw-queuing is given every worker queues the packets of
+ * both directions per client (see fq_codel.c) and sends the downstream
+ * ones only as long as the (small) socket buffer takes them.
+ */
+struct gw_worker {
+	pthread_t thread_id;
+	int32_t num;
+	int32_t udp_sock;
+	int32_t tun_fd;
+	int32_t aggr_len;
+	struct fq_codel *queue_down;          /* internet -> client - NULL without queuing */
+	struct fq_codel *queue_up;            /* client -> internet */
+};
+
+static pthread_mutex_t tunnel_poll_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct tunnel_poll *tunnel_polls[TUNNEL_POLL_MAX];
+
+static pthread_rwlock_t gw_clients_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* the workers of the running gateway - their queue statistics are read by the unix socket thread */
+static pthread_mutex_t gw_queues_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct gw_worker *gw_queues_workers = NULL;
+static int32_t gw_queues_num = 0;
+
+/*
+ * The client keeps a tunnel to the selected gateway and (unless
+ * --disable-gw-standby is given) one to the next best gateway. Both lease
+ * their tunnel address but only one of them routes the traffic. When the
+ * selection changes the standby tunnel adds its default route before the
+ * old tunnel removes its own (make-before-break) - the old tunnel waits
+ * a moment for that instead of leaving the client without a route.
+ *
+ * Older gateways send to the port the lease started with. The tunnel to
+ * the selected gateway therefore uses the tunnel port like older clients
+ * do, standby tunnels (from a port of their own) are only kept to
+ * gateways which announce TUNNEL_CAP_PORT. A tunnel holding the tunnel
+ * port does not become a standby but closes - a new standby replaces it.
+ */
+struct client_route {
+	uint32_t gw_addr;                     /* 0 - nobody routes the traffic */
+	uint32_t tun_addr;
+	int32_t tun_ifi;
+	char tun_if[IFNAMSIZ];
+};
+
+static pthread_mutex_t client_route_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t client_route_cond = PTHREAD_COND_INITIALIZER;
+static struct client_route client_route;
+static uint32_t client_standby_gw = 0;       /* the standby tunnel to this gateway is ready */
+static uint32_t client_port_gw = 0;          /* the tunnel to this gateway holds the tunnel port */
+
+/* gateways without TUNNEL_CAP_PORT - no standby tunnel for a while */
+static struct {
+	uint32_t gw_addr;
+	uint32_t refused;
+} client_no_standby[CLIENT_NO_STANDBY_MAX];
+
+
+unsigned short bh_udp_ports[] = BH_UDP_PORTS;
+
+void init_bh_ports(void)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(bh_udp_ports)/sizeof(short)); i++)
+		bh_udp_ports[i] = htons(bh_udp_ports[i]);
+}
+
+static uint8_t get_tunneled_protocol(const unsigned char *packet)
+{
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__Darwin__)
+	return ((struct ip *)packet)->ip_p;
+#else
+	return ((struct iphdr *)packet)->protocol;
+#endif
+}
+
+static uint32_t get_tunneled_sender_ip(const unsigned char *packet)
+{
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__Darwin__)
+	return ((struct ip *)packet)->ip_src;
+#else
+	return ((struct iphdr *)packet)->saddr;
+#endif
+}
+
+static uint16_t get_tunneled_udpdest(const unsigned char *packet)
+{
+#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__Darwin__)
+       return ((struct udphdr *)(packet + ((struct ip *)packet)->ip_hl*4))->uh_dport;
+#else
+       return ((struct udphdr *)(packet + ((struct iphdr *)packet)->ihl*4))->dest;
+#endif
+}
+
+static void tunnel_poll_lock(void)
+{
+	if (pthread_mutex_lock(&tunnel_poll_mutex) != 0)
+		debug_output(0, "Error - could not lock tunnel poll mutex: %s \n", strerror(errno));
+}
+
+static void tunnel_poll_unlock(void)
+{
+	if (pthread_mutex_unlock(&tunnel_poll_mutex) != 0)
+		debug_output(0, "Error - could not unlock tunnel poll mutex: %s \n", strerror(errno));
+}
+
+/* may be called more than once - closed fds are set to -1 */
+static void tunnel_poll_close(struct tunnel_poll *tunnel_poll, uint8_t slot)
+{
+	tunnel_poll_lock();
+
+	if (tunnel_polls[slot] == tunnel_poll)
+		tunnel_polls[slot] = NULL;
+
+	tunnel_poll_unlock();
+
+#ifdef __linux__
+	if (tunnel_poll->epoll_fd >= 0)
+		close(tunnel_poll->epoll_fd);
+
+	if (tunnel_poll->timer_fd >= 0)
+		close(tunnel_poll->timer_fd);
+
+	tunnel_poll->epoll_fd = tunnel_poll->timer_fd = -1;
+#else
+	if (tunnel_poll->wakeup_fd[1] >= 0)
+		close(tunnel_poll->wakeup_fd[1]);
+#endif
+
+	if (tunnel_poll->wakeup_fd[0] >= 0)
+		close(tunnel_poll->wakeup_fd[0]);
+
+	tunnel_poll->wakeup_fd[0] = tunnel_poll->wakeup_fd[1] = -1;
+}
+
+#ifdef __linux__
+static int8_t tunnel_poll_add(struct tunnel_poll *tunnel_poll, int32_t fd, uint32_t event)
+{
+	struct epoll_event epoll_event;
+
+	memset(&epoll_event, 0, sizeof(epoll_event));
+	epoll_event.events = EPOLLIN;
+	epoll_event.data.u32 = event;
+
+	if (epoll_ctl(tunnel_poll->epoll_fd, EPOLL_CTL_ADD, fd, &epoll_event) < 0) {
+		debug_output(0, "Error - can't add fd to tunnel epoll set: %s \n", strerror(errno));
+		return -1;
+	}
+
+	return 1;
+}
+#endif
+
+static int8_t tunnel_poll_init(struct tunnel_poll *tunnel_poll, int32_t sock, int32_t tun_fd, uint8_t slot)
+{
+	memset(tunnel_poll, 0, sizeof(struct tunnel_poll));
+	tunnel_poll->sock = sock;
+	tunnel_poll->tun_fd = tun_fd;
+	tunnel_poll->wakeup_fd[0] = tunnel_poll->wakeup_fd[1] = -1;
+
+#ifdef __linux__
+	tunnel_poll->timer_fd = -1;
+
+	if ((tunnel_poll->epoll_fd = epoll_create(4)) < 0) {
+		debug_output(0, "Error - can't create tunnel epoll set: %s \n", strerror(errno));
+		goto err;
+	}
+
+	if ((tunnel_poll->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) {
+		debug_output(0, "Error - can't create tunnel timer: %s \n", strerror(errno));
+		goto err;
+	}
+
+	if ((tunnel_poll->wakeup_fd[0] = eventfd(0, EFD_NONBLOCK)) < 0) {
+		debug_output(0, "Error - can't create tunnel wakeup eventfd: %s \n", strerror(errno));
+		goto err;
+	}
+
+	tunnel_poll->wakeup_fd[1] = tunnel_poll->wakeup_fd[0];
+
+	if ((tunnel_poll_add(tunnel_poll, sock, TUNNEL_EV_SOCK) < 0) ||
+	    (tunnel_poll_add(tunnel_poll, tun_fd, TUNNEL_EV_TUN) < 0) ||
+	    (tunnel_poll_add(tunnel_poll, tunnel_poll->timer_fd, TUNNEL_EV_TIMER) < 0) ||
+	    (tunnel_poll_add(tunnel_poll, tunnel_poll->wakeup_fd[0], TUNNEL_EV_WAKEUP) < 0))
+		goto err;
+#else
+	if (pipe(tunnel_poll->wakeup_fd) < 0) {
+		tunnel_poll->wakeup_fd[0] = tunnel_poll->wakeup_fd[1] = -1;
+		debug_output(0, "Error - can't create tunnel wakeup pipe: %s \n", strerror(errno));
+		goto err;
+	}
+
+	fcntl(tunnel_poll->wakeup_fd[0], F_SETFL, fcntl(tunnel_poll->wakeup_fd[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(tunnel_poll->wakeup_fd[1], F_SETFL, fcntl(tunnel_poll->wakeup_fd[1], F_GETFL, 0) | O_NONBLOCK);
+
+	FD_ZERO(&tunnel_poll->wait_sockets);
+	FD_ZERO(&tunnel_poll->write_sockets);
+	FD_SET(sock, &tunnel_poll->wait_sockets);
+	FD_SET(tun_fd, &tunnel_poll->wait_sockets);
+	FD_SET(tunnel_poll->wakeup_fd[0], &tunnel_poll->wait_sockets);
+
+	tunnel_poll->max_sock = (sock > tun_fd ? sock : tun_fd);
+
+	if (tunnel_poll->wakeup_fd[0] > tunnel_poll->max_sock)
+		tunnel_poll->max_sock = tunnel_poll->wakeup_fd[0];
+#endif
+
+	tunnel_poll_lock();
+	tunnel_polls[slot] = tunnel_poll;
+	tunnel_poll_unlock();
+
+	return 1;
+
+err:
+	tunnel_poll_close(tunnel_poll, slot);
+	return -1;
+}
+
+/* makes sure the thread wakes up at the given time - an earlier deadline replaces the armed one */
+static void tunnel_poll_timer(struct tunnel_poll *tunnel_poll, uint32_t deadline, uint32_t current_time)
+{
+#ifdef __linux__
+	struct itimerspec itimerspec;
+#endif
+	int32_t timeout;
+
+	if ((tunnel_poll->timer_armed) && ((int)(deadline - tunnel_poll->deadline) >= 0))
+		return;
+
+	timeout = (int)(deadline - current_time);
+
+	if (timeout < 1)
+		timeout = 1;
+
+#ifdef __linux__
+	memset(&itimerspec, 0, sizeof(itimerspec));
+	itimerspec.it_value.tv_sec = timeout / 1000;
+	itimerspec.it_value.tv_nsec = (timeout % 1000) * 1000000;
+
+	if (timerfd_settime(tunnel_poll->timer_fd, 0, &itimerspec, NULL) < 0) {
+		debug_output(0, "Error - can't arm tunnel timer: %s \n", strerror(errno));
+		return;
+	}
+#endif
+
+	tunnel_poll->deadline = current_time + timeout;
+	tunnel_poll->timer_armed = 1;
+}
+
+/* blocks until something happened - returns the TUNNEL_EV_* flags or -1 on error */
+static int32_t tunnel_poll_wait(struct tunnel_poll *tunnel_poll)
+{
+#ifdef __linux__
+	struct epoll_event epoll_events[4];
+	uint64_t counter;
+	int32_t i;
+#else
+	struct timeval tv, *tv_ptr = NULL;
+	fd_set tmp_wait_sockets, tmp_write_sockets;
+	char buff[64];
+	int32_t timeout;
+#endif
+	int32_t res, events = 0;
+
+#ifdef __linux__
+	res = epoll_wait(tunnel_poll->epoll_fd, epoll_events, 4, -1);
+
+	if (res < 0) {
+
+		if (errno == EINTR)
+			return 0;
+
+		debug_output(0, "Error - can't wait for tunnel events: %s \n", strerror(errno));
+		return -1;
+
+	}
+
+	for (i = 0; i < res; i++) {
+
+		if ((epoll_events[i].data.u32 == TUNNEL_EV_SOCK) && (epoll_events[i].events & EPOLLOUT))
+			events |= TUNNEL_EV_SOCK_OUT;
+
+		if ((epoll_events[i].data.u32 != TUNNEL_EV_SOCK) || (epoll_events[i].events & (EPOLLIN | EPOLLERR)))
+			events |= epoll_events[i].data.u32;
+
+	}
+
+	if ((events & TUNNEL_EV_TIMER) && (read(tunnel_poll->timer_fd, &counter, sizeof(counter)) > 0))
+		tunnel_poll->timer_armed = 0;
+
+	if (events & TUNNEL_EV_WAKEUP)
+		while (read(tunnel_poll->wakeup_fd[0], &counter, sizeof(counter)) > 0);
+#else
+	if (tunnel_poll->timer_armed) {
+		timeout = (int)(tunnel_poll->deadline - get_time_msec());
+
+		if (timeout < 0)
+			timeout = 0;
+
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		tv_ptr = &tv;
+	}
+
+	memcpy(&tmp_wait_sockets, &tunnel_poll->wait_sockets, sizeof(fd_set));
+	memcpy(&tmp_write_sockets, &tunnel_poll->write_sockets, sizeof(fd_set));
+
+	res = select(tunnel_poll->max_sock + 1, &tmp_wait_sockets, &tmp_write_sockets, NULL, tv_ptr);
+
+	if (res < 0) {
+
+		if (errno == EINTR)
+			return 0;
+
+		debug_output(0, "Error - can't wait for tunnel events: %s \n", strerror(errno));
+		return -1;
+
+	}
+
+	if ((tunnel_poll->timer_armed) && ((int)(get_time_msec() - tunnel_poll->deadline) >= 0)) {
+		tunnel_poll->timer_armed = 0;
+		events |= TUNNEL_EV_TIMER;
+	}
+
+	if (res > 0) {
+
+		if (FD_ISSET(tunnel_poll->sock, &tmp_wait_sockets))
+			events |= TUNNEL_EV_SOCK;
+
+		if (FD_ISSET(tunnel_poll->tun_fd, &tmp_wait_sockets))
+			events |= TUNNEL_EV_TUN;
+
+		if (FD_ISSET(tunnel_poll->sock, &tmp_write_sockets))
+			events |= TUNNEL_EV_SOCK_OUT;
+
+		if (FD_ISSET(tunnel_poll->wakeup_fd[0], &tmp_wait_sockets)) {
+			events |= TUNNEL_EV_WAKEUP;
+			while (read(tunnel_poll->wakeup_fd[0], buff, sizeof(buff)) > 0);
+		}
+
+	}
+#endif
+
+	return events;
+}
+
+/* (stops) waiting for the full socket to take data again */
+static void tunnel_poll_sock_out(struct tunnel_poll *tunnel_poll, uint8_t wait)
+{
+#ifdef __linux__
+	struct epoll_event epoll_event;
+#endif
+
+	if (tunnel_poll->sock_out == wait)
+		return;
+
+#ifdef __linux__
+	memset(&epoll_event, 0, sizeof(epoll_event));
+	epoll_event.events = EPOLLIN | (wait ? EPOLLOUT : 0);
+	epoll_event.data.u32 = TUNNEL_EV_SOCK;
+
+	if (epoll_ctl(tunnel_poll->epoll_fd, EPOLL_CTL_MOD, tunnel_poll->sock, &epoll_event) < 0) {
+		debug_output(0, "Error - can't change tunnel socket events: %s \n", strerror(errno));
+		return;
+	}
+#else
+	if (wait)
+		FD_SET(tunnel_poll->sock, &tunnel_poll->write_sockets);
+	else
+		FD_CLR(tunnel_poll->sock, &tunnel_poll->write_sockets);
+#endif
+
+	tunnel_poll->sock_out = wait;
+}
+
+/* called by the main thread whenever the tunnel threads have to check the gateway / shutdown state */
+void tunnel_wakeup(void)
+{
+#ifdef __linux__
+	uint64_t counter = 1;
+#else
+	char counter = 0;
+#endif
+	int32_t i;
+
+	tunnel_poll_lock();
+
+	for (i = 0; i < TUNNEL_POLL_MAX; i++) {
+
+		if (tunnel_polls[i] == NULL)
+			continue;
+
+		if ((write(tunnel_polls[i]->wakeup_fd[1], &counter, sizeof(counter)) < 0) && (errno != EAGAIN))
+			debug_output(0, "Error - can't wake up tunnel thread: %s \n", strerror(errno));
+
+	}
+
+	tunnel_poll_unlock();
+}
+
+static void gw_clients_rdlock(void)
+{
+	if (pthread_rwlock_rdlock(&gw_clients_rwlock) != 0)
+		debug_output(0, "Error - could not lock gateway client table: %s \n", strerror(errno));
+}
+
+static void gw_clients_wrlock(void)
+{
+	if (pthread_rwlock_wrlock(&gw_clients_rwlock) != 0)
+		debug_output(0, "Error - could not lock gateway client table: %s \n", strerror(errno));
+}
+
+static void gw_clients_unlock(void)
+{
+	if (pthread_rwlock_unlock(&gw_clients_rwlock) != 0)
+		debug_output(0, "Error - could not unlock gateway client table: %s \n", strerror(errno));
+}
+
+static uint32_t time_later(uint32_t time1, uint32_t time2)
+{
+	return ((int)(time1 - time2) > 0 ? time1 : time2);
+}
+
+static uint32_t time_earlier(uint32_t time1, uint32_t time2)
+{
+	return ((int)(time1 - time2) < 0 ? time1 : time2);
+}
+
+static void tunnel_batch_init(struct tunnel_batch *batch, uint8_t flags)
+{
+	int32_t i;
+
+	memset(batch, 0, sizeof(struct tunnel_batch));
+	batch->flags = flags;
+	batch->comp_step = 1;
+	batch->num_max = TUNNEL_BATCH_LEN;
+	batch->buff_len = TUNNEL_BUFF_LEN;
+
+	if (flags & (TUNNEL_BATCH_GSO | TUNNEL_BATCH_GRO)) {
+		batch->num_max = TUNNEL_GSO_BATCH_LEN;
+		batch->buff_len = TUNNEL_GSO_BUFF_LEN;
+	}
+
+	batch->buff = debugMalloc(batch->num_max * batch->buff_len, 231);
+	batch->iovs = debugMalloc(batch->num_max * sizeof(struct iovec), 232);
+	batch->addrs = debugMalloc(batch->num_max * sizeof(struct sockaddr_in), 233);
+	batch->seg_sizes = debugMalloc(batch->num_max * sizeof(uint16_t), 235);
+	memset(batch->seg_sizes, 0, batch->num_max * sizeof(uint16_t));
+#ifdef __linux__
+	batch->msgs = debugMalloc(batch->num_max * sizeof(struct mmsghdr), 234);
+	memset(batch->msgs, 0, batch->num_max * sizeof(struct mmsghdr));
+	batch->ctrl = debugMalloc(batch->num_max * TUNNEL_CTRL_LEN, 236);
+	memset(batch->ctrl, 0, batch->num_max * TUNNEL_CTRL_LEN);
+
+	if (flags & TUNNEL_BATCH_VNET)
+		batch->tun_buff = debugMalloc(sizeof(struct virtio_net_hdr) + TUNNEL_GSO_BUFF_LEN, 237);
+#endif
+
+	for (i = 0; i < batch->num_max; i++) {
+		batch->iovs[i].iov_base = batch->buff + i * batch->buff_len;
+		batch->iovs[i].iov_len = batch->buff_len;
+
+#ifdef __linux__
+		batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+		batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+#endif
+	}
+}
+
+static void tunnel_batch_free(struct tunnel_batch *batch)
+{
+	debugFree(batch->buff, 1231);
+	debugFree(batch->iovs, 1232);
+	debugFree(batch->addrs, 1233);
+	debugFree(batch->seg_sizes, 1235);
+#ifdef __linux__
+	debugFree(batch->msgs, 1234);
+	debugFree(batch->ctrl, 1236);
+
+	if (batch->tun_buff != NULL)
+		debugFree(batch->tun_buff, 1237);
+#endif
+}
+
+/* offloads usable with this socket - none unless enabled via --tunnel-offload */
+static uint8_t tunnel_offload_flags(int32_t sock)
+{
+	uint8_t flags = 0;
+#ifdef __linux__
+	int32_t sock_opts = 1;
+
+	if (!tunnel_offload)
+		return 0;
+
+	flags = TUNNEL_BATCH_VNET;
+
+	if (setsockopt(sock, SOL_UDP, UDP_GRO, &sock_opts, sizeof(sock_opts)) == 0)
+		flags |= TUNNEL_BATCH_GRO;
+	else
+		debug_output(3, "Tunnel - UDP_GRO not supported: %s \n", strerror(errno));
+
+	/* the segment size is given with every send - this only checks the kernel support */
+	sock_opts = 0;
+
+	if (setsockopt(sock, SOL_UDP, UDP_SEGMENT, &sock_opts, sizeof(sock_opts)) == 0)
+		flags |= TUNNEL_BATCH_GSO;
+	else
+		debug_output(3, "Tunnel - UDP_SEGMENT not supported: %s \n", strerror(errno));
+#else
+	sock = 0;
+#endif
+
+	return flags;
+}
+
+#ifdef __linux__
+static uint16_t tunnel_gro_size(struct msghdr *msg_hdr)
+{
+	struct cmsghdr *cmsg;
+	int gso_size;
+
+	for (cmsg = CMSG_FIRSTHDR(msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(msg_hdr, cmsg)) {
+
+		if ((cmsg->cmsg_level != SOL_UDP) || (cmsg->cmsg_type != UDP_GRO))
+			continue;
+
+		memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+		return gso_size;
+
+	}
+
+	return 0;
+}
+
+static void tunnel_gso_cmsg(struct msghdr *msg_hdr, char *ctrl, uint16_t seg_size)
+{
+	struct cmsghdr *cmsg;
+
+	msg_hdr->msg_control = ctrl;
+	msg_hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+	cmsg = CMSG_FIRSTHDR(msg_hdr);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	memcpy(CMSG_DATA(cmsg), &seg_size, sizeof(uint16_t));
+}
+
+/* ones' complement sum (RFC 1071) */
+static uint32_t tunnel_csum_add(uint32_t sum, const unsigned char *data, int32_t len)
+{
+	for (; len > 1; data += 2, len -= 2)
+		sum += (data[0] << 8) | data[1];
+
+	if (len > 0)
+		sum += data[0] << 8;
+
+	return sum;
+}
+
+static uint16_t tunnel_csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return htons(~sum & 0xffff);
+}
+#endif
+
+/* hands out the next received packet - returns -1 (errno set) once the socket is drained */
+static int32_t tunnel_recv(struct tunnel_batch *batch, int32_t sock, unsigned char **buff, struct sockaddr_in *addr)
+{
+	uint32_t addr_len = sizeof(struct sockaddr_in);
+	int32_t res, i;
+
+	if (batch->next >= batch->num) {
+
+		batch->num = batch->next = batch->seg_off = 0;
+
+#ifdef __linux__
+		if (batch->num_max > 1) {
+
+			for (i = 0; i < batch->num_max; i++) {
+				batch->iovs[i].iov_len = batch->buff_len - 1;
+				batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+				if (batch->flags & TUNNEL_BATCH_GRO) {
+					batch->msgs[i].msg_hdr.msg_control = batch->ctrl + i * TUNNEL_CTRL_LEN;
+					batch->msgs[i].msg_hdr.msg_controllen = TUNNEL_CTRL_LEN;
+				}
+			}
+
+			res = recvmmsg(sock, batch->msgs, batch->num_max, MSG_DONTWAIT, NULL);
+
+			if (res > 0) {
+
+				for (i = 0; i < res; i++) {
+					batch->iovs[i].iov_len = batch->msgs[i].msg_len;
+					batch->seg_sizes[i] = ((batch->flags & TUNNEL_BATCH_GRO) ? tunnel_gro_size(&batch->msgs[i].msg_hdr) : 0);
+				}
+
+				batch->num = res;
+
+			} else if ((res < 0) && (errno == ENOSYS)) {
+
+				debug_output(3, "Tunnel - recvmmsg() not supported: falling back to single packets \n");
+				batch->num_max = 1;
+
+			} else {
+
+				return res;
+
+			}
+
+		}
+#endif
+
+		if (batch->num == 0) {
+
+			if ((res = recvfrom(sock, batch->buff, batch->buff_len - 1, 0, (struct sockaddr *)&batch->addrs[0], &addr_len)) < 0)
+				return res;
+
+			batch->iovs[0].iov_len = res;
+			batch->seg_sizes[0] = 0;
+			batch->num = 1;
+
+		}
+
+	}
+
+	i = batch->next;
+
+	*buff = (unsigned char *)batch->iovs[i].iov_base + batch->seg_off;
+	res = batch->iovs[i].iov_len - batch->seg_off;
+
+	/* a GRO buffer is handed out datagram by datagram */
+	if ((batch->seg_sizes[i] > 0) && (res > batch->seg_sizes[i]))
+		res = batch->seg_sizes[i];
+
+	batch->seg_off += res;
+
+	if (batch->seg_off >= (int32_t)batch->iovs[i].iov_len) {
+		batch->next++;
+		batch->seg_off = 0;
+	}
+
+	memcpy(addr, &batch->addrs[i], sizeof(struct sockaddr_in));
+
+	return res;
+}
+
+/* moves the datagrams from first on to the front of the batch - the buffers are swapped, not copied */
+static void tunnel_send_keep(struct tunnel_batch *batch, int32_t first)
+{
+	struct iovec iov;
+	int32_t i, j = 0;
+
+	for (i = first; i < batch->num; i++, j++) {
+
+		iov = batch->iovs[j];
+		batch->iovs[j] = batch->iovs[i];
+		batch->iovs[i] = iov;
+
+		memcpy(&batch->addrs[j], &batch->addrs[i], sizeof(struct sockaddr_in));
+		batch->seg_sizes[j] = batch->seg_sizes[i];
+
+	}
+
+	batch->num = j;
+}
+
+/* sends the batch - returns -1 if the socket buffer is full and the rest was kept (TUNNEL_BATCH_KEEP) */
+static int8_t tunnel_send_flush(struct tunnel_batch *batch, int32_t sock)
+{
+	int32_t res, seg_size, off, i = 0;
+
+#ifdef __linux__
+	for (i = 0; i < batch->num; i++) {
+
+		batch->msgs[i].msg_hdr.msg_control = NULL;
+		batch->msgs[i].msg_hdr.msg_controllen = 0;
+
+		if ((batch->flags & TUNNEL_BATCH_GSO) && (batch->seg_sizes[i] > 0) && ((int32_t)batch->iovs[i].iov_len > batch->seg_sizes[i]))
+			tunnel_gso_cmsg(&batch->msgs[i].msg_hdr, batch->ctrl + i * TUNNEL_CTRL_LEN, batch->seg_sizes[i]);
+
+	}
+
+	i = 0;
+
+	while ((batch->num_max > 1) && (i < batch->num)) {
+
+		res = sendmmsg(sock, batch->msgs + i, batch->num - i, 0);
+
+		if ((res < 0) && (errno == ENOSYS)) {
+			debug_output(3, "Tunnel - sendmmsg() not supported: falling back to single packets \n");
+			batch->num_max = 1;
+			break;
+		}
+
+		/* the outgoing interface can't segment (e.g. no checksum offload) */
+		if ((res < 0) && (batch->msgs[i].msg_hdr.msg_controllen > 0) &&
+		    ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT))) {
+			debug_output(3, "Tunnel - UDP segmentation offload not usable (%s): falling back to single packets \n", strerror(errno));
+			batch->flags &= ~TUNNEL_BATCH_GSO;
+			break;
+		}
+
+		if ((res < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (batch->flags & TUNNEL_BATCH_KEEP)) {
+			tunnel_send_keep(batch, i);
+			return -1;
+		}
+
+		/* drop the packet that could not be sent - like sendto() below */
+		if (res < 0) {
+			debug_output(0, "Error - can't send tunnel data: %s\n", strerror(errno));
+			res = 1;
+		}
+
+		i += res;
+
+	}
+#endif
+
+	for (; i < batch->num; i++) {
+
+		seg_size = (batch->seg_sizes[i] > 0 ? batch->seg_sizes[i] : (int32_t)batch->iovs[i].iov_len);
+
+		for (off = 0; off < (int32_t)batch->iovs[i].iov_len; off += seg_size) {
+
+			res = sendto(sock, (unsigned char *)batch->iovs[i].iov_base + off, (seg_size < (int32_t)batch->iovs[i].iov_len - off ? seg_size : (int32_t)batch->iovs[i].iov_len - off),
+			             0, (struct sockaddr *)&batch->addrs[i], sizeof(struct sockaddr_in));
+
+			if ((res < 0) && (off == 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (batch->flags & TUNNEL_BATCH_KEEP)) {
+				tunnel_send_keep(batch, i);
+				return -1;
+			}
+
+			if (res < 0)
+				debug_output(0, "Error - can't send tunnel data: %s\n", strerror(errno));
+
+		}
+
+	}
+
+	batch->num = 0;
+	return 0;
+}
+
+/* makes room for one more datagram - kept datagrams are dropped if the socket still does not take them */
+static void tunnel_send_room(struct tunnel_batch *batch, int32_t sock)
+{
+	if (batch->num < batch->num_max)
+		return;
+
+	if (tunnel_send_flush(batch, sock) < 0) {
+		debug_output(4, "Tunnel - socket buffer full: dropping %i datagrams \n", batch->num);
+		batch->num = 0;
+	}
+}
+
+/* returns the buffer for the next packet to send - sends the batch if it is full */
+static unsigned char *tunnel_send_buff(struct tunnel_batch *batch, int32_t sock)
+{
+	tunnel_send_room(batch, sock);
+
+	return batch->iovs[batch->num].iov_base;
+}
+
+/* the packet was written into the buffer returned by tunnel_send_buff() */
+static void tunnel_send_queue(struct tunnel_batch *batch, int32_t len, struct sockaddr_in *addr)
+{
+	batch->iovs[batch->num].iov_len = len;
+	batch->seg_sizes[batch->num] = 0;
+	memcpy(&batch->addrs[batch->num], addr, sizeof(struct sockaddr_in));
+	batch->num++;
+}
+
+#ifdef __linux__
+/* reserves len bytes for a datagram - appended to the last buffer if it can be sent as one GSO train */
+static unsigned char *tunnel_send_frame(struct tunnel_batch *batch, int32_t sock, int32_t len, struct sockaddr_in *addr)
+{
+	unsigned char *frame;
+	int32_t i = batch->num - 1;
+
+	/* all datagrams of a train have the same size - only the last one may be shorter */
+	if ((batch->flags & TUNNEL_BATCH_GSO) && (i >= 0) &&
+	    (batch->addrs[i].sin_addr.s_addr == addr->sin_addr.s_addr) && (batch->addrs[i].sin_port == addr->sin_port) &&
+	    (batch->seg_sizes[i] > 0) && (len <= batch->seg_sizes[i]) && (batch->iovs[i].iov_len % batch->seg_sizes[i] == 0) &&
+	    (batch->iovs[i].iov_len + len <= TUNNEL_GSO_TRAIN_LEN) &&
+	    (batch->iovs[i].iov_len / batch->seg_sizes[i] < TUNNEL_GSO_SEGS_MAX)) {
+
+		frame = (unsigned char *)batch->iovs[i].iov_base + batch->iovs[i].iov_len;
+		batch->iovs[i].iov_len += len;
+		return frame;
+
+	}
+
+	tunnel_send_room(batch, sock);
+
+	i = batch->num++;
+
+	batch->iovs[i].iov_len = len;
+	batch->seg_sizes[i] = len;
+	memcpy(&batch->addrs[i], addr, sizeof(struct sockaddr_in));
+
+	return batch->iovs[i].iov_base;
+}
+
+/* cuts a TSO packet into datagrams of gso_size payload - like the kernel would have done */
+static void tunnel_send_tso(struct tunnel_batch *batch, int32_t sock, unsigned char *packet, int32_t len, uint16_t gso_size, struct sockaddr_in *addr)
+{
+	struct iphdr *iph = (struct iphdr *)packet;
+	struct tcphdr *tcph;
+	unsigned char *frame;
+	int32_t ip_len, hdr_len, off, seg_len;
+	uint32_t seq, sum;
+	uint16_t ip_id;
+
+	ip_len = iph->ihl * 4;
+
+	if ((iph->protocol != IPPROTO_TCP) || (len < ip_len + (int32_t)sizeof(struct tcphdr))) {
+		debug_output(0, "Error - dropping invalid TSO packet from tun device \n");
+		return;
+	}
+
+	tcph = (struct tcphdr *)(packet + ip_len);
+	hdr_len = ip_len + tcph->doff * 4;
+
+	if ((hdr_len >= len) || (gso_size == 0) || (hdr_len + gso_size + 1 > batch->buff_len)) {
+		debug_output(0, "Error - dropping invalid TSO packet from tun device \n");
+		return;
+	}
+
+	seq = ntohl(tcph->seq);
+	ip_id = ntohs(iph->id);
+
+	for (off = hdr_len; off < len; off += seg_len) {
+
+		seg_len = (len - off < gso_size ? len - off : gso_size);
+
+		frame = tunnel_send_frame(batch, sock, 1 + hdr_len + seg_len, addr);
+		frame[0] = TUNNEL_DATA;
+		memcpy(frame + 1, packet, hdr_len);
+		memcpy(frame + 1 + hdr_len, packet + off, seg_len);
+
+		iph = (struct iphdr *)(frame + 1);
+		tcph = (struct tcphdr *)(frame + 1 + ip_len);
+
+		iph->tot_len = htons(hdr_len + seg_len);
+		iph->id = htons(ip_id++);
+		iph->check = 0;
+		iph->check = tunnel_csum_fold(tunnel_csum_add(0, frame + 1, ip_len));
+
+		tcph->seq = htonl(seq + off - hdr_len);
+
+		/* CWR only in the first, FIN and PSH only in the last segment (tcp flags are in byte 13) */
+		if (off > hdr_len)
+			frame[1 + ip_len + 13] &= ~TUNNEL_TH_CWR;
+
+		if (off + seg_len < len)
+			frame[1 + ip_len + 13] &= ~(TH_FIN | TH_PUSH);
+
+		/* pseudo header: addresses, protocol and tcp length */
+		sum = tunnel_csum_add(0, (unsigned char *)&iph->saddr, 8) + IPPROTO_TCP + hdr_len - ip_len + seg_len;
+
+		tcph->check = 0;
+		tcph->check = tunnel_csum_fold(tunnel_csum_add(sum, (unsigned char *)tcph, hdr_len - ip_len + seg_len));
+
+	}
+}
+#endif
+
+/* packs a small packet into an aggregate - unless the last datagram to addr is one with room left a new one is started */
+static void tunnel_send_aggr(struct tunnel_batch *batch, int32_t sock, unsigned char *packet, int32_t len, struct sockaddr_in *addr)
+{
+	unsigned char *frame = NULL;
+	uint16_t packet_len = htons(len);
+	int32_t i;
+
+	/* appending to an earlier datagram would reorder the packets */
+	for (i = batch->num - 1; i >= 0; i--) {
+
+		if ((batch->addrs[i].sin_addr.s_addr != addr->sin_addr.s_addr) || (batch->addrs[i].sin_port != addr->sin_port))
+			continue;
+
+		frame = batch->iovs[i].iov_base;
+
+		if ((frame[0] != TUNNEL_DATA_AGGR) || ((int32_t)batch->iovs[i].iov_len + 2 + len > batch->aggr_len))
+			frame = NULL;
+
+		break;
+
+	}
+
+	if (frame == NULL) {
+
+		tunnel_send_room(batch, sock);
+
+		i = batch->num++;
+
+		frame = batch->iovs[i].iov_base;
+		frame[0] = TUNNEL_DATA_AGGR;
+
+		batch->iovs[i].iov_len = 1;
+		batch->seg_sizes[i] = 0;
+		memcpy(&batch->addrs[i], addr, sizeof(struct sockaddr_in));
+
+	}
+
+	/* without offloads the packet was read into this very buffer */
+	memmove(frame + batch->iovs[i].iov_len + 2, packet, len);
+	memcpy(frame + batch->iovs[i].iov_len, &packet_len, sizeof(packet_len));
+	batch->iovs[i].iov_len += 2 + len;
+}
 
+/* walks the packets of a TUNNEL_DATA or TUNNEL_DATA_AGGR datagram - start with *off = 0, returns 0 at the end */
+static int32_t tunnel_data_next(unsigned char *buff, int32_t buff_len, int32_t *off, unsigned char **packet)
+{
+	uint16_t packet_len;
 
-#include "../os.h"
-#include "../batman.h"
+	if (buff[0] == TUNNEL_DATA) {
 
+		if (*off > 0)
+			return 0;
 
+		*off = buff_len;
+		*packet = buff + 1;
+		return buff_len - 1;
 
-#define TUNNEL_DATA 0x01
-#define TUNNEL_IP_REQUEST 0x02
-#define TUNNEL_IP_INVALID 0x03
-#define TUNNEL_KEEPALIVE_REQUEST 0x04
-#define TUNNEL_KEEPALIVE_REPLY 0x05
+	}
 
-#define GW_STATE_UNKNOWN  0x01
-#define GW_STATE_VERIFIED 0x02
+	if (*off == 0)
+		*off = 1;
 
-#define GW_STATE_UNKNOWN_TIMEOUT 60000
-#define GW_STATE_VERIFIED_TIMEOUT 5 * GW_STATE_UNKNOWN_TIMEOUT
+	if (*off + 2 > buff_len)
+		return 0;
 
-#define IP_LEASE_TIMEOUT 4 * GW_STATE_VERIFIED_TIMEOUT
+	memcpy(&packet_len, buff + *off, sizeof(packet_len));
+	packet_len = ntohs(packet_len);
 
+	if ((packet_len == 0) || (*off + 2 + packet_len > buff_len)) {
+		debug_output(0, "Error - ignoring malformed aggregated tunnel packet \n");
+		return 0;
+	}
 
-unsigned short bh_udp_ports[] = BH_UDP_PORTS;
+	*packet = buff + *off + 2;
+	*off += 2 + packet_len;
 
-void init_bh_ports(void)
+	return packet_len;
+}
+
+/* largest aggregate: what fits into a TUNNEL_DATA datagram of a full sized packet */
+static int32_t tunnel_aggr_len(char *tun_dev)
 {
-	int i;
+	struct ifreq ifr;
+	int32_t sock, aggr_len = 0;
 
-	for (i = 0; i < (int)(sizeof(bh_udp_ports)/sizeof(short)); i++)
-		bh_udp_ports[i] = htons(bh_udp_ports[i]);
+	if (!tunnel_aggregation)
+		return 0;
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return 0;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, tun_dev, IFNAMSIZ - 1);
+
+	if (ioctl(sock, SIOCGIFMTU, &ifr) < 0)
+		debug_output(0, "Error - can't get MTU of %s - not aggregating tunnel packets: %s \n", tun_dev, strerror(errno));
+	else
+		aggr_len = (ifr.ifr_mtu + 1 < TUNNEL_BUFF_LEN - 1 ? ifr.ifr_mtu + 1 : TUNNEL_BUFF_LEN - 1);
+
+	close(sock);
+	return aggr_len;
 }
 
-static uint8_t get_tunneled_protocol(const unsigned char *buff)
+/* reads the next packet from the tun device - returns its length or -1 (errno set) */
+static int32_t tunnel_read(struct tunnel_batch *batch, int32_t sock, int32_t tun_fd, unsigned char **packet)
 {
-#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__Darwin__)
-	return ((struct ip *)(buff + 1))->ip_p;
-#else
-	return ((struct iphdr *)(buff + 1))->protocol;
+	unsigned char *buff;
+	int32_t len;
+
+#ifdef __linux__
+	if (batch->flags & TUNNEL_BATCH_VNET) {
+
+		if ((len = read(tun_fd, batch->tun_buff, sizeof(struct virtio_net_hdr) + TUNNEL_GSO_BUFF_LEN)) < (int32_t)sizeof(struct virtio_net_hdr))
+			return (len < 0 ? len : 0);
+
+		*packet = batch->tun_buff + sizeof(struct virtio_net_hdr);
+		return len - sizeof(struct virtio_net_hdr);
+
+	}
 #endif
+
+	/* without offloads the packet is read into the send buffer right away */
+	buff = tunnel_send_buff(batch, sock);
+
+	if ((len = read(tun_fd, buff + 1, TUNNEL_BUFF_LEN - 2)) <= 0)
+		return len;
+
+	*packet = buff + 1;
+	return len;
 }
 
-static uint32_t get_tunneled_sender_ip(const unsigned char *buff)
+#ifdef __linux__
+/* fills in the checksum the tun device left to us - only once, the packet may be compressed afterwards */
+static void tunnel_vnet_csum(struct virtio_net_hdr *vnet_hdr, unsigned char *packet, int32_t len)
 {
-#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__Darwin__)
-	return ((struct ip *)(buff + 1))->ip_src;
-#else
-	return ((struct iphdr *)(buff + 1))->saddr;
+	uint16_t csum;
+
+	/* the checksum field holds the sum of the pseudo header */
+	if ((vnet_hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && (vnet_hdr->csum_start + vnet_hdr->csum_offset + 2 <= len)) {
+		csum = tunnel_csum_fold(tunnel_csum_add(0, packet + vnet_hdr->csum_start, len - vnet_hdr->csum_start));
+		memcpy(packet + vnet_hdr->csum_start + vnet_hdr->csum_offset, &csum, sizeof(csum));
+	}
+
+	vnet_hdr->flags &= ~VIRTIO_NET_HDR_F_NEEDS_CSUM;
+}
+#endif
+
+/* compresses the headers of a packet for tunnel_send_packet() (comp NULL) ahead of time - returns its new length, TSO trains are left alone */
+static int32_t tunnel_comp_packet(struct tunnel_batch *batch, unsigned char *packet, int32_t len, struct hdr_comp *comp)
+{
+#ifdef __linux__
+	struct virtio_net_hdr *vnet_hdr;
+
+	if (batch->flags & TUNNEL_BATCH_VNET) {
+
+		vnet_hdr = (struct virtio_net_hdr *)(packet - sizeof(struct virtio_net_hdr));
+
+		if (vnet_hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE)
+			return len;
+
+		tunnel_vnet_csum(vnet_hdr, packet, len);
+
+	}
 #endif
+
+	return hdr_comp_packet(comp, packet, len, batch->comp_first, batch->comp_step);
 }
 
-static uint16_t get_tunneled_udpdest(const unsigned char *buff)
+/* a zeroed control message which starts as a copy of the request it answers */
+static void tunnel_reply_init(unsigned char *reply, int32_t reply_len, unsigned char *request, int32_t request_len)
 {
-#if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__Darwin__)
-       return ((struct udphdr *)(buff + 1 + ((struct ip *)(buff + 1))->ip_hl*4))->uh_dport;
-#else
-       return ((struct udphdr *)(buff + 1 + ((struct iphdr *)(buff + 1))->ihl*4))->dest;
+	memset(reply, 0, reply_len);
+	memcpy(reply, request, (request_len < reply_len ? request_len : reply_len));
+}
+
+/* asks the other end of the tunnel for the full header of a compression context */
+static void tunnel_comp_resync(int32_t sock, struct sockaddr_in *addr, uint8_t ctx_id)
+{
+	unsigned char buff[2];
+
+	buff[0] = TUNNEL_COMP_RESYNC;
+	buff[1] = ctx_id;
+
+	if (sendto(sock, buff, sizeof(buff), 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0)
+		debug_output(3, "Error - can't request a full header for compression context %i: %s \n", ctx_id, strerror(errno));
+}
+
+/* sends the packet returned by tunnel_read() (or a queued one, behind its virtio_net_hdr) as TUNNEL_DATA - small ones aggregated if the other end supports it (caps), headers compressed with comp (NULL if not negotiated) */
+static void tunnel_send_packet(struct tunnel_batch *batch, int32_t sock, unsigned char *packet, int32_t len, struct sockaddr_in *addr, uint8_t caps, struct hdr_comp *comp)
+{
+	unsigned char *buff;
+	uint8_t aggregate;
+#ifdef __linux__
+	struct virtio_net_hdr *vnet_hdr;
+	unsigned char *frame;
+
+	if (batch->flags & TUNNEL_BATCH_VNET) {
+
+		vnet_hdr = (struct virtio_net_hdr *)(packet - sizeof(struct virtio_net_hdr));
+
+		if (vnet_hdr->gso_type == VIRTIO_NET_HDR_GSO_TCPV4) {
+			tunnel_send_tso(batch, sock, packet, len, vnet_hdr->gso_size, addr);
+			return;
+		}
+
+		if ((vnet_hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE) || (len + 1 > batch->buff_len)) {
+			debug_output(0, "Error - dropping tun packet: unsupported offload type %i or too large (%i) \n", vnet_hdr->gso_type, len);
+			return;
+		}
+
+		tunnel_vnet_csum(vnet_hdr, packet, len);
+
+	}
+#endif
+
+	if (comp != NULL)
+		len = hdr_comp_packet(comp, packet, len, batch->comp_first, batch->comp_step);
+
+	aggregate = ((caps & TUNNEL_CAP_AGGR) && (len <= TUNNEL_AGGR_PACKET_MAX) && (len + 3 <= batch->aggr_len));
+
+	if (aggregate) {
+		tunnel_send_aggr(batch, sock, packet, len, addr);
+		return;
+	}
+
+#ifdef __linux__
+	if (batch->flags & TUNNEL_BATCH_VNET) {
+		frame = tunnel_send_frame(batch, sock, len + 1, addr);
+		frame[0] = TUNNEL_DATA;
+		memcpy(frame + 1, packet, len);
+		return;
+	}
+#endif
+
+	/* queued packets were not read into the send buffer */
+	buff = tunnel_send_buff(batch, sock);
+
+	if (packet != buff + 1)
+		memcpy(buff + 1, packet, len);
+
+	buff[0] = TUNNEL_DATA;
+	tunnel_send_queue(batch, len + 1, addr);
+}
+
+/* writes a received packet into the tun device - behind an empty virtio_net_hdr with offloads and a rebuilt header (hdr_len > 0) if it was compressed */
+static int32_t tunnel_write(struct tunnel_batch *batch, int32_t tun_fd, unsigned char *hdr, int32_t hdr_len, unsigned char *packet, int32_t len)
+{
+	struct iovec iov[3];
+	int32_t iov_num = 0;
+#ifdef __linux__
+	struct virtio_net_hdr vnet_hdr;
+
+	if (batch->flags & TUNNEL_BATCH_VNET) {
+
+		memset(&vnet_hdr, 0, sizeof(vnet_hdr));
+
+		iov[iov_num].iov_base = &vnet_hdr;
+		iov[iov_num++].iov_len = sizeof(vnet_hdr);
+
+	}
 #endif
+
+	if (hdr_len > 0) {
+		iov[iov_num].iov_base = hdr;
+		iov[iov_num++].iov_len = hdr_len;
+	}
+
+	if (iov_num == 0)
+		return write(tun_fd, packet, len);
+
+	iov[iov_num].iov_base = packet;
+	iov[iov_num++].iov_len = len;
+
+	return writev(tun_fd, iov, iov_num);
+}
+
+static uint8_t tunnel_caps(void)
+{
+	return TUNNEL_CAP_PORT | (tunnel_aggregation ? TUNNEL_CAP_AGGR : 0) | (tunnel_compression ? TUNNEL_CAP_COMP : 0);
+}
+
+static void client_route_lock(void)
+{
+	if (pthread_mutex_lock(&client_route_mutex) != 0)
+		debug_output(0, "Error - could not lock client route mutex: %s \n", strerror(errno));
+}
+
+static void client_route_unlock(void)
+{
+	if (pthread_mutex_unlock(&client_route_mutex) != 0)
+		debug_output(0, "Error - could not unlock client route mutex: %s \n", strerror(errno));
+}
+
+/* what the published view wants the tunnel to the gateway to do */
+static uint8_t client_tun_role(struct route_view *view, uint32_t gw_addr)
+{
+	if (view == NULL)
+		return CLIENT_ROLE_NONE;
+
+	if (view->gw_addr == gw_addr)
+		return CLIENT_ROLE_ACTIVE;
+
+	return (view->gw_standby_addr == gw_addr ? CLIENT_ROLE_STANDBY : CLIENT_ROLE_NONE);
+}
+
+/* the standby tunnel to the gateway is ready to take over (or not any more) */
+static void client_route_standby(uint32_t gw_addr, uint8_t ready)
+{
+	client_route_lock();
+
+	if (ready)
+		client_standby_gw = gw_addr;
+	else if (client_standby_gw == gw_addr)
+		client_standby_gw = 0;
+
+	pthread_cond_broadcast(&client_route_cond);
+	client_route_unlock();
+}
+
+/* the tunnel to the selected gateway uses the tunnel port - returns 0 if the old tunnel did not free it in time */
+static int8_t client_port_take(uint32_t gw_addr)
+{
+	int32_t i;
+	int8_t taken = 0;
+
+	for (i = 0; (i < CLIENT_PORT_WAIT / 10) && (!taken) && (!is_aborted()); i++) {
+
+		if (i > 0)
+			usleep(10000);
+
+		client_route_lock();
+
+		if ((client_port_gw == 0) || (client_port_gw == gw_addr)) {
+			client_port_gw = gw_addr;
+			taken = 1;
+		}
+
+		client_route_unlock();
+
+	}
+
+	return taken;
+}
+
+static void client_port_release(uint32_t gw_addr)
+{
+	client_route_lock();
+
+	if (client_port_gw == gw_addr)
+		client_port_gw = 0;
+
+	client_route_unlock();
+}
+
+/* the gateway would keep sending to the port of the old lease - no standby tunnel to it for a while */
+static void client_standby_refuse(uint32_t gw_addr)
+{
+	uint32_t current_time = get_time_msec();
+	int32_t i, slot = 0;
+
+	client_route_lock();
+
+	for (i = 0; i < CLIENT_NO_STANDBY_MAX; i++) {
+
+		if (client_no_standby[i].gw_addr == gw_addr) {
+			slot = i;
+			break;
+		}
+
+		/* the oldest entry makes room */
+		if ((int)(client_no_standby[i].refused - client_no_standby[slot].refused) < 0)
+			slot = i;
+
+	}
+
+	client_no_standby[slot].gw_addr = gw_addr;
+	client_no_standby[slot].refused = current_time;
+
+	client_route_unlock();
+}
+
+/* main thread: the gateway may get a standby tunnel */
+uint8_t tunnel_standby_possible(uint32_t gw_addr)
+{
+	uint32_t current_time = get_time_msec();
+	uint8_t possible = 1;
+	int32_t i;
+
+	client_route_lock();
+
+	for (i = 0; i < CLIENT_NO_STANDBY_MAX; i++) {
+
+		if ((client_no_standby[i].gw_addr == gw_addr) &&
+		    ((int)(current_time - (client_no_standby[i].refused + CLIENT_NO_STANDBY_TIMEOUT)) < 0))
+			possible = 0;
+
+	}
+
+	client_route_unlock();
+	return possible;
+}
+
+/* asks for the capabilities without a lease - a keep alive request is answered by every gateway, older ones echo our 0 */
+static int8_t get_gw_caps(struct sockaddr_in *gw_addr, int32_t udp_sock, uint8_t *gw_caps)
+{
+	struct timeval tv;
+	unsigned char buff[100];
+	int32_t res, buff_len, i;
+	fd_set wait_sockets;
+
+	for (i = 0; (i < 4) && (!is_aborted()); i++) {
+
+		memset(buff, 0, sizeof(buff));
+		buff[0] = TUNNEL_KEEPALIVE_REQUEST;
+		buff[TUNNEL_CAPS_CLIENT] = tunnel_caps();
+
+		if (sendto(udp_sock, buff, sizeof(buff), 0, (struct sockaddr *)gw_addr, sizeof(struct sockaddr_in)) < 0) {
+			debug_output(0, "Error - can't send capability request to gateway: %s \n", strerror(errno));
+			return -1;
+		}
+
+		tv.tv_sec = 0;
+		tv.tv_usec = 250000;
+
+		FD_ZERO(&wait_sockets);
+		FD_SET(udp_sock, &wait_sockets);
+
+		res = select(udp_sock + 1, &wait_sockets, NULL, NULL, &tv);
+
+		if (res <= 0)
+			continue;
+
+		if ((buff_len = recvfrom(udp_sock, buff, sizeof(buff), 0, NULL, NULL)) <= TUNNEL_CAPS_GW)
+			continue;
+
+		if ((buff[0] != TUNNEL_KEEPALIVE_REPLY) && (buff[0] != TUNNEL_IP_INVALID))
+			continue;
+
+		*gw_caps = buff[TUNNEL_CAPS_GW];
+
+		/* replies to the earlier requests must not be taken for the lease by get_tun_ip() */
+		while (recv(udp_sock, buff, sizeof(buff), MSG_DONTWAIT) >= 0)
+			;
+
+		return 1;
+
+	}
+
+	return -1;
+}
+
+/* routes the traffic into the tunnel - the new default route is added before the old one is removed */
+static void client_route_take(struct client_route *route)
+{
+	client_route_lock();
+
+	add_del_route(0, 0, 0, route->tun_addr, route->tun_ifi, route->tun_if, BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+
+	if ((client_route.gw_addr != 0) && (client_route.gw_addr != route->gw_addr))
+		add_del_route(0, 0, 0, client_route.tun_addr, client_route.tun_ifi, client_route.tun_if, BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+
+	memcpy(&client_route, route, sizeof(struct client_route));
+
+	if (client_standby_gw == route->gw_addr)
+		client_standby_gw = 0;
+
+	pthread_cond_broadcast(&client_route_cond);
+	client_route_unlock();
 }
 
-static int8_t get_tun_ip(struct sockaddr_in *gw_addr, int32_t udp_sock, uint32_t *tun_addr)
+/* the tunnel no longer routes the traffic - a ready standby tunnel to next_gw gets CLIENT_HANDOVER_WAIT ms to take over */
+static void client_route_drop(struct client_route *route, uint32_t next_gw)
+{
+	struct timespec timeout;
+
+	client_route_lock();
+
+	if ((next_gw != 0) && (client_standby_gw == next_gw) && (client_route.gw_addr == route->gw_addr)) {
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += CLIENT_HANDOVER_WAIT * 1000000;
+		timeout.tv_sec += timeout.tv_nsec / 1000000000;
+		timeout.tv_nsec %= 1000000000;
+
+		while ((client_route.gw_addr == route->gw_addr) && (client_standby_gw == next_gw) && (!is_aborted())) {
+
+			if (pthread_cond_timedwait(&client_route_cond, &client_route_mutex, &timeout) != 0)
+				break;
+
+		}
+
+	}
+
+	if (client_route.gw_addr == route->gw_addr) {
+		add_del_route(0, 0, 0, route->tun_addr, route->tun_ifi, route->tun_if, BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+		client_route.gw_addr = 0;
+	}
+
+	client_route_unlock();
+}
+
+static int8_t get_tun_ip(struct sockaddr_in *gw_addr, int32_t udp_sock, uint32_t *tun_addr, uint8_t *gw_caps, struct route_view **view)
 {
 	struct sockaddr_in sender_addr;
 	struct timeval tv;
@@ -108,12 +1592,20 @@ static int8_t get_tun_ip(struct sockaddr_in *gw_addr, int32_t udp_sock, uint32_t
 
 
 	addr_len = sizeof(struct sockaddr_in);
-	memset(&buff, 0, sizeof(buff));
 
 
-	while ((!is_aborted()) && (curr_gateway != NULL) && (i > 0)) {
+	while ((!is_aborted()) && (i > 0)) {
 
+		/* the gateway may have been deselected meanwhile */
+		*view = view_refresh(*view);
+
+		if (client_tun_role(*view, gw_addr->sin_addr.s_addr) == CLIENT_ROLE_NONE)
+			break;
+
+		memset(&buff, 0, sizeof(buff));
 		buff[0] = TUNNEL_IP_REQUEST;
+		buff[TUNNEL_CAPS_CLIENT] = tunnel_caps();
+		buff[TUNNEL_CAPS_GW] = 0;
 
 		if (sendto(udp_sock, buff, sizeof(buff), 0, (struct sockaddr *)gw_addr, sizeof(struct sockaddr_in)) < 0) {
 			debug_output(0, "Error - can't send ip request to gateway: %s \n", strerror(errno));
@@ -146,8 +1638,14 @@ static int8_t get_tun_ip(struct sockaddr_in *gw_addr, int32_t udp_sock, uint32_t
 			goto next_try;
 		}
 
-		if (buff_len < 4) {
-			debug_output(0, "Error - can't receive ip request: packet size is %i < 4 \n", buff_len);
+		if (buff_len < 5) {
+			debug_output(0, "Error - can't receive ip request: packet size is %i < 5 \n", buff_len);
+			goto next_try;
+		}
+
+		/* e.g. a late reply to a keep alive request of get_gw_caps() */
+		if (buff[0] != TUNNEL_IP_REQUEST) {
+			debug_output(4, "Gateway client - ignoring message of type %i while waiting for the ip \n", buff[0]);
 			goto next_try;
 		}
 
@@ -158,6 +1656,13 @@ static int8_t get_tun_ip(struct sockaddr_in *gw_addr, int32_t udp_sock, uint32_t
 		} */
 
 		memcpy(tun_addr, buff + 1, 4);
+
+		if (*tun_addr == 0) {
+			debug_output(0, "Error - can't receive ip request: gateway sent no address \n");
+			goto next_try;
+		}
+
+		*gw_caps = (buff_len > TUNNEL_CAPS_GW ? buff[TUNNEL_CAPS_GW] & tunnel_caps() : 0);
 		return 1;
 
 next_try:
@@ -175,17 +1680,22 @@ next_try:
 void *client_to_gw_tun(void *arg)
 {
 	struct curr_gw_data *curr_gw_data = (struct curr_gw_data *)arg;
+	struct route_view *view = NULL;
+	struct client_route route;
+	struct tunnel_poll tunnel_poll;
+	struct tunnel_batch rx_batch, tx_batch;
 	struct sockaddr_in gw_addr, my_addr, sender_addr;
-	struct timeval tv;
 	struct list_head_first packet_list;
-	int32_t res, max_sock, buff_len, udp_sock, tun_fd, tun_ifi, sock_opts, i, num_refresh_lease = 0, last_refresh_attempt = 0;
-	uint32_t addr_len, current_time, ip_lease_time = 0, gw_state_time = 0, my_tun_addr = 0, ignore_packet;
+	int32_t events, buff_len, recv_errno, udp_sock, tun_fd, tun_ifi, sock_opts, i, num_refresh_lease = 0, last_refresh_attempt = 0;
+	uint32_t current_time, deadline, ip_lease_time = 0, gw_state_time = 0, my_tun_addr = 0, ignore_packet;
 	char tun_if[IFNAMSIZ], my_str[ADDR_STR_LEN], gw_str[ADDR_STR_LEN], gw_state = GW_STATE_UNKNOWN;
-	unsigned char buff[1501];
-	fd_set wait_sockets, tmp_wait_sockets;
+	unsigned char *buff, *packet, *payload, keep_alive[100], hdr[HDR_COMP_HDR_MAX];
+	struct hdr_comp *comp_tx = NULL, *comp_rx = NULL;
+	uint8_t offload_flags, gw_caps = 0, role = CLIENT_ROLE_NONE, routing = 0, standby_ready = 0, port_owner = 0;
+	int32_t off, packet_len, hdr_len, payload_len, ctx_id, slot = curr_gw_data->slot;
 
 
-	addr_len = sizeof(struct sockaddr_in);
+	memset(keep_alive, 0, sizeof(keep_alive));
 
 	INIT_LIST_HEAD_FIRST(packet_list);
 
@@ -193,13 +1703,30 @@ void *client_to_gw_tun(void *arg)
 	memset(&my_addr, 0, sizeof(struct sockaddr_in));
 
 	gw_addr.sin_family = AF_INET;
-	gw_addr.sin_port = curr_gw_data->gw_node->gw_port;
+	gw_addr.sin_port = curr_gw_data->gw_port;
 	gw_addr.sin_addr.s_addr = curr_gw_data->orig;
 
 	my_addr.sin_family = AF_INET;
-	my_addr.sin_port = curr_gw_data->gw_node->gw_port;
 	my_addr.sin_addr.s_addr = curr_gw_data->batman_if->addr.sin_addr.s_addr;
 
+	view = view_refresh(view);
+
+	if ((role = client_tun_role(view, curr_gw_data->orig)) == CLIENT_ROLE_NONE)
+		goto out;
+
+	/* a standby tunnel runs beside the selected one - from a port of its own */
+	if (role == CLIENT_ROLE_ACTIVE) {
+
+		if (!client_port_take(curr_gw_data->orig)) {
+			debug_output(3, "Error - couldn't create tunnel: old tunnel still holds the tunnel port \n");
+			goto out;
+		}
+
+		port_owner = 1;
+		my_addr.sin_port = curr_gw_data->gw_port;
+
+	}
+
 
 	/* connect to server (establish udp tunnel) */
 	if ((udp_sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
@@ -224,9 +1751,19 @@ void *client_to_gw_tun(void *arg)
 	fcntl(udp_sock, F_SETFL, sock_opts | O_NONBLOCK);
 
 
-	if (get_tun_ip(&gw_addr, udp_sock, &my_tun_addr) < 0) {
-		curr_gw_data->gw_node->last_failure = get_time_msec();
-		curr_gw_data->gw_node->gw_failure++;
+	if ((!port_owner) && ((get_gw_caps(&gw_addr, udp_sock, &gw_caps) < 0) || (!(gw_caps & TUNNEL_CAP_PORT)))) {
+
+		addr_to_string(curr_gw_data->orig, gw_str, sizeof(gw_str));
+		debug_output(3, "Gateway client - no standby tunnel to gateway %s: it does not follow the client port \n", gw_str);
+
+		client_standby_refuse(curr_gw_data->orig);
+		goto udp_out;
+	}
+
+	if (get_tun_ip(&gw_addr, udp_sock, &my_tun_addr, &gw_caps, &view) < 0) {
+
+		if ((!is_aborted()) && (client_tun_role(view, curr_gw_data->orig) != CLIENT_ROLE_NONE))
+			view_gw_failure(curr_gw_data->orig, get_time_msec());
 
 		goto udp_out;
 	}
@@ -235,44 +1772,101 @@ void *client_to_gw_tun(void *arg)
 
 	addr_to_string(my_tun_addr, my_str, sizeof(my_str));
 	addr_to_string(curr_gw_data->orig, gw_str, sizeof(gw_str));
-	debug_output(3, "Gateway client - got IP (%s) from gateway: %s \n", my_str, gw_str);
+	debug_output(3, "Gateway client - got IP (%s) from gateway: %s%s%s \n", my_str, gw_str,
+	             (gw_caps & TUNNEL_CAP_AGGR ? " (aggregating small packets)" : ""), (gw_caps & TUNNEL_CAP_COMP ? " (compressing headers)" : ""));
 
 
-	if (add_dev_tun(curr_gw_data->batman_if, my_tun_addr, tun_if, sizeof(tun_if), &tun_fd, &tun_ifi) <= 0)
+	if (add_dev_tun(curr_gw_data->batman_if, my_tun_addr, tun_if, sizeof(tun_if), &tun_fd, &tun_ifi, (tunnel_offload ? TUN_OFFLOAD : 0)) <= 0)
 		goto udp_out;
 
-	add_nat_rule(tun_if);
-	add_del_route(0, 0, 0, my_tun_addr, tun_ifi, tun_if, BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+	add_nat_rule(tun_if);
+
+	/* the default route is added once the gateway is (or becomes) the selected one */
+	memset(&route, 0, sizeof(struct client_route));
+	route.gw_addr = curr_gw_data->orig;
+	route.tun_addr = my_tun_addr;
+	route.tun_ifi = tun_ifi;
+	strncpy(route.tun_if, tun_if, IFNAMSIZ - 1);
+
+	offload_flags = tunnel_offload_flags(udp_sock);
+	tunnel_batch_init(&rx_batch, offload_flags & ~TUNNEL_BATCH_GSO);
+	tunnel_batch_init(&tx_batch, offload_flags & ~TUNNEL_BATCH_GRO);
+	tx_batch.aggr_len = tunnel_aggr_len(tun_if);
+
+	if (gw_caps & TUNNEL_CAP_COMP) {
+		comp_tx = hdr_comp_new();
+		comp_rx = hdr_comp_new();
+	}
+
+	if (tunnel_poll_init(&tunnel_poll, udp_sock, tun_fd, TUNNEL_POLL_CLIENT + slot) < 0)
+		goto cleanup;
+
+	while (!is_aborted()) {
+
+		/* stop as soon as the main thread neither selected this gateway nor keeps it as standby */
+		view = view_refresh(view);
+
+		if ((role = client_tun_role(view, curr_gw_data->orig)) == CLIENT_ROLE_NONE)
+			break;
+
+		if ((role == CLIENT_ROLE_ACTIVE) && (!routing)) {
+
+			client_route_take(&route);
+			routing = 1;
+			standby_ready = 0;
+
+			gw_state = GW_STATE_UNKNOWN;
+			gw_state_time = 0;
+
+			debug_output(3, "Gateway client - routing via gateway: %s \n", gw_str);
+
+		} else if ((role == CLIENT_ROLE_STANDBY) && (port_owner)) {
+
+			/* the new selected gateway may need the tunnel port - a standby from a port of its own replaces us */
+			break;
+
+		} else if (role == CLIENT_ROLE_STANDBY) {
+
+			/* the selected gateway changed - its tunnel takes over the route */
+			if (routing) {
+				client_route_drop(&route, view->gw_addr);
+				routing = 0;
+
+				debug_output(3, "Gateway client - keeping tunnel to gateway as standby: %s \n", gw_str);
+			}
+
+			if (!standby_ready) {
+				client_route_standby(curr_gw_data->orig, 1);
+				standby_ready = 1;
+			}
 
-	FD_ZERO(&wait_sockets);
-	FD_SET(udp_sock, &wait_sockets);
-	FD_SET(tun_fd, &wait_sockets);
+		}
 
-	max_sock = (udp_sock > tun_fd ? udp_sock : tun_fd);
+		/* sleep until the lease has to be refreshed or the gateway state times out */
+		current_time = get_time_msec();
+		deadline = ip_lease_time + IP_LEASE_TIMEOUT + 1;
 
-	while ((!is_aborted()) && (curr_gateway != NULL) && (!curr_gw_data->gw_node->deleted)) {
+		if (num_refresh_lease > 0)
+			deadline = time_later(deadline, last_refresh_attempt + 1000 + 1);
 
-		tv.tv_sec = 0;
-		tv.tv_usec = 250;
+		if ((gw_state == GW_STATE_UNKNOWN) && (gw_state_time != 0))
+			deadline = time_earlier(deadline, gw_state_time + GW_STATE_UNKNOWN_TIMEOUT + 1);
+		else if (gw_state == GW_STATE_VERIFIED)
+			deadline = time_earlier(deadline, gw_state_time + GW_STATE_VERIFIED_TIMEOUT + 1);
 
-		memcpy(&tmp_wait_sockets, &wait_sockets, sizeof(fd_set));
+		tunnel_poll_timer(&tunnel_poll, deadline, current_time);
 
-		res = select(max_sock + 1, &tmp_wait_sockets, NULL, NULL, &tv);
+		events = tunnel_poll_wait(&tunnel_poll);
 
 		current_time = get_time_msec();
 
-		if ((res < 0) && (errno != EINTR)) {
-			debug_output(0, "Error - can't select (client_to_gw_tun): %s \n", strerror(errno));
+		if (events < 0)
 			break;
-		}
-
-		if (res <= 0)
-			goto after_incoming_packet;
 
 		/* traffic that comes from the gateway via the tunnel */
-		if (FD_ISSET(udp_sock, &tmp_wait_sockets)) {
+		if (events & TUNNEL_EV_SOCK) {
 
-			while ((buff_len = recvfrom(udp_sock, buff, sizeof(buff) - 1, 0, (struct sockaddr *)&sender_addr, &addr_len)) > 0) {
+			while ((buff_len = tunnel_recv(&rx_batch, udp_sock, &buff, &sender_addr)) > 0) {
 
 				if (buff_len < 2) {
 					debug_output(0, "Error - ignoring gateway packet from %s: packet too small (%i)\n", my_str, buff_len);
@@ -288,20 +1882,42 @@ void *client_to_gw_tun(void *arg)
 				switch(buff[0]) {
 				/* got data from gateway */
 				case TUNNEL_DATA:
-					if (write(tun_fd, buff + 1, buff_len - 1) < 0)
-						debug_output(0, "Error - can't write packet: %s\n", strerror(errno));
+				case TUNNEL_DATA_AGGR:
+					off = 0;
+
+					while ((packet_len = tunnel_data_next(buff, buff_len, &off, &packet)) > 0) {
+
+						/* the full header of the flow got lost - the gateway sends a new one */
+						if ((hdr_len = hdr_decomp_packet(comp_rx, packet, packet_len, hdr, &payload, &payload_len)) < 0) {
+							debug_output(4, "Gateway client - dropping packet from %s: unknown header compression context \n", gw_str);
+
+							if ((ctx_id = hdr_decomp_resync(comp_rx, packet, packet_len)) >= 0)
+								tunnel_comp_resync(udp_sock, &gw_addr, ctx_id);
+
+							continue;
+						}
+
+						if (tunnel_write(&rx_batch, tun_fd, hdr, hdr_len, payload, payload_len) < 0)
+							debug_output(0, "Error - can't write packet: %s\n", strerror(errno));
+
+						if (get_tunneled_protocol(hdr_len > 0 ? hdr : payload) != IPPROTO_ICMP) {
+							gw_state = GW_STATE_VERIFIED;
+							gw_state_time = current_time;
+						}
 
-					if (get_tunneled_protocol(buff) != IPPROTO_ICMP) {
-						gw_state = GW_STATE_VERIFIED;
-						gw_state_time = current_time;
 					}
 					break;
+				/* the gateway lost the full header of one of our flows */
+				case TUNNEL_COMP_RESYNC:
+					if (comp_tx != NULL)
+						hdr_comp_resync(comp_tx, buff[1]);
+
+					break;
 				/* gateway told us that we have no valid ip */
 				case TUNNEL_IP_INVALID:
 					addr_to_string(my_tun_addr, my_str, sizeof(my_str));
 					debug_output(3, "Gateway client - gateway (%s) says: IP (%s) is invalid (maybe expired) \n", gw_str, my_str);
 
-					curr_gateway = NULL;
 					goto cleanup;
 				/* keep alive packet was confirmed */
 				case TUNNEL_KEEPALIVE_REPLY:
@@ -318,28 +1934,26 @@ void *client_to_gw_tun(void *arg)
 				break;
 			}
 
-		/* traffic that we should send to the gateway via the tunnel */
-		} else if (FD_ISSET(tun_fd, &tmp_wait_sockets)) {
-
-			while ((buff_len = read(tun_fd, buff + 1, sizeof(buff) - 2)) > 0) {
+		}
 
-				buff[0] = TUNNEL_DATA;
+		/* traffic that we should send to the gateway via the tunnel */
+		if (events & TUNNEL_EV_TUN) {
 
-				if (sendto(udp_sock, buff, buff_len + 1, 0, (struct sockaddr *)&gw_addr, sizeof(struct sockaddr_in)) < 0)
-					debug_output(0, "Error - can't send data to gateway: %s\n", strerror(errno));
+			while ((buff_len = tunnel_read(&tx_batch, udp_sock, tun_fd, &packet)) > 0) {
 
+				/* sending may compress or move the packet */
 				if ((gw_state == GW_STATE_UNKNOWN) && (gw_state_time == 0)) {
 
 					ignore_packet = 0;
 
-					if (get_tunneled_protocol(buff) == IPPROTO_ICMP)
+					if (get_tunneled_protocol(packet) == IPPROTO_ICMP)
 						ignore_packet = 1;
 
-					if (get_tunneled_protocol(buff) == IPPROTO_UDP) {
+					if (get_tunneled_protocol(packet) == IPPROTO_UDP) {
 
 						for (i = 0; i < (int)(sizeof(bh_udp_ports)/sizeof(short)); i++) {
 
-							if (get_tunneled_udpdest(buff) == bh_udp_ports[i]) {
+							if (get_tunneled_udpdest(packet) == bh_udp_ports[i]) {
 
 								ignore_packet = 1;
 								break;
@@ -351,33 +1965,37 @@ void *client_to_gw_tun(void *arg)
 					}
 
 					/* if the packet was not natted (half tunnel) don't active the blackhole detection */
-					if (get_tunneled_sender_ip(buff) != my_tun_addr)
+					if (get_tunneled_sender_ip(packet) != my_tun_addr)
 						ignore_packet = 1;
 
 					if (!ignore_packet)
 						gw_state_time = current_time;
 
 				}
+
+				tunnel_send_packet(&tx_batch, udp_sock, packet, buff_len, &gw_addr, gw_caps, comp_tx);
+
 			}
 
-			if (errno != EWOULDBLOCK) {
-				debug_output(0, "Error - gateway client can't read tun data: %s\n", strerror(errno));
+			recv_errno = errno;
+			tunnel_send_flush(&tx_batch, udp_sock);
+
+			if (recv_errno != EWOULDBLOCK) {
+				debug_output(0, "Error - gateway client can't read tun data: %s\n", strerror(recv_errno));
 				break;
 			}
 
 		}
 
-after_incoming_packet:
-
 		/* refresh leased IP */
 		if (((int)(current_time - (ip_lease_time + IP_LEASE_TIMEOUT)) > 0) &&
 			((int)(current_time - (last_refresh_attempt + 1000)) > 0)) {
 
 			if (num_refresh_lease < 12) {
 
-				buff[0] = TUNNEL_KEEPALIVE_REQUEST;
+				keep_alive[0] = TUNNEL_KEEPALIVE_REQUEST;
 
-				if (sendto(udp_sock, buff, 100, 0, (struct sockaddr *)&gw_addr, sizeof(struct sockaddr_in)) < 0)
+				if (sendto(udp_sock, keep_alive, sizeof(keep_alive), 0, (struct sockaddr *)&gw_addr, sizeof(struct sockaddr_in)) < 0)
 					debug_output(0, "Error - can't send keep alive request to gateway: %s \n", strerror(errno));
 
 				num_refresh_lease++;
@@ -388,8 +2006,7 @@ after_incoming_packet:
 				addr_to_string(my_tun_addr, my_str, sizeof(my_str));
 				debug_output(3, "Gateway client - disconnecting from unresponsive gateway (%s): could not refresh IP lease \n", gw_str);
 
-				curr_gw_data->gw_node->last_failure = current_time;
-				curr_gw_data->gw_node->gw_failure++;
+				view_gw_failure(curr_gw_data->orig, current_time);
 				break;
 
 			}
@@ -402,8 +2019,7 @@ after_incoming_packet:
 
 			debug_output(3, "Gateway client - disconnecting from unresponsive gateway (%s): gateway seems to be a blackhole \n", gw_str);
 
-			curr_gw_data->gw_node->last_failure = current_time;
-			curr_gw_data->gw_node->gw_failure++;
+			view_gw_failure(curr_gw_data->orig, current_time);
 
 			break;
 		}
@@ -418,7 +2034,21 @@ after_incoming_packet:
 	}
 
 cleanup:
-	add_del_route(0, 0, 0, my_tun_addr, tun_ifi, tun_if, BATMAN_RT_TABLE_TUNNEL, ROUTE_TYPE_UNICAST, ROUTE_DEL);
+	tunnel_poll_close(&tunnel_poll, TUNNEL_POLL_CLIENT + slot);
+	tunnel_batch_free(&rx_batch);
+	tunnel_batch_free(&tx_batch);
+
+	if (comp_tx != NULL) {
+		hdr_comp_free(comp_tx);
+		hdr_comp_free(comp_rx);
+	}
+
+	/* a ready standby tunnel to the newly selected gateway takes over the route first */
+	if (routing)
+		client_route_drop(&route, ((role != CLIENT_ROLE_ACTIVE) && (view != NULL) ? view->gw_addr : 0));
+
+	client_route_standby(curr_gw_data->orig, 0);
+
 	del_nat_rule(tun_if);
 	del_dev_tun(tun_fd);
 
@@ -426,212 +2056,473 @@ udp_out:
 	close(udp_sock);
 
 out:
-	curr_gateway = NULL;
-	tunnel_running = 0;
+	if (port_owner)
+		client_port_release(curr_gw_data->orig);
+
+	if (view != NULL)
+		view_put(view);
+
+	/* lets the main thread choose another gateway */
+	if (role == CLIENT_ROLE_ACTIVE)
+		view_gw_lost(curr_gw_data->orig);
+
 	debugFree(arg, 1212);
+	tunnel_gw_addrs[slot] = 0;
 
 	return NULL;
 }
 
-static struct gw_client *get_ip_addr(struct sockaddr_in *client_addr, struct hashtable_t **wip_hash, struct hashtable_t **vip_hash, struct list_head_first *free_ip_list, uint8_t next_free_ip[]) {
+/**
+ * probes every gateway of the view once per GW_PROBE_INTERVAL (--gw-probe)
+ *
+ * The rounds run one gateway after the other from a socket of their own.
+ * The main thread smoothes the results per gateway (see gw_probe.c) and
+ * rates the gateways by the goodput they promise.
+ */
+void *client_probe_gws(void *BATMANUNUSED(arg))
+{
+	struct route_view *view = NULL;
+	struct gw_probe_sample sample;
+	struct sockaddr_in gw_addr;
+	uint32_t next_round, i;
+	uint16_t round = 0;
+	int32_t probe_sock;
+	char gw_str[ADDR_STR_LEN];
+
 
-	struct gw_client *gw_client;
-	struct free_ip *free_ip;
-	struct list_head *list_pos, *list_pos_tmp;
-	struct hashtable_t *swaphash;
+	if ((probe_sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+		debug_output(0, "Error - can't create gateway probe socket: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	next_round = get_time_msec();
+
+	while (!is_aborted()) {
+
+		/* short naps - shutting down does not wait for the next round */
+		if ((routing_class == 0) || ((int)(get_time_msec() - next_round) < 0)) {
+			usleep(100000);
+			continue;
+		}
+
+		next_round = get_time_msec() + GW_PROBE_INTERVAL;
+		view = view_refresh(view);
+
+		if (view == NULL)
+			continue;
+
+		for (i = 0; (i < view->num_gws) && (!is_aborted()); i++) {
+
+			memset(&gw_addr, 0, sizeof(struct sockaddr_in));
+			gw_addr.sin_family = AF_INET;
+			gw_addr.sin_port = view->gws[i].gw_port;
+			gw_addr.sin_addr.s_addr = view->gws[i].orig;
+
+			addr_to_string(view->gws[i].orig, gw_str, sizeof(gw_str));
+
+			if (gw_probe_round(probe_sock, &gw_addr, ++round, &sample) < 0) {
+				debug_output(4, "Gateway probe - can't probe gateway %s: %s \n", gw_str, strerror(errno));
+				continue;
+			}
 
+			debug_output(4, "Gateway probe - %s: rtt %u us, %u kbit/s, %i of %i probes answered \n", gw_str, sample.rtt, sample.bw, sample.received, sample.sent);
+			view_gw_probe(view->gws[i].orig, &sample);
+
+		}
+
+	}
+
+	if (view != NULL)
+		view_put(view);
+
+	close(probe_sock);
+	return NULL;
+}
 
-	gw_client = ((struct gw_client *)hash_find(*wip_hash, &client_addr->sin_addr.s_addr));
+/* has to be called with the client table write locked - returns NULL if no address is left */
+static struct gw_client *get_ip_addr(struct sockaddr_in *client_addr)
+{
+	struct gw_client *gw_client;
 
-	if (gw_client != NULL)
+	if ((gw_client = gw_table_find_wip(client_addr->sin_addr.s_addr)) != NULL)
 		return gw_client;
 
-	gw_client = debugMalloc( sizeof(struct gw_client), 208 );
+	return gw_table_add(client_addr->sin_addr.s_addr, client_addr->sin_port, get_time_msec());
+}
+
+/* has to be called with the client table write locked */
+static void gw_client_comp_free(struct gw_client *gw_client)
+{
+	if (gw_client->comp_tx == NULL)
+		return;
+
+	hdr_comp_free(gw_client->comp_tx);
+	hdr_comp_free(gw_client->comp_rx);
+
+	gw_client->comp_tx = NULL;
+	gw_client->comp_rx = NULL;
+}
 
-	gw_client->wip_addr = client_addr->sin_addr.s_addr;
-	gw_client->client_port = client_addr->sin_port;
-	gw_client->last_keep_alive = get_time_msec();
-	gw_client->vip_addr = 0;
-	gw_client->nat_warn = 0;
+/* sends the tunnelled packet to the client it belongs to - returns 0 if there is none */
+static int8_t gw_client_send(struct tunnel_batch *batch, int32_t sock, unsigned char *packet, int32_t len)
+{
+	struct gw_client *gw_client;
+	struct sockaddr_in client_addr;
+	uint32_t dst;
+	uint8_t caps = 0, found;
 
-	list_for_each_safe(list_pos, list_pos_tmp, free_ip_list) {
+	memset(&client_addr, 0, sizeof(struct sockaddr_in));
+	client_addr.sin_family = AF_INET;
+	memcpy(&dst, packet + 16, sizeof(dst));
 
-		free_ip = list_entry(list_pos, struct free_ip, list);
+	/* the read lock keeps the compression contexts alive - each worker only uses its own ones */
+	gw_clients_rdlock();
 
-		gw_client->vip_addr = free_ip->addr;
+	gw_client = gw_table_find_vip(dst);
+	found = (gw_client != NULL);
 
-		list_del((struct list_head *)free_ip_list, list_pos, free_ip_list);
-		debugFree(free_ip, 1216);
+	if (found) {
+		client_addr.sin_addr.s_addr = gw_client->wip_addr;
+		client_addr.sin_port = gw_client->client_port;
+		caps = gw_client->caps;
 
-		break;
+		if (gw_client->comp_tx != NULL)
+			len = tunnel_comp_packet(batch, packet, len, gw_client->comp_tx);
 	}
 
-	if (gw_client->vip_addr == 0) {
+	gw_clients_unlock();
+
+	/* sending may block on a full socket - not with the client table locked */
+	if (found)
+		tunnel_send_packet(batch, sock, packet, len, &client_addr, caps, NULL);
+
+	return found;
+}
+
+/**
+ * rebuilds the headers of a packet sent by the client - returns -2 if the
+ * client has no compression contexts (any more) and -1 if the packet was
+ * dropped, *ctx_id is the context to ask a full header for then (or -1)
+ */
+static int32_t gw_client_decomp(unsigned char *packet, int32_t len, struct sockaddr_in *addr, unsigned char *hdr, unsigned char **payload, int32_t *payload_len, int32_t *ctx_id)
+{
+	struct gw_client *gw_client;
+	int32_t hdr_len = -2;
+
+	*ctx_id = -1;
 
-		gw_client->vip_addr = *(uint32_t *)next_free_ip;
+	if (HDR_COMP_PLAIN(packet))
+		return hdr_decomp_packet(NULL, packet, len, hdr, payload, payload_len);
 
-		next_free_ip[3]++;
+	gw_clients_rdlock();
 
-		if (next_free_ip[3] == 0)
-			next_free_ip[2]++;
+	gw_client = gw_table_find_wip(addr->sin_addr.s_addr);
+
+	/* all datagrams of a client arrive at the same worker socket - nobody else touches comp_rx */
+	if ((gw_client != NULL) && (gw_client->comp_rx != NULL)) {
+		hdr_len = hdr_decomp_packet(gw_client->comp_rx, packet, len, hdr, payload, payload_len);
+
+		if (hdr_len == -1)
+			*ctx_id = hdr_decomp_resync(gw_client->comp_rx, packet, len);
 	}
 
-	hash_add(*wip_hash, gw_client);
-	hash_add(*vip_hash, gw_client);
+	gw_clients_unlock();
+	return hdr_len;
+}
+
+/* the client has to request a new lease - it starts over with fresh compression contexts */
+static void gw_client_invalid(int32_t sock, struct sockaddr_in *addr)
+{
+	unsigned char buff[100];
+	char str[16];
 
-	if ((*wip_hash)->elements * 4 > (*wip_hash)->size) {
+	memset(buff, 0, sizeof(buff));
+	buff[0] = TUNNEL_IP_INVALID;
 
-		swaphash = hash_resize(*wip_hash, (*wip_hash)->size * 2);
+	addr_to_string(addr->sin_addr.s_addr, str, sizeof(str));
 
-		if (swaphash == NULL) {
-			debug_output( 0, "Couldn't resize hash table \n" );
-			restore_and_exit(0);
-		}
+	if (sendto(sock, buff, sizeof(buff), 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0) {
+		debug_output(0, "Error - can't send invalid ip information to client (%s): %s \n", str, strerror(errno));
+		return;
+	}
+
+	debug_output(3, "Gateway - send invalid ip information to client: %s (unknown header compression contexts) \n", str);
+}
+
+/* warns about packets of clients without lease (e.g. not natted) - they are forwarded anyway */
+static void gw_client_check(unsigned char *packet, struct sockaddr_in *addr)
+{
+	struct gw_client *gw_client;
+	char gw_addr[16], str[16];
+	uint32_t src;
+	uint8_t client_known;
+
+	memcpy(&src, packet + 12, sizeof(src));
+
+	gw_clients_rdlock();
+	gw_client = gw_table_find_vip(src);
+	client_known = ((gw_client != NULL) && ((gw_client->wip_addr == addr->sin_addr.s_addr) || (gw_client->nat_warn != 0)));
+	gw_clients_unlock();
+
+	if (client_known)
+		return;
+
+	gw_clients_wrlock();
+	gw_client = gw_table_find_vip(src);
+
+	/* check whether client IP is known */
+	if ((gw_client == NULL) || ((gw_client->wip_addr != addr->sin_addr.s_addr) && (gw_client->nat_warn == 0))) {
+
+		addr_to_string(addr->sin_addr.s_addr, str, sizeof(str));
+
+		debug_output(0, "Error - got packet from unknown client: %s (tunnelled sender ip %i.%i.%i.%i) \n", str, packet[12], packet[13], packet[14], packet[15]);
 
-		*wip_hash = swaphash;
-		swaphash = hash_resize(*vip_hash, (*vip_hash)->size * 2);
+		if (gw_client == NULL) {
+
+			/* TODO: only send refresh if the IP comes from 169.254.x.y ?? */
+
+			/* auto assign a dummy address to output the NAT warning only once */
+			if ((gw_client = get_ip_addr(addr)) == NULL) {
+				debug_output(0, "Error - no tunnel address left for client: %s \n", str);
+				gw_clients_unlock();
+				return;
+			}
+
+			addr_to_string(gw_client->vip_addr, str, sizeof(str));
+			addr_to_string(addr->sin_addr.s_addr, gw_addr, sizeof(gw_addr));
+			debug_output(3, "Gateway - assigned %s to unregistered client: %s \n", str, gw_addr);
 
-		if (swaphash == NULL) {
-			debug_output( 0, "Couldn't resize hash table \n" );
-			restore_and_exit(0);
 		}
 
-		*vip_hash = swaphash;
+		debug_output(0, "Either enable NAT on the client or make sure this host has a route back to the sender address.\n");
+		gw_client->nat_warn++;
 	}
 
-	return gw_client;
+	gw_clients_unlock();
+}
 
+/* close unresponsive client connections (free unused IPs) - only the clients due on the lease wheel are looked at */
+static void gw_clients_purge(uint32_t current_time)
+{
+	gw_clients_wrlock();
+	gw_table_expire(current_time, gw_client_comp_free);
+	gw_clients_unlock();
 }
 
-/* needed for hash, compares 2 struct gw_client, but only their ip-addresses. assumes that
- * the ip address is the first/second field in the struct */
-static int compare_wip(void *data1, void *data2)
+/* reads a packet from the tun device into the downstream queue - returns its length, 0 if it was dropped or -1 (errno set) */
+static int32_t gw_queue_read(struct gw_worker *gw_worker, struct tunnel_batch *batch, uint32_t current_time)
 {
-	return (memcmp(data1, data2, 4) == 0 ? 1 : 0);
+	struct fq_packet *fq_packet;
+	unsigned char *packet;
+	int32_t vnet_len = (batch->flags & TUNNEL_BATCH_VNET ? TUNNEL_VNET_LEN : 0);
+	int32_t len;
+	uint32_t key;
+
+	fq_packet = fq_codel_packet(gw_worker->queue_down);
+	packet = fq_packet->data + TUNNEL_VNET_LEN;
+
+	/* the virtio_net_hdr (if any) lands right in front of the packet */
+	if ((len = read(gw_worker->tun_fd, packet - vnet_len, vnet_len + TUNNEL_BUFF_LEN - 2)) <= 0) {
+		fq_codel_release(gw_worker->queue_down, fq_packet);
+		return -1;
+	}
+
+	len -= vnet_len;
+
+	if (len < 20) {
+		fq_codel_release(gw_worker->queue_down, fq_packet);
+		return 0;
+	}
+
+	/* the packets of a client share a queue - keyed by its tunnel address */
+	memcpy(&key, packet + 16, sizeof(key));
+
+	fq_packet->len = len;
+	fq_codel_enqueue(gw_worker->queue_down, fq_packet, key, current_time);
+
+	return len;
 }
 
-static int compare_vip(void *data1, void *data2)
+/* sends the queued packets as long as the socket takes them - returns -1 once its buffer is full */
+static int8_t gw_queue_send(struct gw_worker *gw_worker, struct tunnel_batch *batch, uint32_t current_time)
 {
-	return (memcmp(((char *)data1) + 4, ((char *)data2) + 4, 4) == 0 ? 1 : 0);
+	struct fq_packet *fq_packet;
+	unsigned char *packet;
+	char gw_addr[16];
+	uint32_t dst;
+
+	while (1) {
+
+		/* the packets not taken stay in the batch - nothing more is dequeued until they are sent */
+		if ((batch->num >= batch->num_max) && (tunnel_send_flush(batch, gw_worker->udp_sock) < 0))
+			return -1;
+
+		if ((fq_packet = fq_codel_dequeue(gw_worker->queue_down, current_time)) == NULL)
+			break;
+
+		packet = fq_packet->data + TUNNEL_VNET_LEN;
+
+		if (!gw_client_send(batch, gw_worker->udp_sock, packet, fq_packet->len)) {
+
+			memcpy(&dst, packet + 16, sizeof(dst));
+			addr_to_string(dst, gw_addr, sizeof(gw_addr));
+			debug_output(3, "Gateway - could not resolve packet: %s \n", gw_addr);
+
+		}
+
+		fq_codel_release(gw_worker->queue_down, fq_packet);
+
+	}
+
+	return tunnel_send_flush(batch, gw_worker->udp_sock);
 }
 
-/* hashfunction to choose an entry in a hash table of given size */
-/* hash algorithm from http://en.wikipedia.org/wiki/Hash_table */
-static int choose_wip(void *data, int32_t size)
+/* writes the queued client packets into the tun device */
+static void gw_queue_write(struct gw_worker *gw_worker, struct tunnel_batch *batch, uint32_t current_time)
 {
-	unsigned char *key= data;
-	uint32_t hash = 0;
-	size_t i;
+	struct fq_packet *fq_packet;
+
+	while ((fq_packet = fq_codel_dequeue(gw_worker->queue_up, current_time)) != NULL) {
+
+		if (tunnel_write(batch, gw_worker->tun_fd, NULL, 0, fq_packet->data + TUNNEL_VNET_LEN, fq_packet->len) < 0)
+			debug_output(0, "Error - can't write packet into tun: %s\n", strerror(errno));
+
+		fq_codel_release(gw_worker->queue_up, fq_packet);
 
-	for (i = 0; i < 4; i++) {
-		hash += key[i];
-		hash += (hash << 10);
-		hash ^= (hash >> 6);
 	}
+}
+
+/* queues a (decompressed) client packet for the tun device - keyed by the client's tunnel address */
+static void gw_queue_up(struct gw_worker *gw_worker, struct tunnel_batch *batch, unsigned char *hdr, int32_t hdr_len, unsigned char *payload, int32_t payload_len, uint32_t current_time)
+{
+	struct fq_packet *fq_packet;
+	unsigned char *packet;
+	uint32_t key = 0;
 
-	hash += (hash << 3);
-	hash ^= (hash >> 11);
-	hash += (hash << 15);
+	fq_packet = fq_codel_packet(gw_worker->queue_up);
+	packet = fq_packet->data + TUNNEL_VNET_LEN;
 
-	return (hash%size);
+	memcpy(packet, hdr, hdr_len);
+	memcpy(packet + hdr_len, payload, payload_len);
+	fq_packet->len = hdr_len + payload_len;
 
+	if (fq_packet->len >= 20)
+		memcpy(&key, packet + 12, sizeof(key));
+
+	fq_codel_enqueue(gw_worker->queue_up, fq_packet, key, current_time);
+
+	/* the packets that arrived together are sent round robin - a burst is not held back */
+	if (fq_codel_backlog(gw_worker->queue_up) >= TUNNEL_BATCH_LEN)
+		gw_queue_write(gw_worker, batch, current_time);
 }
 
-static int choose_vip(void *data, int32_t size)
+static void gw_queues_lock(void)
 {
-	unsigned char *key= data;
-	uint32_t hash = 0;
-	size_t i;
+	if (pthread_mutex_lock(&gw_queues_mutex) != 0)
+		debug_output(0, "Error - could not lock gateway queues mutex: %s \n", strerror(errno));
+}
 
-	for (i = 4; i < 8; i++) {
-		hash += key[i];
-		hash += (hash << 10);
-		hash ^= (hash >> 6);
-	}
+static void gw_queues_unlock(void)
+{
+	if (pthread_mutex_unlock(&gw_queues_mutex) != 0)
+		debug_output(0, "Error - could not unlock gateway queues mutex: %s \n", strerror(errno));
+}
+
+static void gw_queue_stats_output(int32_t sock, char *direction, int32_t worker, struct fq_codel *fq)
+{
+	struct fq_stats stats[FQ_CODEL_FLOWS];
+	char str[16];
+	int32_t num, i;
 
-	hash += (hash << 3);
-	hash ^= (hash >> 11);
-	hash += (hash << 15);
+	num = fq_codel_get_stats(fq, stats, FQ_CODEL_FLOWS);
 
-	return (hash%size);
+	for (i = 0; i < num; i++) {
 
+		addr_to_string(stats[i].key, str, sizeof(str));
+		dprintf(sock, "gw_queue_%s=%s worker=%i packets=%u drops=%u delay_avg_ms=%u delay_max_ms=%u backlog_bytes=%u\n",
+		        direction, str, worker, stats[i].packets, stats[i].drops, stats[i].delay_avg, stats[i].delay_max, stats[i].backlog);
+
+	}
 }
 
-void *gw_listen(void *BATMANUNUSED(arg)) {
+/* unix socket thread: the queue statistics of the running gateway */
+void gw_queue_output(int32_t sock)
+{
+	int32_t i;
 
-	struct batman_if *batman_if = (struct batman_if *)if_list.next;
-	struct timeval tv;
-	struct sockaddr_in addr, client_addr;
+	gw_queues_lock();
+
+	for (i = 0; i < gw_queues_num; i++) {
+		gw_queue_stats_output(sock, "down", i, gw_queues_workers[i].queue_down);
+		gw_queue_stats_output(sock, "up", i, gw_queues_workers[i].queue_up);
+	}
+
+	gw_queues_unlock();
+}
+
+static void *gw_worker(void *arg)
+{
+	struct gw_worker *gw_worker = (struct gw_worker *)arg;
+	struct tunnel_poll tunnel_poll;
+	struct sockaddr_in addr;
 	struct gw_client *gw_client;
-	char gw_addr[16], str[16], tun_dev[IFNAMSIZ];
-	unsigned char buff[1501];
-	int32_t res, max_sock, buff_len, tun_fd, tun_ifi;
-	uint32_t addr_len, client_timeout, current_time;
-	uint8_t my_tun_ip[4] ALIGN_WORD, next_free_ip[4] ALIGN_WORD;
-	struct hashtable_t *wip_hash, *vip_hash;
-	struct list_head_first free_ip_list;
-	fd_set wait_sockets, tmp_wait_sockets;
-	struct hash_it_t *hashit;
-	struct free_ip *free_ip;
-	struct list_head *list_pos, *list_pos_tmp;
-
-
-	my_tun_ip[0] = next_free_ip[0] = 169;
-	my_tun_ip[1] = next_free_ip[1] = 254;
-	my_tun_ip[2] = next_free_ip[2] = 0;
-	my_tun_ip[3] = 0;
-	next_free_ip[3] = 1;
+	struct tunnel_batch rx_batch, tx_batch;
+	char gw_addr[16], str[16];
+	unsigned char *buff, *packet, *payload, hdr[HDR_COMP_HDR_MAX], reply[100];
+	int32_t events, buff_len, recv_errno, off, packet_len, hdr_len, payload_len, ctx_id;
+	uint32_t client_timeout, current_time, num_clients;
+	uint8_t offload_flags;
+	int sndbuf = GW_QUEUE_SNDBUF;
+
 
-	addr_len = sizeof (struct sockaddr_in);
 	client_timeout = get_time_msec();
 
-	client_addr.sin_family = AF_INET;
-	client_addr.sin_port = htons(PORT + 1);
+	offload_flags = tunnel_offload_flags(gw_worker->udp_sock);
+	tunnel_batch_init(&rx_batch, offload_flags & ~TUNNEL_BATCH_GSO);
+	tunnel_batch_init(&tx_batch, offload_flags & ~TUNNEL_BATCH_GRO);
+	tx_batch.aggr_len = gw_worker->aggr_len;
+	tx_batch.comp_first = gw_worker->num;
+	tx_batch.comp_step = gw_workers;
 
-	INIT_LIST_HEAD_FIRST(free_ip_list);
+	/* the packets rather wait in our queues than in the socket buffer - where no client gets its fair share */
+	if (gw_worker->queue_down != NULL) {
 
-	if (add_dev_tun(batman_if, *(uint32_t *)my_tun_ip, tun_dev, sizeof(tun_dev), &tun_fd, &tun_ifi) < 0)
-		return NULL;
+		if (setsockopt(gw_worker->udp_sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0)
+			debug_output(0, "Warning - can't shrink the send buffer of gateway worker %i: %s\n", gw_worker->num, strerror(errno));
 
-	if (NULL == ( wip_hash = hash_new(128, compare_wip, choose_wip)))
-		return NULL;
+		tx_batch.flags |= TUNNEL_BATCH_KEEP;
 
-	if (NULL == (vip_hash = hash_new(128, compare_vip, choose_vip))) {
-		hash_destroy(wip_hash);
-		return NULL;
 	}
 
-	add_del_route(*(uint32_t *)my_tun_ip, 16, 0, 0, tun_ifi, tun_dev, 254, ROUTE_TYPE_UNICAST, ROUTE_ADD);
-
+	if (tunnel_poll_init(&tunnel_poll, gw_worker->udp_sock, gw_worker->tun_fd, TUNNEL_POLL_GW + gw_worker->num) < 0)
+		goto out;
 
-	FD_ZERO(&wait_sockets);
-	FD_SET(batman_if->udp_tunnel_sock, &wait_sockets);
-	FD_SET(tun_fd, &wait_sockets);
+	while ((!is_aborted()) && (gateway_class > 0)) {
 
-	max_sock = (batman_if->udp_tunnel_sock > tun_fd ? batman_if->udp_tunnel_sock : tun_fd);
+		/* only the first worker sweeps the client table */
+		num_clients = 0;
 
-	while ((!is_aborted()) && (gateway_class > 0)) {
+		if (gw_worker->num == 0) {
+			gw_clients_rdlock();
+			num_clients = gw_table_clients();
+			gw_clients_unlock();
+		}
 
-		tv.tv_sec = 0;
-		tv.tv_usec = 250;
-		memcpy(&tmp_wait_sockets, &wait_sockets, sizeof(fd_set));
+		/* without clients there is nothing to sweep - an idle gateway sleeps until a packet arrives */
+		if (num_clients > 0)
+			tunnel_poll_timer(&tunnel_poll, client_timeout + GW_CLIENT_SWEEP_INTERVAL + 1, get_time_msec());
 
-		res = select(max_sock + 1, &tmp_wait_sockets, NULL, NULL, &tv);
+		events = tunnel_poll_wait(&tunnel_poll);
 
 		current_time = get_time_msec();
 
-		if ((res < 0) && (errno != EINTR)) {
-			debug_output(0, "Error - can't select (gw_listen): %s \n", strerror(errno));
+		if (events < 0)
 			break;
-		}
-
-		if (res <= 0)
-			goto after_incoming_packet;
 
 		/* traffic coming from the tunnel client via UDP */
-		if (FD_ISSET(batman_if->udp_tunnel_sock, &tmp_wait_sockets)) {
+		if (events & TUNNEL_EV_SOCK) {
 
-			while ((buff_len = recvfrom(batman_if->udp_tunnel_sock, buff, sizeof(buff) - 1, 0, (struct sockaddr *)&addr, &addr_len)) > 0) {
+			while ((buff_len = tunnel_recv(&rx_batch, gw_worker->udp_sock, &buff, &addr)) > 0) {
 
 				if (buff_len < 2) {
 					addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
@@ -642,73 +2533,119 @@ void *gw_listen(void *BATMANUNUSED(arg)) {
 				switch(buff[0]) {
 				/* client sends us data that should to the internet */
 				case TUNNEL_DATA:
-					/* compare_vip() adds 4 bytes, hence buff + 9 */
-					gw_client = ((struct gw_client *)hash_find(vip_hash, buff + 9));
-
-					/* check whether client IP is known */
-					if ((gw_client == NULL) || ((gw_client->wip_addr != addr.sin_addr.s_addr) && (gw_client->nat_warn == 0))) {
+				case TUNNEL_DATA_AGGR:
+					off = 0;
 
-						buff[0] = TUNNEL_IP_INVALID;
-						addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
+					while ((packet_len = tunnel_data_next(buff, buff_len, &off, &packet)) > 0) {
 
-						debug_output(0, "Error - got packet from unknown client: %s (tunnelled sender ip %i.%i.%i.%i) \n", str, (uint8_t)buff[13], (uint8_t)buff[14], (uint8_t)buff[15], (uint8_t)buff[16]);
+						if ((hdr_len = gw_client_decomp(packet, packet_len, &addr, hdr, &payload, &payload_len, &ctx_id)) == -2) {
+							gw_client_invalid(gw_worker->udp_sock, &addr);
+							break;
+						}
 
-						if (gw_client == NULL) {
+						if (hdr_len < 0) {
+							addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
+							debug_output(4, "Gateway - dropping packet from %s: unknown header compression context \n", str);
 
-							/* TODO: only send refresh if the IP comes from 169.254.x.y ?? */
-							/*if (sendto(batman_if->udp_tunnel_sock, buff, buff_len, 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0)
-								debug_output(0, "Error - can't send invalid ip information to client (%s): %s \n", str, strerror(errno));*/
+							if (ctx_id >= 0)
+								tunnel_comp_resync(gw_worker->udp_sock, &addr, ctx_id);
 
-							/* auto assign a dummy address to output the NAT warning only once */
-							gw_client = get_ip_addr(&addr, &wip_hash, &vip_hash, &free_ip_list, next_free_ip);
+							continue;
+						}
 
-							addr_to_string(gw_client->vip_addr, str, sizeof(str));
-							addr_to_string(addr.sin_addr.s_addr, gw_addr, sizeof(gw_addr));
-							debug_output(3, "Gateway - assigned %s to unregistered client: %s \n", str, gw_addr);
+						gw_client_check((hdr_len > 0 ? hdr : payload), &addr);
 
-						}
+						if (gw_worker->queue_up != NULL)
+							gw_queue_up(gw_worker, &rx_batch, hdr, hdr_len, payload, payload_len, current_time);
+						else if (tunnel_write(&rx_batch, gw_worker->tun_fd, hdr, hdr_len, payload, payload_len) < 0)
+							debug_output(0, "Error - can't write packet into tun: %s\n", strerror(errno));
 
-						debug_output(0, "Either enable NAT on the client or make sure this host has a route back to the sender address.\n");
-						gw_client->nat_warn++;
 					}
 
-					if (write(tun_fd, buff + 1, buff_len - 1) < 0)
-						debug_output(0, "Error - can't write packet into tun: %s\n", strerror(errno));
+					break;
+				/* the client lost the full header of one of its flows */
+				case TUNNEL_COMP_RESYNC:
+					gw_clients_rdlock();
+					gw_client = gw_table_find_wip(addr.sin_addr.s_addr);
+
+					if ((gw_client != NULL) && (gw_client->comp_tx != NULL))
+						hdr_comp_resync(gw_client->comp_tx, buff[1]);
+
+					gw_clients_unlock();
+					break;
+				/* clients measure us - answered without a lease */
+				case GW_PROBE_REQUEST:
+					if (gw_probe_reply(gw_worker->udp_sock, buff, buff_len, &addr) < 0) {
+						addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
+						debug_output(4, "Error - can't answer gateway probe of %s: %s \n", str, strerror(errno));
+					}
 
 					break;
 				/* client asks us to refresh the IP lease */
 				case TUNNEL_KEEPALIVE_REQUEST:
-					gw_client = ((struct gw_client *)hash_find(wip_hash, &addr.sin_addr.s_addr));
+					/* the received datagram may be followed by others in the buffer (UDP_GRO) - the reply gets its own */
+					tunnel_reply_init(reply, sizeof(reply), buff, buff_len);
 
-					buff[0] = TUNNEL_IP_INVALID;
+					gw_clients_wrlock();
+					gw_client = gw_table_find_wip(addr.sin_addr.s_addr);
+
+					reply[0] = TUNNEL_IP_INVALID;
 
 					if (gw_client != NULL) {
 						gw_client->last_keep_alive = current_time;
-						buff[0] = TUNNEL_KEEPALIVE_REPLY;
+						reply[0] = TUNNEL_KEEPALIVE_REPLY;
 					}
 
+					/* clients ask for our capabilities before they lease a standby tunnel */
+					reply[TUNNEL_CAPS_GW] = tunnel_caps();
+
+					gw_clients_unlock();
+
 					addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
 
-					if (sendto(batman_if->udp_tunnel_sock, buff, 100, 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
-						debug_output(0, "Error - can't send %s to client (%s): %s \n", (buff[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str, strerror(errno));
+					if (sendto(gw_worker->udp_sock, reply, sizeof(reply), 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
+						debug_output(0, "Error - can't send %s to client (%s): %s \n", (reply[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str, strerror(errno));
 						continue;
 					}
 
-					debug_output(3, "Gateway - send %s to client: %s \n", (buff[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str);
+					debug_output(3, "Gateway - send %s to client: %s \n", (reply[0] == TUNNEL_KEEPALIVE_REPLY ? "keep alive reply" : "invalid ip information"), str);
 					break;
 				/* client requests a fresh IP */
 				case TUNNEL_IP_REQUEST:
-					gw_client = get_ip_addr(&addr, &wip_hash, &vip_hash, &free_ip_list, next_free_ip);
+					tunnel_reply_init(reply, sizeof(reply), buff, buff_len);
+					gw_clients_wrlock();
+
+					/* the client asks again */
+					if ((gw_client = get_ip_addr(&addr)) == NULL) {
+						gw_clients_unlock();
+						addr_to_string(addr.sin_addr.s_addr, str, sizeof(str));
+						debug_output(0, "Error - no tunnel address left for client: %s \n", str);
+						continue;
+					}
+
+					/* every client tunnel uses a port of its own - a renewed lease follows the new one */
+					gw_client->client_port = addr.sin_port;
+					gw_client->caps = (buff_len > TUNNEL_CAPS_CLIENT ? buff[TUNNEL_CAPS_CLIENT] & tunnel_caps() : 0);
 
-					memcpy(buff + 1, (char *)&gw_client->vip_addr, 4);
+					/* a new lease starts with fresh compression contexts on both ends */
+					gw_client_comp_free(gw_client);
 
-					if (sendto(batman_if->udp_tunnel_sock, buff, 100, 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
+					if (gw_client->caps & TUNNEL_CAP_COMP) {
+						gw_client->comp_tx = hdr_comp_new();
+						gw_client->comp_rx = hdr_comp_new();
+					}
+
+					memcpy(reply + 1, (char *)&gw_client->vip_addr, 4);
+					reply[TUNNEL_CAPS_GW] = tunnel_caps();
+					gw_clients_unlock();
+
+					if (sendto(gw_worker->udp_sock, reply, sizeof(reply), 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
 						addr_to_string(addr.sin_addr.s_addr, str, sizeof (str));
 						debug_output(0, "Error - can't send requested ip to client (%s): %s \n", str, strerror(errno));
 						continue;
 					}
 
-					addr_to_string(gw_client->vip_addr, str, sizeof(str));
+					addr_to_string(*(uint32_t *)(reply + 1), str, sizeof(str));
 					addr_to_string(addr.sin_addr.s_addr, gw_addr, sizeof(gw_addr));
 					debug_output(3, "Gateway - assigned %s to client: %s \n", str, gw_addr);
 					break;
@@ -716,112 +2653,205 @@ void *gw_listen(void *BATMANUNUSED(arg)) {
 
 			}
 
-			if (errno != EWOULDBLOCK) {
-				debug_output(0, "Error - gateway can't receive packet: %s\n", strerror(errno));
+			recv_errno = errno;
+
+			if (gw_worker->queue_up != NULL)
+				gw_queue_write(gw_worker, &rx_batch, current_time);
+
+			if (recv_errno != EWOULDBLOCK) {
+				debug_output(0, "Error - gateway can't receive packet: %s\n", strerror(recv_errno));
 				break;
 			}
 
-		/* traffic coming from the internet that needs to be sent back to the client */
-		} else if (FD_ISSET(tun_fd, &tmp_wait_sockets)) {
-
-			while ((buff_len = read(tun_fd, buff + 1, sizeof(buff) - 2 )) > 0) {
+		}
 
-				gw_client = ((struct gw_client *)hash_find(vip_hash, buff + 13));
+		/* traffic coming from the internet that needs to be sent back to the client */
+		if ((events & TUNNEL_EV_TUN) && (gw_worker->queue_down != NULL)) {
 
-				if (gw_client != NULL) {
+			while (gw_queue_read(gw_worker, &tx_batch, current_time) >= 0);
 
-					client_addr.sin_addr.s_addr = gw_client->wip_addr;
-					client_addr.sin_port = gw_client->client_port;
+			if (errno != EWOULDBLOCK) {
+				debug_output(0, "Error - gateway can't read tun data: %s\n", strerror(errno));
+				break;
+			}
 
-					buff[0] = TUNNEL_DATA;
+		} else if (events & TUNNEL_EV_TUN) {
 
-					if (sendto(batman_if->udp_tunnel_sock, buff, buff_len + 1, 0, (struct sockaddr *)&client_addr, sizeof(struct sockaddr_in)) < 0)
-						debug_output(0, "Error - can't send data to client (%s): %s \n", str, strerror(errno));
+			while ((buff_len = tunnel_read(&tx_batch, gw_worker->udp_sock, gw_worker->tun_fd, &packet)) > 0) {
 
-				} else {
+				if (!gw_client_send(&tx_batch, gw_worker->udp_sock, packet, buff_len)) {
 
-					addr_to_string( *(uint32_t *)(buff + 17), gw_addr, sizeof(gw_addr));
+					addr_to_string( *(uint32_t *)(packet + 16), gw_addr, sizeof(gw_addr));
 					debug_output(3, "Gateway - could not resolve packet: %s \n", gw_addr);
 
 				}
 
 			}
 
-			if (errno != EWOULDBLOCK) {
-				debug_output(0, "Error - gateway can't read tun data: %s\n", strerror(errno));
+			recv_errno = errno;
+			tunnel_send_flush(&tx_batch, gw_worker->udp_sock);
+
+			if (recv_errno != EWOULDBLOCK) {
+				debug_output(0, "Error - gateway can't read tun data: %s\n", strerror(recv_errno));
 				break;
 			}
 
 		}
 
-after_incoming_packet:
+		/* the queued packets leave as long as the socket takes them - then we wait until it does again */
+		if ((gw_worker->queue_down != NULL) && ((!tunnel_poll.sock_out) || (events & TUNNEL_EV_SOCK_OUT)))
+			tunnel_poll_sock_out(&tunnel_poll, (gw_queue_send(gw_worker, &tx_batch, current_time) < 0));
 
-		/* close unresponsive client connections (free unused IPs) */
-		if ((int)(current_time - (client_timeout + 60000)) > 0) {
+		/* the first client after an idle period starts a new sweep interval */
+		if ((gw_worker->num == 0) && (num_clients == 0))
+			client_timeout = current_time;
 
+		if ((gw_worker->num == 0) && ((int)(current_time - (client_timeout + GW_CLIENT_SWEEP_INTERVAL)) > 0)) {
 			client_timeout = current_time;
+			gw_clients_purge(current_time);
+		}
 
-			hashit = NULL;
+	}
 
-			while (NULL != (hashit = hash_iterate(wip_hash, hashit))) {
+	tunnel_poll_close(&tunnel_poll, TUNNEL_POLL_GW + gw_worker->num);
 
-				gw_client = hashit->bucket->data;
+out:
+	tunnel_batch_free(&rx_batch);
+	tunnel_batch_free(&tx_batch);
 
-				if ((int)(current_time - (gw_client->last_keep_alive + IP_LEASE_TIMEOUT + GW_STATE_UNKNOWN_TIMEOUT)) > 0) {
+	return NULL;
+}
 
-					hash_remove_bucket(wip_hash, hashit);
-					hash_remove(vip_hash, gw_client);
+/* an additional udp socket on the gateway port - the kernel spreads the clients over all of them */
+static int32_t gw_worker_socket(struct batman_if *batman_if)
+{
+	struct sockaddr_in addr;
+	int32_t sock, sock_opts = 1;
 
-					free_ip = debugMalloc(sizeof(struct neigh_node), 210);
+	if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+		debug_output(0, "Error - can't create gateway worker socket: %s\n", strerror(errno));
+		return -1;
+	}
 
-					INIT_LIST_HEAD(&free_ip->list);
-					free_ip->addr = gw_client->vip_addr;
+#ifdef SO_REUSEPORT
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &sock_opts, sizeof(sock_opts)) < 0) {
+		debug_output(0, "Error - can't set SO_REUSEPORT on gateway worker socket: %s\n", strerror(errno));
+		close(sock);
+		return -1;
+	}
+#endif
 
-					list_add_tail( &free_ip->list, &free_ip_list );
+	memcpy(&addr, &batman_if->addr, sizeof(struct sockaddr_in));
+	addr.sin_port = htons(GW_PORT);
 
-					debugFree(gw_client, 1216);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
+		debug_output(0, "Error - can't bind gateway worker socket: %s\n", strerror(errno));
+		close(sock);
+		return -1;
+	}
 
-				}
+	sock_opts = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL, sock_opts | O_NONBLOCK);
 
-			}
+	return sock;
+}
 
-		}
+void *gw_listen(void *BATMANUNUSED(arg)) {
 
-	}
+	struct batman_if *batman_if = (struct batman_if *)if_list.next;
+	struct gw_worker gw_workers_list[GW_WORKERS_MAX];
+	char tun_dev[IFNAMSIZ];
+	int32_t tun_fd, tun_ifi, aggr_len, num_workers = 1, i;
+	uint8_t tun_flags = (gw_workers > 1 ? TUN_MULTI_QUEUE : 0) | (tunnel_offload ? TUN_OFFLOAD : 0) | (gw_queuing ? TUN_NO_TSO : 0);
+	uint8_t my_tun_ip[4] ALIGN_WORD;
 
-	/* delete tun device and routes on exit */
+
+	my_tun_ip[0] = 169;
+	my_tun_ip[1] = 254;
+	my_tun_ip[2] = 0;
 	my_tun_ip[3] = 0;
-	add_del_route( *(uint32_t *)my_tun_ip, 16, 0, 0, tun_ifi, tun_dev, 254, ROUTE_TYPE_UNICAST, ROUTE_DEL );
 
-	del_dev_tun( tun_fd );
+	if (add_dev_tun(batman_if, *(uint32_t *)my_tun_ip, tun_dev, sizeof(tun_dev), &tun_fd, &tun_ifi, tun_flags) < 0)
+		return NULL;
 
-	hashit = NULL;
+	/* the clients get the other addresses of the /16 - expired leases are looked for once per sweep interval */
+	gw_table_init(*(uint32_t *)my_tun_ip, IP_LEASE_TIMEOUT + GW_STATE_UNKNOWN_TIMEOUT, GW_CLIENT_SWEEP_INTERVAL, get_time_msec());
 
-	while (NULL != (hashit = hash_iterate(wip_hash, hashit))) {
+	add_del_route(*(uint32_t *)my_tun_ip, 16, 0, 0, tun_ifi, tun_dev, 254, ROUTE_TYPE_UNICAST, ROUTE_ADD);
+
+	aggr_len = tunnel_aggr_len(tun_dev);
+
+	for (i = 0; i < GW_WORKERS_MAX; i++) {
+		gw_workers_list[i].aggr_len = aggr_len;
+		gw_workers_list[i].queue_down = (gw_queuing && (i < gw_workers) ? fq_codel_new(GW_QUEUE_LIMIT, TUNNEL_QUEUE_PACKET_LEN) : NULL);
+		gw_workers_list[i].queue_up = (gw_queuing && (i < gw_workers) ? fq_codel_new(GW_QUEUE_LIMIT, TUNNEL_QUEUE_PACKET_LEN) : NULL);
+	}
 
-		gw_client = hashit->bucket->data;
+	gw_workers_list[0].num = 0;
+	gw_workers_list[0].udp_sock = batman_if->udp_tunnel_sock;
+	gw_workers_list[0].tun_fd = tun_fd;
+
+	/* every further worker gets its own tun queue and udp socket */
+	for (; num_workers < gw_workers; num_workers++) {
+
+		gw_workers_list[num_workers].num = num_workers;
+
+		if (add_dev_tun_queue(tun_dev, &gw_workers_list[num_workers].tun_fd, tun_flags) < 0)
+			break;
 
-		hash_remove_bucket(wip_hash, hashit);
-		hash_remove(vip_hash, gw_client);
+		if ((gw_workers_list[num_workers].udp_sock = gw_worker_socket(batman_if)) < 0) {
+			close(gw_workers_list[num_workers].tun_fd);
+			break;
+		}
 
-		debugFree(gw_client, 1217);
+		if (pthread_create(&gw_workers_list[num_workers].thread_id, NULL, &gw_worker, &gw_workers_list[num_workers]) != 0) {
+			debug_output(0, "Error - couldn't spawn gateway worker: %s\n", strerror(errno));
+			close(gw_workers_list[num_workers].udp_sock);
+			close(gw_workers_list[num_workers].tun_fd);
+			break;
+		}
 
 	}
 
-	hash_destroy(wip_hash);
-	hash_destroy(vip_hash);
+	if (num_workers < gw_workers)
+		debug_output(0, "Warning - running %i of %i gateway workers \n", num_workers, gw_workers);
+
+	gw_queues_lock();
+	gw_queues_workers = gw_workers_list;
+	gw_queues_num = (gw_queuing ? num_workers : 0);
+	gw_queues_unlock();
+
+	gw_worker(&gw_workers_list[0]);
+
+	for (i = 1; i < num_workers; i++) {
+		pthread_join(gw_workers_list[i].thread_id, NULL);
+		close(gw_workers_list[i].udp_sock);
+		close(gw_workers_list[i].tun_fd);
+	}
 
-	list_for_each_safe(list_pos, list_pos_tmp, &free_ip_list) {
+	gw_queues_lock();
+	gw_queues_workers = NULL;
+	gw_queues_num = 0;
+	gw_queues_unlock();
 
-		free_ip = list_entry(list_pos, struct free_ip, list);
+	for (i = 0; i < gw_workers; i++) {
 
-		list_del((struct list_head *)&free_ip_list, list_pos, &free_ip_list);
+		if (gw_workers_list[i].queue_down != NULL)
+			fq_codel_free(gw_workers_list[i].queue_down);
 
-		debugFree(free_ip, 1218);
+		if (gw_workers_list[i].queue_up != NULL)
+			fq_codel_free(gw_workers_list[i].queue_up);
 
 	}
 
+	/* delete tun device and routes on exit */
+	my_tun_ip[3] = 0;
+	add_del_route( *(uint32_t *)my_tun_ip, 16, 0, 0, tun_ifi, tun_dev, 254, ROUTE_TYPE_UNICAST, ROUTE_DEL );
+
+	del_dev_tun( tun_fd );
+
+	gw_table_free(gw_client_comp_free);
+
 	return NULL;
 
 }
-
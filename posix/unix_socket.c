@@ -38,6 +38,14 @@
 #include "../os.h"
 #include "../batman.h"
 #include "../hna.h"
+#include "../fib.h"
+#include "../hna_sync.h"
+#include "../lpm.h"
+#include "../peer_table.h"
+#include "../snapshot.h"
+#include "../events.h"
+#include "../view.h"
+#include "../route_pipe.h"
 
 
 void debug_output(int8_t debug_prio, char *format, ...) {
@@ -118,11 +126,21 @@ void debug_output(int8_t debug_prio, char *format, ...) {
 
 void internal_output(uint32_t sock)
 {
+	uint32_t fib_routes, fib_entries, lazy_misses;
+	uint32_t pipe_frames, pipe_records, pipe_coalesced, pipe_pending, pipe_buffered;
+	uint32_t sync_transfers, sync_full, sync_delta, sync_sent;
+	uint32_t lpm_prefixes, lpm_nodes;
+	uint32_t peers, peer_generation, peer_file_writes;
+	uint32_t snapshots_built, snapshots_served;
+	uint32_t events_seq, events_subscribers, events_overflows;
+	uint32_t view_generation, views_alive;
+
 	dprintf(sock, "source_version=%s\n", SOURCE_VERSION);
 	dprintf(sock, "compat_version=%i\n", COMPAT_VERSION);
 	dprintf(sock, "vis_compat_version=%i\n", VIS_COMPAT_VERSION);
 	dprintf(sock, "ogm_port=%i\n", PORT);
 	dprintf(sock, "gw_port=%i\n", GW_PORT);
+	dprintf(sock, "hna_sync_port=%i\n", HNA_SYNC_PORT);
 	dprintf(sock, "vis_port=%i\n", PORT + 2);
 	dprintf(sock, "unix_socket_path=%s\n", UNIX_PATH);
 	dprintf(sock, "own_ogm_jitter=%i\n", JITTER);
@@ -135,6 +153,67 @@ void internal_output(uint32_t sock)
 	dprintf(sock, "tq_hop_penalty=%i (default: %i)\n", hop_penalty, TQ_HOP_PENALTY);
 	dprintf(sock, "tq_total_limit=%i\n", TQ_TOTAL_BIDRECT_LIMIT);
 	dprintf(sock, "tq_max_value=%i\n", TQ_MAX_VALUE);
+	dprintf(sock, "route_tq_margin=%i (default: %i)\n", route_tq_margin, ROUTE_SWITCH_TQ_MARGIN);
+	dprintf(sock, "route_dwell_time=%u (default: %i)\n", route_dwell_time, ROUTE_SWITCH_DWELL_TIME);
+	dprintf(sock, "route_flap_penalty=%i (default: %i)\n", route_flap_penalty, ROUTE_FLAP_PENALTY);
+	dprintf(sock, "route_flap_suppress_limit=%i\n", ROUTE_FLAP_SUPPRESS_LIMIT);
+	dprintf(sock, "route_flap_reuse_limit=%i\n", ROUTE_FLAP_REUSE_LIMIT);
+	dprintf(sock, "route_flap_half_life=%i\n", ROUTE_FLAP_HALF_LIFE);
+	dprintf(sock, "route_updates_suppressed=%u\n", route_updates_suppressed);
+	dprintf(sock, "fib_compression=%i (default: 0)\n", fib_compression);
+	fib_get_stats(BATMAN_RT_TABLE_HOSTS, &fib_routes, &fib_entries);
+	dprintf(sock, "fib_hosts_routes=%u\n", fib_routes);
+	dprintf(sock, "fib_hosts_entries=%u\n", fib_entries);
+	fib_get_stats(BATMAN_RT_TABLE_NETWORKS, &fib_routes, &fib_entries);
+	dprintf(sock, "fib_networks_routes=%u\n", fib_routes);
+	dprintf(sock, "fib_networks_entries=%u\n", fib_entries);
+	dprintf(sock, "lazy_route_timeout=%u (default: 0)\n", lazy_route_timeout);
+	fib_get_lazy_stats(&fib_routes, &fib_entries, &lazy_misses);
+	dprintf(sock, "lazy_routes=%u\n", fib_routes);
+	dprintf(sock, "lazy_routes_active=%u\n", fib_entries);
+	dprintf(sock, "lazy_route_misses=%u\n", lazy_misses);
+	dprintf(sock, "policy_routing_binary=%i (default: 0)\n", policy_routing_binary);
+	route_pipe_get_stats(&pipe_frames, &pipe_records, &pipe_coalesced, &pipe_pending, &pipe_buffered);
+	dprintf(sock, "policy_routing_frames=%u\n", pipe_frames);
+	dprintf(sock, "policy_routing_records=%u\n", pipe_records);
+	dprintf(sock, "policy_routing_coalesced=%u\n", pipe_coalesced);
+	dprintf(sock, "policy_routing_pending=%u\n", pipe_pending);
+	dprintf(sock, "policy_routing_buffered=%u\n", pipe_buffered);
+	dprintf(sock, "hna_sync=%i (default: 0)\n", hna_sync);
+	dprintf(sock, "hna_local=%i\n", num_hna_local);
+	dprintf(sock, "hna_local_announced=%i\n", (hna_sync ? num_hna_local : (num_hna_local > MAX_HNA_OGM ? (int)MAX_HNA_OGM : num_hna_local)));
+	hna_sync_get_stats(&sync_transfers, &sync_full, &sync_delta, &sync_sent);
+	dprintf(sock, "hna_sync_transfers=%u\n", sync_transfers);
+	dprintf(sock, "hna_sync_full_received=%u\n", sync_full);
+	dprintf(sock, "hna_sync_delta_received=%u\n", sync_delta);
+	dprintf(sock, "hna_sync_packets_sent=%u\n", sync_sent);
+	lpm_get_stats(&lpm_prefixes, &lpm_nodes);
+	dprintf(sock, "lookup_prefixes=%u\n", lpm_prefixes);
+	dprintf(sock, "lookup_nodes=%u\n", lpm_nodes);
+	dprintf(sock, "peer_table_path=%s\n", PEER_TABLE_PATH);
+	dprintf(sock, "peer_file_interval=%u (default: %i)\n", peer_file_interval, PEER_FILE_INTERVAL);
+	dprintf(sock, "gw_workers=%i (default: 1)\n", gw_workers);
+	dprintf(sock, "tunnel_offload=%i (default: 0)\n", tunnel_offload);
+	dprintf(sock, "tunnel_aggregation=%i (default: 1)\n", tunnel_aggregation);
+	dprintf(sock, "tunnel_compression=%i (default: 0)\n", tunnel_compression);
+	dprintf(sock, "gw_queuing=%i (default: 1)\n", gw_queuing);
+	dprintf(sock, "gw_standby=%i (default: 1)\n", gw_standby);
+	dprintf(sock, "gw_probing=%i (default: 0)\n", gw_probing);
+	gw_queue_output(sock);
+	peer_table_get_stats(&peers, &peer_generation, &peer_file_writes);
+	dprintf(sock, "peer_table_peers=%u\n", peers);
+	dprintf(sock, "peer_table_generation=%u\n", peer_generation);
+	dprintf(sock, "peer_file_writes=%u\n", peer_file_writes);
+	snapshot_get_stats(&snapshots_built, &snapshots_served);
+	dprintf(sock, "snapshots_built=%u\n", snapshots_built);
+	dprintf(sock, "snapshots_served=%u\n", snapshots_served);
+	event_get_stats(&events_seq, &events_subscribers, &events_overflows);
+	dprintf(sock, "events_seq=%u\n", events_seq);
+	dprintf(sock, "events_subscribers=%u\n", events_subscribers);
+	dprintf(sock, "events_overflows=%u\n", events_overflows);
+	view_get_stats(&view_generation, &views_alive);
+	dprintf(sock, "view_generation=%u\n", view_generation);
+	dprintf(sock, "views_alive=%u\n", views_alive);
 	dprintf(sock, "rt_table_networks=%i\n", BATMAN_RT_TABLE_NETWORKS);
 	dprintf(sock, "rt_table_hosts=%i\n", BATMAN_RT_TABLE_HOSTS);
 	dprintf(sock, "rt_table_unreach=%i\n", BATMAN_RT_TABLE_UNREACH);
@@ -144,21 +223,179 @@ void internal_output(uint32_t sock)
 	dprintf(sock, "rt_prio_tunnel=%i\n", BATMAN_RT_PRIO_TUNNEL);
 }
 
+/* tells which originator and next hop the given destination would use */
+static void lookup_output(uint32_t sock, uint32_t addr)
+{
+	struct lpm_result lpm_result;
+	char dest_str[ADDR_STR_LEN], prefix_str[ADDR_STR_LEN], orig_str[ADDR_STR_LEN], router_str[ADDR_STR_LEN];
+
+	addr_to_string(addr, dest_str, sizeof(dest_str));
+	dprintf(sock, "destination=%s\n", dest_str);
+
+	if (!lpm_lookup(addr, &lpm_result)) {
+		dprintf(sock, "route=none\n");
+		return;
+	}
+
+	addr_to_string(lpm_result.prefix, prefix_str, sizeof(prefix_str));
+	addr_to_string(lpm_result.orig, orig_str, sizeof(orig_str));
+	addr_to_string(lpm_result.router, router_str, sizeof(router_str));
+
+	dprintf(sock, "route=%s\n", (lpm_result.is_host ? "originator" : "announced network"));
+	dprintf(sock, "prefix=%s/%i\n", prefix_str, lpm_result.netmask);
+	dprintf(sock, "originator=%s\n", orig_str);
+	dprintf(sock, "next_hop=%s\n", router_str);
+	dprintf(sock, "tq=%i\n", lpm_result.tq);
+	dprintf(sock, "interface=%s\n", lpm_result.dev);
+}
+
+
+
+/* the client socket is non blocking - wait until the whole buffer was sent */
+static int8_t unix_write(int32_t sock, char *buff, uint32_t len)
+{
+	struct timeval tv;
+	fd_set wait_set;
+	ssize_t written;
+
+	while (len > 0) {
+
+		if ((written = write(sock, buff, len)) >= 0) {
+			buff += written;
+			len -= written;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+			return -1;
+
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		FD_ZERO(&wait_set);
+		FD_SET(sock, &wait_set);
+
+		if (select(sock + 1, NULL, &wait_set, NULL, &tv) < 1)
+			return -1;
+
+	}
+
+	return 0;
+}
+
+/* sends the routing state snapshot built by the main thread (and the EOD) */
+static void snapshot_output(int32_t sock)
+{
+	struct snapshot *snapshot;
+
+	if ((snapshot = snapshot_get()) == NULL) {
+		debug_output(3, "Unix socket: routing state snapshot not available\n");
+	} else {
+		if (unix_write(sock, snapshot->buff, snapshot->len) < 0)
+			debug_output(3, "Unix socket: can't send routing state snapshot: %s\n", strerror(errno));
+
+		snapshot_put(snapshot);
+	}
+
+	unix_write(sock, "EOD\n", 4);
+}
+
+
+
+static void unix_bulk_free(struct unix_client *unix_client)
+{
+	if (unix_client->bulk_buff != NULL)
+		debugFree(unix_client->bulk_buff, 1211);
+
+	unix_client->bulk_buff = NULL;
+	unix_client->bulk_len = unix_client->bulk_size = 0;
+}
+
+/**
+ * unix_bulk_receive() collects a bulk HNA request ("b:" followed by one
+ * "a:ip/netmask" or "A:ip/netmask" line per network and an empty line)
+ * which may span many reads. data is the start of the request (from the
+ * first read) or NULL to read the next chunk from the client socket.
+ * Returns the read() result - the client is closed if it is < 1.
+ */
+static int32_t unix_bulk_receive(struct unix_client *unix_client, char *data, int32_t data_len)
+{
+	char *search_start;
+	int32_t status = data_len;
+	int res;
+
+	if (data != NULL) {
+		unix_client->bulk_size = data_len + UNIX_BULK_CHUNK;
+		unix_client->bulk_buff = debugMalloc(unix_client->bulk_size, 211);
+		unix_client->bulk_len = data_len;
+		memcpy(unix_client->bulk_buff, data, data_len);
+	} else {
+		if (unix_client->bulk_size - unix_client->bulk_len < UNIX_BULK_CHUNK) {
+			unix_client->bulk_size += UNIX_BULK_CHUNK;
+			unix_client->bulk_buff = debugRealloc(unix_client->bulk_buff, unix_client->bulk_size, 212);
+		}
+
+		status = read(unix_client->sock, unix_client->bulk_buff + unix_client->bulk_len,
+			      unix_client->bulk_size - unix_client->bulk_len - 1);
+
+		if (status < 1)
+			return status;
+
+		unix_client->bulk_len += status;
+	}
+
+	unix_client->bulk_buff[unix_client->bulk_len] = '\0';
 
+	/* the terminating empty line may be split across two reads */
+	search_start = unix_client->bulk_buff + unix_client->bulk_len - status;
+
+	if (search_start > unix_client->bulk_buff)
+		search_start--;
+
+	if (strstr(search_start, "\n\n") == NULL) {
+
+		if (unix_client->bulk_len < UNIX_BULK_MAX_LEN)
+			return status;
+
+		dprintf(unix_client->sock, "Error - bulk request exceeds %i bytes\nEOD\n", UNIX_BULK_MAX_LEN);
+
+	} else {
+
+		res = hna_local_task_add_bulk(unix_client->bulk_buff);
+
+		if (res < 0) {
+			dprintf(unix_client->sock, "Error - bulk request rejected (invalid network)\nEOD\n");
+		} else {
+			/* the OGM only carries the first networks - the others are not announced */
+			if ((!hna_sync) && (num_hna_local + res > (int)MAX_HNA_OGM))
+				dprintf(unix_client->sock, "Warning - only %i announced networks fit into the OGM (see --hna-sync)\n", (int)MAX_HNA_OGM);
+
+			dprintf(unix_client->sock, "EOD\n");
+		}
+
+	}
+
+	unix_bulk_free(unix_client);
+
+	return status;
+}
 
 void *unix_listen(void * BATMANUNUSED(arg)) {
 
 	struct unix_client *unix_client;
 	struct debug_level_info *debug_level_info;
 	struct list_head *list_pos, *unix_pos_tmp, *debug_pos, *debug_pos_tmp, *prev_list_head, *prev_list_head_unix;
-	struct hna_local_entry *hna_local_entry;
+	struct route_view *view;
 	struct batman_if *batman_if;
 	struct timeval tv;
 	struct sockaddr_un sun_addr;
 	struct in_addr tmp_ip_holder;
 	int32_t status, max_sock, unix_opts, download_speed, upload_speed;
+	uint32_t i;
 	int8_t res;
-	char buff[100], str[16], was_gateway, tmp_unix_value;
+	char buff[100], str[16], was_gateway, was_bulk, tmp_unix_value;
 	fd_set wait_sockets, tmp_wait_sockets;
 	socklen_t sun_size = sizeof(struct sockaddr_un);
 
@@ -218,7 +455,13 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 					if ( FD_ISSET( unix_client->sock, &tmp_wait_sockets ) ) {
 
-						status = read( unix_client->sock, buff, sizeof( buff ) );
+						/* the bulk request may be finished (and freed) by this read - buff holds nothing new then */
+						was_bulk = (unix_client->bulk_buff != NULL);
+
+						if (was_bulk)
+							status = unix_bulk_receive(unix_client, NULL, 0);
+						else
+							status = read( unix_client->sock, buff, sizeof( buff ) );
 
 						if ( status > 0 ) {
 
@@ -227,7 +470,16 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 							/* debug_output( 3, "gateway: client sent data via unix socket: %s\n", buff ); */
 
-							if (buff[0] == 'a') {
+							if (was_bulk) {
+
+								/* bulk request still incomplete or just handled */
+
+							} else if (buff[0] == 'b') {
+
+								if (status > 2)
+									unix_bulk_receive(unix_client, buff + 2, status - 2);
+
+							} else if (buff[0] == 'a') {
 
 								if (status > 2) {
 									hna_local_task_add_str(buff + 2, ROUTE_ADD, 1);
@@ -305,6 +557,24 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 								internal_output(unix_client->sock);
 								dprintf( unix_client->sock, "EOD\n" );
 
+							} else if (buff[0] == 'l') {
+
+								if ((status > 2) && (inet_pton(AF_INET, buff + 2, &tmp_ip_holder) > 0))
+									lookup_output(unix_client->sock, tmp_ip_holder.s_addr);
+								else
+									debug_output(3, "Unix socket: rejected destination lookup - invalid IP specified\n");
+
+								dprintf(unix_client->sock, "EOD\n");
+
+							} else if (buff[0] == 'j') {
+
+								snapshot_output(unix_client->sock);
+
+							} else if (buff[0] == 'e') {
+
+								/* the main thread sends the events until the client disconnects */
+								event_subscribe(unix_client->sock);
+
 							} else if ( buff[0] == 'g' ) {
 
 								if ( status > 2 ) {
@@ -318,8 +588,8 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 										if ( ( gateway_class > 0 ) && ( routing_class > 0 ) ) {
 
-											if ((routing_class != 0) && (curr_gateway != NULL))
-												del_default_route();
+											/* the standby is kept across gateway switches - not across routing class changes */
+											view_gw_drop(VIEW_GW_DROP | VIEW_GW_DROP_STANDBY);
 
 											add_del_interface_rules(RULE_DEL);
 											routing_class = 0;
@@ -364,8 +634,8 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 										if ( ( tmp_unix_value >= 0 ) && ( tmp_unix_value <= 3 ) && (tmp_unix_value != routing_class) ) {
 
-											if ((routing_class != 0) && (curr_gateway != NULL))
-												del_default_route();
+											/* the standby is kept across gateway switches - not across routing class changes */
+											view_gw_drop(VIEW_GW_DROP | VIEW_GW_DROP_STANDBY);
 
 											if ( ( tmp_unix_value > 0 ) && ( gateway_class > 0 ) ) {
 
@@ -398,8 +668,7 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 										pref_gateway = tmp_ip_holder.s_addr;
 
-										if ( curr_gateway != NULL )
-											del_default_route();
+										view_gw_drop(VIEW_GW_DROP);
 
 									} else {
 
@@ -411,6 +680,11 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 								dprintf( unix_client->sock, "EOD\n" );
 
+							} else if ((buff[0] == 'y') && (buff[1] == ':') && (buff[2] == 'b')) {
+
+								/* the client asks whether bulk requests are understood - older versions answer with the command line */
+								dprintf(unix_client->sock, "BULK\nEOD\n");
+
 							} else if (buff[0] == 'y') {
 
 								dprintf(unix_client->sock, "%s", prog_name);
@@ -434,12 +708,16 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 								}
 
-								list_for_each(debug_pos, &hna_list) {
+								/* hna_list is changed by the main thread at any time */
+								if ((view = view_get()) != NULL) {
 
-									hna_local_entry = list_entry(debug_pos, struct hna_local_entry, list);
+									for (i = 0; i < view->num_hna_local; i++) {
+										addr_to_string(view->hna_local[i].addr, str, sizeof(str));
+										dprintf(unix_client->sock, " -a %s/%i", str, view->hna_local[i].netmask);
+									}
+
+									view_put(view);
 
-									addr_to_string(hna_local_entry->addr, str, sizeof (str));
-									dprintf(unix_client->sock, " -a %s/%i", str, hna_local_entry->netmask);
 								}
 
 								if (debug_level != 0)
@@ -456,6 +734,9 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 								if (policy_routing_script != NULL)
 									dprintf(unix_client->sock, " --policy-routing-script %s", policy_routing_script);
 
+								if (policy_routing_binary)
+									dprintf(unix_client->sock, " --policy-routing-binary");
+
 								if (hop_penalty != TQ_HOP_PENALTY)
 									dprintf(unix_client->sock, " --hop-penalty %i", hop_penalty);
 
@@ -465,6 +746,48 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 								if (purge_timeout != PURGE_TIMEOUT)
 									dprintf(unix_client->sock, " --purge-timeout %u", purge_timeout);
 
+								if (route_tq_margin != ROUTE_SWITCH_TQ_MARGIN)
+									dprintf(unix_client->sock, " --route-tq-margin %i", route_tq_margin);
+
+								if (route_dwell_time != ROUTE_SWITCH_DWELL_TIME)
+									dprintf(unix_client->sock, " --route-dwell-time %u", route_dwell_time);
+
+								if (route_flap_penalty != ROUTE_FLAP_PENALTY)
+									dprintf(unix_client->sock, " --route-flap-penalty %i", route_flap_penalty);
+
+								if (fib_compression)
+									dprintf(unix_client->sock, " --fib-compression");
+
+								if (lazy_route_timeout > 0)
+									dprintf(unix_client->sock, " --lazy-routes %u", lazy_route_timeout);
+
+								if (hna_sync)
+									dprintf(unix_client->sock, " --hna-sync");
+
+								if (peer_file_interval != PEER_FILE_INTERVAL)
+									dprintf(unix_client->sock, " --peer-file-interval %u", peer_file_interval);
+
+								if (gw_workers > 1)
+									dprintf(unix_client->sock, " --gw-workers %i", gw_workers);
+
+								if (tunnel_offload)
+									dprintf(unix_client->sock, " --tunnel-offload");
+
+								if (!tunnel_aggregation)
+									dprintf(unix_client->sock, " --disable-tunnel-aggregation");
+
+								if (tunnel_compression)
+									dprintf(unix_client->sock, " --tunnel-compression");
+
+								if (!gw_queuing)
+									dprintf(unix_client->sock, " --disable-gw-queuing");
+
+								if (!gw_standby)
+									dprintf(unix_client->sock, " --disable-gw-standby");
+
+								if (gw_probing)
+									dprintf(unix_client->sock, " --gw-probe");
+
 								list_for_each(debug_pos, &if_list) {
 
 									batman_if = list_entry(debug_pos, struct batman_if, list);
@@ -517,9 +840,13 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 							debug_output( 3, "Unix client closed connection ...\n" );
 
+							event_unsubscribe(unix_client->sock);
+
 							FD_CLR(unix_client->sock, &wait_sockets);
 							close( unix_client->sock );
 
+							unix_bulk_free(unix_client);
+
 							list_del( prev_list_head_unix, list_pos, &unix_if.client_list );
 							debugFree( list_pos, 1203 );
 
@@ -580,6 +907,10 @@ void *unix_listen(void * BATMANUNUSED(arg)) {
 
 		}
 
+		event_unsubscribe(unix_client->sock);
+
+		unix_bulk_free(unix_client);
+
 		list_del( (struct list_head *)&unix_if.client_list, list_pos, &unix_if.client_list );
 		debugFree( list_pos, 1205 );
 
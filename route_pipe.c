@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * writer of the binary policy routing script protocol (see route_pipe.h)
+ *
+ * Route and rule changes are collected until the main loop flushes them as
+ * one transaction. Pending changes are coalesced per routing entry: adding
+ * and deleting the same entry cancels out (the entry stays as tombstone to
+ * keep its position) and repeated adds only keep the latest one. While the
+ * pipe is full the already framed bytes are kept and new changes keep on
+ * being coalesced - nothing gets dropped.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "route_pipe.h"
+
+
+struct route_pipe_entry {
+	struct list_head list;
+	struct route_pipe_record record;
+	uint8_t tombstone;
+};
+
+static pthread_mutex_t route_pipe_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct hashtable_t *route_pipe_hash = NULL;
+static struct list_head_first route_pipe_list = {(struct list_head *)&route_pipe_list, (struct list_head *)&route_pipe_list};
+
+/* framed bytes the pipe did not take yet */
+static unsigned char *route_pipe_buff = NULL;
+static uint32_t route_pipe_buff_len = 0, route_pipe_buff_size = 0, route_pipe_buff_sent = 0;
+
+static uint32_t route_pipe_seqno = 0, route_pipe_txn = 0;
+static uint32_t route_pipe_frames = 0, route_pipe_records = 0, route_pipe_coalesced = 0, route_pipe_pending = 0;
+
+
+
+/* compares the routing entry a record refers to - action, source address and device don't matter */
+static int route_pipe_compare(void *data1, void *data2)
+{
+	struct route_pipe_record *record1 = &((struct route_pipe_entry *)data1)->record;
+	struct route_pipe_record *record2 = &((struct route_pipe_entry *)data2)->record;
+
+	return ((record1->object == record2->object) && (record1->type == record2->type) &&
+		(record1->netmask == record2->netmask) && (record1->table == record2->table) &&
+		(record1->dest == record2->dest) && (record1->router == record2->router) &&
+		(record1->ifi == record2->ifi) && (record1->prio == record2->prio) ? 1 : 0);
+}
+
+static int route_pipe_choose(void *data, int32_t size)
+{
+	struct route_pipe_record *record = &((struct route_pipe_entry *)data)->record;
+	unsigned char key[9];
+	uint32_t hash = 0;
+	size_t i;
+
+	memcpy(key, &record->dest, 4);
+	memcpy(key + 4, &record->router, 4);
+	key[8] = record->netmask;
+
+	for (i = 0; i < sizeof(key); i++) {
+		hash += key[i];
+		hash += (hash << 10);
+		hash ^= (hash >> 6);
+	}
+
+	hash += (hash << 3);
+	hash ^= (hash >> 11);
+	hash += (hash << 15);
+
+	return (hash % size);
+}
+
+static void route_pipe_add(struct route_pipe_record *record)
+{
+	struct route_pipe_entry *entry, key;
+	struct hashtable_t *swaphash;
+
+	pthread_mutex_lock(&route_pipe_mutex);
+
+	if (route_pipe_hash == NULL) {
+		if (NULL == (route_pipe_hash = hash_new(128, route_pipe_compare, route_pipe_choose))) {
+			pthread_mutex_unlock(&route_pipe_mutex);
+			restore_and_exit(0);
+		}
+	}
+
+	memcpy(&key.record, record, sizeof(struct route_pipe_record));
+	entry = hash_find(route_pipe_hash, &key);
+
+	if (entry == NULL) {
+
+		entry = debugMalloc(sizeof(struct route_pipe_entry), 901);
+		memset(entry, 0, sizeof(struct route_pipe_entry));
+		INIT_LIST_HEAD(&entry->list);
+		memcpy(&entry->record, record, sizeof(struct route_pipe_record));
+
+		list_add_tail(&entry->list, &route_pipe_list);
+		hash_add(route_pipe_hash, entry);
+		route_pipe_pending++;
+
+		if (route_pipe_hash->elements * 4 > route_pipe_hash->size) {
+
+			swaphash = hash_resize(route_pipe_hash, route_pipe_hash->size * 2);
+
+			if (swaphash == NULL) {
+				debug_output(0, "Couldn't resize policy routing pipe hash table \n");
+				pthread_mutex_unlock(&route_pipe_mutex);
+				restore_and_exit(0);
+			}
+
+			route_pipe_hash = swaphash;
+		}
+
+	/* adding and deleting the same entry within one transaction cancels out */
+	} else if ((!entry->tombstone) && (entry->record.action != record->action)) {
+
+		entry->tombstone = 1;
+		route_pipe_pending--;
+		route_pipe_coalesced += 2;
+
+	} else {
+
+		if (entry->tombstone)
+			route_pipe_pending++;
+		else
+			route_pipe_coalesced++;
+
+		memcpy(&entry->record, record, sizeof(struct route_pipe_record));
+		entry->tombstone = 0;
+
+	}
+
+	pthread_mutex_unlock(&route_pipe_mutex);
+}
+
+void route_pipe_route(uint32_t dest, uint8_t netmask, uint32_t router, uint32_t src_ip, int32_t ifi, char *dev, uint8_t rt_table, int8_t route_type, int8_t route_action)
+{
+	struct route_pipe_record record;
+
+	memset(&record, 0, sizeof(struct route_pipe_record));
+
+	record.object = ROUTE_PIPE_OBJ_ROUTE;
+	record.action = (route_action == ROUTE_DEL ? ROUTE_PIPE_DEL : ROUTE_PIPE_ADD);
+	record.type = route_type;
+	record.netmask = netmask;
+	record.dest = dest;
+	record.router = router;
+	record.src_ip = src_ip;
+	record.ifi = htonl(ifi);
+	record.table = rt_table;
+
+	if (dev != NULL)
+		strncpy(record.dev, dev, ROUTE_PIPE_DEV_LEN - 1);
+
+	route_pipe_add(&record);
+}
+
+void route_pipe_rule(uint32_t network, uint8_t netmask, int8_t rt_table, uint32_t prio, char *iif, int8_t rule_type, int8_t rule_action)
+{
+	struct route_pipe_record record;
+
+	memset(&record, 0, sizeof(struct route_pipe_record));
+
+	record.object = ROUTE_PIPE_OBJ_RULE;
+	record.action = (rule_action == RULE_DEL ? ROUTE_PIPE_DEL : ROUTE_PIPE_ADD);
+	record.type = rule_type;
+	record.netmask = netmask;
+	record.dest = network;
+	record.prio = htonl(prio);
+	record.table = rt_table;
+
+	if (iif != NULL)
+		strncpy(record.dev, iif, ROUTE_PIPE_DEV_LEN - 1);
+
+	route_pipe_add(&record);
+}
+
+static void route_pipe_buff_reserve(uint32_t len)
+{
+	if (route_pipe_buff_len + len <= route_pipe_buff_size)
+		return;
+
+	while (route_pipe_buff_len + len > route_pipe_buff_size)
+		route_pipe_buff_size = (route_pipe_buff_size == 0 ? 4096 : route_pipe_buff_size * 2);
+
+	route_pipe_buff = debugRealloc(route_pipe_buff, route_pipe_buff_size, 902);
+}
+
+/* turns the pending changes into the frames of one transaction */
+static void route_pipe_frame_pending(void)
+{
+	struct list_head *list_pos, *list_pos_tmp;
+	struct route_pipe_entry *entry;
+	struct route_pipe_frame *frame = NULL;
+	uint32_t frame_pos = 0, records_left = route_pipe_pending;
+
+	if (route_pipe_pending > 0)
+		route_pipe_txn++;
+
+	list_for_each_safe(list_pos, list_pos_tmp, &route_pipe_list) {
+
+		entry = list_entry(list_pos, struct route_pipe_entry, list);
+
+		if (!entry->tombstone) {
+
+			if ((frame == NULL) || (ntohs(frame->num_records) == ROUTE_PIPE_MAX_RECORDS)) {
+
+				if (frame != NULL)
+					frame->flags = ROUTE_PIPE_FLAG_MORE;
+
+				route_pipe_buff_reserve(sizeof(struct route_pipe_frame) +
+					(records_left > ROUTE_PIPE_MAX_RECORDS ? ROUTE_PIPE_MAX_RECORDS : records_left) * sizeof(struct route_pipe_record));
+
+				frame_pos = route_pipe_buff_len;
+				frame = (struct route_pipe_frame *)(route_pipe_buff + frame_pos);
+				memset(frame, 0, sizeof(struct route_pipe_frame));
+
+				frame->magic = htons(ROUTE_PIPE_MAGIC);
+				frame->version = ROUTE_PIPE_VERSION;
+				frame->seqno = htonl(++route_pipe_seqno);
+				frame->txn = htonl(route_pipe_txn);
+
+				route_pipe_buff_len += sizeof(struct route_pipe_frame);
+				route_pipe_frames++;
+
+			}
+
+			memcpy(route_pipe_buff + route_pipe_buff_len, &entry->record, sizeof(struct route_pipe_record));
+			route_pipe_buff_len += sizeof(struct route_pipe_record);
+
+			frame->num_records = htons(ntohs(frame->num_records) + 1);
+			route_pipe_records++;
+			records_left--;
+
+			/* the buffer might have been moved */
+			frame = (struct route_pipe_frame *)(route_pipe_buff + frame_pos);
+
+		}
+
+		hash_remove(route_pipe_hash, entry);
+		debugFree(entry, 1901);
+
+	}
+
+	INIT_LIST_HEAD_FIRST(route_pipe_list);
+	route_pipe_pending = 0;
+}
+
+/* writes as much as the pipe takes - returns 1 if everything has been written */
+static int route_pipe_write(void)
+{
+	ssize_t len;
+
+	while (route_pipe_buff_sent < route_pipe_buff_len) {
+
+		len = write(policy_routing_pipe, route_pipe_buff + route_pipe_buff_sent, route_pipe_buff_len - route_pipe_buff_sent);
+
+		if (len < 0) {
+
+			if (errno == EINTR)
+				continue;
+
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				debug_output(0, "Error - can't write to policy routing script: %s\n", strerror(errno));
+				route_pipe_buff_sent = route_pipe_buff_len;
+			}
+
+			break;
+		}
+
+		route_pipe_buff_sent += len;
+
+	}
+
+	if (route_pipe_buff_sent < route_pipe_buff_len)
+		return 0;
+
+	route_pipe_buff_len = route_pipe_buff_sent = 0;
+	return 1;
+}
+
+void route_pipe_flush(void)
+{
+	if ((policy_routing_script == NULL) || (!policy_routing_binary))
+		return;
+
+	pthread_mutex_lock(&route_pipe_mutex);
+
+	/* new changes wait until the script has read the previous transaction */
+	if ((route_pipe_write()) && (route_pipe_pending > 0)) {
+		route_pipe_frame_pending();
+		route_pipe_write();
+	}
+
+	pthread_mutex_unlock(&route_pipe_mutex);
+}
+
+/* hands everything to the script - blocks until the pipe took it */
+void route_pipe_close(void)
+{
+	int pipe_opts;
+
+	if ((policy_routing_script == NULL) || (!policy_routing_binary))
+		return;
+
+	pipe_opts = fcntl(policy_routing_pipe, F_GETFL, 0);
+	fcntl(policy_routing_pipe, F_SETFL, pipe_opts & ~O_NONBLOCK);
+
+	route_pipe_flush();
+
+	pthread_mutex_lock(&route_pipe_mutex);
+
+	if (route_pipe_hash != NULL)
+		hash_destroy(route_pipe_hash);
+
+	route_pipe_hash = NULL;
+
+	if (route_pipe_buff != NULL)
+		debugFree(route_pipe_buff, 1902);
+
+	route_pipe_buff = NULL;
+	route_pipe_buff_len = route_pipe_buff_size = route_pipe_buff_sent = 0;
+
+	pthread_mutex_unlock(&route_pipe_mutex);
+}
+
+void route_pipe_get_stats(uint32_t *frames, uint32_t *records, uint32_t *coalesced, uint32_t *pending, uint32_t *buffered)
+{
+	pthread_mutex_lock(&route_pipe_mutex);
+
+	*frames = route_pipe_frames;
+	*records = route_pipe_records;
+	*coalesced = route_pipe_coalesced;
+	*pending = route_pipe_pending;
+	*buffered = route_pipe_buff_len - route_pipe_buff_sent;
+
+	pthread_mutex_unlock(&route_pipe_mutex);
+}
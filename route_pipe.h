@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_ROUTE_PIPE_H
+#define _BATMAN_ROUTE_PIPE_H
+
+#include <stdint.h>
+
+
+/***
+ *
+ * binary protocol of the policy routing script pipe (--policy-routing-binary)
+ *
+ * The pipe carries a stream of frames. Each frame is a route_pipe_frame header
+ * followed by num_records route_pipe_record entries. All records of one
+ * transaction have to be applied together - a transaction spans several frames
+ * if ROUTE_PIPE_FLAG_MORE is set, the last frame of a transaction has it cleared.
+ * The frame seqno increases by one per frame, a gap means the stream is broken.
+ * All multi byte fields are in network byte order.
+ *
+ * Route and rule types use the ROUTE_TYPE_* / RULE_TYPE_* values of batman.h.
+ *
+ ***/
+
+#define ROUTE_PIPE_MAGIC 0x4252
+#define ROUTE_PIPE_VERSION 1
+#define ROUTE_PIPE_MAX_RECORDS 64
+
+#define ROUTE_PIPE_FLAG_MORE 0x01
+
+#define ROUTE_PIPE_OBJ_ROUTE 1
+#define ROUTE_PIPE_OBJ_RULE 2
+
+#define ROUTE_PIPE_ADD 1
+#define ROUTE_PIPE_DEL 2
+
+#define ROUTE_PIPE_DEV_LEN 16
+
+struct route_pipe_frame {
+	uint16_t magic;
+	uint8_t version;
+	uint8_t flags;
+	uint32_t seqno;
+	uint32_t txn;
+	uint16_t num_records;
+	uint16_t reserved;
+} __attribute__((packed));
+
+struct route_pipe_record {
+	uint8_t object;
+	uint8_t action;
+	uint8_t type;
+	uint8_t netmask;
+	uint32_t dest;                 /* destination of routes, network of rules */
+	uint32_t router;               /* routes only */
+	uint32_t src_ip;               /* routes only */
+	uint32_t prio;                 /* rules only */
+	int32_t ifi;                   /* routes only */
+	uint8_t table;
+	uint8_t reserved[3];
+	char dev[ROUTE_PIPE_DEV_LEN];  /* outgoing device of routes, incoming device of rules */
+} __attribute__((packed));
+
+
+void route_pipe_route(uint32_t dest, uint8_t netmask, uint32_t router, uint32_t src_ip, int32_t ifi, char *dev, uint8_t rt_table, int8_t route_type, int8_t route_action);
+void route_pipe_rule(uint32_t network, uint8_t netmask, int8_t rt_table, uint32_t prio, char *iif, int8_t rule_type, int8_t rule_action);
+void route_pipe_flush(void);
+void route_pipe_close(void);
+void route_pipe_get_stats(uint32_t *frames, uint32_t *records, uint32_t *coalesced, uint32_t *pending, uint32_t *buffered);
+
+#endif
@@ -27,6 +27,7 @@
 #include "batman.h"
 #include "schedule.h"
 #include "hna.h"
+#include "hna_sync.h"
 
 
 
@@ -36,6 +37,7 @@ void schedule_own_packet(struct batman_if *batman_if)
 	struct list_head *list_pos, *prev_list_head;
 	struct hash_it_t *hashit = NULL;
 	struct orig_node *orig_node;
+	uint16_t num_hna;
 
 
 	debug_output(4, "schedule_own_packet(): %s \n", batman_if->dev);
@@ -53,11 +55,19 @@ void schedule_own_packet(struct batman_if *batman_if)
 	/* non-primary interfaces do not send hna information */
 	if ((num_hna_local > 0) && (batman_if->if_num == 0)) {
 
+		/* with hna sync only the reference to the announced set is sent */
+		num_hna = (hna_sync ? 1 : (num_hna_local > MAX_HNA_OGM ? MAX_HNA_OGM : num_hna_local));
+
 		forw_node_new->pack_buff = debugMalloc(MAX_AGGREGATION_BYTES, 502);
 		memcpy(forw_node_new->pack_buff, (unsigned char *)&batman_if->out, sizeof(struct bat_packet));
-		memcpy(forw_node_new->pack_buff + sizeof(struct bat_packet), hna_buff_local, num_hna_local * 5);
-		forw_node_new->pack_buff_len = sizeof(struct bat_packet) + num_hna_local * 5;
-		((struct bat_packet *)forw_node_new->pack_buff)->hna_len = num_hna_local;
+
+		if (hna_sync)
+			hna_sync_fill_ref(forw_node_new->pack_buff + sizeof(struct bat_packet));
+		else
+			memcpy(forw_node_new->pack_buff + sizeof(struct bat_packet), hna_buff_local, num_hna * 5);
+
+		forw_node_new->pack_buff_len = sizeof(struct bat_packet) + num_hna * 5;
+		((struct bat_packet *)forw_node_new->pack_buff)->hna_len = num_hna;
 
 	} else {
 
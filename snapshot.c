@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * routing state snapshots for the unix socket
+ *
+ * The originator, gateway and HNA tables belong to the main thread. The
+ * unix socket thread therefore only asks for a snapshot (and wakes the main
+ * loop) while the main thread serializes its tables in between two packets
+ * and publishes the result as an immutable, reference counted buffer.
+ * Every unix client gets a reference to the latest snapshot - it is
+ * rebuilt only if it is older than SNAPSHOT_MAX_AGE ms.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "hna.h"
+#include "snapshot.h"
+#include "events.h"
+
+
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_cond = PTHREAD_COND_INITIALIZER;
+
+static struct snapshot *snapshot_curr = NULL;
+static volatile uint8_t snapshot_requested = 0;
+static uint32_t snapshots_built = 0, snapshots_served = 0;
+
+/* buffer of the snapshot being built - starts with the size of the last one */
+static char *build_buff = NULL;
+static uint32_t build_len = 0, build_size = 1024;
+
+
+
+static void snapshot_lock(void)
+{
+	if (pthread_mutex_lock(&snapshot_mutex) != 0)
+		debug_output(0, "Error - could not lock snapshot mutex: %s \n", strerror(errno));
+}
+
+static void snapshot_unlock(void)
+{
+	if (pthread_mutex_unlock(&snapshot_mutex) != 0)
+		debug_output(0, "Error - could not unlock snapshot mutex: %s \n", strerror(errno));
+}
+
+static void snapshot_printf(char *format, ...)
+{
+	va_list args;
+	int len;
+
+	while (1) {
+
+		va_start(args, format);
+		len = vsnprintf(build_buff + build_len, build_size - build_len, format, args);
+		va_end(args);
+
+		if (len < 0)
+			return;
+
+		if (build_len + len < build_size)
+			break;
+
+		build_size = (build_size * 2 > build_len + len + 1 ? build_size * 2 : build_len + len + 1);
+		build_buff = debugRealloc(build_buff, build_size, 942);
+
+	}
+
+	build_len += len;
+}
+
+/* interface names are the only strings not built by ourselves */
+static void snapshot_print_string(char *str)
+{
+	snapshot_printf("\"");
+
+	for (; *str != '\0'; str++) {
+
+		if ((*str == '"') || (*str == '\\'))
+			snapshot_printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			snapshot_printf("\\u%04x", (unsigned char)*str);
+		else
+			snapshot_printf("%c", *str);
+
+	}
+
+	snapshot_printf("\"");
+}
+
+static void snapshot_print_addr(char *name, uint32_t addr)
+{
+	char addr_str[ADDR_STR_LEN];
+
+	addr_to_string(addr, addr_str, sizeof(addr_str));
+	snapshot_printf("\"%s\":\"%s\"", name, addr_str);
+}
+
+static void snapshot_print_network(uint32_t addr, uint8_t netmask)
+{
+	char addr_str[ADDR_STR_LEN];
+
+	addr_to_string(addr, addr_str, sizeof(addr_str));
+	snapshot_printf("\"%s/%i\"", addr_str, netmask);
+}
+
+static void snapshot_print_orig(struct orig_node *orig_node, uint32_t curr_time)
+{
+	struct list_head *neigh_pos;
+	struct neigh_node *neigh_node;
+	struct hna_element *hna_element;
+	int first = 1, i;
+
+	snapshot_printf("{");
+	snapshot_print_addr("address", orig_node->orig);
+	snapshot_printf(",\"last_seen\":%u,", curr_time - orig_node->last_valid);
+
+	if (orig_node->router != NULL) {
+		snapshot_print_addr("router", orig_node->router->addr);
+		snapshot_printf(",\"tq\":%i,\"interface\":", orig_node->router->tq_avg);
+		snapshot_print_string(orig_node->router->if_incoming->dev);
+	} else {
+		snapshot_printf("\"router\":null");
+	}
+
+	if (orig_node->gwflags != 0)
+		snapshot_printf(",\"gw_flags\":%i", orig_node->gwflags);
+
+	snapshot_printf(",\"neighbors\":[");
+
+	list_for_each(neigh_pos, &orig_node->neigh_list) {
+
+		neigh_node = list_entry(neigh_pos, struct neigh_node, list);
+
+		snapshot_printf("%s{", (first ? "" : ","));
+		snapshot_print_addr("address", neigh_node->addr);
+		snapshot_printf(",\"tq\":%i,\"interface\":", neigh_node->tq_avg);
+		snapshot_print_string(neigh_node->if_incoming->dev);
+		snapshot_printf(",\"last_seen\":%u}", curr_time - neigh_node->last_valid);
+		first = 0;
+
+	}
+
+	snapshot_printf("],\"hna\":[");
+
+	for (i = 0; i < orig_node->hna_buff_len / (int32_t)sizeof(struct hna_element); i++) {
+
+		hna_element = (struct hna_element *)(orig_node->hna_buff + i * sizeof(struct hna_element));
+
+		snapshot_printf("%s", (i == 0 ? "" : ","));
+		snapshot_print_network(hna_element->addr, hna_element->netmask);
+
+	}
+
+	snapshot_printf("]}");
+}
+
+static void snapshot_build(uint32_t curr_time)
+{
+	struct hash_it_t *hashit = NULL;
+	struct list_head *list_pos;
+	struct gw_node *gw_node;
+	struct hna_global_entry *hna_global_entry;
+	struct hna_local_entry *hna_local_entry;
+	int first = 1;
+
+	build_buff = debugMalloc(build_size, 941);
+	build_len = 0;
+
+	snapshot_printf("{\"version\":%i,\"time\":%u,\"event_seq\":%u,\"originators\":[", SNAPSHOT_VERSION, curr_time, event_get_seq());
+
+	while (NULL != (hashit = hash_iterate(orig_hash, hashit))) {
+
+		snapshot_printf("%s", (first ? "" : ","));
+		snapshot_print_orig(hashit->bucket->data, curr_time);
+		first = 0;
+
+	}
+
+	snapshot_printf("],\"gateways\":[");
+	first = 1;
+
+	list_for_each(list_pos, &gw_list) {
+
+		gw_node = list_entry(list_pos, struct gw_node, list);
+
+		if (gw_node->deleted)
+			continue;
+
+		snapshot_printf("%s{", (first ? "" : ","));
+		snapshot_print_addr("address", gw_node->orig_node->orig);
+		snapshot_printf(",\"gw_flags\":%i,\"port\":%i,\"tq\":%i,\"selected\":%s}",
+		                gw_node->orig_node->gwflags, ntohs(gw_node->gw_port),
+		                (gw_node->orig_node->router != NULL ? gw_node->orig_node->router->tq_avg : 0),
+		                (gw_node == curr_gateway ? "true" : "false"));
+		first = 0;
+
+	}
+
+	snapshot_printf("],\"hna\":[");
+	first = 1;
+	hashit = NULL;
+
+	while (NULL != (hashit = hna_global_iterate(hashit))) {
+
+		hna_global_entry = hashit->bucket->data;
+
+		snapshot_printf("%s{\"network\":", (first ? "" : ","));
+		snapshot_print_network(hna_global_entry->addr, hna_global_entry->netmask);
+		snapshot_printf(",");
+
+		if (hna_global_entry->curr_orig_node != NULL)
+			snapshot_print_addr("originator", hna_global_entry->curr_orig_node->orig);
+		else
+			snapshot_printf("\"originator\":null");
+
+		snapshot_printf("}");
+		first = 0;
+
+	}
+
+	snapshot_printf("],\"local_hna\":[");
+	first = 1;
+
+	list_for_each(list_pos, &hna_list) {
+
+		hna_local_entry = list_entry(list_pos, struct hna_local_entry, list);
+
+		snapshot_printf("%s", (first ? "" : ","));
+		snapshot_print_network(hna_local_entry->addr, hna_local_entry->netmask);
+		first = 0;
+
+	}
+
+	snapshot_printf("]}\n");
+}
+
+/* called by the unix socket thread - returns NULL if the main thread did not answer in time */
+struct snapshot *snapshot_get(void)
+{
+	struct snapshot *snapshot;
+	struct timespec timeout;
+	uint32_t built;
+
+	snapshot_lock();
+
+	if ((snapshot_curr == NULL) || ((int)(get_time_msec() - (snapshot_curr->created + SNAPSHOT_MAX_AGE)) > 0)) {
+
+		built = snapshots_built;
+		snapshot_requested = 1;
+		wakeup_main_loop();
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_sec += SNAPSHOT_WAIT;
+
+		while ((snapshots_built == built) && (!is_aborted())) {
+
+			if (pthread_cond_timedwait(&snapshot_cond, &snapshot_mutex, &timeout) != 0)
+				break;
+
+		}
+
+	}
+
+	snapshot = snapshot_curr;
+
+	if (snapshot != NULL) {
+		snapshot->refcount++;
+		snapshots_served++;
+	}
+
+	snapshot_unlock();
+	return snapshot;
+}
+
+static void _snapshot_put(struct snapshot *snapshot)
+{
+	if (--snapshot->refcount > 0)
+		return;
+
+	debugFree(snapshot->buff, 1941);
+	debugFree(snapshot, 1942);
+}
+
+void snapshot_put(struct snapshot *snapshot)
+{
+	snapshot_lock();
+	_snapshot_put(snapshot);
+	snapshot_unlock();
+}
+
+/* called by the main thread in every loop - cheap unless a snapshot was requested */
+void snapshot_serve(void)
+{
+	struct snapshot *snapshot;
+	uint32_t curr_time;
+
+	if (!snapshot_requested)
+		return;
+
+	curr_time = get_time_msec();
+
+	snapshot_build(curr_time);
+
+	snapshot = debugMalloc(sizeof(struct snapshot), 943);
+	snapshot->buff = build_buff;
+	snapshot->len = build_len;
+	snapshot->created = curr_time;
+	snapshot->refcount = 1;
+
+	build_buff = NULL;
+
+	snapshot_lock();
+
+	if (snapshot_curr != NULL)
+		_snapshot_put(snapshot_curr);
+
+	snapshot_curr = snapshot;
+	snapshot_requested = 0;
+	snapshots_built++;
+
+	pthread_cond_broadcast(&snapshot_cond);
+	snapshot_unlock();
+}
+
+void snapshot_get_stats(uint32_t *built, uint32_t *served)
+{
+	snapshot_lock();
+	*built = snapshots_built;
+	*served = snapshots_served;
+	snapshot_unlock();
+}
+
+void snapshot_free(void)
+{
+	snapshot_lock();
+
+	if (snapshot_curr != NULL)
+		_snapshot_put(snapshot_curr);
+
+	snapshot_curr = NULL;
+
+	/* wake a unix client still waiting for us */
+	pthread_cond_broadcast(&snapshot_cond);
+	snapshot_unlock();
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_SNAPSHOT_H
+#define _BATMAN_SNAPSHOT_H
+
+#include <stdint.h>
+
+
+/***
+ *
+ * routing state snapshot (unix socket command "j")
+ *
+ * One JSON object on a single line:
+ *
+ * {"version":1,"time":<ms>,"event_seq":<seq of the last event contained (see events.h)>,
+ *  "originators":[{"address":"a.b.c.d","last_seen":<ms ago>,
+ *                  "router":"a.b.c.d"|null,"tq":<tq>,"interface":"dev","gw_flags":<class>,
+ *                  "neighbors":[{"address":"a.b.c.d","tq":<tq>,"interface":"dev","last_seen":<ms ago>}],
+ *                  "hna":["a.b.c.d/n"]}],
+ *  "gateways":[{"address":"a.b.c.d","gw_flags":<class>,"port":<port>,"tq":<tq>,"selected":true|false}],
+ *  "hna":[{"network":"a.b.c.d/n","originator":"a.b.c.d"|null}],
+ *  "local_hna":["a.b.c.d/n"]}
+ *
+ * "neighbors" are the possible next hops towards the originator, "hna" of
+ * an originator are the networks it announces while the global "hna" list
+ * tells which originator is used for each announced network. tq, interface
+ * and gw_flags are omitted if there is no router / no gateway.
+ *
+ * The snapshot is built by the main thread between two packets, so it is
+ * consistent. Requests arriving within SNAPSHOT_MAX_AGE ms share the
+ * same snapshot.
+ *
+ ***/
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAX_AGE 100
+#define SNAPSHOT_WAIT 1
+
+
+struct snapshot {
+	char *buff;
+	uint32_t len;
+	uint32_t created;
+	uint32_t refcount;
+};
+
+
+struct snapshot *snapshot_get(void);
+void snapshot_put(struct snapshot *snapshot);
+void snapshot_serve(void);
+void snapshot_get_stats(uint32_t *built, uint32_t *served);
+void snapshot_free(void);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * probes a gateway like batmand --gw-probe does (see gw_probe.h)
+ *
+ * "gw_probe 10.0.0.1" prints the result of every round and the smoothed
+ * estimates, "gw_probe -s" answers the probes like a gateway - a stand-in
+ * for testing the probes (and batmand --gw-probe) without a real one.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../gw_probe.h"
+
+
+#define GW_PROBE_TOOL_PORT 4306               /* GW_PORT of batmand */
+
+
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: gw_probe [-n rounds] [-l limit kbit/s] [-p port] <gateway address>\n");
+	fprintf(stderr, "       gw_probe -s [-p port]   answer probes like a gateway\n");
+}
+
+static int stand_in(int sock, int port)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len;
+	unsigned char buff[GW_PROBE_LARGE + 1];
+	unsigned long answered = 0;
+	int len;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = INADDR_ANY;
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Error - can't bind to port %i: %s\n", port, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stderr, "Answering gateway probes on port %i\n", port);
+
+	while (1) {
+
+		addr_len = sizeof(addr);
+
+		if ((len = recvfrom(sock, buff, sizeof(buff), 0, (struct sockaddr *)&addr, &addr_len)) < 0) {
+
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "Error - can't receive: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+
+		}
+
+		if (gw_probe_reply(sock, buff, len, &addr) > 0)
+			answered++;
+
+		if ((answered > 0) && (answered % 1000 == 0))
+			fprintf(stderr, "%lu probes answered\n", answered);
+
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in gw_addr;
+	struct gw_probe_sample sample;
+	struct gw_probe_estimate estimate;
+	int sock, optchar, rounds = 5, port = GW_PROBE_TOOL_PORT, server = 0, i;
+	uint32_t limit = 0;
+
+	while ((optchar = getopt(argc, argv, "l:n:p:sh")) != -1) {
+
+		switch (optchar) {
+		case 'l':
+			limit = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			rounds = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			port = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			server = 1;
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+
+	}
+
+	if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+		fprintf(stderr, "Error - can't create udp socket: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (server)
+		return stand_in(sock, port);
+
+	memset(&gw_addr, 0, sizeof(gw_addr));
+	gw_addr.sin_family = AF_INET;
+	gw_addr.sin_port = htons(port);
+
+	if ((optind >= argc) || (inet_pton(AF_INET, argv[optind], &gw_addr.sin_addr) < 1)) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	memset(&estimate, 0, sizeof(estimate));
+
+	for (i = 1; i <= rounds; i++) {
+
+		if (gw_probe_round(sock, &gw_addr, i, &sample) < 0) {
+			fprintf(stderr, "Error - can't probe %s: %s\n", argv[optind], strerror(errno));
+			return EXIT_FAILURE;
+		}
+
+		gw_probe_update(&estimate, &sample);
+
+		printf("round %i: rtt %u.%03u ms, %u kbit/s, %i of %i probes answered\n", i,
+		       sample.rtt / 1000, sample.rtt % 1000, sample.bw, sample.received, sample.sent);
+
+		if (i < rounds)
+			sleep(1);
+
+	}
+
+	printf("smoothed: rtt %u.%03u ms, %u kbit/s, loss %u%%, expected goodput %u kbit/s\n",
+	       estimate.rtt / 1000, estimate.rtt % 1000, estimate.bw, estimate.loss, gw_probe_goodput(&estimate, limit));
+
+	close(sock);
+	return EXIT_SUCCESS;
+}
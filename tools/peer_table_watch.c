@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * reference reader of the memory mapped peer table
+ *
+ * Usage: peer_table_watch [-1] [table]
+ * Prints the reachable peers every time batmand changes the table
+ * (-1 prints them once). The default table is the one batmand writes.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <arpa/inet.h>
+
+#include "../peer_table.h"
+
+
+#define DEFAULT_TABLE "/dev/shm/batmand.peers.map"
+
+
+static struct peer_table_record records[PEER_TABLE_MAX_PEERS];
+
+
+
+/* consistent copy of the table - returns the number of records */
+static uint32_t read_table(struct peer_table_header *table)
+{
+	uint32_t seq, num;
+
+	do {
+		while ((seq = table->seq) & 1)
+			sched_yield();
+
+		__sync_synchronize();
+
+		num = table->num_peers;
+
+		if (num > PEER_TABLE_MAX_PEERS)
+			num = PEER_TABLE_MAX_PEERS;
+
+		memcpy(records, table + 1, num * sizeof(struct peer_table_record));
+
+		__sync_synchronize();
+	} while (table->seq != seq);
+
+	return num;
+}
+
+int main(int argc, char *argv[])
+{
+	struct peer_table_header *table;
+	struct stat st;
+	char *path = DEFAULT_TABLE, addr_str[16], router_str[16];
+	uint32_t generation, num, i;
+	int fd, once = 0;
+
+	for (i = 1; i < (uint32_t)argc; i++) {
+		if (strcmp(argv[i], "-1") == 0)
+			once = 1;
+		else
+			path = argv[i];
+	}
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "Error - can't open peer table '%s': %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(struct peer_table_header))) {
+		fprintf(stderr, "Error - peer table '%s' is too short\n", path);
+		return EXIT_FAILURE;
+	}
+
+	table = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (table == MAP_FAILED) {
+		fprintf(stderr, "Error - can't map peer table '%s': %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if ((table->magic != PEER_TABLE_MAGIC) || (table->version != PEER_TABLE_VERSION) ||
+	    (table->record_size != sizeof(struct peer_table_record)) ||
+	    (st.st_size < (off_t)(sizeof(struct peer_table_header) + table->max_peers * sizeof(struct peer_table_record)))) {
+		fprintf(stderr, "Error - unknown peer table format (magic 0x%08x, version %i)\n", table->magic, table->version);
+		return EXIT_FAILURE;
+	}
+
+	while (1) {
+
+		generation = table->generation;
+		num = read_table(table);
+
+		printf("generation %u: %u peers\n", generation, num);
+
+		for (i = 0; i < num; i++) {
+			inet_ntop(AF_INET, &records[i].addr, addr_str, sizeof(addr_str));
+			inet_ntop(AF_INET, &records[i].router, router_str, sizeof(router_str));
+			printf("%-15s via %-15s tq %3i\n", addr_str, router_str, records[i].tq);
+		}
+
+		fflush(stdout);
+
+		if (once)
+			break;
+
+		/* sleep until batmand changed the table */
+		while (table->generation == generation)
+			syscall(SYS_futex, &table->generation, FUTEX_WAIT, generation, NULL, NULL, 0);
+
+	}
+
+	munmap(table, st.st_size);
+	return EXIT_SUCCESS;
+}
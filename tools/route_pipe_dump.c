@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * reference reader of the binary policy routing script protocol
+ *
+ * Use it as policy routing script: batmand --policy-routing-script
+ * "route_pipe_dump" --policy-routing-binary ...
+ * Every complete transaction is printed in the text format of the
+ * policy routing script (-q only counts), statistics go to stderr.
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "../route_pipe.h"
+
+
+static const char *route_type_to_string[] = {"UNICAST", "THROW", "UNREACH", "UNKNOWN"};
+static const char *rule_type_to_string[] = {"from", "to", "iif"};
+
+static struct route_pipe_record *txn_records = NULL;
+static uint32_t txn_num = 0, txn_size = 0;
+static int quiet = 0;
+
+static unsigned long frames = 0, transactions = 0, records = 0, bytes = 0, errors = 0;
+
+
+
+static void print_record(struct route_pipe_record *record)
+{
+	char str1[16], str2[16], str3[16], dev[ROUTE_PIPE_DEV_LEN + 1];
+
+	inet_ntop(AF_INET, &record->dest, str1, sizeof(str1));
+	inet_ntop(AF_INET, &record->router, str2, sizeof(str2));
+	inet_ntop(AF_INET, &record->src_ip, str3, sizeof(str3));
+
+	memcpy(dev, record->dev, ROUTE_PIPE_DEV_LEN);
+	dev[ROUTE_PIPE_DEV_LEN] = '\0';
+
+	if (dev[0] == '\0')
+		strcpy(dev, "none");
+
+	if (record->object == ROUTE_PIPE_OBJ_ROUTE)
+		printf("ROUTE %s %s %s %i %s %s %i %s %i\n", (record->action == ROUTE_PIPE_DEL ? "del" : "add"),
+		       route_type_to_string[record->type > 3 ? 3 : record->type], str1, record->netmask, str2, str3,
+		       (int32_t)ntohl(record->ifi), dev, record->table);
+	else
+		printf("RULE %s %s %s %i %s %s %u %s %i\n", (record->action == ROUTE_PIPE_DEL ? "del" : "add"),
+		       (record->type > 2 ? "unknown" : rule_type_to_string[record->type]), str1, record->netmask,
+		       "unused", "unused", ntohl(record->prio), dev, record->table);
+}
+
+/* all records of a transaction are applied at once */
+static void apply_transaction(void)
+{
+	uint32_t i;
+
+	if (!quiet) {
+		for (i = 0; i < txn_num; i++)
+			print_record(&txn_records[i]);
+
+		fflush(stdout);
+	}
+
+	records += txn_num;
+	transactions++;
+	txn_num = 0;
+}
+
+static int read_full(void *buff, size_t len)
+{
+	size_t done = 0;
+	ssize_t res;
+
+	while (done < len) {
+		res = read(STDIN_FILENO, (char *)buff + done, len - done);
+
+		if ((res < 0) && (errno == EINTR))
+			continue;
+
+		if (res <= 0)
+			return (done == 0 ? 0 : -1);
+
+		done += res;
+	}
+
+	bytes += len;
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct route_pipe_frame frame;
+	struct timeval start, end;
+	uint32_t seqno = 0, num_records;
+	double elapsed;
+	int res;
+
+	if ((argc > 1) && (strcmp(argv[1], "-q") == 0))
+		quiet = 1;
+
+	gettimeofday(&start, NULL);
+
+	while ((res = read_full(&frame, sizeof(frame))) > 0) {
+
+		if ((ntohs(frame.magic) != ROUTE_PIPE_MAGIC) || (frame.version != ROUTE_PIPE_VERSION)) {
+			fprintf(stderr, "Error - unknown frame (magic 0x%04x, version %i)\n", ntohs(frame.magic), frame.version);
+			return EXIT_FAILURE;
+		}
+
+		if ((seqno != 0) && (ntohl(frame.seqno) != seqno + 1)) {
+			fprintf(stderr, "Warning - frames %u - %u missing\n", seqno + 1, ntohl(frame.seqno) - 1);
+			errors++;
+		}
+
+		seqno = ntohl(frame.seqno);
+		num_records = ntohs(frame.num_records);
+
+		if (txn_num + num_records > txn_size) {
+			txn_size = (txn_num + num_records) * 2;
+			txn_records = realloc(txn_records, txn_size * sizeof(struct route_pipe_record));
+
+			if (txn_records == NULL) {
+				fprintf(stderr, "Error - out of memory\n");
+				return EXIT_FAILURE;
+			}
+		}
+
+		if ((num_records > 0) && (read_full(&txn_records[txn_num], num_records * sizeof(struct route_pipe_record)) <= 0))
+			break;
+
+		txn_num += num_records;
+		frames++;
+
+		if (!(frame.flags & ROUTE_PIPE_FLAG_MORE))
+			apply_transaction();
+
+	}
+
+	gettimeofday(&end, NULL);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+
+	if (txn_num > 0)
+		fprintf(stderr, "Warning - incomplete transaction with %u records discarded\n", txn_num);
+
+	fprintf(stderr, "frames=%lu transactions=%lu records=%lu bytes=%lu gaps=%lu seconds=%.3f records_per_second=%.0f\n",
+		frames, transactions, records, bytes, errors, elapsed, (elapsed > 0 ? records / elapsed : 0));
+
+	free(txn_records);
+	return EXIT_SUCCESS;
+}
@@ -23,6 +23,7 @@
 #define TYPES_H
 
 #include "packet.h"
+#include "gw_probe.h"
 
 struct orig_node {                /* structure for orig_list maintaining nodes of mesh */
 	uint32_t orig;
@@ -35,9 +36,18 @@ struct orig_node {                /* structure for orig_list maintaining nodes o
 	uint32_t last_valid;        /* when last packet from this node was received */
 	uint8_t  gwflags;      /* flags related to gateway functions: gateway class */
 	unsigned char *hna_buff;
-	int16_t  hna_buff_len;
+	int32_t  hna_buff_len;
+	uint32_t hna_hash;          /* content hash of the announced HNA set */
+	uint32_t hna_sync_hash;     /* hash of the set announced in the last OGM (hna sync) */
+	uint8_t hna_tq;             /* router TQ the HNA candidate lists are sorted by */
 	uint16_t last_real_seqno;   /* last and best known squence number */
 	uint8_t last_ttl;         /* ttl of last received packet */
+	uint32_t router_changed;    /* when the next hop was changed the last time */
+	uint32_t flap_penalty;      /* next hop flap penalty points (decaying) */
+	uint32_t flap_decayed;      /* when flap_penalty was decayed the last time */
+	uint8_t flap_suppressed;    /* next hop changes are suppressed until the penalty decayed */
+	uint8_t event_tq;           /* TQ value reported in the last next hop / tq event */
+	uint16_t vis_slot;          /* position in the vis packet neighbor list + 1 - 0 if not listed */
 	struct list_head_first neigh_list;
 };
 
@@ -73,6 +83,7 @@ struct gw_node {
 	uint16_t gw_failure;
 	uint32_t last_failure;
 	uint32_t deleted;
+	struct gw_probe_estimate probe;    /* measured with --gw-probe */
 };
 
 struct batman_if {
@@ -101,11 +112,11 @@ struct gw_client {
 	uint16_t client_port;
 	uint32_t last_keep_alive;
 	uint8_t nat_warn;
-};
-
-struct free_ip {
-	struct list_head list;
-	uint32_t addr;
+	uint8_t caps;                         /* TUNNEL_CAP_* announced with the ip request */
+	struct hdr_comp *comp_tx;             /* header compression contexts - NULL if not negotiated */
+	struct hdr_comp *comp_rx;
+	struct gw_client *wip_next;           /* client table links (see gw_table.c) */
+	struct gw_client *wheel_next;
 };
 
 struct vis_if {
@@ -113,6 +124,13 @@ struct vis_if {
 	struct sockaddr_in addr;
 };
 
+struct lazy_if {
+	int32_t tun_fd;
+	int32_t tun_ifi;
+	char tun_dev[16];
+	int32_t raw_sock;
+};
+
 struct unix_if {
 	int32_t unix_sock;
 	pthread_t listen_thread_id;
@@ -124,6 +142,9 @@ struct unix_client {
 	struct list_head list;
 	int32_t sock;
 	uint8_t debug_level;
+	char *bulk_buff;            /* pending bulk HNA request */
+	uint32_t bulk_len;
+	uint32_t bulk_size;
 };
 
 struct debug_clients {
@@ -139,8 +160,9 @@ struct debug_level_info {
 
 struct curr_gw_data {
 	unsigned int orig;
-	struct gw_node *gw_node;
+	uint16_t gw_port;
 	struct batman_if *batman_if;
+	int32_t slot;                         /* index into tunnel_gw_addrs */
 };
 
 struct batgat_ioc_args {
@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+/**
+ * published routing state for the unix socket and tunnel threads
+ *
+ * The main thread owns the originator, gateway and HNA tables and frees
+ * their entries whenever it likes. Other threads therefore never touch
+ * them but read an immutable copy (route_view): after every routing
+ * change (see events.c) and once per second the main thread builds a new
+ * view and swaps the published pointer. The mutex only guards that swap
+ * and the reference counts - a view stays valid as long as a reader
+ * holds a reference, the old one is freed by its last reader.
+ * view_refresh() lets long running readers check for a newer view
+ * without taking the mutex.
+ *
+ * The tunnel thread reports gateway failures via view_gw_failure(), the
+ * probe thread its measurements via view_gw_probe() - the main thread
+ * applies both to its gateway list. A tunnel that gave up (view_gw_lost())
+ * and the unix socket (view_gw_drop()) ask the main thread to drop the
+ * gateway as well: only the main thread writes curr_gateway and
+ * standby_gateway.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "os.h"
+#include "batman.h"
+#include "hna.h"
+#include "events.h"
+#include "view.h"
+
+
+struct gw_failure {
+	uint32_t gw_addr;
+	uint32_t failure_time;
+};
+
+struct gw_probe_report {
+	uint32_t gw_addr;
+	struct gw_probe_sample sample;
+};
+
+
+static pthread_mutex_t view_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct route_view *view_curr = NULL;
+static volatile uint32_t view_generation = 0;
+static uint32_t view_event_seq = 0, views_alive = 0;
+
+static struct gw_failure gw_failures[VIEW_MAX_GW_FAILURES];
+static uint32_t gw_failures_num = 0;
+
+static struct gw_probe_report gw_probes[VIEW_MAX_GW_PROBES];
+static uint32_t gw_probes_num = 0;
+
+static uint32_t gw_lost_addr = 0;
+static uint8_t gw_drop_flags = 0;
+
+
+
+static void view_lock(void)
+{
+	if (pthread_mutex_lock(&view_mutex) != 0)
+		debug_output(0, "Error - could not lock view mutex: %s \n", strerror(errno));
+}
+
+static void view_unlock(void)
+{
+	if (pthread_mutex_unlock(&view_mutex) != 0)
+		debug_output(0, "Error - could not unlock view mutex: %s \n", strerror(errno));
+}
+
+static int view_orig_cmp(const void *data1, const void *data2)
+{
+	uint32_t addr1 = ntohl(((struct view_orig *)data1)->orig);
+	uint32_t addr2 = ntohl(((struct view_orig *)data2)->orig);
+
+	return (addr1 < addr2 ? -1 : (addr1 > addr2 ? 1 : 0));
+}
+
+/* has to be called with the view mutex held */
+static void _view_put(struct route_view *view)
+{
+	if (--view->refcount > 0)
+		return;
+
+	views_alive--;
+	debugFree(view, 1961);
+}
+
+/* the failures were reported by the tunnel thread - has to be called with the view mutex held */
+static void view_apply_gw_failures(void)
+{
+	struct list_head *list_pos;
+	struct gw_node *gw_node;
+	uint32_t i;
+
+	for (i = 0; i < gw_failures_num; i++) {
+
+		list_for_each(list_pos, &gw_list) {
+
+			gw_node = list_entry(list_pos, struct gw_node, list);
+
+			if ((gw_node->deleted) || (gw_node->orig_node->orig != gw_failures[i].gw_addr))
+				continue;
+
+			gw_node->last_failure = gw_failures[i].failure_time;
+			gw_node->gw_failure++;
+			break;
+
+		}
+
+	}
+
+	gw_failures_num = 0;
+}
+
+/* the measurements were reported by the probe thread - has to be called with the view mutex held */
+static void view_apply_gw_probes(void)
+{
+	struct list_head *list_pos;
+	struct gw_node *gw_node;
+	uint32_t i;
+
+	for (i = 0; i < gw_probes_num; i++) {
+
+		list_for_each(list_pos, &gw_list) {
+
+			gw_node = list_entry(list_pos, struct gw_node, list);
+
+			if ((gw_node->deleted) || (gw_node->orig_node->orig != gw_probes[i].gw_addr))
+				continue;
+
+			gw_probe_update(&gw_node->probe, &gw_probes[i].sample);
+			break;
+
+		}
+
+	}
+
+	gw_probes_num = 0;
+}
+
+static struct route_view *view_build(void)
+{
+	struct hash_it_t *hashit = NULL;
+	struct list_head *list_pos;
+	struct orig_node *orig_node;
+	struct gw_node *gw_node;
+	struct hna_local_entry *hna_local_entry;
+	struct route_view *view;
+	uint32_t num_gws = 0, num_hna_local = 0;
+	size_t size;
+
+	list_for_each(list_pos, &gw_list)
+		num_gws++;
+
+	list_for_each(list_pos, &hna_list)
+		num_hna_local++;
+
+	/* the arrays follow the header in the same block */
+	size = sizeof(struct route_view) + orig_hash->elements * sizeof(struct view_orig) +
+	       num_gws * sizeof(struct view_gw) + num_hna_local * sizeof(struct view_hna);
+
+	view = debugMalloc(size, 961);
+	memset(view, 0, size);
+
+	view->origs = (struct view_orig *)(view + 1);
+	view->gws = (struct view_gw *)(view->origs + orig_hash->elements);
+	view->hna_local = (struct view_hna *)(view->gws + num_gws);
+
+	while (NULL != (hashit = hash_iterate(orig_hash, hashit))) {
+
+		orig_node = hashit->bucket->data;
+
+		if (orig_node->router == NULL)
+			continue;
+
+		view->origs[view->num_origs].orig = orig_node->orig;
+		view->origs[view->num_origs].router = orig_node->router->addr;
+		view->origs[view->num_origs].tq = orig_node->router->tq_avg;
+		view->origs[view->num_origs].gw_flags = orig_node->gwflags;
+		strncpy(view->origs[view->num_origs].dev, orig_node->router->if_incoming->dev, IFNAMSIZ - 1);
+		view->num_origs++;
+
+	}
+
+	qsort(view->origs, view->num_origs, sizeof(struct view_orig), view_orig_cmp);
+
+	list_for_each(list_pos, &gw_list) {
+
+		gw_node = list_entry(list_pos, struct gw_node, list);
+
+		if (gw_node->deleted)
+			continue;
+
+		view->gws[view->num_gws].orig = gw_node->orig_node->orig;
+		view->gws[view->num_gws].gw_port = gw_node->gw_port;
+		view->gws[view->num_gws].gw_flags = gw_node->orig_node->gwflags;
+		view->gws[view->num_gws].tq = (gw_node->orig_node->router != NULL ? gw_node->orig_node->router->tq_avg : 0);
+		view->num_gws++;
+
+	}
+
+	list_for_each(list_pos, &hna_list) {
+
+		hna_local_entry = list_entry(list_pos, struct hna_local_entry, list);
+
+		view->hna_local[view->num_hna_local].addr = hna_local_entry->addr;
+		view->hna_local[view->num_hna_local].netmask = hna_local_entry->netmask;
+		view->num_hna_local++;
+
+	}
+
+	if ((curr_gateway != NULL) && (!curr_gateway->deleted))
+		view->gw_addr = curr_gateway->orig_node->orig;
+
+	if ((standby_gateway != NULL) && (!standby_gateway->deleted))
+		view->gw_standby_addr = standby_gateway->orig_node->orig;
+
+	return view;
+}
+
+/* main thread: publishes a new view if the routing changed (or if forced) */
+void view_publish(uint8_t force)
+{
+	struct route_view *view;
+	uint32_t lost_addr;
+	uint8_t gw_changed, drop_flags;
+
+	if ((gw_failures_num > 0) || (gw_probes_num > 0) || (gw_lost_addr != 0) || (gw_drop_flags != 0)) {
+		view_lock();
+		view_apply_gw_failures();
+		view_apply_gw_probes();
+		lost_addr = gw_lost_addr;
+		drop_flags = gw_drop_flags;
+		gw_lost_addr = 0;
+		gw_drop_flags = 0;
+		view_unlock();
+
+		/* del_default_route() wakes the tunnel threads - not with the view mutex held */
+		if ((curr_gateway != NULL) && ((drop_flags & VIEW_GW_DROP) || (curr_gateway->orig_node->orig == lost_addr)))
+			del_default_route();
+
+		if (drop_flags & VIEW_GW_DROP_STANDBY)
+			standby_gateway = NULL;
+	}
+
+	if ((!force) && (view_curr != NULL) && (view_event_seq == event_get_seq()))
+		return;
+
+	view_event_seq = event_get_seq();
+
+	view = view_build();
+	view->refcount = 1;
+	view->created = get_time_msec();
+
+	view_lock();
+
+	view->generation = view_generation + 1;
+	gw_changed = ((view_curr == NULL) || (view_curr->gw_addr != view->gw_addr) || (view_curr->gw_standby_addr != view->gw_standby_addr));
+
+	if (view_curr != NULL)
+		_view_put(view_curr);
+
+	view_curr = view;
+	views_alive++;
+	view_generation = view->generation;
+
+	view_unlock();
+
+	/* the tunnel threads sleep until they are woken up */
+	if (gw_changed)
+		tunnel_wakeup();
+}
+
+/* returns a reference to the latest view (NULL before the first one) - release it with view_put() */
+struct route_view *view_get(void)
+{
+	struct route_view *view;
+
+	view_lock();
+
+	if ((view = view_curr) != NULL)
+		view->refcount++;
+
+	view_unlock();
+	return view;
+}
+
+/* swaps the given reference for the latest view - cheap if nothing changed */
+struct route_view *view_refresh(struct route_view *view)
+{
+	if ((view != NULL) && (view->generation == view_generation))
+		return view;
+
+	if (view != NULL)
+		view_put(view);
+
+	return view_get();
+}
+
+void view_put(struct route_view *view)
+{
+	view_lock();
+	_view_put(view);
+	view_unlock();
+}
+
+struct view_orig *view_find_orig(struct route_view *view, uint32_t addr)
+{
+	struct view_orig key;
+
+	key.orig = addr;
+	return bsearch(&key, view->origs, view->num_origs, sizeof(struct view_orig), view_orig_cmp);
+}
+
+/* tunnel thread: the selected gateway did not answer */
+void view_gw_failure(uint32_t gw_addr, uint32_t failure_time)
+{
+	view_lock();
+
+	if (gw_failures_num < VIEW_MAX_GW_FAILURES) {
+		gw_failures[gw_failures_num].gw_addr = gw_addr;
+		gw_failures[gw_failures_num].failure_time = failure_time;
+		gw_failures_num++;
+	}
+
+	view_unlock();
+}
+
+/* probe thread: the result of a probe round */
+void view_gw_probe(uint32_t gw_addr, struct gw_probe_sample *sample)
+{
+	view_lock();
+
+	if (gw_probes_num < VIEW_MAX_GW_PROBES) {
+		gw_probes[gw_probes_num].gw_addr = gw_addr;
+		memcpy(&gw_probes[gw_probes_num].sample, sample, sizeof(struct gw_probe_sample));
+		gw_probes_num++;
+	}
+
+	view_unlock();
+}
+
+/* tunnel thread: the tunnel to the selected gateway is gone - the main thread chooses another one */
+void view_gw_lost(uint32_t gw_addr)
+{
+	view_lock();
+	gw_lost_addr = gw_addr;
+	view_unlock();
+}
+
+/* unix socket: the gateway settings changed - the main thread drops the gateways given by flags */
+void view_gw_drop(uint8_t flags)
+{
+	view_lock();
+	gw_drop_flags |= flags;
+	view_unlock();
+}
+
+void view_get_stats(uint32_t *generation, uint32_t *alive)
+{
+	view_lock();
+	*generation = view_generation;
+	*alive = views_alive;
+	view_unlock();
+}
+
+void view_free(void)
+{
+	view_lock();
+
+	if (view_curr != NULL)
+		_view_put(view_curr);
+
+	view_curr = NULL;
+	view_generation++;
+
+	view_unlock();
+}
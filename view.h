@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+#ifndef _BATMAN_VIEW_H
+#define _BATMAN_VIEW_H
+
+#include <net/if.h>
+
+#include "batman.h"
+
+
+#define VIEW_MAX_GW_FAILURES 8
+#define VIEW_MAX_GW_PROBES 16
+
+#define VIEW_GW_DROP 0x01           /* drop the selected gateway */
+#define VIEW_GW_DROP_STANDBY 0x02   /* drop the standby gateway */
+
+
+struct view_orig {
+	uint32_t orig;
+	uint32_t router;
+	uint8_t tq;
+	uint8_t gw_flags;
+	char dev[IFNAMSIZ];
+};
+
+struct view_hna {
+	uint32_t addr;
+	uint8_t netmask;
+};
+
+struct view_gw {
+	uint32_t orig;
+	uint16_t gw_port;                     /* network byte order */
+	uint8_t gw_flags;
+	uint8_t tq;
+};
+
+/**
+ * read only copy of the routing state for the other threads
+ *
+ * A view is never changed after it was published. Readers keep their
+ * reference as long as they like - the view is freed with the last one.
+ */
+struct route_view {
+	uint32_t refcount;
+	uint32_t generation;
+	uint32_t created;
+	uint32_t gw_addr;                     /* selected gateway - 0 if none */
+	uint32_t gw_standby_addr;             /* gateway the client keeps a standby tunnel to - 0 if none */
+	uint32_t num_origs;
+	struct view_orig *origs;              /* originators with a route - sorted by address */
+	uint32_t num_gws;
+	struct view_gw *gws;
+	uint32_t num_hna_local;
+	struct view_hna *hna_local;
+};
+
+
+void view_publish(uint8_t force);
+struct route_view *view_get(void);
+struct route_view *view_refresh(struct route_view *view);
+void view_put(struct route_view *view);
+struct view_orig *view_find_orig(struct route_view *view, uint32_t addr);
+void view_gw_failure(uint32_t gw_addr, uint32_t failure_time);
+void view_gw_probe(uint32_t gw_addr, struct gw_probe_sample *sample);
+void view_gw_lost(uint32_t gw_addr);
+void view_gw_drop(uint8_t flags);
+void view_get_stats(uint32_t *generation, uint32_t *alive);
+void view_free(void);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+/**
+ * visualization packet
+ *
+ * The vis packet is kept up to date instead of being rebuilt for every
+ * transmission. The buffer starts with the vis_packet header followed by
+ * the local entries (secondary interfaces and announced networks) and the
+ * 1-hop neighbors:
+ *
+ *   | header | sec ifs + hna (vis_num_local) | neighbors (vis_num_neigh) |
+ *
+ * Local entries rarely change and are rewritten as a whole. A neighbor
+ * remembers its position (orig_node->vis_slot) and is updated in place
+ * whenever its route is evaluated; a removed neighbor is replaced by the
+ * last one. Everything is done by the main thread - sending the packet is
+ * a single sendto() of the buffer.
+ */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "os.h"
+#include "batman.h"
+#include "hna.h"
+#include "vis.h"
+
+
+static unsigned char *vis_buff = NULL;
+static struct orig_node **vis_neigh = NULL;   /* owner of each neighbor entry */
+static uint32_t vis_max = 0, vis_num_local = 0, vis_num_neigh = 0;
+
+
+
+static struct vis_data *vis_entry(uint32_t i)
+{
+	return (struct vis_data *)(vis_buff + sizeof(struct vis_packet) + i * sizeof(struct vis_data));
+}
+
+/* makes room for num entries - returns 0 if the packet would get too big */
+static int8_t vis_reserve(uint32_t num)
+{
+	uint32_t max = vis_max;
+
+	if (num <= vis_max)
+		return 1;
+
+	if (num > VIS_MAX_ENTRIES)
+		return 0;
+
+	while (max < num)
+		max *= 2;
+
+	if (max > VIS_MAX_ENTRIES)
+		max = VIS_MAX_ENTRIES;
+
+	vis_buff = debugRealloc(vis_buff, sizeof(struct vis_packet) + max * sizeof(struct vis_data), 972);
+	vis_neigh = debugRealloc(vis_neigh, max * sizeof(struct orig_node *), 973);
+	vis_max = max;
+
+	return 1;
+}
+
+void vis_init(void)
+{
+	vis_max = VIS_INIT_ENTRIES;
+	vis_buff = debugMalloc(sizeof(struct vis_packet) + vis_max * sizeof(struct vis_data), 971);
+	vis_neigh = debugMalloc(vis_max * sizeof(struct orig_node *), 974);
+
+	((struct vis_packet *)vis_buff)->version = VIS_COMPAT_VERSION;
+	((struct vis_packet *)vis_buff)->tq_max = TQ_MAX_VALUE;
+
+	vis_update_local();
+}
+
+/* called whenever the route towards an originator was (re)evaluated */
+void vis_update_orig(struct orig_node *orig_node)
+{
+	struct vis_data *vis_data;
+	uint32_t i;
+
+	if (vis_buff == NULL)
+		return;
+
+	/* we interested in 1 hop neighbours only */
+	if ((orig_node->router != NULL) && (orig_node->orig == orig_node->router->addr) &&
+	    (orig_node->router->tq_avg > 0)) {
+
+		if (orig_node->vis_slot == 0) {
+
+			if (!vis_reserve(vis_num_local + vis_num_neigh + 1))
+				return;
+
+			vis_neigh[vis_num_neigh] = orig_node;
+			vis_num_neigh++;
+			orig_node->vis_slot = vis_num_neigh;
+
+			vis_data = vis_entry(vis_num_local + vis_num_neigh - 1);
+			memcpy(&vis_data->ip, (unsigned char *)&orig_node->orig, 4);
+			vis_data->type = DATA_TYPE_NEIGH;
+
+		}
+
+		vis_entry(vis_num_local + orig_node->vis_slot - 1)->data = orig_node->router->tq_avg;
+		return;
+
+	}
+
+	if (orig_node->vis_slot == 0)
+		return;
+
+	/* move the last neighbor into the gap */
+	i = orig_node->vis_slot - 1;
+	vis_num_neigh--;
+
+	if (i != vis_num_neigh) {
+		memcpy(vis_entry(vis_num_local + i), vis_entry(vis_num_local + vis_num_neigh), sizeof(struct vis_data));
+		vis_neigh[i] = vis_neigh[vis_num_neigh];
+		vis_neigh[i]->vis_slot = i + 1;
+	}
+
+	orig_node->vis_slot = 0;
+}
+
+/* rewrites the sender address, secondary interfaces and announced networks */
+void vis_update_local(void)
+{
+	struct list_head *list_pos;
+	struct batman_if *batman_if;
+	struct hna_local_entry *hna_local_entry;
+	struct vis_data *vis_data;
+	uint32_t num_local = 0, i = 0;
+
+	if (vis_buff == NULL)
+		return;
+
+	memcpy(&((struct vis_packet *)vis_buff)->sender_ip, (unsigned char *)&(((struct batman_if *)if_list.next)->addr.sin_addr.s_addr), 4);
+
+	if (found_ifs > 1)
+		num_local += found_ifs - 1;
+
+	list_for_each(list_pos, &hna_list)
+		num_local++;
+
+	if (!vis_reserve(num_local + vis_num_neigh)) {
+		debug_output(3, "Error - vis packet too big: dropping %u local entries \n", num_local);
+		return;
+	}
+
+	/* the neighbors follow the local entries */
+	if (num_local != vis_num_local)
+		memmove(vis_entry(num_local), vis_entry(vis_num_local), vis_num_neigh * sizeof(struct vis_data));
+
+	vis_num_local = num_local;
+
+	/* secondary interfaces */
+	if (found_ifs > 1) {
+		list_for_each(list_pos, &if_list) {
+			batman_if = list_entry(list_pos, struct batman_if, list);
+
+			if (((struct vis_packet *)vis_buff)->sender_ip == batman_if->addr.sin_addr.s_addr)
+				continue;
+
+			/* the first interface was configured with the address of another one */
+			if (i >= vis_num_local)
+				break;
+
+			vis_data = vis_entry(i++);
+			memcpy(&vis_data->ip, (unsigned char *)&batman_if->addr.sin_addr.s_addr, 4);
+			vis_data->data = 0;
+			vis_data->type = DATA_TYPE_SEC_IF;
+		}
+	}
+
+	/* hna announcements */
+	list_for_each(list_pos, &hna_list) {
+		hna_local_entry = list_entry(list_pos, struct hna_local_entry, list);
+
+		vis_data = vis_entry(i++);
+		memcpy(&vis_data->ip, (unsigned char *)&hna_local_entry->addr, 4);
+		vis_data->data = hna_local_entry->netmask;
+		vis_data->type = DATA_TYPE_HNA;
+	}
+
+	/* fewer secondary interfaces than expected - close the gap */
+	if (i < vis_num_local) {
+		memmove(vis_entry(i), vis_entry(vis_num_local), vis_num_neigh * sizeof(struct vis_data));
+		vis_num_local = i;
+	}
+}
+
+/* returns NULL if there is nothing to report */
+unsigned char *vis_get_packet(uint16_t *len)
+{
+	if ((vis_buff == NULL) || (vis_num_local + vis_num_neigh == 0))
+		return NULL;
+
+	((struct vis_packet *)vis_buff)->gw_class = gateway_class;
+
+	*len = sizeof(struct vis_packet) + (vis_num_local + vis_num_neigh) * sizeof(struct vis_data);
+	return vis_buff;
+}
+
+void vis_free(void)
+{
+	if (vis_buff != NULL)
+		debugFree(vis_buff, 1971);
+
+	if (vis_neigh != NULL)
+		debugFree(vis_neigh, 1972);
+
+	vis_buff = NULL;
+	vis_neigh = NULL;
+	vis_max = vis_num_local = vis_num_neigh = 0;
+}
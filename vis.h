@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2006-2009 B.A.T.M.A.N. contributors:
+ *
+ * Marek Lindner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ *
+ */
+
+
+
+
+#ifndef _BATMAN_VIS_H
+#define _BATMAN_VIS_H
+
+#include "batman.h"
+
+
+#define VIS_INIT_ENTRIES 64
+/* the packet has to fit into one udp datagram */
+#define VIS_MAX_ENTRIES ((65507 - sizeof(struct vis_packet)) / sizeof(struct vis_data))
+
+
+void vis_init(void);
+void vis_update_orig(struct orig_node *orig_node);
+void vis_update_local(void);
+unsigned char *vis_get_packet(uint16_t *len);
+void vis_free(void);
+
+#endif